@@ -0,0 +1,47 @@
+//
+//  allocations.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "allocations.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocationCount {0};
+
+} // namespace
+
+namespace ocls::bench {
+
+uint64_t GetAllocationCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+} // namespace ocls::bench
+
+void* operator new(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,42 @@
+//
+//  allocations.hpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+
+namespace ocls::bench {
+
+/**
+ Number of heap allocations made by the process so far.
+ Counted by the replaced global operator new in allocations.cpp.
+ */
+uint64_t GetAllocationCount();
+
+/**
+ Reports the average number of allocations per iteration as the \c allocs counter.
+ Create it right before the benchmark loop.
+ */
+class AllocationCounter
+{
+public:
+    explicit AllocationCounter(benchmark::State& state) : m_state {state}, m_start {GetAllocationCount()} {}
+
+    ~AllocationCounter()
+    {
+        const auto count = GetAllocationCount() - m_start;
+        m_state.counters["allocs"] =
+            benchmark::Counter(static_cast<double>(count), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& m_state;
+    uint64_t m_start;
+};
+
+} // namespace ocls::bench
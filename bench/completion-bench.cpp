@@ -0,0 +1,56 @@
+//
+//  completion-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "completion.hpp"
+#include "kernel-generator.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace ocls;
+
+namespace {
+
+// Completes the unfinished call of the generated program, the results include the declarations of the OpenCL headers
+void BM_FilterCompletions(benchmark::State& state, const std::string& prefix)
+{
+    const bench::ParsedKernel kernel(static_cast<size_t>(state.range(0)));
+    CXTranslationUnit tu = kernel.TranslationUnit();
+    if (!tu)
+    {
+        state.SkipWithError("Failed to parse the generated program");
+        return;
+    }
+
+    CXUnsavedFile unsavedFile;
+    unsavedFile.Filename = kernel.FilePath().c_str();
+    unsavedFile.Contents = kernel.Content().data();
+    unsavedFile.Length = static_cast<unsigned long>(kernel.Content().size());
+    const unsigned flags = clang_defaultCodeCompleteOptions() | CXCodeComplete_IncludeBriefComments;
+    CXCodeCompleteResults* compResults = clang_codeCompleteAt(
+        tu, kernel.FilePath().c_str(), kernel.completionLine, kernel.completionColumn, &unsavedFile, 1, flags);
+    if (!compResults)
+    {
+        state.SkipWithError("No completions available");
+        return;
+    }
+
+    size_t count = 0;
+    for (auto _ : state)
+    {
+        auto completions = FilterCompletions(compResults, prefix, {});
+        count = completions.size();
+        benchmark::DoNotOptimize(completions);
+    }
+    state.counters["results"] = static_cast<double>(compResults->NumResults);
+    state.counters["completions"] = static_cast<double>(count);
+    clang_disposeCodeCompleteResults(compResults);
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_FilterCompletions, all, std::string())->Arg(64 << 10)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_FilterCompletions, prefix, std::string("get_"))->Arg(64 << 10)->Unit(benchmark::kMillisecond);
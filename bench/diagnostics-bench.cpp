@@ -0,0 +1,36 @@
+//
+//  diagnostics-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "diagnostics.hpp"
+#include "kernel-generator.hpp"
+
+#include <benchmark/benchmark.h>
+#include <limits>
+
+using namespace ocls;
+
+namespace {
+
+// Range(0) - number of lines in the build log
+void BM_ParseDiagnostics(benchmark::State& state)
+{
+    const auto buildLog = bench::GenerateBuildLog("<program source>", static_cast<size_t>(state.range(0)));
+    auto parser = CreateDiagnosticsParser();
+    size_t count = 0;
+    for (auto _ : state)
+    {
+        auto diagnostics = parser->ParseDiagnostics(buildLog, "kernel.cl", std::numeric_limits<uint64_t>::max());
+        count = diagnostics.size();
+        benchmark::DoNotOptimize(diagnostics);
+    }
+    state.counters["diagnostics"] = static_cast<double>(count);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * buildLog.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_ParseDiagnostics)->Arg(100)->Arg(10000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,101 @@
+//
+//  document-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "allocations.hpp"
+#include "document.hpp"
+#include "protocol.hpp"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+std::string BuildKernelText(size_t size)
+{
+    const std::string line = "    c[id] = a[id] + b[id]; // generated kernel line\n";
+    std::string text;
+    text.reserve(size + line.size());
+    while (text.size() < size)
+    {
+        text += line;
+    }
+    return text;
+}
+
+// A keystroke in the middle of the document with full synchronization: the whole text goes through the pipe
+void BM_DidChangeFullSync(benchmark::State& state)
+{
+    const auto text = BuildKernelText(static_cast<size_t>(state.range(0)));
+    const auto content = json::object(
+                             {{"jsonrpc", "2.0"},
+                              {"method", "textDocument/didChange"},
+                              {"params",
+                               {{"textDocument", {{"uri", "file:///kernel.cl"}, {"version", 2}}},
+                                {"contentChanges", {{{"text", text}}}}}}})
+                             .dump();
+    Document document(text);
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto message = JRPCMessage::FromView(content);
+        auto params = DidChangeTextDocumentParams::Decode(message);
+        for (const auto& change : params->contentChanges)
+        {
+            document.Apply(change);
+        }
+        benchmark::DoNotOptimize(document.Size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+
+// The same keystroke with incremental synchronization, the edit is applied to the piece table
+void BM_DidChangeIncremental(benchmark::State& state)
+{
+    const auto text = BuildKernelText(static_cast<size_t>(state.range(0)));
+    const auto content = json::object(
+                             {{"jsonrpc", "2.0"},
+                              {"method", "textDocument/didChange"},
+                              {"params",
+                               {{"textDocument", {{"uri", "file:///kernel.cl"}, {"version", 2}}},
+                                {"contentChanges",
+                                 {{{"range", {{"start", {{"line", 1000}, {"character", 8}}}, {"end", {{"line", 1000}, {"character", 9}}}}},
+                                   {"text", "d"}}}}}}})
+                             .dump();
+    Document document(text);
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto message = JRPCMessage::FromView(content);
+        auto params = DidChangeTextDocumentParams::Decode(message);
+        for (const auto& change : params->contentChanges)
+        {
+            document.Apply(change);
+        }
+        benchmark::DoNotOptimize(document.Size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+
+// Joining the edited document for a reparse
+void BM_DocumentMaterialize(benchmark::State& state)
+{
+    Document document(BuildKernelText(static_cast<size_t>(state.range(0))));
+    for (auto _ : state)
+    {
+        document.Apply(TextChange {TextRange {{1000, 8}, {1000, 9}}, "d"});
+        benchmark::DoNotOptimize(document.Materialize().data());
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_DidChangeFullSync)->Arg(64 << 10)->Arg(4 << 20);
+BENCHMARK(BM_DidChangeIncremental)->Arg(64 << 10)->Arg(4 << 20);
+BENCHMARK(BM_DocumentMaterialize)->Arg(64 << 10)->Arg(4 << 20);
@@ -0,0 +1,159 @@
+//
+//  jsonrpc-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "jsonrpc.hpp"
+#include "kernel-generator.hpp"
+#include "writer.hpp"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+std::string BuildDidOpenRequest(size_t textSize)
+{
+    const auto text = bench::GenerateKernel(textSize);
+    const auto content = json::object(
+                             {{"jsonrpc", "2.0"},
+                              {"method", "textDocument/didOpen"},
+                              {"params", {{"textDocument", {{"uri", "file:///kernel.cl"}, {"text", text}}}}}})
+                             .dump();
+    return "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+}
+
+std::shared_ptr<IJsonRPC> CreateInitializedJsonRPC()
+{
+    auto jrpc = CreateJsonRPC();
+    jrpc->RegisterOutputCallback([](const std::string&) {});
+    jrpc->RegisterMethodCallback("initialize", [](const JRPCMessage&) {});
+    jrpc->RegisterMethodCallback("textDocument/didOpen", [](const JRPCMessage& request) {
+        benchmark::DoNotOptimize(request.ExtractString({"textDocument", "text"}));
+    });
+    const std::string init =
+        json::object({{"jsonrpc", "2.0"}, {"id", 0}, {"method", "initialize"}, {"params", {{"trace", "off"}}}})
+            .dump();
+    jrpc->Consume("Content-Length: " + std::to_string(init.size()) + "\r\n\r\n" + init);
+    jrpc->Reset();
+    return jrpc;
+}
+
+void Feed(IJsonRPC& jrpc, std::string_view data, size_t chunkSize)
+{
+    while (!data.empty())
+    {
+        auto consumed = jrpc.Consume(data.substr(0, chunkSize));
+        data.remove_prefix(consumed);
+        if (jrpc.IsReady())
+        {
+            jrpc.Reset();
+        }
+    }
+}
+
+// Range(0) - document size in bytes, Range(1) - size of the chunks the input is delivered in
+void BM_JsonRPCConsume(benchmark::State& state)
+{
+    const auto request = BuildDidOpenRequest(static_cast<size_t>(state.range(0)));
+    const auto chunkSize = static_cast<size_t>(state.range(1));
+    auto jrpc = CreateInitializedJsonRPC();
+    for (auto _ : state)
+    {
+        Feed(*jrpc, request, chunkSize);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * request.size()));
+}
+
+std::string BuildDidOpenContent(size_t textSize)
+{
+    const auto request = BuildDidOpenRequest(textSize);
+    return request.substr(request.find("\r\n\r\n") + 4);
+}
+
+// Former decoding: full DOM, then the text is copied out of it
+void BM_DecodeDidOpenDom(benchmark::State& state)
+{
+    const auto content = BuildDidOpenContent(static_cast<size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        auto body = json::parse(content);
+        auto method = body["method"].get<std::string>();
+        auto text = body["params"]["textDocument"]["text"].get<std::string>();
+        benchmark::DoNotOptimize(method);
+        benchmark::DoNotOptimize(text);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+
+// Lazy decoding: scan for the top level members, then decode the text alone
+void BM_DecodeDidOpenLazy(benchmark::State& state)
+{
+    const auto content = BuildDidOpenContent(static_cast<size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        auto message = JRPCMessage::FromView(content);
+        auto method = message.Method();
+        auto text = message.ExtractString({"textDocument", "text"});
+        benchmark::DoNotOptimize(method);
+        benchmark::DoNotOptimize(text);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+
+json BuildCompletionResponse(size_t count)
+{
+    auto items = json::array();
+    for (size_t i = 0; i < count; ++i)
+    {
+        items.push_back({{"label", "get_global_id" + std::to_string(i)}, {"kind", 3}});
+    }
+    return {{"jsonrpc", "2.0"}, {"id", 1}, {"result", {{"isIncomplete", false}, {"items", items}}}};
+}
+
+// Former framing: dump into a temporary string and concatenate the headers
+void BM_FrameMessageConcat(benchmark::State& state)
+{
+    const auto response = BuildCompletionResponse(static_cast<size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        std::string message;
+        std::string content = response.dump();
+        message.append(std::string("Content-Length: ") + std::to_string(content.size()) + "\r\n");
+        message.append(std::string("Content-Type: application/vscode-jsonrpc;charset=utf-8") + "\r\n");
+        message.append("\r\n");
+        message.append(content);
+        benchmark::DoNotOptimize(message);
+    }
+}
+
+// Writer thread framing: serialize into reused buffers
+void BM_FrameMessageReused(benchmark::State& state)
+{
+    const auto response = BuildCompletionResponse(static_cast<size_t>(state.range(0)));
+    std::string scratch;
+    std::string message;
+    for (auto _ : state)
+    {
+        message.clear();
+        AppendFramedMessage(response, scratch, message);
+        benchmark::DoNotOptimize(message);
+    }
+}
+
+} // namespace
+
+// 1 byte chunks reproduce the former per-character reading loop
+BENCHMARK(BM_JsonRPCConsume)
+    ->ArgsProduct({{64 << 10, 2 << 20}, {1, 4 << 10, 64 << 10}})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_DecodeDidOpenDom)->Arg(64 << 10)->Arg(2 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DecodeDidOpenLazy)->Arg(64 << 10)->Arg(2 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FrameMessageConcat)->Arg(10)->Arg(5000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FrameMessageReused)->Arg(10)->Arg(5000)->Unit(benchmark::kMicrosecond);
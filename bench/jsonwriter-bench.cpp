@@ -0,0 +1,97 @@
+//
+//  jsonwriter-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "allocations.hpp"
+#include "completion.hpp"
+#include "jsonwriter.hpp"
+#include "writer.hpp"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+// Roughly the shape of builtins from opencl-c.h
+std::vector<CompletionResult> BuildCompletions(size_t count)
+{
+    std::vector<CompletionResult> completions;
+    completions.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        CompletionResult item;
+        item.index = static_cast<unsigned>(i);
+        item.label = "convert_float4_rte" + std::to_string(i);
+        item.detail = "float4 convert_float4_rte(int4 x) __attribute__((overloadable))";
+        item.insertText = item.label + "(${1:int4 x})";
+        item.isSnippet = true;
+        item.itemKind = CompletionItemKind::function;
+        item.sortText = "0050" + item.label;
+        completions.push_back(std::move(item));
+    }
+    return completions;
+}
+
+// The path used before the streaming writer, the result is built as a DOM and framed
+void BM_CompletionRespondDom(benchmark::State& state)
+{
+    const auto completions = BuildCompletions(static_cast<size_t>(state.range(0)));
+    std::string scratch;
+    std::string out;
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        json items = json::array();
+        for (const auto& item : completions)
+        {
+            items.emplace_back(item.toJsonIncomplete());
+        }
+        json result = {{"isIncomplete", false}, {"items", items}};
+        json message = {{"id", 7}, {"result", result}};
+        message.emplace("jsonrpc", "2.0");
+        out.clear();
+        AppendFramedMessage(message, scratch, out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * out.size()));
+}
+
+void BM_CompletionRespondStreaming(benchmark::State& state)
+{
+    const auto completions = BuildCompletions(static_cast<size_t>(state.range(0)));
+    const json id = 7;
+    std::string out;
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        JsonWriter writer(completions.size() * 160);
+        writer.StartObject();
+        writer.Key("jsonrpc").String("2.0");
+        writer.Key("id").Value(id);
+        writer.Key("result").StartObject();
+        writer.Key("isIncomplete").Bool(false);
+        writer.Key("items").StartArray();
+        for (const auto& item : completions)
+        {
+            item.writeJsonIncomplete(writer);
+        }
+        writer.EndArray();
+        writer.EndObject();
+        writer.EndObject();
+        out.clear();
+        AppendFramedMessage(writer.Buffer(), out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * out.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_CompletionRespondDom)->Arg(500)->Arg(5000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_CompletionRespondStreaming)->Arg(500)->Arg(5000)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,138 @@
+//
+//  kernel-generator.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "kernel-generator.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace ocls::bench {
+
+namespace {
+
+std::string GenerateUnit(size_t index)
+{
+    const auto i = std::to_string(index);
+    return "typedef struct\n"
+           "{\n"
+           "    float4 position;\n"
+           "    float4 velocity;\n"
+           "    float weight;\n"
+           "} Particle" + i + ";\n"
+           "\n"
+           "/**\n"
+           " Returns the weight of the particle scaled by \\c factor.\n"
+           " */\n"
+           "float scale" + i + "(Particle" + i + " particle, float factor)\n"
+           "{\n"
+           "    return particle.weight * factor + " + i + ".0f;\n"
+           "}\n"
+           "\n"
+           "__kernel void update" + i + "(__global Particle" + i + " *particles, __global float *out, const uint count)\n"
+           "{\n"
+           "    const size_t gid = get_global_id(0);\n"
+           "    if (gid >= count)\n"
+           "    {\n"
+           "        return;\n"
+           "    }\n"
+           "    float acc = 0.0f;\n"
+           "    for (uint k = 0; k < 8; ++k)\n"
+           "    {\n"
+           "        acc += scale" + i + "(particles[gid], (float)k);\n"
+           "    }\n"
+           "    particles[gid].position += particles[gid].velocity * 0.5f;\n"
+           "    out[gid] = acc + length(particles[gid].position);\n"
+           "}\n"
+           "\n";
+}
+
+} // namespace
+
+std::string GenerateKernel(size_t minSize)
+{
+    std::string kernel;
+    kernel.reserve(minSize + 1024);
+    for (size_t index = 0; kernel.size() < minSize; index++)
+    {
+        kernel += GenerateUnit(index);
+    }
+    return kernel;
+}
+
+std::string GenerateBuildLog(const std::string &fileName, size_t lines)
+{
+    // Every diagnostic takes three lines: the message, the source line and the caret
+    std::string log;
+    for (size_t index = 0; index < lines; index++)
+    {
+        const auto unit = std::to_string(index / 3);
+        const auto line = std::to_string(index / 3 * 31 + 11);
+        switch (index % 3)
+        {
+            case 0:
+                switch (index / 3 % 3)
+                {
+                    case 0:
+                        log += fileName + ":" + line + ":7: warning: no previous prototype for function 'scale" + unit + "'\n";
+                        break;
+                    case 1:
+                        log += fileName + ":" + line + ":12: error: use of undeclared identifier 'factor" + unit + "'\n";
+                        break;
+                    default:
+                        log += fileName + ":" + line + ":1: note: declare 'static' if the function is not intended to be used outside of this translation unit\n";
+                        break;
+                }
+                break;
+            case 1:
+                log += "float scale" + unit + "(Particle" + unit + " particle, float factor)\n";
+                break;
+            default:
+                log += "      ^\n";
+                break;
+        }
+    }
+    return log;
+}
+
+ParsedKernel::ParsedKernel(size_t minSize)
+    : m_filePath {(fs::temp_directory_path() / ("opencl-language-server-bench-" + std::to_string(minSize) + ".cl")).string()}
+    , m_content {GenerateKernel(minSize)}
+{
+    completionLine = static_cast<unsigned>(std::count(m_content.begin(), m_content.end(), '\n')) + 3;
+    completionColumn = 5;
+    m_content += "__kernel void probe(__global float *out)\n"
+                 "{\n"
+                 "    get_\n"
+                 "}\n";
+    {
+        std::ofstream file(m_filePath, std::ios::binary);
+        file << m_content;
+    }
+
+    m_store = CreateTranslationUnitStore();
+    m_store->SaveHeaders();
+    m_store->SetTranslationOptions({});
+    m_store->OnFileOpen(m_filePath, m_content);
+}
+
+ParsedKernel::~ParsedKernel()
+{
+    m_store->OnFileClose(m_filePath);
+    std::error_code error;
+    fs::remove(m_filePath, error);
+}
+
+CXTranslationUnit ParsedKernel::TranslationUnit() const
+{
+    // The store keeps the unit while the kernel is open
+    return m_store->Lease(m_filePath, LeaseMode::shared).TranslationUnit();
+}
+
+} // namespace ocls::bench
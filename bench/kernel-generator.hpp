@@ -0,0 +1,71 @@
+//
+//  kernel-generator.hpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include "translation.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace ocls::bench {
+
+/**
+ Generates an OpenCL C program of at least \c minSize bytes.
+ The program is a sequence of units with a struct, a documented helper function and a kernel calling it,
+ the output is the same for the same size so the runs are comparable.
+ */
+std::string GenerateKernel(size_t minSize);
+
+/**
+ Generates a build log of \c lines lines for the program source \c fileName in the format of the OpenCL compilers:
+ errors, warnings and notes followed by the source line and the caret they point to.
+ */
+std::string GenerateBuildLog(const std::string &fileName, size_t lines);
+
+/**
+ A generated program of at least \c minSize bytes parsed by libclang with the embedded OpenCL headers,
+ so that completions and cursors come from a real translation unit.
+ The program ends with a kernel whose last line is an unfinished \c get_ call, see \c completionLine.
+ The source is written to a temporary file that is removed on destruction.
+ */
+class ParsedKernel
+{
+public:
+    explicit ParsedKernel(size_t minSize);
+    ~ParsedKernel();
+
+    ParsedKernel(const ParsedKernel &) = delete;
+    ParsedKernel &operator=(const ParsedKernel &) = delete;
+
+    const std::string &FilePath() const
+    {
+        return m_filePath;
+    }
+
+    const std::string &Content() const
+    {
+        return m_content;
+    }
+
+    /**
+     \return translation unit of the program or \c nullptr if libclang failed to parse it
+     */
+    CXTranslationUnit TranslationUnit() const;
+
+    // 1-based position of the token start of the unfinished call
+    unsigned completionLine = 0;
+    unsigned completionColumn = 0;
+
+private:
+    std::string m_filePath;
+    std::string m_content;
+    std::shared_ptr<ITranslationUnitStore> m_store;
+};
+
+} // namespace ocls::bench
@@ -0,0 +1,53 @@
+//
+//  location-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "kernel-generator.hpp"
+#include "location.hpp"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+using namespace ocls;
+
+namespace {
+
+CXChildVisitResult CollectCursors(CXCursor cursor, CXCursor, CXClientData data)
+{
+    if (!clang_Location_isFromMainFile(clang_getCursorLocation(cursor)))
+    {
+        return CXChildVisit_Continue;
+    }
+    static_cast<std::vector<CXCursor>*>(data)->push_back(cursor);
+    return CXChildVisit_Recurse;
+}
+
+// Range(0) - size of the program, every cursor of the program is converted
+void BM_MakeLocation(benchmark::State& state)
+{
+    const bench::ParsedKernel kernel(static_cast<size_t>(state.range(0)));
+    CXTranslationUnit tu = kernel.TranslationUnit();
+    if (!tu)
+    {
+        state.SkipWithError("Failed to parse the generated program");
+        return;
+    }
+
+    std::vector<CXCursor> cursors;
+    clang_visitChildren(clang_getTranslationUnitCursor(tu), CollectCursors, &cursors);
+    for (auto _ : state)
+    {
+        for (const auto& cursor : cursors)
+        {
+            benchmark::DoNotOptimize(MakeLocation(cursor));
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * cursors.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_MakeLocation)->Arg(16 << 10)->Arg(256 << 10)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,24 @@
+//
+//  main.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "log.hpp"
+
+#include <benchmark/benchmark.h>
+
+int main(int argc, char** argv)
+{
+    ocls::ConfigureNullLogging();
+    spdlog::set_level(spdlog::level::off);
+    ::benchmark::Initialize(&argc, argv);
+    if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    ::benchmark::RunSpecifiedBenchmarks();
+    ::benchmark::Shutdown();
+    return 0;
+}
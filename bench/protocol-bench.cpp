@@ -0,0 +1,121 @@
+//
+//  protocol-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "allocations.hpp"
+#include "protocol.hpp"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+// The lookup helper handlers used before the typed protocol layer
+std::optional<json> GetNestedValue(const json& j, const std::vector<std::string>& keys)
+{
+    const json* current = &j;
+    for (const auto& key : keys)
+    {
+        if (!current->contains(key))
+        {
+            return std::nullopt;
+        }
+        current = &(*current)[key];
+    }
+    return *current;
+}
+
+std::string BuildDidOpenContent(size_t textSize)
+{
+    return json::object(
+               {{"jsonrpc", "2.0"},
+                {"method", "textDocument/didOpen"},
+                {"params",
+                 {{"textDocument",
+                   {{"uri", "file:///kernel.cl"}, {"languageId", "opencl"}, {"version", 1}, {"text", std::string(textSize, 'x')}}}}}})
+        .dump();
+}
+
+std::string BuildDefinitionContent()
+{
+    return json::object(
+               {{"jsonrpc", "2.0"},
+                {"id", 7},
+                {"method", "textDocument/definition"},
+                {"params", {{"textDocument", {{"uri", "file:///kernel.cl"}}}, {"position", {{"line", 12}, {"character", 27}}}}}})
+        .dump();
+}
+
+void BM_DidOpenNestedValue(benchmark::State& state)
+{
+    const auto content = BuildDidOpenContent(static_cast<size_t>(state.range(0)));
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto data = json::parse(content);
+        auto uri = GetNestedValue(data, {"params", "textDocument", "uri"});
+        auto text = GetNestedValue(data, {"params", "textDocument", "text"});
+        auto filePath = uri->get<std::string>();
+        auto stored = text->get<std::string>();
+        benchmark::DoNotOptimize(filePath);
+        benchmark::DoNotOptimize(stored);
+    }
+}
+
+void BM_DidOpenTyped(benchmark::State& state)
+{
+    const auto content = BuildDidOpenContent(static_cast<size_t>(state.range(0)));
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto message = JRPCMessage::FromView(content);
+        auto params = DidOpenTextDocumentParams::Decode(message);
+        auto stored = std::move(params->text);
+        benchmark::DoNotOptimize(params);
+        benchmark::DoNotOptimize(stored);
+    }
+}
+
+void BM_DefinitionNestedValue(benchmark::State& state)
+{
+    const auto content = BuildDefinitionContent();
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto data = json::parse(content);
+        auto uri = GetNestedValue(data, {"params", "textDocument", "uri"});
+        auto character = GetNestedValue(data, {"params", "position", "character"});
+        auto line = GetNestedValue(data, {"params", "position", "line"});
+        auto id = data["id"];
+        benchmark::DoNotOptimize(uri->get<std::string>());
+        benchmark::DoNotOptimize(static_cast<unsigned>(*line) + static_cast<unsigned>(*character));
+        benchmark::DoNotOptimize(id);
+    }
+}
+
+void BM_DefinitionTyped(benchmark::State& state)
+{
+    const auto content = BuildDefinitionContent();
+    bench::AllocationCounter allocations(state);
+    for (auto _ : state)
+    {
+        const auto message = JRPCMessage::FromView(content);
+        auto params = TextDocumentPositionParams::Decode(message);
+        const auto& id = message.Id();
+        benchmark::DoNotOptimize(params);
+        benchmark::DoNotOptimize(id);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_DidOpenNestedValue)->Arg(64 << 10)->Arg(2 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DidOpenTyped)->Arg(64 << 10)->Arg(2 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DefinitionNestedValue)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_DefinitionTyped)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,84 @@
+//
+//  translation-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "kernel-generator.hpp"
+#include "translation.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+
+using namespace ocls;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+PreambleStorage TemporaryFiles()
+{
+    return {};
+}
+
+PreambleStorage InMemory()
+{
+    return {true, {}};
+}
+
+// A tmpfs where available, the mode users pick when the temporary directory is slow
+PreambleStorage SharedMemoryDirectory()
+{
+    std::error_code error;
+    return {false, fs::is_directory("/dev/shm", error) ? "/dev/shm" : fs::temp_directory_path().string()};
+}
+
+// Open, two edits and close of a generated program with leading directives, the first edit builds the preamble
+// and the second one reuses it, so the preamble is written and read back once per iteration
+void BM_OpenEditClose(benchmark::State& state, PreambleStorage (*storage)())
+{
+    const auto filePath =
+        (fs::temp_directory_path() / ("opencl-language-server-bench-preamble-" + std::to_string(state.range(0)) + ".cl"))
+            .string();
+    std::string content = "#define SCALE 2.0f\n"
+                          "#define OFFSET 1.0f\n"
+                          "\n" +
+                          bench::GenerateKernel(static_cast<size_t>(state.range(0)));
+    {
+        std::ofstream file(filePath, std::ios::binary);
+        file << content;
+    }
+
+    auto store = CreateTranslationUnitStore(storage());
+    store->SaveHeaders();
+    store->SetTranslationOptions({});
+
+    uint64_t preamble = 0;
+    for (auto _ : state)
+    {
+        store->OnFileOpen(filePath, content);
+        store->OnFileChange(filePath, {TextChange {std::nullopt, content + "\n// edit\n"}});
+        store->OnFileChange(filePath, {TextChange {std::nullopt, content + "\n// another edit\n"}});
+        const auto usage = store->GetMemoryUsage();
+        if (usage.empty())
+        {
+            state.SkipWithError("Failed to parse the generated program");
+            break;
+        }
+        preamble = usage.front().preamble;
+        store->OnFileClose(filePath);
+    }
+    state.counters["preambleBytes"] = static_cast<double>(preamble);
+
+    std::error_code error;
+    fs::remove(filePath, error);
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_OpenEditClose, temporaryFiles, &TemporaryFiles)->Arg(16 << 10)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_OpenEditClose, inMemory, &InMemory)->Arg(16 << 10)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_OpenEditClose, tmpfs, &SharedMemoryDirectory)->Arg(16 << 10)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,50 @@
+//
+//  utils-bench.cpp
+//  opencl-language-server-bench
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "kernel-generator.hpp"
+#include "utils.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace ocls;
+
+namespace {
+
+void BM_UriToFilePathUnix(benchmark::State& state)
+{
+    const std::string uri = "file:///home/user/projects/particles%20sim/kernels/update%2Bscale.cl";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(utils::UriToFilePath(uri, true));
+    }
+}
+
+void BM_UriToFilePathWindows(benchmark::State& state)
+{
+    const std::string uri = "file:///c%3A/Users/user/projects/particles%20sim/kernels/update%2Bscale.cl";
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(utils::UriToFilePath(uri, false));
+    }
+}
+
+// Range(0) - size of the input, device identifiers are short so the small size is the common one
+void BM_CRC32(benchmark::State& state)
+{
+    const auto content = bench::GenerateKernel(static_cast<size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(utils::CRC32(content.begin(), content.end()));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_UriToFilePathUnix)->Unit(benchmark::kNanosecond);
+BENCHMARK(BM_UriToFilePathWindows)->Unit(benchmark::kNanosecond);
+BENCHMARK(BM_CRC32)->Arg(64)->Arg(64 << 10)->Unit(benchmark::kMicrosecond);
@@ -16,8 +16,8 @@ class OpenCLLanguageServerConanfile(ConanFile):
     topics = ("opencl", "language-server")
     settings = "os", "compiler", "build_type", "arch"
     generators = "CMakeDeps", "VirtualBuildEnv"
-    options = {"enable_testing": [True, False]}
-    default_options = {"enable_testing": False}
+    options = {"enable_testing": [True, False], "enable_benchmarks": [True, False]}
+    default_options = {"enable_testing": False, "enable_benchmarks": False}
     requires = (
         "cli11/[^2.3.2]",
         "nlohmann_json/[^3.11.2]",
@@ -46,6 +46,8 @@ class OpenCLLanguageServerConanfile(ConanFile):
     def build_requirements(self):
         if self.options.enable_testing:
             self.test_requires("gtest/[^1.13.0]")
+        if self.options.enable_benchmarks:
+            self.test_requires("benchmark/[^1.8.0]")
 
     def validate(self):
         check_min_cppstd(self, 17)
@@ -65,6 +67,7 @@ class OpenCLLanguageServerConanfile(ConanFile):
         cmake.configure(
             {
                 "ENABLE_TESTING": self.options.enable_testing,
+                "ENABLE_BENCHMARKS": self.options.enable_benchmarks,
             }
         )
         cmake.build()
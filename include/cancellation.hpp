@@ -0,0 +1,68 @@
+//
+//  cancellation.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace ocls {
+
+/**
+ Read side of a cancellation flag, passed by value into long running work.
+
+ Engines poll \c IsCancelled() at their checkpoints and return early once it is set,
+ the caller decides how the abandoned work is reported.
+ A default constructed token is never cancelled.
+ */
+class CancellationToken
+{
+public:
+    CancellationToken() = default;
+
+    bool IsCancelled() const
+    {
+        return m_flag && m_flag->load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class CancellationSource;
+
+    explicit CancellationToken(std::shared_ptr<const std::atomic<bool>> flag) : m_flag {std::move(flag)} {}
+
+private:
+    std::shared_ptr<const std::atomic<bool>> m_flag;
+};
+
+/**
+ Owner side of a cancellation flag, copies share the same flag.
+ */
+class CancellationSource
+{
+public:
+    CancellationSource() : m_flag {std::make_shared<std::atomic<bool>>(false)} {}
+
+    CancellationToken Token() const
+    {
+        return CancellationToken {m_flag};
+    }
+
+    void Cancel()
+    {
+        m_flag->store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const
+    {
+        return m_flag->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
+} // namespace ocls
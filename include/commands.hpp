@@ -11,6 +11,7 @@
 #include <memory>
 #include <functional>
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <CLI/CLI.hpp>
 
@@ -74,6 +75,41 @@ private:
     bool json = false;
 };
 
+// ReplaySubCommand
+
+/**
+ Feeds the client messages of a session recorded with \c --record through the server
+ and reports the latency percentiles of the responds by method.
+ */
+struct ReplaySubCommand final : public SubCommand
+{
+    explicit ReplaySubCommand(CLI::App& app);
+
+    int Execute() override;
+
+private:
+    std::string recording;
+    std::string speed = "original";
+    bool json = false;
+};
+
+// MemorySubCommand
+
+/**
+ Parses a set of kernels the way the server does and reports the memory of their translation units.
+ */
+struct MemorySubCommand final : public SubCommand
+{
+    explicit MemorySubCommand(CLI::App& app);
+
+    int Execute() override;
+
+private:
+    std::vector<std::string> kernels;
+    std::string clVersion = "CL";
+    bool json = false;
+};
+
 // LocationSubCommand
 
 /**
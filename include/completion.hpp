@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "cancellation.hpp"
+#include "jsonwriter.hpp"
 #include "translation.hpp"
 
 #include <clinfo.hpp>
@@ -120,6 +122,53 @@ struct CompletionResult
         json["preselect"] = preselect;
         return json;
     }
+
+    /**
+     Streaming counterparts of \c toJsonIncomplete and \c toJson, they produce the same documents.
+     */
+    void writeJsonIncomplete(JsonWriter &writer) const
+    {
+        writer.StartObject();
+        writeBasicMembers(writer);
+        writer.EndObject();
+    }
+
+    void writeJson(JsonWriter &writer) const
+    {
+        writer.StartObject();
+        writeBasicMembers(writer);
+        writer.Key("documentation").String(documentation);
+        writer.Key("insertText").String(insertText);
+        writer.Key("insertTextFormat")
+            .Unsigned(static_cast<unsigned>(isSnippet ? InsertTextFormat::snippet : InsertTextFormat::plainText));
+        writer.Key("deprecated").Bool(deprecated);
+        writer.Key("commitCharacters").StartArray();
+        for (const auto &character : commitCharacters)
+        {
+            writer.String(character);
+        }
+        writer.EndArray();
+        writer.Key("tags").StartArray();
+        for (const auto tag : tags)
+        {
+            writer.Unsigned(tag);
+        }
+        writer.EndArray();
+        writer.Key("preselect").Bool(preselect);
+        writer.EndObject();
+    }
+
+private:
+    void writeBasicMembers(JsonWriter &writer) const
+    {
+        writer.Key("label").String(label);
+        writer.Key("detail").String(detail);
+        writer.Key("kind").Unsigned(static_cast<unsigned>(itemKind));
+        writer.Key("sortText").String(sortText);
+        writer.Key("data").StartObject();
+        writer.Key("index").Unsigned(index);
+        writer.EndObject();
+    }
 };
 
 struct ICompletion
@@ -127,12 +176,20 @@ struct ICompletion
     virtual ~ICompletion() = default;
 
     /**
+     * Results are filtered by the prefix under the cursor, an empty list is returned once \c token is cancelled.
      * \note \c line and \c column are 1-based values
      */
     virtual std::vector<CompletionResult> GetCompletions(
-        const std::string &filePath, unsigned line, unsigned column) = 0;
+        const std::string &filePath, unsigned line, unsigned column, const CancellationToken &token) = 0;
 };
 
 std::shared_ptr<ICompletion> CreateCompletion(std::shared_ptr<ITranslationUnitStore> store);
 
+/**
+ * Converts the results of \c clang_codeCompleteAt that start with \c prefix,
+ * an empty list is returned once \c token is cancelled.
+ */
+std::vector<CompletionResult> FilterCompletions(
+    CXCodeCompleteResults *compResults, const std::string &prefix, const CancellationToken &token);
+
 } // namespace ocls
@@ -0,0 +1,60 @@
+//
+//  daemon.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include "clinfo.hpp"
+#include "lsp.hpp"
+
+#include <memory>
+#include <string>
+
+namespace ocls {
+
+/**
+ Hands out per-session views of a translation unit store shared by several clients.
+ A file stays open in the shared store until every session that opened it has closed it or disconnected.
+ Sessions that open a file with the same text share its translation unit. Only the changes of one session,
+ the owner of the file, are applied, the changes of the others are dropped and logged, since their ranges refer
+ to another text. The ownership passes to a session whose text still matches once the owner closes the file.
+ The translation options are the last ones set by any session, the strictest limits of the sessions apply.
+ */
+struct ISharedTranslationUnitStore
+{
+    virtual ~ISharedTranslationUnitStore() = default;
+
+    /**
+     \return store of a new session, the files it left open are closed when it is destroyed
+     */
+    virtual std::shared_ptr<ITranslationUnitStore> CreateSession() = 0;
+};
+
+std::shared_ptr<ISharedTranslationUnitStore> CreateSharedTranslationUnitStore(
+    std::shared_ptr<ITranslationUnitStore> store);
+
+/**
+ Creates a server that accepts LSP clients on the Unix domain socket \c socketPath.
+
+ Every connection is a session with its own protocol state and diagnostics settings.
+ The translation units, the worker pool and the devices listed with \c clInfo are shared by all sessions,
+ see \c ISharedTranslationUnitStore for how the documents and the translation options are shared.
+ 'exit' ends the session only, the daemon runs until it is interrupted.
+ Not supported on Windows.
+ */
+std::shared_ptr<ILSPServer> CreateLSPDaemon(
+    std::string socketPath,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ICLInfo> clInfo);
+
+/**
+ Creates a proxy that connects to the daemon listening on \c socketPath and relays
+ the standard input to it and its messages to the standard output, for editors that only speak stdio.
+ Not supported on Windows.
+ */
+std::shared_ptr<ILSPServer> CreateLSPProxy(std::string socketPath);
+
+} // namespace ocls
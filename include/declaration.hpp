@@ -29,7 +29,7 @@ struct IDeclaration
     /**
      \note \c lineno / \c columnno are 1-based values
      */
-    virtual std::vector<Location> GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno) = 0;
+    virtual LocationResult GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno) = 0;
 };
 
 std::shared_ptr<IDeclaration> CreateDeclaration(std::shared_ptr<ITranslationUnitStore> store);
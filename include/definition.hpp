@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include "cancellation.hpp"
 #include "translation.hpp"
 #include "location.hpp"
 
@@ -27,10 +28,11 @@ struct IDefinition
     virtual ~IDefinition() = default;
 
     /**
+     The translation unit walk stops as soon as \c token is cancelled, the results are incomplete then.
      \note \c lineno / \c columnno are 1-based values
      */
-    virtual std::vector<Location> GetDefinitions(
-        const std::string &filePath, unsigned lineno, unsigned columnno) = 0;
+    virtual LocationResult GetDefinitions(
+        const std::string &filePath, unsigned lineno, unsigned columnno, const CancellationToken &token) = 0;
 };
 
 std::shared_ptr<IDefinition> CreateDefinition(std::shared_ptr<ITranslationUnitStore> store);
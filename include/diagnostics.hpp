@@ -8,6 +8,8 @@
 #pragma once
 
 #include <clinfo.hpp>
+#include "cancellation.hpp"
+#include "jsonwriter.hpp"
 
 #include <memory>
 #include <nlohmann/json.hpp>
@@ -15,6 +17,7 @@
 #include <regex>
 #include <tuple>
 #include <optional>
+#include <vector>
 
 namespace ocls {
 
@@ -36,12 +39,59 @@ struct Source
     }
 };
 
+/**
+ Single problem reported by the OpenCL compiler, line/character values are 0-based.
+ */
+struct Diagnostic
+{
+    std::string source;
+    long line = 0;
+    long character = 0;
+    DiagnosticSeverity severity = DiagnosticSeverity::error;
+    std::string message;
+
+    nlohmann::json toJson() const
+    {
+        return {
+            {"source", source},
+            {"range",
+             {{"start", {{"line", line}, {"character", character}}},
+              {"end", {{"line", line}, {"character", character}}}}},
+            {"severity", severity},
+            {"message", message}};
+    }
+
+    /**
+     Streaming counterpart of \c toJson, produces the same document.
+     */
+    void writeJson(JsonWriter& writer) const
+    {
+        writer.StartObject();
+        writer.Key("source").String(source);
+        writer.Key("range").StartObject();
+        writer.Key("start").StartObject().Key("line").Integer(line).Key("character").Integer(character).EndObject();
+        writer.Key("end").StartObject().Key("line").Integer(line).Key("character").Integer(character).EndObject();
+        writer.EndObject();
+        writer.Key("severity").Unsigned(static_cast<unsigned>(severity));
+        writer.Key("message").String(message);
+        writer.EndObject();
+    }
+
+    bool operator==(const Diagnostic& other) const
+    {
+        return source == other.source && line == other.line && character == other.character &&
+            severity == other.severity && message == other.message;
+    }
+};
+
+nlohmann::json ToJson(const std::vector<Diagnostic>& diagnostics);
+
 struct IDiagnosticsParser
 {
     virtual ~IDiagnosticsParser() = default;
 
     virtual std::tuple<std::string, long, long, DiagnosticSeverity, std::string> ParseMatch(const std::smatch& matches) = 0;
-    virtual nlohmann::json ParseDiagnostics(
+    virtual std::vector<Diagnostic> ParseDiagnostics(
         const std::string& buildLog, const std::string& name, uint64_t problemsLimit) = 0;
 };
 
@@ -56,7 +106,11 @@ struct IDiagnostics
 
     virtual std::optional<ocls::Device> GetDevice() const = 0;
     virtual std::string GetBuildLog(const Source& source) = 0;
-    virtual nlohmann::json GetDiagnostics(const Source& source) = 0;
+    /**
+     Builds \c source and parses the build log. The build itself cannot be interrupted,
+     \c token is checked before and after it, an empty list is returned once it is cancelled.
+     */
+    virtual std::vector<Diagnostic> GetDiagnostics(const Source& source, const CancellationToken& token) = 0;
 };
 
 std::shared_ptr<IDiagnosticsParser> CreateDiagnosticsParser();
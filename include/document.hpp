@@ -0,0 +1,117 @@
+//
+//  document.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ocls {
+
+/**
+ Zero-based position in a document, \c character is counted in UTF-16 code units as in LSP.
+ */
+struct TextPosition
+{
+    unsigned line = 0;
+    unsigned character = 0;
+};
+
+struct TextRange
+{
+    TextPosition start;
+    TextPosition end;
+};
+
+/**
+ A single entry of \c contentChanges, the whole document is replaced if \c range is not set.
+ */
+struct TextChange
+{
+    std::optional<TextRange> range;
+    std::string text;
+};
+
+/**
+ Text of an opened document stored as a piece table.
+
+ The document is a sequence of pieces referring either to the original buffer or to the
+ append-only buffer of inserted text, so an edit never moves the existing content.
+ Newline offsets of both buffers are indexed, positions are resolved in O(pieces + log n).
+ \c Text joins the pieces for a consumer that needs the content in one piece, e.g. a reparse, and keeps the table.
+ \c Materialize makes the joined content the new original buffer, it is meant to compact a table split by many edits.
+ */
+class Document
+{
+public:
+    explicit Document(std::string text = {});
+
+    /**
+     Applies \c change, positions outside of the document are clamped to its bounds.
+     */
+    void Apply(const TextChange& change);
+
+    /**
+     Joins the pieces into a single buffer that becomes the new original one.
+     \return the content, valid until the next \c Apply or \c Materialize call
+     */
+    const std::string& Materialize();
+
+    /**
+     \return the contiguous content if there were no edits since the last \c Materialize, otherwise \c nullptr
+     */
+    const std::string* Contiguous() const;
+
+    std::string Text() const;
+    size_t Size() const;
+    size_t PieceCount() const;
+
+    /**
+     \return byte offset of \c position, a character past the end of the line is clamped to the line end
+     */
+    size_t OffsetAt(const TextPosition& position) const;
+
+private:
+    enum class Source
+    {
+        original,
+        added
+    };
+
+    struct Piece
+    {
+        Source source = Source::original;
+        size_t offset = 0;
+        size_t length = 0;
+    };
+
+    struct Buffer
+    {
+        std::string text;
+        // Offsets of '\n' in text, sorted
+        std::vector<size_t> newlines;
+
+        void Assign(std::string value);
+        void Append(std::string_view value);
+        size_t CountNewlines(size_t begin, size_t end) const;
+    };
+
+    const Buffer& BufferOf(const Piece& piece) const;
+    std::string_view View(const Piece& piece) const;
+    void Replace(size_t begin, size_t end, std::string_view text);
+    void Reset(std::string text);
+
+private:
+    Buffer m_original;
+    Buffer m_added;
+    std::vector<Piece> m_pieces;
+    size_t m_size = 0;
+};
+
+} // namespace ocls
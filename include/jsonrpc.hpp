@@ -10,11 +10,17 @@
 #include <functional>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <string_view>
+
+#include "message.hpp"
+#include "recording.hpp"
+#include "writer.hpp"
 
 namespace ocls {
 
-using InputCallbackFunc = std::function<void(const nlohmann::json&)>;
+using InputCallbackFunc = std::function<void(const JRPCMessage&)>;
 using OutputCallbackFunc = std::function<void(const std::string&)>;
+using DispatchFunc = std::function<bool(const JRPCMessage&)>;
 
 // clang-format off
 enum class JRPCErrorCode : int
@@ -27,7 +33,10 @@ enum class JRPCErrorCode : int
     InvalidParams = -32602,  ///< Invalid params    Invalid method parameter(s).
     InternalError = -32603,  ///< Internal error    Internal JSON-RPC error.
     // -32000 to -32099    Server error    Reserved for implementation-defined server-errors.
-    NotInitialized = -32002 ///< The first client's message is not equal to "initialize"
+    NotInitialized = -32002, ///< The first client's message is not equal to "initialize"
+    // -32899 to -32800    Reserved for LSP errors.
+    RequestCancelled = -32800, ///< The client has canceled a request and a server has detected the cancel.
+    RequestFailed = -32803     ///< A request failed but it was syntactically correct.
     ///@}
 };
 // clang-format on
@@ -41,6 +50,11 @@ struct IJsonRPC
      All unregistered notifications will be responded with MethodNotFound automatically.
     */
     virtual void RegisterMethodCallback(const std::string& method, InputCallbackFunc&& func) = 0;
+    /**
+     Register dispatcher to be consulted before the method callbacks.
+     The dispatcher returns \c false for methods it does not handle.
+     */
+    virtual void RegisterDispatcher(DispatchFunc&& func) = 0;
     /**
      Register callback to be notified on client responds to server (our) requests.
      */
@@ -50,15 +64,42 @@ struct IJsonRPC
      Basically it should be redirected to the stdout.
      */
     virtual void RegisterOutputCallback(OutputCallbackFunc&& func) = 0;
+    /**
+     Register asynchronous writer to deliver messages to the client.
+     When set, messages are handed over to the writer instead of being framed and passed to the output callback.
+     */
+    virtual void RegisterOutputWriter(std::shared_ptr<IMessageWriter> writer) = 0;
+    /**
+     Register recorder to capture the bodies of every inbound and outbound message.
+     */
+    virtual void RegisterRecorder(std::shared_ptr<ISessionRecorder> recorder) = 0;
 
-    virtual void Consume(char c) = 0;
+    /**
+     Feed a chunk of raw input into the message framer.
+     Bytes are consumed until the end of the chunk or until a complete message has been processed,
+     whichever comes first, so the caller can flush responses in between messages.
+     \return the number of bytes consumed from \c data
+     */
+    virtual size_t Consume(std::string_view data) = 0;
     virtual bool IsReady() const = 0;
-    virtual void Write(const nlohmann::json& data) const = 0;
+    /**
+     Write a message to the client, safe to call from any thread.
+     Responds to the requests of a batch are held back and written as a single array after the last of them.
+     */
+    virtual void Write(nlohmann::json data) const = 0;
+    /**
+     Write a message that has already been serialized, it is framed as is.
+     */
+    virtual void Write(SerializedMessage message) const = 0;
     virtual void Reset() = 0;
     /**
      Send trace message to client.
      */
     virtual void WriteTrace(const std::string& message, const std::string& verbose) = 0;
+    /**
+     Respond with an error to the message being read, only the thread that reads the messages may call it.
+     Errors of the requests handled elsewhere are sent as responds with their own id.
+     */
     virtual void WriteError(JRPCErrorCode errorCode, const std::string& message) const = 0;
 };
 
@@ -0,0 +1,77 @@
+//
+//  jsonwriter.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ocls {
+
+/**
+ Serializes JSON straight into a string buffer without building a DOM.
+
+ The output is compact and matches \c nlohmann::json::dump() for the same document.
+ Commas are inserted automatically, the caller is responsible for balancing containers
+ and for emitting a \c Key before every value inside an object.
+ \code
+ JsonWriter writer;
+ writer.StartObject();
+ writer.Key("label").String(item.label);
+ writer.Key("kind").Unsigned(3);
+ writer.EndObject();
+ \endcode
+ \note String values are expected to be valid UTF-8, bytes outside of ASCII are copied as is.
+ */
+class JsonWriter
+{
+public:
+    JsonWriter() = default;
+    explicit JsonWriter(size_t capacity);
+
+    JsonWriter& StartObject();
+    JsonWriter& EndObject();
+    JsonWriter& StartArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& String(std::string_view value);
+    JsonWriter& Integer(int64_t value);
+    JsonWriter& Unsigned(uint64_t value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& Null();
+    /**
+     Embeds an existing DOM value, e.g. a request \c id or a value echoed back to the client.
+     */
+    JsonWriter& Value(const nlohmann::json& value);
+
+    const std::string& Buffer() const;
+    /**
+     Moves the serialized document out, the writer is left empty.
+     */
+    std::string Release();
+
+private:
+    // Emits a comma if the current container already has members
+    void Separate();
+    void AppendEscaped(std::string_view value);
+
+private:
+    std::string m_buffer;
+    // One entry per open container, true once it has got its first member
+    std::vector<bool> m_hasMembers;
+    bool m_afterKey = false;
+};
+
+/**
+ Writes an LSP \c Range value, positions are 0-based.
+ */
+void WriteRange(JsonWriter& writer, unsigned startLine, unsigned startCharacter, unsigned endLine, unsigned endCharacter);
+
+} // namespace ocls
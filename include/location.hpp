@@ -7,10 +7,13 @@
 
 #pragma once
 
+#include "jsonwriter.hpp"
+
 #include <clang-c/Index.h>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace ocls {
 
@@ -56,6 +59,39 @@ struct Location
                   {"end", {{"line", selEndLine}, {"character", selEndColumn}}}}}};
         }
     }
+
+    /**
+     Streaming counterpart of \c toJson, produces the same document.
+     */
+    void writeJson(JsonWriter &writer, bool linkSupport) const
+    {
+        writer.StartObject();
+        if (linkSupport)
+        {
+            writer.Key("targetUri").String(uri);
+            writer.Key("targetRange");
+            WriteRange(writer, startLine, startColumn, endLine, endColumn);
+            writer.Key("targetSelectionRange");
+            WriteRange(writer, selStartLine, selStartColumn, selEndLine, selEndColumn);
+        }
+        else
+        {
+            writer.Key("uri").String(uri);
+            writer.Key("range");
+            WriteRange(writer, selStartLine, selStartColumn, selEndLine, selEndColumn);
+        }
+        writer.EndObject();
+    }
+};
+
+/**
+ Locations found for a position. \c upToDate is false if they were resolved in a translation unit parsed from
+ an older revision of the file than the position refers to, the position was mapped to that revision then.
+ */
+struct LocationResult
+{
+    std::vector<Location> locations;
+    bool upToDate = true;
 };
 
 /**
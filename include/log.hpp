@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <spdlog/spdlog.h>
 
 namespace ocls {
@@ -25,8 +27,43 @@ struct LogName
     static std::string declaration;
     static std::string jrpc;
     static std::string lsp;
+    static std::string daemon;
 };
 
+/**
+ Handles of the loggers named by \c LogName, set by \c ConfigureFileLogging and \c ConfigureNullLogging,
+ so log statements do not look the loggers up in the spdlog registry.
+ */
+struct Loggers
+{
+    static std::shared_ptr<spdlog::logger> main;
+    static std::shared_ptr<spdlog::logger> hdiscovery;
+    static std::shared_ptr<spdlog::logger> clinfo;
+    static std::shared_ptr<spdlog::logger> translation;
+    static std::shared_ptr<spdlog::logger> diagnostics;
+    static std::shared_ptr<spdlog::logger> completion;
+    static std::shared_ptr<spdlog::logger> definition;
+    static std::shared_ptr<spdlog::logger> typeDefinition;
+    static std::shared_ptr<spdlog::logger> declaration;
+    static std::shared_ptr<spdlog::logger> jrpc;
+    static std::shared_ptr<spdlog::logger> lsp;
+    static std::shared_ptr<spdlog::logger> daemon;
+};
+
+/**
+ Capacity of the queue of the file logging thread, the oldest messages are dropped when it is full.
+ */
+constexpr size_t logQueueSize = 8192;
+/**
+ Messages longer than this are truncated before they are written to the log file.
+ */
+constexpr size_t maxLogMessageSize = 16 * 1024;
+
+/**
+ \return \c message cut to \c maxLogMessageSize bytes with a note about the truncated tail
+ */
+std::string TruncateLogMessage(std::string_view message);
+
 extern void ConfigureFileLogging(const std::string& filename, spdlog::level::level_enum level);
 extern void ConfigureNullLogging();
 
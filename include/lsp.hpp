@@ -10,6 +10,7 @@
 #include <memory>
 #include <optional>
 
+#include "cancellation.hpp"
 #include "declaration.hpp"
 #include "typedef.hpp"
 #include "definition.hpp"
@@ -17,10 +18,27 @@
 #include "diagnostics.hpp"
 #include "translation.hpp"
 #include "jsonrpc.hpp"
+#include "protocol.hpp"
+#include "scheduler.hpp"
 #include "utils.hpp"
+#include "writer.hpp"
 
 namespace ocls {
 
+/**
+ Channel the server exchanges messages over.
+ */
+struct LSPTransport
+{
+    int input = -1;       ///< Descriptor the client messages are read from, not owned by the server
+    WriteSinkFunc output; ///< Sink the framed server messages are written to
+};
+
+/**
+ \return transport over the standard input and output
+ */
+LSPTransport CreateStdioTransport();
+
 struct ILSPServer
 {
     virtual ~ILSPServer() = default;
@@ -33,29 +51,47 @@ struct ILSPServerEventsHandler
 {
     virtual ~ILSPServerEventsHandler() = default;
 
+    /**
+     Respond builders run on the scheduler workers. Once \c token is cancelled, requests are
+     replied with \c RequestCancelled and outdated diagnostics are not published.
+     */
     virtual void BuildDiagnosticsRespond(
-        const std::string &uri, const std::string &filePath, const std::string &content) = 0;
-    virtual nlohmann::json BuildDefinitionRespond(const json &data, bool typeDefinition) = 0;
-    virtual nlohmann::json BuildDeclarationRespond(const json &data) = 0;
-    virtual void BuildCompletionRespond(const json &data) = 0;
-    virtual void ResolveCompletion(const json &data) = 0;
+        const std::string &uri, const Source &source, const CancellationToken &token) = 0;
+    virtual void BuildDefinitionRespond(
+        const RequestId &id,
+        const TextDocumentPositionParams &params,
+        bool typeDefinition,
+        const CancellationToken &token) = 0;
+    virtual void BuildDeclarationRespond(const RequestId &id, const TextDocumentPositionParams &params) = 0;
+    virtual void BuildCompletionRespond(
+        const RequestId &id, const TextDocumentPositionParams &params, const CancellationToken &token) = 0;
+    virtual void ResolveCompletion(const RequestId &id, const CompletionResolveParams &params) = 0;
 
     virtual void GetConfiguration() = 0;
-    virtual std::optional<nlohmann::json> GetNextResponse() = 0;
-    virtual void OnInitialize(const nlohmann::json &data) = 0;
-    virtual void OnInitialized(const nlohmann::json &data) = 0;
-    virtual void OnTextOpen(const nlohmann::json &data) = 0;
-    virtual void OnTextChanged(const nlohmann::json &data) = 0;
-    virtual void OnTextClose(const nlohmann::json &data) = 0;
-    virtual void OnDefinition(const nlohmann::json &data) = 0;
-    virtual void OnTypeDefinition(const nlohmann::json &data) = 0;
-    virtual void OnDeclaration(const nlohmann::json &data) = 0;
-    virtual void OnCompletion(const nlohmann::json &data) = 0;
-    virtual void OnResolveCompletion(const nlohmann::json &data) = 0;
+    virtual std::optional<OutgoingMessage> GetNextResponse() = 0;
+    virtual void OnInitialize(const RequestId &id, const InitializeParams &params) = 0;
+    virtual void OnInitialized() = 0;
+    virtual void OnTextOpen(DidOpenTextDocumentParams &&params) = 0;
+    virtual void OnTextChanged(DidChangeTextDocumentParams &&params) = 0;
+    virtual void OnTextClose(const DidCloseTextDocumentParams &params) = 0;
+    virtual void OnDefinition(const RequestId &id, const TextDocumentPositionParams &params) = 0;
+    virtual void OnTypeDefinition(const RequestId &id, const TextDocumentPositionParams &params) = 0;
+    virtual void OnDeclaration(const RequestId &id, const TextDocumentPositionParams &params) = 0;
+    virtual void OnCompletion(const RequestId &id, const TextDocumentPositionParams &params) = 0;
+    virtual void OnResolveCompletion(const RequestId &id, const CompletionResolveParams &params) = 0;
     virtual void OnConfiguration(const nlohmann::json &data) = 0;
     virtual void OnRespond(const nlohmann::json &data) = 0;
-    virtual void OnCancel(const nlohmann::json &data) = 0;
-    virtual void OnShutdown(const nlohmann::json &data) = 0;
+    virtual void OnCancel(const CancelParams &params) = 0;
+    virtual void OnShutdown(const RequestId &id) = 0;
+    /**
+     Responds to \c $/ocls/stats with the latency histograms, queue depths and the number of translation units,
+     see \c Statistics.
+     */
+    virtual void OnStats(const RequestId &id) = 0;
+    /**
+     Responds to \c $/ocls/memory with the AST, preamble and total memory of each translation unit.
+     */
+    virtual void OnMemory(const RequestId &id) = 0;
     virtual void OnExit() = 0;
 };
 
@@ -68,10 +104,21 @@ std::shared_ptr<ILSPServerEventsHandler> CreateLSPEventsHandler(
     std::shared_ptr<ITypeDefinition> typeDefinition,
     std::shared_ptr<IDeclaration> declaration,
     std::shared_ptr<utils::IGenerator> generator,
-    std::shared_ptr<utils::IExitHandler> exitHandler);
+    std::shared_ptr<utils::IExitHandler> exitHandler,
+    std::shared_ptr<IScheduler> scheduler);
+
+std::shared_ptr<ILSPServer> CreateLSPServer(
+    std::shared_ptr<IJsonRPC> jrpc,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ILSPServerEventsHandler> handler,
+    std::shared_ptr<IScheduler> scheduler);
 
 std::shared_ptr<ILSPServer> CreateLSPServer(
-    std::shared_ptr<IJsonRPC> jrpc, std::shared_ptr<ITranslationUnitStore> store, std::shared_ptr<ILSPServerEventsHandler> handler);
+    std::shared_ptr<IJsonRPC> jrpc,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ILSPServerEventsHandler> handler,
+    std::shared_ptr<IScheduler> scheduler,
+    LSPTransport transport);
 
 std::shared_ptr<ILSPServer> CreateLSPServer(
     std::shared_ptr<IJsonRPC> jrpc, std::shared_ptr<ITranslationUnitStore> store, std::shared_ptr<IDiagnostics> diagnostics, std::shared_ptr<ICompletion> completion, std::shared_ptr<IDefinition> definition, std::shared_ptr<ITypeDefinition> typeDefinition, std::shared_ptr<IDeclaration> declaration);
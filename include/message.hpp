@@ -0,0 +1,152 @@
+//
+//  message.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace ocls {
+
+/**
+ \return \c true if \c content is a JSON-RPC batch, i.e. its first non-whitespace character opens an array
+ */
+bool IsBatch(std::string_view content);
+
+/**
+ Locates the elements of a batch array without decoding them.
+ \return views of the elements inside \c content
+ \throw std::invalid_argument if \c content is not a JSON array
+ */
+std::vector<std::string_view> SplitBatch(std::string_view content);
+
+/**
+ Binds a scalar value at \c path inside \c params to a decoding target.
+ \see JRPCMessage::Decode
+ */
+struct JRPCField
+{
+    std::initializer_list<std::string_view> path;
+    std::variant<std::optional<std::string>*, std::optional<int64_t>*, std::optional<bool>*> target;
+};
+
+/**
+ Binds the members of every object of the array at \c path inside \c params to decoding targets.
+ The targets of \c fields are reset when an object of the array starts, \c onElement is called when it ends,
+ so it can take the decoded values over. Field paths are full paths from \c params, like \c path.
+ \see JRPCMessage::Decode
+ */
+struct JRPCArrayField
+{
+    std::initializer_list<std::string_view> path;
+    std::initializer_list<JRPCField> fields;
+    std::function<void()> onElement;
+};
+
+/**
+ JSON-RPC message decoded on demand.
+
+ Construction performs a single forward scan over the body that locates the top level
+ \c method, \c id and \c params members without building a DOM. Everything else is parsed
+ only when requested through \c Params(), \c Json() or \c ExtractString().
+
+ \note A message created with \c FromView refers to the input buffer and is valid only
+ while the callback it was passed to is running. Materialized values are cached, so the
+ accessors are not thread-safe.
+ */
+class JRPCMessage
+{
+public:
+    /**
+     Scans \c content without copying it.
+     \throw std::invalid_argument if \c content is not a JSON object
+     */
+    static JRPCMessage FromView(std::string_view content);
+
+    /**
+     Creates a message that owns a serialized copy of \c body.
+     */
+    JRPCMessage(const nlohmann::json& body);
+
+    bool HasMethod() const;
+    std::string_view Method() const;
+    /**
+     \return \c true if the message has a non-null \c id, i.e. it is a request or a respond
+     */
+    bool HasId() const;
+    /**
+     \return request \c id or \c null
+     */
+    const nlohmann::json& Id() const;
+    std::string_view RawParams() const;
+    /**
+     \return materialized \c params or \c null
+     */
+    const nlohmann::json& Params() const;
+    /**
+     \return the whole materialized message
+     */
+    const nlohmann::json& Json() const;
+    std::string_view Raw() const;
+
+    /**
+     Decodes a single string value from \c params straight into the returned string, without a DOM.
+     Arrays along the path are traversed transparently, if several values match the last one wins.
+     \code
+     message.ExtractString({"textDocument", "text"});
+     message.ExtractString({"contentChanges", "text"});
+     \endcode
+     \throw std::runtime_error if \c params is malformed
+     */
+    std::optional<std::string> ExtractString(std::initializer_list<std::string_view> path) const;
+
+    /**
+     Decodes several scalar values from \c params in a single SAX pass, strings are moved into their targets.
+     Path matching follows \c ExtractString rules, targets of values with a different type are left untouched.
+     The objects of the \c arrays are decoded one by one in the same pass.
+     \code
+     message.Decode(
+         {{{"textDocument", "uri"}, &uri}},
+         {{{"contentChanges"}, {{{"contentChanges", "text"}, &text}}, [&]() { texts.push_back(*text); }}});
+     \endcode
+     \throw std::runtime_error if \c params is malformed
+     */
+    void Decode(std::initializer_list<JRPCField> fields, std::initializer_list<JRPCArrayField> arrays = {}) const;
+
+private:
+    // Byte range of a top level value inside the raw content
+    struct Range
+    {
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    JRPCMessage() = default;
+    void Scan();
+    std::string_view View(const Range& range) const;
+
+private:
+    std::string m_storage;
+    std::string_view m_view;
+    bool m_owning = false;
+    std::optional<Range> m_method;
+    std::optional<Range> m_id;
+    std::optional<Range> m_params;
+    // Holds the decoded method when it contains escape sequences
+    std::optional<std::string> m_decodedMethod;
+    mutable std::optional<nlohmann::json> m_idValue;
+    mutable std::optional<nlohmann::json> m_paramsValue;
+    mutable std::optional<nlohmann::json> m_jsonValue;
+};
+
+} // namespace ocls
@@ -0,0 +1,116 @@
+//
+//  protocol.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include "document.hpp"
+#include "message.hpp"
+
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ocls {
+
+/**
+ Typed parameters of the LSP methods handled by the server.
+
+ Each \c Decode reads the fields it needs straight from the request, large string payloads
+ are moved out of the parser and can be moved further down to the consumers.
+ \c Decode returns \c std::nullopt if a required field is missing or has an unexpected type.
+ */
+
+using RequestId = nlohmann::json;
+
+struct ClientCapabilities
+{
+    bool hasConfigurationCapability = false;
+    bool supportDidChangeConfiguration = false;
+    bool hasDefinitionLinkSupport = false;
+    bool hasTypeDefinitionLinkSupport = false;
+    bool hasDeclarationLinkSupport = false;
+};
+
+// initialize
+struct InitializeParams
+{
+    ClientCapabilities capabilities;
+    // initializationOptions.configuration
+    std::optional<nlohmann::json> buildOptions;
+    std::optional<uint64_t> maxNumberOfProblems;
+    std::optional<uint32_t> deviceID;
+    // Debounce window of the diagnostics builds and the longest a build can be postponed, in milliseconds
+    std::optional<uint64_t> diagnosticsDelay;
+    std::optional<uint64_t> diagnosticsMaxLatency;
+    // Bounds of the parsed translation units: memory in MiB, count, and seconds without queries
+    std::optional<uint64_t> memoryBudget;
+    std::optional<uint64_t> maxTranslationUnits;
+    std::optional<uint64_t> idleTimeout;
+
+    static std::optional<InitializeParams> Decode(const JRPCMessage& message);
+};
+
+// textDocument/didOpen
+struct DidOpenTextDocumentParams
+{
+    std::string uri;
+    std::string text;
+
+    static std::optional<DidOpenTextDocumentParams> Decode(const JRPCMessage& message);
+};
+
+// textDocument/didChange
+struct DidChangeTextDocumentParams
+{
+    std::string uri;
+    // Changes to apply in order, TextDocumentSyncKind.Incremental
+    std::vector<TextChange> contentChanges;
+
+    static std::optional<DidChangeTextDocumentParams> Decode(const JRPCMessage& message);
+};
+
+// textDocument/didClose
+struct DidCloseTextDocumentParams
+{
+    std::string uri;
+
+    static std::optional<DidCloseTextDocumentParams> Decode(const JRPCMessage& message);
+};
+
+// textDocument/completion, textDocument/definition, textDocument/typeDefinition, textDocument/declaration
+struct TextDocumentPositionParams
+{
+    std::string uri;
+    // Zero-based position
+    unsigned line = 0;
+    unsigned character = 0;
+
+    static std::optional<TextDocumentPositionParams> Decode(const JRPCMessage& message);
+};
+
+// completionItem/resolve
+struct CompletionResolveParams
+{
+    std::optional<std::string> label;
+    std::optional<unsigned> index;
+    // The item as sent by the client, it is echoed back if the item cannot be resolved
+    nlohmann::json item;
+
+    static std::optional<CompletionResolveParams> Decode(const JRPCMessage& message);
+};
+
+// $/cancelRequest
+struct CancelParams
+{
+    RequestId id;
+
+    static std::optional<CancelParams> Decode(const JRPCMessage& message);
+};
+
+} // namespace ocls
@@ -0,0 +1,104 @@
+//
+//  recording.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include "stats.hpp"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ocls {
+
+enum class RecordDirection
+{
+    inbound, ///< Client to server
+    outbound ///< Server to client
+};
+
+/**
+ A message of a recorded session.
+ */
+struct RecordEntry
+{
+    uint64_t timestamp = 0; ///< Nanoseconds since the recording started, monotonic
+    RecordDirection direction = RecordDirection::inbound;
+    std::string body; ///< Message body without the framing headers
+};
+
+/**
+ Captures the messages of a session, one JSON object per line:
+ \code
+ {"t":1250000,"dir":"in","body":"{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",...}"}
+ \endcode
+ Safe to call from any thread, every line is flushed so the recording survives an abrupt exit.
+ */
+struct ISessionRecorder
+{
+    virtual ~ISessionRecorder() = default;
+
+    virtual void Record(RecordDirection direction, std::string_view body) = 0;
+};
+
+/**
+ \return recorder writing to \c filePath, the file is truncated
+ \throw std::runtime_error if the file cannot be opened
+ */
+std::shared_ptr<ISessionRecorder> CreateSessionRecorder(const std::string& filePath);
+
+/**
+ \throw std::runtime_error if the file cannot be read or a line is malformed
+ */
+std::vector<RecordEntry> ReadRecording(const std::string& filePath);
+
+/**
+ Removes the complete framed messages from the front of \c buffer, an incomplete tail is left in place.
+ \return bodies of the removed messages
+ */
+std::vector<std::string> TakeFramedMessages(std::string& buffer);
+
+/**
+ Nearest-rank percentiles of \c samples.
+ */
+LatencyPercentiles ComputePercentiles(std::vector<uint64_t> samples);
+
+/**
+ Matches the messages of a session to measure how long the server takes to answer.
+
+ A request is answered by the respond with its id. Diagnostics published for a document
+ answer the latest \c didOpen or \c didChange of the document, they are reported as \c textDocument/publishDiagnostics.
+ Batches are taken apart into their items.
+ */
+class LatencyTracker
+{
+public:
+    void OnInbound(std::string_view body, uint64_t timestamp);
+    void OnOutbound(std::string_view body, uint64_t timestamp);
+
+    /**
+     \return percentiles by method
+     */
+    std::map<std::string, LatencyPercentiles> Report() const;
+
+private:
+    struct Pending
+    {
+        std::string method;
+        uint64_t timestamp = 0;
+    };
+
+    // Requests by serialized id, changed documents by uri
+    std::map<std::string, Pending> m_requests;
+    std::map<std::string, uint64_t> m_documents;
+    std::map<std::string, std::vector<uint64_t>> m_samples;
+};
+
+} // namespace ocls
@@ -0,0 +1,93 @@
+//
+//  scheduler.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ocls {
+
+enum class TaskPriority
+{
+    interactive, ///< Requests the user is waiting for: completion, definition, declaration, typeDefinition
+    background   ///< Work that may lag behind: diagnostics, reparses
+};
+
+using TaskFunc = std::function<void()>;
+
+/**
+ Runs tasks on a pool of worker threads.
+
+ Interactive tasks always go ahead of the background ones, and background tasks never occupy
+ the last worker so one is always left for interactive requests.
+ Tasks that share a non-empty \c key run one at a time in the order they were scheduled,
+ regardless of their priority, e.g. every task for the same document uses the document uri as the key.
+ Background tasks an interactive task with the same key waits for are run as interactive ones,
+ so a request waits only for the work on its own document and not for the rest of the background queue.
+ */
+struct IScheduler
+{
+    virtual ~IScheduler() = default;
+
+    /**
+     Start the worker threads.
+     \c onTaskFinished is invoked on the worker thread after every task, it can be empty.
+     */
+    virtual void Start(TaskFunc onTaskFinished) = 0;
+    /**
+     Enqueue \c task, never blocks. Exceptions thrown by tasks are logged and swallowed.
+     */
+    virtual void Schedule(TaskPriority priority, const std::string& key, TaskFunc task) = 0;
+    /**
+     Enqueue \c task once \c key has been quiet for \c delay, never blocks.
+     A task scheduled again with the same \c key before it is due replaces the pending one,
+     so a burst collapses into a single run of the latest task. The run is not postponed further than
+     \c maxLatency after the first task of the burst. Due tasks follow the \c Schedule rules.
+     */
+    virtual void ScheduleDebounced(
+        TaskPriority priority,
+        const std::string& key,
+        std::chrono::milliseconds delay,
+        std::chrono::milliseconds maxLatency,
+        TaskFunc task) = 0;
+    /**
+     Enqueue \c task once \c delay has passed, never blocks, e.g. for timeouts and periodic checks.
+     A timer scheduled again with the same \c key before it is due replaces the pending one.
+     Unlike debounced tasks, pending timers are neither run nor waited for by \c Drain, \c Stop drops them.
+     Due timers follow the \c Schedule rules, the key is only used to replace them.
+     */
+    virtual void ScheduleTimer(
+        TaskPriority priority, const std::string& key, std::chrono::milliseconds delay, TaskFunc task) = 0;
+    /**
+     Block until every task scheduled so far has finished, pending debounced tasks are run without a delay.
+     */
+    virtual void Drain() = 0;
+    /**
+     Finish the running tasks, drop the pending ones and join the workers.
+     */
+    virtual void Stop() = 0;
+};
+
+/**
+ \param workers number of worker threads, at least 2, 0 picks one per core plus the one kept for interactive tasks
+ */
+std::shared_ptr<IScheduler> CreateScheduler(size_t workers = 0);
+
+/**
+ Creates a view of \c scheduler for one of several clients that share its workers.
+ Tasks keep the key ordering of the shared pool, so work on the same document is serialized across clients,
+ while debounced and timer keys are prefixed with \c scope and clients never replace each other's pending tasks.
+ \c Start, \c Drain and \c Stop affect only the tasks scheduled through the view, the shared pool is started
+ and stopped by its owner. Pending debounced tasks are not hurried by \c Drain, it waits until they are due.
+ */
+std::shared_ptr<IScheduler> CreateScopedScheduler(std::shared_ptr<IScheduler> scheduler, std::string scope);
+
+} // namespace ocls
@@ -0,0 +1,214 @@
+//
+//  stats.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string_view>
+
+namespace ocls {
+
+struct LatencyPercentiles
+{
+    size_t count = 0;
+    uint64_t p50 = 0; ///< Nanoseconds
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+};
+
+/**
+ \return \c {"count", "p50Ms", "p90Ms", "p99Ms", "maxMs"}
+ */
+nlohmann::json ToJson(const LatencyPercentiles& percentiles);
+
+/**
+ Histogram of latencies in nanoseconds with log-linear buckets in the manner of HdrHistogram:
+ every power of two is split into 16 buckets, so a reported value is within 6.25% of the recorded one.
+ \c Record is wait-free and can be called from any thread, the percentiles are read without stopping the writers.
+ */
+class LatencyHistogram
+{
+public:
+    void Record(uint64_t nanoseconds) noexcept;
+
+    /**
+     \return the highest value of the bucket every percentile falls into, capped by the maximum
+     */
+    LatencyPercentiles Percentiles() const;
+
+private:
+    static constexpr unsigned SubBucketBits = 4;
+    static constexpr size_t SubBucketCount = size_t {1} << SubBucketBits;
+    static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    static size_t BucketIndex(uint64_t value) noexcept;
+    static uint64_t BucketHighest(size_t index) noexcept;
+
+    std::array<std::atomic<uint64_t>, BucketCount> m_buckets {};
+    std::atomic<uint64_t> m_max {0};
+};
+
+inline uint64_t NanosecondsSince(std::chrono::steady_clock::time_point start) noexcept
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/**
+ Records the time from construction to destruction into \c histogram, nothing is recorded if it is \c nullptr.
+ */
+class LatencyTimer
+{
+public:
+    explicit LatencyTimer(LatencyHistogram* histogram) noexcept
+        : m_histogram {histogram}
+        , m_start {std::chrono::steady_clock::now()}
+    {}
+
+    ~LatencyTimer()
+    {
+        if (m_histogram)
+        {
+            m_histogram->Record(NanosecondsSince(m_start));
+        }
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    LatencyHistogram* m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+/**
+ Calls into libclang and the OpenCL runtime whose duration is recorded, and the time to the first completion.
+ */
+enum class Probe
+{
+    parseTranslationUnit,   ///< clang_parseTranslationUnit2
+    reparseTranslationUnit, ///< clang_reparseTranslationUnit
+    createTranslationUnit,  ///< clang_createTranslationUnit2, restores a translation unit from the AST cache
+    codeCompleteAt,         ///< clang_codeCompleteAt
+    openToFirstCompletion,  ///< From didOpen of a document to the response to its first completion
+    buildProgram            ///< cl::Program::build
+};
+
+/**
+ Current sizes of the server queues and caches.
+ */
+enum class Gauge
+{
+    interactiveTasks,            ///< Interactive tasks waiting for a worker or for the previous task with the same key
+    backgroundTasks,             ///< Same for the background tasks
+    debouncedTasks,              ///< Tasks waiting for their debounce window to pass
+    runningTasks,
+    outgoingMessages,            ///< Messages waiting for the writer thread
+    translationUnits,            ///< Parsed translation units
+    translationUnitMemory,       ///< Bytes held by the translation units, sampled after each parse and reparse
+    preambleMemory,              ///< Part of \c translationUnitMemory taken by precompiled preambles and headers
+    translationUnitMemoryBudget, ///< Configured bound of \c translationUnitMemory, 0 if there is none
+    maxTranslationUnits,         ///< Configured bound of \c translationUnits, 0 if there is none
+    evictedTranslationUnits      ///< Translation units released to fit the bounds since the start
+};
+
+/**
+ Process wide statistics of the server, sessions of the daemon share them.
+ Everything is recorded with atomics only, the cost is a few relaxed increments when nobody reads them.
+ */
+class Statistics
+{
+public:
+    /**
+     \return histogram of the time a method takes to be handled on the reading thread,
+      \c nullptr if there are too many methods or the name is too long
+     */
+    LatencyHistogram* Method(std::string_view method) noexcept
+    {
+        return m_methods.Find(method);
+    }
+
+    /**
+     \return histogram of the time from the dispatch of a request to the end of the task that responds to it,
+      for the requests that are handled on the workers, \c nullptr in the same cases as \c Method
+     */
+    LatencyHistogram* Request(std::string_view method) noexcept
+    {
+        return m_requests.Find(method);
+    }
+
+    LatencyHistogram& Of(Probe probe) noexcept
+    {
+        return m_probes[static_cast<size_t>(probe)];
+    }
+
+    void Add(Gauge gauge, int64_t delta) noexcept
+    {
+        m_gauges[static_cast<size_t>(gauge)].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void Set(Gauge gauge, int64_t value) noexcept
+    {
+        m_gauges[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+    }
+
+    int64_t Get(Gauge gauge) const noexcept
+    {
+        return m_gauges[static_cast<size_t>(gauge)].load(std::memory_order_relaxed);
+    }
+
+    /**
+     \return the result of \c $/ocls/stats
+     */
+    nlohmann::json ToJson() const;
+
+private:
+    /**
+     Histograms by name in a fixed open addressing table, a name takes a slot on its first use and keeps it.
+     */
+    class HistogramTable
+    {
+    public:
+        LatencyHistogram* Find(std::string_view name) noexcept;
+        nlohmann::json ToJson() const;
+
+    private:
+        static constexpr size_t Capacity = 32;
+        static constexpr size_t MaxNameLength = 63;
+
+        enum SlotState : int
+        {
+            empty,
+            claimed, ///< The name is being written
+            ready
+        };
+
+        struct Slot
+        {
+            std::atomic<int> state {empty};
+            size_t length = 0;
+            char name[MaxNameLength + 1] = {};
+            LatencyHistogram histogram;
+        };
+
+        std::array<Slot, Capacity> m_slots;
+    };
+
+    HistogramTable m_methods;
+    HistogramTable m_requests;
+    std::array<LatencyHistogram, static_cast<size_t>(Probe::buildProgram) + 1> m_probes;
+    std::array<std::atomic<int64_t>, static_cast<size_t>(Gauge::evictedTranslationUnits) + 1> m_gauges {};
+};
+
+Statistics& GetStatistics();
+
+} // namespace ocls
@@ -0,0 +1,173 @@
+//
+//  tracing.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ocls {
+
+/**
+ Writes Chrome trace events in the JSON array format understood by chrome://tracing, Perfetto and Speedscope.
+
+ Every span is a complete event tagged with the request id and the document uri of the \c TraceContext
+ of the thread that recorded it. Events are buffered per thread and appended to the file by a background thread,
+ so a recording thread never waits for the disk. Nothing is recorded until \c Start.
+ */
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Tracer();
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     \throw std::runtime_error if the file cannot be opened
+     */
+    void Start(const std::string& filePath);
+    /**
+     Writes the buffered events and closes the file, spans still open are dropped.
+     */
+    void Stop();
+
+    bool IsEnabled() const noexcept
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     Records a span of the calling thread, \c category groups the spans in the viewer.
+     */
+    void Complete(std::string_view name, const char* category, Clock::time_point start, Clock::time_point end);
+
+private:
+    struct Event
+    {
+        std::string name;
+        const char* category = nullptr;
+        uint64_t startNs = 0;
+        uint64_t durationNs = 0;
+        std::string id;
+        std::string uri;
+    };
+
+    struct ThreadBuffer
+    {
+        uint32_t tid = 0;
+        std::mutex mutex;
+        std::vector<Event> events;
+    };
+
+    ThreadBuffer& GetThreadBuffer();
+    void Loop();
+    // Requires m_mutex to be held
+    void Flush();
+
+private:
+    const uint64_t m_identifier;
+    std::atomic<bool> m_enabled {false};
+    Clock::time_point m_origin;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+    std::thread m_thread;
+    std::ofstream m_file;
+    std::string m_output;
+    uint32_t m_nextTid = 0;
+    bool m_stopping = false;
+    bool m_empty = true;
+};
+
+/**
+ \return tracer of the process, started by \c --trace-file
+ */
+Tracer& GetTracer();
+
+/**
+ Tags the spans recorded by the current thread with the request id and the document uri while it is alive.
+ Contexts nest, the innermost one is used. It does nothing while tracing is disabled.
+ */
+class TraceContext
+{
+public:
+    TraceContext(const nlohmann::json& id, std::string_view uri);
+    ~TraceContext();
+
+    TraceContext(const TraceContext&) = delete;
+    TraceContext& operator=(const TraceContext&) = delete;
+
+    static const TraceContext* Current() noexcept;
+
+    const std::string& Id() const noexcept
+    {
+        return m_id;
+    }
+
+    const std::string& Uri() const noexcept
+    {
+        return m_uri;
+    }
+
+private:
+    bool m_active = false;
+    const TraceContext* m_previous = nullptr;
+    std::string m_id;
+    std::string m_uri;
+};
+
+/**
+ Records the time from construction to destruction as a span of \c GetTracer.
+ \c name must outlive the span, the clock is not read while tracing is disabled.
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(std::string_view name, const char* category) noexcept
+        : m_name {name}
+        , m_category {category}
+        , m_active {GetTracer().IsEnabled()}
+    {
+        if (m_active)
+        {
+            m_start = Tracer::Clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_active)
+        {
+            GetTracer().Complete(m_name, m_category, m_start, Tracer::Clock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    std::string_view m_name;
+    const char* m_category;
+    bool m_active;
+    Tracer::Clock::time_point m_start;
+};
+
+} // namespace ocls
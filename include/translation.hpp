@@ -7,8 +7,13 @@
 
 #pragma once
 
+#include "document.hpp"
+
 #include <clang-c/Index.h>
+#include <nlohmann/json.hpp>
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <string>
@@ -16,16 +21,107 @@
 
 namespace ocls {
 
+/**
+ Memory held by the translation unit of a file, as reported by \c clang_getCXTUResourceUsage.
+ */
+struct TranslationUnitMemory
+{
+    std::string filePath;
+    uint64_t ast = 0;      ///< AST nodes and side tables, identifier and selector tables
+    uint64_t preamble = 0; ///< Precompiled preamble with the OpenCL headers, allocated or mapped
+    uint64_t total = 0;    ///< Every resource libclang accounts for, including the ones above
+};
+
+nlohmann::json ToJson(const TranslationUnitMemory &memory);
+
+/**
+ Bounds of the memory held by translation units, a zero value disables the bound.
+ */
+struct TranslationUnitLimits
+{
+    uint64_t memoryBudget = 0;                 ///< Bytes of all translation units together
+    size_t maxTranslationUnits = 0;            ///< Number of parsed translation units
+    std::chrono::milliseconds idleTimeout {0}; ///< Translation units not queried for this long are released
+};
+
+/**
+ A translation unit shared by the store and the queries running on it, it is disposed with the last reference,
+ so a query keeps its revision even if a newer one is swapped in meanwhile.
+ */
+using TranslationUnitRef = std::shared_ptr<CXTranslationUnitImpl>;
+
+enum class LeaseMode
+{
+    shared,   ///< Reads the translation unit, many shared leases of a document may be held at once
+    exclusive ///< Calls that change the translation unit, such as code completion
+};
+
+/**
+ Pins the translation unit served for a file together with the content it was parsed from.
+ Both stay valid while a copy of the lease is alive, even if the file changes, is evicted or closed meanwhile.
+ The lease also holds the lock of its document in the requested mode, it is released with the last copy.
+ An empty lease has no translation unit, the file is not open or its parse failed.
+ */
+class TranslationUnitLease
+{
+public:
+    TranslationUnitLease() = default;
+    /**
+     \param latest the latest content of the file if the unit was parsed from an older one, otherwise \c nullptr
+     */
+    TranslationUnitLease(
+        TranslationUnitRef tu,
+        std::shared_ptr<const std::string> content,
+        std::shared_ptr<const std::string> latest,
+        std::shared_ptr<void> lock = nullptr);
+
+    explicit operator bool() const;
+    CXTranslationUnit TranslationUnit() const;
+    /**
+     \return the content the translation unit was parsed from, or \c nullptr for an empty lease
+     */
+    const std::string *Content() const;
+    /**
+     \return whether the unit was parsed from the latest content of the file when the lease was taken
+     */
+    bool IsUpToDate() const;
+    /**
+     Maps the 1-based \c lineno / \c columnno of the latest content to the content the unit was parsed from,
+     the text before and after the changes since then keeps its meaning. Nothing is mapped if the unit is up to date.
+     \return false if the position lies in the changed text or outside of the latest content
+     */
+    bool MapPosition(unsigned &lineno, unsigned &columnno) const;
+
+private:
+    TranslationUnitRef m_tu;
+    std::shared_ptr<const std::string> m_content;
+    std::shared_ptr<const std::string> m_latest;
+    std::shared_ptr<void> m_lock;
+};
+
 /**
  Owns the lifecycle of libclang translation units and their backing file
  content, plus the shared header cache and translation options.
+ Calls for different files may come from different threads. Calls that change a file must not overlap,
+ leases of a file may be taken alongside them and are served by the last parsed revision.
  */
 struct ITranslationUnitStore
 {
     virtual ~ITranslationUnitStore() = default;
 
-    virtual void OnFileOpen(const std::string &filePath, const std::string &content) = 0;
-    virtual void OnFileChange(const std::string &filePath, const std::string &content) = 0;
+    /**
+     * Takes ownership of \c content, pass an rvalue to avoid copying the document.
+     */
+    virtual void OnFileOpen(const std::string &filePath, std::string content) = 0;
+    /**
+     * Applies \c changes to the stored document in place and parses the new revision into a standby
+     * translation unit, while the current one keeps serving queries. The units are swapped once
+     * the parse succeeds, the previous one becomes the standby reparsed on the next change, unless
+     * \c ReleaseStandbys disposes it first.
+     * If the parse fails, the previous revision is served until the next change.
+     * The document keeps its pieces between changes, a contiguous snapshot is joined once per call for the reparse.
+     */
+    virtual void OnFileChange(const std::string &filePath, std::vector<TextChange> changes) = 0;
     virtual void OnFileClose(const std::string &filePath) = 0;
 
     /**
@@ -34,31 +130,96 @@ struct ITranslationUnitStore
      * These command-line options will be parsed and will affect how the translation
      * unit is parsed. Note that the following options are ignored: '-c',
      * '-emit-ast', '-fsyntax-only' (which is the default), and '-o \<output file>'.
+     * After \c SaveHeaders the OpenCL headers are precompiled once per distinct set of options
+     * and shared by every translation unit with '-include-pch', the PCH is kept next to the headers
+     * for later calls and runs.
+     * The open documents are kept, their translation units are disposed and parsed again on the next lease.
      *
      * \see BuildDefaultTranslationOptions
      */
     virtual void SetTranslationOptions(const std::vector<std::string> &options) = 0;
 
     /**
-     * Saves embedded OpenCL headers to disk
+     * Saves embedded OpenCL headers to disk, into the per-user cache directory of this version,
+     * or next to the AST cache when it is enabled. The directory is kept between runs and shared by
+     * concurrent servers, a header is written only if it is missing or differs.
      */
     virtual void SaveHeaders() = 0;
 
     /**
-     * Returns the cached translation unit for \c filePath, or \c nullptr
+     * Keeps the translation units parsed on open in \c directory between server runs, at most \c capacity bytes,
+     * the least recently used ones are removed first.
+     * A file opened with the same content, path, options and clang version is restored with
+     * \c clang_createTranslationUnit2 instead of being parsed.
+     * Must be called before \c SaveHeaders, the headers are stored next to the units, since libclang rejects
+     * a unit whose headers changed on disk.
+     * The precompiled headers are kept there too and count against \c capacity.
+     */
+    virtual void EnableASTCache(const std::string &directory, uint64_t capacity) = 0;
+
+    /**
+     * Leases the translation unit served for \c filePath, the lease is empty
      * if the file hasn't been opened / parsing failed.
+     * Blocks while a lease in a conflicting mode is held for the same file.
+     * A translation unit released by \c Evict is parsed again from the stored content.
+     * For an exclusive lease a translation unit restored from the AST cache is parsed first,
+     * since libclang can neither reparse nor complete code in a unit loaded from an AST file.
+     */
+    virtual TranslationUnitLease Lease(const std::string &filePath, LeaseMode mode) = 0;
+
+    /**
+     * Returns \c false while the translation unit served for \c filePath is older than its content,
+     * that is while \c OnFileChange parses the new revision or after that parse failed.
+     */
+    virtual bool IsUpToDate(const std::string &filePath) const = 0;
+
+    /**
+     * Returns the latest content of \c filePath, or \c nullptr if not tracked.
+     * The snapshot is not affected by later changes of the file.
      */
-    virtual CXTranslationUnit GetTranslationUnit(const std::string &filePath) const = 0;
+    virtual std::shared_ptr<const std::string> GetContent(const std::string &filePath) const = 0;
 
     /**
-     * Returns a pointer to the cached in-memory content for \c filePath,
-     * or \c nullptr if not tracked. The pointer is valid until the next
-     * \c OnFileChange / \c OnFileClose call for the same file.
+     * Returns the memory of every file, largest first, including its standby translation unit,
+     * which counts against the budget of \c SetLimits too.
+     * It is sampled after each parse and reparse, so the call does not touch libclang.
      */
-    virtual const std::string *GetContent(const std::string &filePath) const = 0;
+    virtual std::vector<TranslationUnitMemory> GetMemoryUsage() const = 0;
+
+    virtual void SetLimits(const TranslationUnitLimits &limits) = 0;
+
+    /**
+     * Disposes the standby translation units that do not fit the limits, least recently queried first:
+     * the ones of files idle for longer than the timeout and as many others as the budget requires.
+     * A standby is cheaper to lose than a served unit, the next change of its file is parsed in full,
+     * so call this before \c GetEvictionCandidates.
+     */
+    virtual void ReleaseStandbys() = 0;
+
+    /**
+     * Returns the files to \c Evict to fit the limits, least recently queried first:
+     * the ones idle for longer than the timeout and as many others as the budget and the cap require.
+     * The most recently queried translation unit is kept unless it is idle.
+     */
+    virtual std::vector<std::string> GetEvictionCandidates() const = 0;
+
+    /**
+     * Disposes the translation units of \c filePath but keeps its content,
+     * freed memory is returned to the system where the allocator supports it.
+     */
+    virtual void Evict(const std::string &filePath) = 0;
+};
+
+/**
+ Where libclang keeps the precompiled preambles, the leading directives of a file parsed once and reused by reparses.
+ */
+struct PreambleStorage
+{
+    bool inMemory = false; ///< Nothing is written to disk, the preambles count towards the memory of the units
+    std::string directory; ///< Directory of the preamble files, the system temporary directory if empty
 };
 
-std::shared_ptr<ITranslationUnitStore> CreateTranslationUnitStore();
+std::shared_ptr<ITranslationUnitStore> CreateTranslationUnitStore(const PreambleStorage &preambles = {});
 
 std::vector<std::string> BuildDefaultTranslationOptions(const std::string &clStandard);
 
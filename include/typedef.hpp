@@ -29,7 +29,7 @@ struct ITypeDefinition
     /**
      \note \c lineno / \c columnno are 1-based values
      */
-    virtual std::vector<Location> GetTypeDefinitions(
+    virtual LocationResult GetTypeDefinitions(
         const std::string &filePath, unsigned lineno, unsigned columnno) = 0;
 };
 
@@ -0,0 +1,97 @@
+//
+//  writer.hpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <variant>
+
+namespace ocls {
+
+/**
+ Delivers a block of framed messages to the client.
+ \return \c false if the channel is closed and nothing more can be written
+ */
+using WriteSinkFunc = std::function<bool(std::string_view data)>;
+
+/**
+ Message body serialized in advance, e.g. with \c JsonWriter, so it can be framed without a DOM round-trip.
+ Unlike DOM messages, the body must already contain the \c jsonrpc member.
+ */
+struct SerializedMessage
+{
+    std::string body;
+};
+
+using OutgoingMessage = std::variant<nlohmann::json, SerializedMessage>;
+
+/**
+ \return the DOM of \c message, serialized bodies are parsed
+ */
+nlohmann::json ToJson(const OutgoingMessage& message);
+
+struct MessageWriterStats
+{
+    uint64_t messages = 0;     ///< Number of messages written
+    uint64_t batches = 0;      ///< Number of sink calls, each one carries one or more messages
+    uint64_t bytesWritten = 0; ///< Total size of framed messages passed to the sink
+    uint64_t queueWaitNs = 0;  ///< Total time messages spent in the queue before being serialized
+    uint64_t maxQueueWaitNs = 0;
+};
+
+struct IMessageWriter
+{
+    virtual ~IMessageWriter() = default;
+
+    /**
+     Start the writer thread.
+     */
+    virtual void Start() = 0;
+    /**
+     Enqueue a message for delivery. Never blocks on the output channel.
+     */
+    virtual void Push(OutgoingMessage&& message) = 0;
+    /**
+     Block until every message pushed so far has been passed to the sink.
+     */
+    virtual void Flush() = 0;
+    /**
+     Write out pending messages and join the writer thread.
+     */
+    virtual void Stop() = 0;
+    virtual MessageWriterStats GetStats() const = 0;
+};
+
+/**
+ Appends \c body framed with JSON-RPC headers to \c out.
+ \c scratch is used to serialize the body, callers should keep it around to reuse its capacity.
+ */
+void AppendFramedMessage(const nlohmann::json& body, std::string& scratch, std::string& out);
+/**
+ Appends a serialized \c body framed with JSON-RPC headers to \c out.
+ */
+void AppendFramedMessage(std::string_view body, std::string& out);
+
+/**
+ Creates a sink that writes directly to the file descriptor \c fd, e.g. a connected socket.
+ The descriptor is not owned by the sink.
+ */
+WriteSinkFunc CreateDescriptorSink(int fd);
+
+/**
+ Creates a sink that writes directly to the standard output descriptor.
+ */
+WriteSinkFunc CreateStdoutSink();
+
+std::shared_ptr<IMessageWriter> CreateMessageWriter(WriteSinkFunc sink);
+
+} // namespace ocls
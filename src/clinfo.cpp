@@ -20,9 +20,9 @@ using ocls::ICLInfo;
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::clinfo);
+    return ocls::Loggers::clinfo;
 }
 
 const std::unordered_map<cl_bool, std::string> booleanChoices {
@@ -227,11 +227,11 @@ json GetKernels(const std::string& strKernels)
 
 json::object_t GetDeviceJSONInfo(const cl::Device& device)
 {
-    logger()->trace("Getting device info...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting device info...");
     json info;
     for (auto& property : deviceProperties)
     {
-        logger()->trace("Getting device property '{}' ...", property.name);
+        SPDLOG_LOGGER_TRACE(logger(), "Getting device property '{}' ...", property.name);
         try
         {
             switch (property.type)
@@ -391,7 +391,7 @@ json::object_t GetDeviceJSONInfo(const cl::Device& device)
 
 uint32_t CalculateDeviceID(const cl::Device& device)
 {
-    logger()->trace("Calculating device ID...");
+    SPDLOG_LOGGER_TRACE(logger(), "Calculating device ID...");
     try
     {
         auto name = device.getInfo<CL_DEVICE_NAME>();
@@ -413,7 +413,7 @@ uint32_t CalculateDeviceID(const cl::Device& device)
 
 uint32_t CalculatePlatformID(const cl::Platform& platform)
 {
-    logger()->trace("Calculating platform ID...");
+    SPDLOG_LOGGER_TRACE(logger(), "Calculating platform ID...");
     try
     {
         const auto name = platform.getInfo<CL_PLATFORM_NAME>();
@@ -432,7 +432,7 @@ uint32_t CalculatePlatformID(const cl::Platform& platform)
 
 std::vector<cl::Platform> GetPlatforms()
 {
-    logger()->trace("Getting platforms...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting platforms...");
     std::vector<cl::Platform> platforms;
     try
     {
@@ -466,7 +466,7 @@ std::string GetPlatformDescription(const cl::Platform& platform)
 
 size_t GetDevicePowerIndex(const cl::Device& device)
 {
-    logger()->trace("Getting device power index...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting device power index...");
     try
     {
         const size_t maxComputeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
@@ -546,7 +546,7 @@ std::string GetDeviceDescription(const cl::Device& device)
 
 json GetDevicesJSONInfo(const std::vector<cl::Device>& devices)
 {
-    logger()->trace("Getting devices info...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting devices info...");
     if (devices.size() == 0)
     {
         return json::array({});
@@ -566,12 +566,12 @@ json GetDevicesJSONInfo(const std::vector<cl::Device>& devices)
 
 json GetPlatformJSONInfo(const cl::Platform& platform)
 {
-    logger()->trace("Getting platform info...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting platform info...");
     json info;
     info["PLATFORM_ID"] = CalculatePlatformID(platform);
     for (auto& property : platformProperties)
     {
-        logger()->trace("Getting platform property '{}' ...", property.name);
+        SPDLOG_LOGGER_TRACE(logger(), "Getting platform property '{}' ...", property.name);
         try
         {
             std::string value;
@@ -626,16 +626,16 @@ public:
         const auto platforms = GetPlatforms();
         for (const auto& platform : platforms)
         {
-            const auto description = GetPlatformDescription(platform);
-            logger()->trace("Platform {}", description);
-            logger()->trace("Searching for platform's devices...");
+            SPDLOG_LOGGER_TRACE(logger(), "Platform {}", GetPlatformDescription(platform));
+            SPDLOG_LOGGER_TRACE(logger(), "Searching for platform's devices...");
 
             try
             {
                 std::vector<cl::Device> platformDevices;
                 platform.getDevices(CL_DEVICE_TYPE_ALL, &platformDevices);
 
-                if (logger()->level() <= spdlog::level::trace)
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+                if (logger()->should_log(spdlog::level::trace))
                 {
                     std::stringstream traceLog;
                     traceLog << "Found devices: " << platformDevices.size() << "\n";
@@ -643,8 +643,9 @@ public:
                     {
                         traceLog << "Device " << GetDeviceDescription(device) << "\n";
                     }
-                    logger()->trace(traceLog.str());
+                    SPDLOG_LOGGER_TRACE(logger(), traceLog.str());
                 }
+#endif
 
                 auto deviceToOclsDevice = [](const cl::Device& device) {
                     return ocls::Device(
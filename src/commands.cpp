@@ -14,16 +14,30 @@
 #include "definition.hpp"
 #include "typedef.hpp"
 #include "declaration.hpp"
+#include "lsp.hpp"
+#include "message.hpp"
+#include "recording.hpp"
 
+#include <chrono>
 #include <filesystem>
+#include <iomanip>
 #include <list>
+#include <mutex>
+#include <thread>
+
+#if defined(WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 
 namespace {
-auto logger()
+[[maybe_unused]] const auto& logger()
 {
-    return spdlog::get(ocls::LogName::main);
+    return ocls::Loggers::main;
 }
 
 std::list<const char*> clVersions = {
@@ -45,6 +59,67 @@ std::list<const char*> clVersions = {
     "CLC++1.0",
     "clc++2021",
     "CLC++2021"};
+
+// Size of the pipe buffer the replayed messages are written to on Windows
+constexpr unsigned ReplayPipeSize = 64 * 1024;
+
+bool CreatePipe(int fds[2])
+{
+#if defined(WIN32)
+    return _pipe(fds, ReplayPipeSize, _O_BINARY) == 0;
+#else
+    return pipe(fds) == 0;
+#endif
+}
+
+void ClosePipeEnd(int fd)
+{
+#if defined(WIN32)
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool WriteToPipe(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+#if defined(WIN32)
+        const auto count = _write(fd, data.data(), static_cast<unsigned>(data.size()));
+#else
+        const auto count = write(fd, data.data(), data.size());
+#endif
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<size_t>(count));
+    }
+    return true;
+}
+
+bool IsExitMessage(const std::string& body)
+{
+    try
+    {
+        return !ocls::IsBatch(body) && ocls::JRPCMessage::FromView(body).Method() == "exit";
+    }
+    catch (std::exception&)
+    {
+        // Malformed messages are replayed as they are
+        return false;
+    }
+}
+
+double ToMilliseconds(uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e6;
+}
 } // namespace
 
 namespace ocls {
@@ -74,7 +149,7 @@ int CLInfoSubCommand::Execute()
     auto jsonBody = clinfo->json();
     auto indentation = prettyPrint ? 4 : -1;
     auto info = jsonBody.dump(indentation);
-    logger()->trace("Result: {}", info);
+    SPDLOG_LOGGER_TRACE(logger(), "Result: {}", info);
     std::cout << info << std::endl;
     return EXIT_SUCCESS;
 }
@@ -134,7 +209,7 @@ int DiagnosticsSubCommand::Execute()
         Source source {kernel, *content};
         if (json)
         {
-            auto output = diagnostics->GetDiagnostics(source);
+            auto output = ToJson(diagnostics->GetDiagnostics(source, {}));
             std::cout << output.dump(4) << std::endl;
         }
         else
@@ -191,7 +266,7 @@ int CompletionSubCommand::Execute()
             return EXIT_FAILURE;
         }
         store->OnFileOpen(kernel, *content);
-        auto completions = completion->GetCompletions(kernel, line, column);
+        auto completions = completion->GetCompletions(kernel, line, column, {});
         store->OnFileClose(kernel);
 
         if (json)
@@ -265,6 +340,219 @@ int CompletionSubCommand::Execute()
     return EXIT_SUCCESS;
 }
 
+// ReplaySubCommand
+
+ReplaySubCommand::ReplaySubCommand(CLI::App& app)
+    : SubCommand(app, "replay", "Replays a session recorded with --record and reports respond latencies")
+{
+    cmd->add_flag("-j,--json", json, "Print latencies in JSON format");
+    cmd->add_option("-r,--recording", recording, "Path to a recording")->required(true);
+    cmd->add_option("-s,--speed", speed, "Send the messages with the recorded delays or as fast as possible")
+        ->check(CLI::IsMember({"original", "max"}))
+        ->capture_default_str();
+}
+
+int ReplaySubCommand::Execute()
+{
+    using Clock = std::chrono::steady_clock;
+    try
+    {
+        const auto entries = ReadRecording(recording);
+
+        auto clinfo = CreateCLInfo();
+        auto diagnostics = CreateDiagnostics(clinfo);
+        auto device = diagnostics->GetDevice();
+        auto store = CreateTranslationUnitStore();
+        store->SaveHeaders();
+        store->SetTranslationOptions(BuildDefaultTranslationOptions(device ? device->GetCLStandard() : "CL"));
+
+        int fds[2];
+        if (!CreatePipe(fds))
+        {
+            std::cerr << "Failed to create a pipe" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // The tracker is fed by the sender thread and by the writer thread of the server
+        std::mutex trackerMutex;
+        LatencyTracker tracker;
+        std::string output;
+        const auto start = Clock::now();
+        const auto elapsed = [start]() {
+            return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        };
+        const auto sink = [&](std::string_view data) {
+            const auto timestamp = elapsed();
+            std::lock_guard<std::mutex> lock(trackerMutex);
+            output.append(data);
+            for (const auto& body : TakeFramedMessages(output))
+            {
+                tracker.OnOutbound(body, timestamp);
+            }
+            return true;
+        };
+
+        auto jrpc = CreateJsonRPC();
+        auto scheduler = CreateScheduler();
+        auto handler = CreateLSPEventsHandler(
+            jrpc,
+            store,
+            diagnostics,
+            CreateCompletion(store),
+            CreateDefinition(store),
+            CreateTypeDefinition(store),
+            CreateDeclaration(store),
+            utils::CreateDefaultGenerator(),
+            utils::CreateDefaultExitHandler(),
+            scheduler);
+        auto server = CreateLSPServer(jrpc, store, handler, scheduler, LSPTransport {fds[0], sink});
+
+        std::thread sender([&]() {
+            std::optional<uint64_t> origin;
+            for (const auto& entry : entries)
+            {
+                if (entry.direction != RecordDirection::inbound)
+                {
+                    continue;
+                }
+                // The end of the input ends the replay, 'exit' would terminate the process
+                if (IsExitMessage(entry.body))
+                {
+                    continue;
+                }
+                if (!origin)
+                {
+                    origin = entry.timestamp;
+                }
+                if (speed == "original")
+                {
+                    std::this_thread::sleep_until(start + std::chrono::nanoseconds(entry.timestamp - *origin));
+                }
+                {
+                    std::lock_guard<std::mutex> lock(trackerMutex);
+                    tracker.OnInbound(entry.body, elapsed());
+                }
+                const auto frame = "Content-Length: " + std::to_string(entry.body.size()) + "\r\n\r\n" + entry.body;
+                if (!WriteToPipe(fds[1], frame))
+                {
+                    break;
+                }
+            }
+            ClosePipeEnd(fds[1]);
+        });
+        server->Run();
+        sender.join();
+        ClosePipeEnd(fds[0]);
+
+        const auto report = tracker.Report();
+        if (json)
+        {
+            nlohmann::json result = nlohmann::json::object();
+            for (const auto& [method, latency] : report)
+            {
+                result[method] = ToJson(latency);
+            }
+            std::cout << result.dump(4) << std::endl;
+        }
+        else
+        {
+            std::cout << "method, count, p50 (ms), p90 (ms), p99 (ms), max (ms)" << std::endl;
+            std::cout << std::fixed << std::setprecision(3);
+            for (const auto& [method, latency] : report)
+            {
+                std::cout << method << ", " << latency.count << ", " << ToMilliseconds(latency.p50) << ", "
+                          << ToMilliseconds(latency.p90) << ", " << ToMilliseconds(latency.p99) << ", "
+                          << ToMilliseconds(latency.max) << std::endl;
+            }
+        }
+    }
+    catch (std::exception& err)
+    {
+        std::cerr << "Failed to replay the session: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// MemorySubCommand
+
+MemorySubCommand::MemorySubCommand(CLI::App& app)
+    : SubCommand(app, "memory", "Parses OpenCL kernels and reports the memory of their translation units")
+{
+    cmd->add_flag("-j,--json", json, "Print memory usage in JSON format");
+    cmd->add_option("-k,--kernel", kernels, "Path to a kernel file, can be repeated")->required(true);
+    cmd->add_option("--cl-std", clVersion, "OpenCL version")
+        ->check(CLI::IsMember(clVersions))
+        ->capture_default_str();
+}
+
+int MemorySubCommand::Execute()
+{
+    try
+    {
+        auto store = CreateTranslationUnitStore();
+        store->SaveHeaders();
+        store->SetTranslationOptions(BuildDefaultTranslationOptions(clVersion));
+
+        for (const auto& kernel : kernels)
+        {
+            if (!fs::exists(kernel))
+            {
+                std::cerr << "Kernel file '" << kernel << "' does not exist" << std::endl;
+                return EXIT_FAILURE;
+            }
+            auto content = utils::ReadFileContent(kernel);
+            if (!content.has_value())
+            {
+                return EXIT_FAILURE;
+            }
+            store->OnFileOpen(kernel, std::move(*content));
+        }
+
+        const auto usage = store->GetMemoryUsage();
+        uint64_t total = 0;
+        for (const auto& memory : usage)
+        {
+            total += memory.total;
+        }
+
+        if (json)
+        {
+            nlohmann::json translationUnits = nlohmann::json::array();
+            for (const auto& memory : usage)
+            {
+                translationUnits.emplace_back(ToJson(memory));
+            }
+            const nlohmann::json result = {{"totalBytes", total}, {"translationUnits", std::move(translationUnits)}};
+            std::cout << result.dump(4) << std::endl;
+        }
+        else
+        {
+            std::cout << "file, AST (bytes), preamble (bytes), total (bytes)" << std::endl;
+            for (const auto& memory : usage)
+            {
+                std::cout << memory.filePath << ", " << memory.ast << ", " << memory.preamble << ", " << memory.total
+                          << std::endl;
+            }
+            std::cout << "total, , , " << total << std::endl;
+        }
+
+        for (const auto& kernel : kernels)
+        {
+            store->OnFileClose(kernel);
+        }
+    }
+    catch (std::exception& err)
+    {
+        std::cerr << "Failed to measure memory: " << err.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 // LocationSubCommand
 
 LocationSubCommand::LocationSubCommand(
@@ -364,7 +652,7 @@ std::shared_ptr<LocationSubCommand> MakeDefinitionSubCommand(CLI::App& app)
         [](std::shared_ptr<ITranslationUnitStore> store) -> LocationResolver {
             auto definition = CreateDefinition(store);
             return [definition](const std::string& filePath, unsigned line, unsigned column) {
-                return definition->GetDefinitions(filePath, line, column);
+                return definition->GetDefinitions(filePath, line, column, {}).locations;
             };
         });
 }
@@ -378,7 +666,7 @@ std::shared_ptr<LocationSubCommand> MakeDeclarationSubCommand(CLI::App& app)
         [](std::shared_ptr<ITranslationUnitStore> store) -> LocationResolver {
             auto declaration = CreateDeclaration(store);
             return [declaration](const std::string& filePath, unsigned line, unsigned column) {
-                return declaration->GetDeclarations(filePath, line, column);
+                return declaration->GetDeclarations(filePath, line, column).locations;
             };
         });
 }
@@ -392,7 +680,7 @@ std::shared_ptr<LocationSubCommand> MakeTypeDefinitionSubCommand(CLI::App& app)
         [](std::shared_ptr<ITranslationUnitStore> store) -> LocationResolver {
             auto typeDefinition = CreateTypeDefinition(store);
             return [typeDefinition](const std::string& filePath, unsigned line, unsigned column) {
-                return typeDefinition->GetTypeDefinitions(filePath, line, column);
+                return typeDefinition->GetTypeDefinitions(filePath, line, column).locations;
             };
         });
 }
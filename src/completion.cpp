@@ -7,6 +7,8 @@
 
 #include "completion.hpp"
 #include "log.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
 
 #include <clang-c/Index.h>
 #include <cstdio>
@@ -18,9 +20,9 @@
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::completion);
+    return ocls::Loggers::completion;
 }
 
 std::unordered_map<CXCompletionChunkKind, std::string> completeChunkKindSpellingMap = {
@@ -46,7 +48,7 @@ std::unordered_map<CXCompletionChunkKind, std::string> completeChunkKindSpelling
     {CXCompletionChunk_HorizontalSpace, "HorizontalSpace"},
     {CXCompletionChunk_VerticalSpace, "VerticalSpace"}};
 
-std::string getCompleteChunkKindSpelling(CXCompletionChunkKind chunkKind)
+[[maybe_unused]] std::string getCompleteChunkKindSpelling(CXCompletionChunkKind chunkKind)
 {
     auto valueIt = completeChunkKindSpellingMap.find(chunkKind);
     if (valueIt == completeChunkKindSpellingMap.end())
@@ -280,11 +282,9 @@ public:
         }
 
     std::vector<CompletionResult> GetCompletions(
-        const std::string &filePath, unsigned lineno, unsigned columnno) override;
+        const std::string &filePath, unsigned lineno, unsigned columnno, const CancellationToken &token) override;
 
 private:
-    std::vector<CompletionResult> FilterCompletions(CXCodeCompleteResults *compResults, const std::string &prefix);
-
     std::optional<std::string> GetPrefix(
         const CXTranslationUnit &translationUnit,
         const std::string &filePath,
@@ -317,6 +317,7 @@ std::optional<std::string> Completion::GetPrefix(
     CXToken *tokens = NULL;
     unsigned ntokens = 0;
 
+    TraceSpan span("clang_tokenize", "libclang");
     clang_tokenize(translationUnit, safeRange, &tokens, &ntokens);
 
     // Scan backwards from the end of the extracted tokens array
@@ -361,12 +362,17 @@ std::optional<std::string> Completion::GetPrefix(
     return std::nullopt;
 }
 
-std::vector<CompletionResult> Completion::FilterCompletions(
-    CXCodeCompleteResults *compResults, const std::string &prefix)
+std::vector<CompletionResult> FilterCompletions(
+    CXCodeCompleteResults *compResults, const std::string &prefix, const CancellationToken &token)
 {
     std::vector<CompletionResult> completions;
     for (auto i = 0U; i < compResults->NumResults; ++i)
     {
+        if (token.IsCancelled())
+        {
+            return {};
+        }
+
         const CXCompletionResult &result = compResults->Results[i];
         const CXCompletionString &compString = result.CompletionString;
 
@@ -417,10 +423,12 @@ std::vector<CompletionResult> Completion::FilterCompletions(
             const bool preselect = shouldPreselect(priority);
             const unsigned resIndex = i;
 
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
             if (logger()->should_log(spdlog::level::trace))
             {
                 CXString kindName = clang_getCursorKindSpelling(result.CursorKind);
-                logger()->trace(
+                SPDLOG_LOGGER_TRACE(
+                    logger(),
                     "  Index: {}; Priority: {}; Label: {}; Kind: {}; Text {}",
                     resIndex,
                     priority,
@@ -429,6 +437,7 @@ std::vector<CompletionResult> Completion::FilterCompletions(
                     getCompleteChunkKindSpelling(chunkKind));
                 clang_disposeString(kindName);
             }
+#endif
 
             completions.push_back(
                 CompletionResult {
@@ -453,18 +462,21 @@ std::vector<CompletionResult> Completion::FilterCompletions(
 }
 
 std::vector<CompletionResult> Completion::GetCompletions(
-    const std::string &filePath, unsigned lineno, unsigned columnno)
+    const std::string &filePath, unsigned lineno, unsigned columnno, const CancellationToken &token)
 {
     logger()->debug("Get completions for {}:{}:{}", filePath, lineno, columnno);
 
-    CXTranslationUnit translationUnit = m_store->GetTranslationUnit(filePath);
+    // Exclusive, clang_codeCompleteAt reparses the unit
+    const auto lease = m_store->Lease(filePath, LeaseMode::exclusive);
+    CXTranslationUnit translationUnit = lease.TranslationUnit();
     if (!translationUnit)
     {
         logger()->error("No translation unit for {}", filePath);
         return {};
     }
 
-    const std::string *contentPtr = m_store->GetContent(filePath);
+    // The content of the leased revision, so the positions match the unit
+    const std::string *contentPtr = lease.Content();
     if (!contentPtr)
     {
         logger()->error("Content is not available for {}", filePath);
@@ -479,26 +491,39 @@ std::vector<CompletionResult> Completion::GetCompletions(
         return {};
     }
 
+    // clang_codeCompleteAt cannot be interrupted, give up before starting it
+    if (token.IsCancelled())
+    {
+        logger()->debug("Completion for {}:{}:{} is cancelled", filePath, lineno, columnno);
+        return {};
+    }
+
     CXUnsavedFile unsavedFile;
     unsavedFile.Filename = filePath.c_str();
     unsavedFile.Contents = contentPtr->data();
     unsavedFile.Length = static_cast<unsigned long>(contentPtr->size());
 
     const unsigned flags = clang_defaultCodeCompleteOptions() | CXCodeComplete_IncludeBriefComments;
-    CXCodeCompleteResults *compResults =
-        clang_codeCompleteAt(translationUnit, filePath.c_str(), lineno, completionColumn, &unsavedFile, 1, flags);
+    CXCodeCompleteResults *compResults = nullptr;
+    {
+        LatencyTimer timer(&GetStatistics().Of(Probe::codeCompleteAt));
+        TraceSpan span("clang_codeCompleteAt", "libclang");
+        compResults =
+            clang_codeCompleteAt(translationUnit, filePath.c_str(), lineno, completionColumn, &unsavedFile, 1, flags);
+    }
 
     std::vector<CompletionResult> completions;
     do
     {
         if (!compResults)
         {
-            logger()->trace("No completions available");
+            SPDLOG_LOGGER_TRACE(logger(), "No completions available");
             break;
         }
 
-        logger()->trace("Completions: {}", compResults->NumResults);
-        completions = FilterCompletions(compResults, *prefix);
+        SPDLOG_LOGGER_TRACE(logger(), "Completions: {}", compResults->NumResults);
+        TraceSpan span("FilterCompletions", "libclang");
+        completions = FilterCompletions(compResults, *prefix, token);
     } while (false);
 
     clang_disposeCodeCompleteResults(compResults);
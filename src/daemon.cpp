@@ -0,0 +1,764 @@
+//
+//  daemon.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "daemon.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if !defined(WIN32)
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+namespace ocls {
+
+namespace {
+
+const auto& logger()
+{
+    return ocls::Loggers::daemon;
+}
+
+} // namespace
+
+// SharedTranslationUnitStore
+
+class SharedTranslationUnitStore final
+    : public ISharedTranslationUnitStore
+    , public std::enable_shared_from_this<SharedTranslationUnitStore>
+{
+public:
+    explicit SharedTranslationUnitStore(std::shared_ptr<ITranslationUnitStore> store) : m_store {std::move(store)} {}
+
+    std::shared_ptr<ITranslationUnitStore> CreateSession();
+
+    ITranslationUnitStore &Store()
+    {
+        return *m_store;
+    }
+
+    bool Open(size_t session, const std::string &filePath, const std::string &content);
+    bool Change(size_t session, const std::string &filePath);
+    void Release(size_t session, const std::string &filePath);
+    void SetTranslationOptions(const std::vector<std::string> &options);
+    void SetLimits(size_t session, std::optional<TranslationUnitLimits> limits);
+
+private:
+    struct OpenFile
+    {
+        // Sessions that have the file open, it is closed in the store once the last of them closes it
+        std::unordered_set<size_t> sessions;
+        // Sessions whose text is the one in the store, the owner is the only one whose changes are applied
+        std::unordered_set<size_t> inSync;
+        std::optional<size_t> owner;
+    };
+
+    std::shared_ptr<ITranslationUnitStore> m_store;
+    std::mutex m_mutex;
+    size_t m_lastSession = 0;
+    std::unordered_map<std::string, OpenFile> m_files;
+    std::optional<std::vector<std::string>> m_options;
+    std::unordered_map<size_t, TranslationUnitLimits> m_limits;
+};
+
+class SessionTranslationUnitStore final : public ITranslationUnitStore
+{
+public:
+    SessionTranslationUnitStore(std::shared_ptr<SharedTranslationUnitStore> shared, size_t session)
+        : m_shared {std::move(shared)}
+        , m_session {session}
+    {}
+
+    ~SessionTranslationUnitStore()
+    {
+        for (const auto &filePath : m_opened)
+        {
+            m_shared->Release(m_session, filePath);
+        }
+        m_shared->SetLimits(m_session, std::nullopt);
+    }
+
+    void OnFileOpen(const std::string &filePath, std::string content);
+    void OnFileChange(const std::string &filePath, std::vector<TextChange> changes);
+    void OnFileClose(const std::string &filePath);
+    void SetTranslationOptions(const std::vector<std::string> &options);
+    void SaveHeaders();
+    void EnableASTCache(const std::string &directory, uint64_t capacity);
+    TranslationUnitLease Lease(const std::string &filePath, LeaseMode mode);
+    bool IsUpToDate(const std::string &filePath) const;
+    std::shared_ptr<const std::string> GetContent(const std::string &filePath) const;
+    std::vector<TranslationUnitMemory> GetMemoryUsage() const;
+    void SetLimits(const TranslationUnitLimits &limits);
+    void ReleaseStandbys();
+    std::vector<std::string> GetEvictionCandidates() const;
+    void Evict(const std::string &filePath);
+
+private:
+    std::shared_ptr<SharedTranslationUnitStore> m_shared;
+    const size_t m_session;
+    // Files opened by this session, calls for different files come from different threads
+    std::mutex m_mutex;
+    std::unordered_set<std::string> m_opened;
+};
+
+std::shared_ptr<ITranslationUnitStore> SharedTranslationUnitStore::CreateSession()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::make_shared<SessionTranslationUnitStore>(shared_from_this(), ++m_lastSession);
+}
+
+bool SharedTranslationUnitStore::Open(size_t session, const std::string &filePath, const std::string &content)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &file = m_files[filePath];
+    file.sessions.insert(session);
+    if (!file.owner || *file.owner == session)
+    {
+        // Opened again by its owner, the others keep their text until they open it again too
+        file.owner = session;
+        file.inSync = {session};
+        return true;
+    }
+    // The translation unit of the owner serves this session as well, as long as their texts match
+    const auto current = m_store->GetContent(filePath);
+    if (current && *current == content)
+    {
+        file.inSync.insert(session);
+    }
+    else
+    {
+        file.inSync.erase(session);
+        logger()->warn("Session {} opened {} with another text than session {}, it is served the text of the latter",
+                       session, filePath, *file.owner);
+    }
+    return false;
+}
+
+bool SharedTranslationUnitStore::Change(size_t session, const std::string &filePath)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(filePath);
+    if (it == m_files.end())
+    {
+        return false;
+    }
+    auto &file = it->second;
+    if (!file.owner && file.inSync.count(session) > 0)
+    {
+        file.owner = session;
+    }
+    if (file.owner == session)
+    {
+        // The others have not received this change, their next one would be applied to another text
+        file.inSync = {session};
+        return true;
+    }
+    file.inSync.erase(session);
+    logger()->warn("Change of {} from session {} is dropped, the file is edited by session {}",
+                   filePath, session, file.owner ? std::to_string(*file.owner) : "none");
+    return false;
+}
+
+void SharedTranslationUnitStore::Release(size_t session, const std::string &filePath)
+{
+    // The close happens under the lock, so another session cannot reopen the file halfway through it
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_files.find(filePath);
+    if (it == m_files.end())
+    {
+        return;
+    }
+    auto &file = it->second;
+    file.sessions.erase(session);
+    file.inSync.erase(session);
+    if (!file.sessions.empty())
+    {
+        if (file.owner == session)
+        {
+            file.owner = file.inSync.empty() ? std::nullopt : std::optional<size_t>(*file.inSync.begin());
+        }
+        return;
+    }
+    m_files.erase(it);
+    m_store->OnFileClose(filePath);
+}
+
+void SharedTranslationUnitStore::SetTranslationOptions(const std::vector<std::string> &options)
+{
+    // Serialized, every session sends the options of its device on start, only a change reparses the files
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_options == options)
+    {
+        return;
+    }
+    m_options = options;
+    m_store->SetTranslationOptions(options);
+}
+
+void SharedTranslationUnitStore::SetLimits(size_t session, std::optional<TranslationUnitLimits> limits)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (limits)
+    {
+        m_limits[session] = *limits;
+    }
+    else if (m_limits.erase(session) == 0)
+    {
+        return;
+    }
+    // The strictest limit of the sessions applies, 0 means no limit
+    const auto strictest = [](auto current, auto value) {
+        if (value == decltype(value) {})
+        {
+            return current;
+        }
+        return current == decltype(current) {} ? value : std::min(current, value);
+    };
+    TranslationUnitLimits applied;
+    for (const auto &[_, other] : m_limits)
+    {
+        applied.memoryBudget = strictest(applied.memoryBudget, other.memoryBudget);
+        applied.maxTranslationUnits = strictest(applied.maxTranslationUnits, other.maxTranslationUnits);
+        applied.idleTimeout = strictest(applied.idleTimeout, other.idleTimeout);
+    }
+    m_store->SetLimits(applied);
+}
+
+void SessionTranslationUnitStore::OnFileOpen(const std::string &filePath, std::string content)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_opened.insert(filePath);
+    }
+    if (m_shared->Open(m_session, filePath, content))
+    {
+        m_shared->Store().OnFileOpen(filePath, std::move(content));
+    }
+}
+
+void SessionTranslationUnitStore::OnFileChange(const std::string &filePath, std::vector<TextChange> changes)
+{
+    if (m_shared->Change(m_session, filePath))
+    {
+        m_shared->Store().OnFileChange(filePath, std::move(changes));
+    }
+}
+
+void SessionTranslationUnitStore::OnFileClose(const std::string &filePath)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_opened.erase(filePath) == 0)
+        {
+            return;
+        }
+    }
+    m_shared->Release(m_session, filePath);
+}
+
+void SessionTranslationUnitStore::SetTranslationOptions(const std::vector<std::string> &options)
+{
+    m_shared->SetTranslationOptions(options);
+}
+
+void SessionTranslationUnitStore::SaveHeaders()
+{
+    // The headers are shared with the other sessions, they are saved once before the daemon starts
+    logger()->debug("Headers are already saved by the daemon");
+}
+
+void SessionTranslationUnitStore::EnableASTCache(const std::string &, uint64_t)
+{
+    logger()->debug("AST cache is configured by the daemon");
+}
+
+TranslationUnitLease SessionTranslationUnitStore::Lease(const std::string &filePath, LeaseMode mode)
+{
+    return m_shared->Store().Lease(filePath, mode);
+}
+
+bool SessionTranslationUnitStore::IsUpToDate(const std::string &filePath) const
+{
+    return m_shared->Store().IsUpToDate(filePath);
+}
+
+std::shared_ptr<const std::string> SessionTranslationUnitStore::GetContent(const std::string &filePath) const
+{
+    return m_shared->Store().GetContent(filePath);
+}
+
+std::vector<TranslationUnitMemory> SessionTranslationUnitStore::GetMemoryUsage() const
+{
+    // Translation units are shared, so is their memory
+    return m_shared->Store().GetMemoryUsage();
+}
+
+void SessionTranslationUnitStore::SetLimits(const TranslationUnitLimits &limits)
+{
+    m_shared->SetLimits(m_session, limits);
+}
+
+void SessionTranslationUnitStore::ReleaseStandbys()
+{
+    m_shared->Store().ReleaseStandbys();
+}
+
+std::vector<std::string> SessionTranslationUnitStore::GetEvictionCandidates() const
+{
+    return m_shared->Store().GetEvictionCandidates();
+}
+
+void SessionTranslationUnitStore::Evict(const std::string &filePath)
+{
+    m_shared->Store().Evict(filePath);
+}
+
+std::shared_ptr<ISharedTranslationUnitStore> CreateSharedTranslationUnitStore(
+    std::shared_ptr<ITranslationUnitStore> store)
+{
+    return std::make_shared<SharedTranslationUnitStore>(std::move(store));
+}
+
+#if !defined(WIN32)
+
+namespace {
+
+// Size of the block relayed by the proxy in one go
+constexpr size_t RelayBufferSize = 64 * 1024;
+
+bool Relay(int input, int output)
+{
+    const auto sink = CreateDescriptorSink(output);
+    std::vector<char> buffer(RelayBufferSize);
+    while (true)
+    {
+        const auto count = read(input, buffer.data(), buffer.size());
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return count == 0;
+        }
+        if (!sink(std::string_view(buffer.data(), static_cast<size_t>(count))))
+        {
+            return false;
+        }
+    }
+}
+
+std::optional<sockaddr_un> MakeSocketAddress(const std::string &socketPath)
+{
+    sockaddr_un address {};
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    {
+        logger()->error("Invalid socket path '{}'", socketPath);
+        return std::nullopt;
+    }
+    address.sun_family = AF_UNIX;
+    socketPath.copy(address.sun_path, socketPath.size());
+    return address;
+}
+
+/**
+ 'exit' of a daemon session ends the session, the daemon keeps running.
+ The read side of the connection is shut down, so the server sees EOF and flushes what is left to write.
+ */
+class SessionExitHandler final : public utils::IExitHandler
+{
+public:
+    explicit SessionExitHandler(int fd) : m_fd {fd} {}
+
+    void OnExit(int code)
+    {
+        logger()->info("Session on descriptor {} exited with code {}", m_fd, code);
+        shutdown(m_fd, SHUT_RD);
+    }
+
+private:
+    int m_fd;
+};
+
+/**
+ The devices are listed once for all sessions, each of them selects its own.
+ */
+class CachedCLInfo final : public ICLInfo
+{
+public:
+    explicit CachedCLInfo(std::shared_ptr<ICLInfo> clInfo) : m_clInfo {std::move(clInfo)} {}
+
+    nlohmann::json json()
+    {
+        return m_clInfo->json();
+    }
+
+    std::vector<Device> GetDevices()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_devices)
+        {
+            m_devices = m_clInfo->GetDevices();
+        }
+        return *m_devices;
+    }
+
+private:
+    std::shared_ptr<ICLInfo> m_clInfo;
+    std::mutex m_mutex;
+    std::optional<std::vector<Device>> m_devices;
+};
+
+} // namespace
+
+// LSPDaemon
+
+class LSPDaemon final : public ILSPServer
+{
+public:
+    LSPDaemon(
+        std::string socketPath,
+        std::shared_ptr<ITranslationUnitStore> store,
+        std::shared_ptr<ICLInfo> clInfo)
+        : m_socketPath {std::move(socketPath)}
+        , m_store {CreateSharedTranslationUnitStore(std::move(store))}
+        , m_clInfo {std::make_shared<CachedCLInfo>(std::move(clInfo))}
+        , m_scheduler {CreateScheduler()}
+    {
+        if (pipe(m_wakeup) != 0)
+        {
+            logger()->error("Failed to create the wakeup pipe, errno: {}", errno);
+            m_wakeup[0] = m_wakeup[1] = -1;
+        }
+    }
+
+    ~LSPDaemon()
+    {
+        for (auto fd : m_wakeup)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    }
+
+    int Run();
+    void Interrupt();
+
+private:
+    struct Session
+    {
+        int fd = -1;
+        std::shared_ptr<ILSPServer> server;
+        std::thread thread;
+        std::atomic<bool> finished = {false};
+    };
+
+    int Listen();
+    void StartSession(int fd);
+    void ReapSessions(bool all);
+    void Wake();
+
+private:
+    std::string m_socketPath;
+    std::shared_ptr<ISharedTranslationUnitStore> m_store;
+    std::shared_ptr<ICLInfo> m_clInfo;
+    std::shared_ptr<IScheduler> m_scheduler;
+    // Owned by the thread in Run, sessions only raise their 'finished' flag
+    std::list<std::unique_ptr<Session>> m_sessions;
+    size_t m_sessionCount = 0;
+    // Interrupt and finished sessions wake the accept loop up through this pipe
+    int m_wakeup[2] = {-1, -1};
+    std::atomic<bool> m_interrupted = {false};
+};
+
+int LSPDaemon::Run()
+{
+    if (m_wakeup[0] < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    // A client that disconnects in the middle of a write must not kill the daemon
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const int listener = Listen();
+    if (listener < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    m_scheduler->Start({});
+    logger()->info("Listening on '{}'...", m_socketPath);
+
+    while (!m_interrupted.load())
+    {
+        pollfd fds[] = {{listener, POLLIN, 0}, {m_wakeup[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            logger()->error("Failed to poll the socket, errno: {}", errno);
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            [[maybe_unused]] const auto count = read(m_wakeup[0], drain, sizeof(drain));
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            const int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                StartSession(fd);
+            }
+            else if (errno != EINTR && errno != EAGAIN)
+            {
+                logger()->error("Failed to accept a connection, errno: {}", errno);
+            }
+        }
+        ReapSessions(false);
+    }
+
+    logger()->info("Stopping {} session(s)...", m_sessions.size());
+    ReapSessions(true);
+    m_scheduler->Stop();
+    close(listener);
+    unlink(m_socketPath.c_str());
+    return m_interrupted.load() ? 0 : EXIT_FAILURE;
+}
+
+void LSPDaemon::Interrupt()
+{
+    // Called from a signal handler, only async-signal-safe calls here
+    m_interrupted.store(true);
+    Wake();
+}
+
+// private
+
+int LSPDaemon::Listen()
+{
+    const auto address = MakeSocketAddress(m_socketPath);
+    if (!address)
+    {
+        return -1;
+    }
+
+    // A socket left behind by a daemon that did not shut down cleanly is replaced, any other file is kept
+    struct stat info;
+    if (stat(m_socketPath.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+    {
+        unlink(m_socketPath.c_str());
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        logger()->error("Failed to create a socket, errno: {}", errno);
+        return -1;
+    }
+    if (bind(fd, reinterpret_cast<const sockaddr *>(&*address), sizeof(*address)) != 0 ||
+        listen(fd, SOMAXCONN) != 0)
+    {
+        logger()->error("Failed to listen on '{}', errno: {}", m_socketPath, errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void LSPDaemon::StartSession(int fd)
+{
+    const auto id = ++m_sessionCount;
+    logger()->info("Session {} connected on descriptor {}", id, fd);
+
+    auto jrpc = CreateJsonRPC();
+    auto store = m_store->CreateSession();
+    auto scheduler = CreateScopedScheduler(m_scheduler, "session-" + std::to_string(id) + ":");
+    // The diagnostics settings are the ones of the client, the translation units are shared through the store
+    auto handler = CreateLSPEventsHandler(
+        jrpc,
+        store,
+        CreateDiagnostics(m_clInfo),
+        CreateCompletion(store),
+        CreateDefinition(store),
+        CreateTypeDefinition(store),
+        CreateDeclaration(store),
+        utils::CreateDefaultGenerator(),
+        std::make_shared<SessionExitHandler>(fd),
+        scheduler);
+
+    auto session = std::make_unique<Session>();
+    session->fd = fd;
+    session->server = CreateLSPServer(
+        std::move(jrpc),
+        std::move(store),
+        std::move(handler),
+        std::move(scheduler),
+        LSPTransport {fd, CreateDescriptorSink(fd)});
+    session->thread = std::thread([this, current = session.get(), id]() {
+        const auto result = current->server->Run();
+        logger()->info("Session {} finished with {}", id, result);
+        current->finished.store(true);
+        Wake();
+    });
+    m_sessions.push_back(std::move(session));
+}
+
+void LSPDaemon::ReapSessions(bool all)
+{
+    for (auto it = m_sessions.begin(); it != m_sessions.end();)
+    {
+        auto &session = **it;
+        if (!all && !session.finished.load())
+        {
+            ++it;
+            continue;
+        }
+        if (!session.finished.load())
+        {
+            session.server->Interrupt();
+            // Unblocks the read of the session
+            shutdown(session.fd, SHUT_RDWR);
+        }
+        session.thread.join();
+        // Releases the documents the session left open
+        session.server.reset();
+        close(session.fd);
+        it = m_sessions.erase(it);
+    }
+}
+
+void LSPDaemon::Wake()
+{
+    if (m_wakeup[1] >= 0)
+    {
+        const char signal = 1;
+        [[maybe_unused]] const auto count = write(m_wakeup[1], &signal, 1);
+    }
+}
+
+// LSPProxy
+
+class LSPProxy final : public ILSPServer
+{
+public:
+    explicit LSPProxy(std::string socketPath) : m_socketPath {std::move(socketPath)} {}
+
+    int Run();
+    void Interrupt();
+
+private:
+    std::string m_socketPath;
+    std::atomic<int> m_fd = {-1};
+};
+
+int LSPProxy::Run()
+{
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const auto address = MakeSocketAddress(m_socketPath);
+    if (!address)
+    {
+        return EXIT_FAILURE;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr *>(&*address), sizeof(*address)) != 0)
+    {
+        logger()->error("Failed to connect to '{}', errno: {}", m_socketPath, errno);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    m_fd.store(fd);
+    logger()->info("Connected to '{}'", m_socketPath);
+
+    // Reading stdin cannot be interrupted, so the upstream thread is left to the process exit
+    // and the descriptor is kept open for it
+    std::thread([fd]() {
+        Relay(STDIN_FILENO, fd);
+        shutdown(fd, SHUT_WR);
+    }).detach();
+    const bool completed = Relay(fd, STDOUT_FILENO);
+    shutdown(fd, SHUT_RDWR);
+    logger()->info("Disconnected from '{}'", m_socketPath);
+    return completed ? 0 : EXIT_FAILURE;
+}
+
+void LSPProxy::Interrupt()
+{
+    const int fd = m_fd.load();
+    if (fd >= 0)
+    {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+#else
+
+namespace {
+
+class UnsupportedServer final : public ILSPServer
+{
+public:
+    int Run()
+    {
+        logger()->error("Unix domain socket transport is not supported on this platform");
+        return EXIT_FAILURE;
+    }
+
+    void Interrupt() {}
+};
+
+} // namespace
+
+#endif
+
+std::shared_ptr<ILSPServer> CreateLSPDaemon(
+    std::string socketPath,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ICLInfo> clInfo)
+{
+#if defined(WIN32)
+    return std::make_shared<UnsupportedServer>();
+#else
+    return std::make_shared<LSPDaemon>(
+        std::move(socketPath),
+        std::move(store),
+        std::move(clInfo));
+#endif
+}
+
+std::shared_ptr<ILSPServer> CreateLSPProxy(std::string socketPath)
+{
+#if defined(WIN32)
+    return std::make_shared<UnsupportedServer>();
+#else
+    return std::make_shared<LSPProxy>(std::move(socketPath));
+#endif
+}
+
+} // namespace ocls
@@ -12,9 +12,9 @@
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::declaration);
+    return ocls::Loggers::declaration;
 }
 
 } // namespace
@@ -26,23 +26,40 @@ class Declaration final : public IDeclaration
 public:
     explicit Declaration(std::shared_ptr<ITranslationUnitStore> store) : m_store(std::move(store)) {}
 
-    std::vector<Location> GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno) override;
+    LocationResult GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno) override;
 
 private:
+    std::vector<Location> GetDeclarations(
+        const TranslationUnitLease &lease, const std::string &filePath, unsigned lineno, unsigned columnno);
+
     std::shared_ptr<ITranslationUnitStore> m_store;
 };
 
-std::vector<Location> Declaration::GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno)
+LocationResult Declaration::GetDeclarations(const std::string &filePath, unsigned lineno, unsigned columnno)
 {
     logger()->debug("Get declaration for {}:{}:{}", filePath, lineno, columnno);
 
-    CXTranslationUnit translationUnit = m_store->GetTranslationUnit(filePath);
+    const auto lease = m_store->Lease(filePath, LeaseMode::shared);
+    return {GetDeclarations(lease, filePath, lineno, columnno), lease.IsUpToDate()};
+}
+
+std::vector<Location> Declaration::GetDeclarations(
+    const TranslationUnitLease &lease, const std::string &filePath, unsigned lineno, unsigned columnno)
+{
+    CXTranslationUnit translationUnit = lease.TranslationUnit();
     if (!translationUnit)
     {
         logger()->error("No translation unit for {}", filePath);
         return {};
     }
 
+    // The unit may be older than the text the position refers to
+    if (!lease.MapPosition(lineno, columnno))
+    {
+        logger()->debug("{}:{}:{} was changed after the served revision", filePath, lineno, columnno);
+        return {};
+    }
+
     CXFile file = clang_getFile(translationUnit, filePath.c_str());
     if (!file)
     {
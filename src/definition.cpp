@@ -7,6 +7,7 @@
 
 #include "definition.hpp"
 #include "log.hpp"
+#include "tracing.hpp"
 
 #include <clang-c/Index.h>
 #include <cstring>
@@ -15,20 +16,25 @@
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::definition);
+    return ocls::Loggers::definition;
 }
 
 struct VisitorContext
 {
     CXCursor target;
     std::vector<CXCursor> *results;
+    const ocls::CancellationToken *token;
 };
 
 CXChildVisitResult visitForDefinitions(CXCursor cursor, CXCursor /*parent*/, CXClientData clientData)
 {
     auto *ctx = static_cast<VisitorContext *>(clientData);
+    if (ctx->token->IsCancelled())
+    {
+        return CXChildVisit_Break;
+    }
     if (clang_isCursorDefinition(cursor))
     {
         // Compare canonical cursors so a definition matches its
@@ -53,38 +59,65 @@ class Definition final : public IDefinition
 public:
     explicit Definition(std::shared_ptr<ITranslationUnitStore> store) : m_store(std::move(store)) {}
 
-    std::vector<Location> GetDefinitions(
-        const std::string &filePath, unsigned lineno, unsigned columnno) override;
+    LocationResult GetDefinitions(
+        const std::string &filePath, unsigned lineno, unsigned columnno, const CancellationToken &token) override;
 
 private:
-    std::vector<CXCursor> FindDefinitions(CXTranslationUnit tu, CXCursor target);
+    std::vector<Location> GetDefinitions(
+        const TranslationUnitLease &lease,
+        const std::string &filePath,
+        unsigned lineno,
+        unsigned columnno,
+        const CancellationToken &token);
+    std::vector<CXCursor> FindDefinitions(CXTranslationUnit tu, CXCursor target, const CancellationToken &token);
 
 private:
     std::shared_ptr<ITranslationUnitStore> m_store;
 };
 
-std::vector<CXCursor> Definition::FindDefinitions(CXTranslationUnit tu, CXCursor target)
+std::vector<CXCursor> Definition::FindDefinitions(
+    CXTranslationUnit tu, CXCursor target, const CancellationToken &token)
 {
     std::vector<CXCursor> results;
-    VisitorContext ctx {target, &results};
+    VisitorContext ctx {target, &results, &token};
 
+    TraceSpan span("clang_visitChildren", "libclang");
     CXCursor root = clang_getTranslationUnitCursor(tu);
     clang_visitChildren(root, visitForDefinitions, &ctx);
 
     return results;
 }
 
-std::vector<Location> Definition::GetDefinitions(
-    const std::string &filePath, unsigned lineno, unsigned columnno)
+LocationResult Definition::GetDefinitions(
+    const std::string &filePath, unsigned lineno, unsigned columnno, const CancellationToken &token)
 {
     logger()->debug("Get definitions for {}:{}:{}", filePath, lineno, columnno);
 
-    CXTranslationUnit translationUnit = m_store->GetTranslationUnit(filePath);
+    // Holds the revision for the whole query, a newer one may be swapped in meanwhile
+    const auto lease = m_store->Lease(filePath, LeaseMode::shared);
+    return {GetDefinitions(lease, filePath, lineno, columnno, token), lease.IsUpToDate()};
+}
+
+std::vector<Location> Definition::GetDefinitions(
+    const TranslationUnitLease &lease,
+    const std::string &filePath,
+    unsigned lineno,
+    unsigned columnno,
+    const CancellationToken &token)
+{
+    CXTranslationUnit translationUnit = lease.TranslationUnit();
     if (!translationUnit)
     {
         logger()->error("No translation unit for {}", filePath);
         return {};
     }
+
+    // The unit may be older than the text the position refers to
+    if (!lease.MapPosition(lineno, columnno))
+    {
+        logger()->debug("{}:{}:{} was changed after the served revision", filePath, lineno, columnno);
+        return {};
+    }
     CXFile file = clang_getFile(translationUnit, filePath.c_str());
     if (!file)
     {
@@ -92,8 +125,12 @@ std::vector<Location> Definition::GetDefinitions(
         return {};
     }
 
-    CXSourceLocation loc = clang_getLocation(translationUnit, file, lineno, columnno);
-    CXCursor cursor = clang_getCursor(translationUnit, loc);
+    CXCursor cursor;
+    {
+        TraceSpan span("clang_getCursor", "libclang");
+        CXSourceLocation loc = clang_getLocation(translationUnit, file, lineno, columnno);
+        cursor = clang_getCursor(translationUnit, loc);
+    }
     if (clang_Cursor_isNull(cursor))
     {
         logger()->debug("No cursor found at {}:{}:{}", filePath, lineno, columnno);
@@ -101,7 +138,11 @@ std::vector<Location> Definition::GetDefinitions(
     }
 
     // If we're sitting on a reference/use, resolve to the declaration first.
-    CXCursor declCursor = clang_getCursorReferenced(cursor);
+    CXCursor declCursor;
+    {
+        TraceSpan span("clang_getCursorReferenced", "libclang");
+        declCursor = clang_getCursorReferenced(cursor);
+    }
     if (clang_Cursor_isNull(declCursor))
     {
         declCursor = cursor;
@@ -116,7 +157,13 @@ std::vector<Location> Definition::GetDefinitions(
     }
     else
     {
-        implCursors = FindDefinitions(translationUnit, declCursor);
+        implCursors = FindDefinitions(translationUnit, declCursor, token);
+    }
+
+    if (token.IsCancelled())
+    {
+        logger()->debug("Definitions lookup for {}:{}:{} is cancelled", filePath, lineno, columnno);
+        return {};
     }
 
     std::vector<Location> locations;
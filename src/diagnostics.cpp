@@ -8,6 +8,8 @@
 #include "device.hpp"
 #include "diagnostics.hpp"
 #include "log.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
 #include <filesystem>
@@ -20,9 +22,9 @@ using namespace nlohmann;
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::diagnostics);
+    return ocls::Loggers::diagnostics;
 }
 
 constexpr char clstdBuildOption[] = "-cl-std";
@@ -31,6 +33,16 @@ constexpr char clstdBuildOption[] = "-cl-std";
 
 namespace ocls {
 
+nlohmann::json ToJson(const std::vector<Diagnostic>& diagnostics)
+{
+    nlohmann::json result = nlohmann::json::array();
+    for (const auto& diagnostic : diagnostics)
+    {
+        result.emplace_back(diagnostic.toJson());
+    }
+    return result;
+}
+
 // - DiagnosticsParser
 
 class DiagnosticsParser final : public IDiagnosticsParser
@@ -68,19 +80,15 @@ public:
         return std::make_tuple(std::move(source), line, col, severity, std::move(message));
     }
 
-    nlohmann::json CreateDiagnostic(const std::smatch& matches, const std::string& name)
+    Diagnostic CreateDiagnostic(const std::smatch& matches, const std::string& name)
     {
         auto [source, line, col, severity, message] = ParseMatch(matches);
-        return {
-            {"source", name.empty() ? source : name},
-            {"range", {{"start", {{"line", line}, {"character", col}}}, {"end", {{"line", line}, {"character", col}}}}},
-            {"severity", severity},
-            {"message", message}};
+        return {name.empty() ? std::move(source) : name, line, col, severity, std::move(message)};
     }
 
-    nlohmann::json ParseDiagnostics(const std::string& buildLog, const std::string& name, uint64_t problemsLimit)
+    std::vector<Diagnostic> ParseDiagnostics(const std::string& buildLog, const std::string& name, uint64_t problemsLimit)
     {
-        nlohmann::json diagnostics = nlohmann::json::array();
+        std::vector<Diagnostic> diagnostics;
         std::istringstream stream(buildLog);
         std::string errLine;
         uint64_t count = 0;
@@ -119,7 +127,7 @@ public:
     void SetOpenCLDevice(uint32_t identifier);
     std::optional<ocls::Device> GetDevice() const;
     std::string GetBuildLog(const Source& source);
-    nlohmann::json GetDiagnostics(const Source& source);
+    std::vector<Diagnostic> GetDiagnostics(const Source& source, const CancellationToken& token);
 
 private:
     std::optional<ocls::Device> SelectOpenCLDevice(const std::vector<ocls::Device>& devices, uint32_t identifier);
@@ -140,7 +148,7 @@ Diagnostics::Diagnostics(std::shared_ptr<ICLInfo> clInfo, std::shared_ptr<IDiagn
 {
     SetOpenCLDevice(0);
     SetBuildOptions(std::string());
-    logger()->trace("Initialized");
+    SPDLOG_LOGGER_TRACE(logger(), "Initialized");
 }
 
 // - IDiagnostics
@@ -161,14 +169,14 @@ void Diagnostics::SetBuildOptions(const json& options)
 
 void Diagnostics::SetBuildOptions(const std::string& options)
 {
-    logger()->trace("Set build options: {}", options);
+    SPDLOG_LOGGER_TRACE(logger(), "Set build options: {}", options);
     m_buildOptions = options;
     if (m_buildOptions.empty() || m_buildOptions.find(clstdBuildOption) == std::string::npos)
     {
         if (m_device.has_value())
         {
             auto clstd = m_device->GetCLStandard();
-            logger()->trace("Adding build option {}={}", clstdBuildOption, clstd);
+            SPDLOG_LOGGER_TRACE(logger(), "Adding build option {}={}", clstdBuildOption, clstd);
             if(!m_buildOptions.empty()) {
                 m_buildOptions.append(" ");
             }
@@ -179,13 +187,13 @@ void Diagnostics::SetBuildOptions(const std::string& options)
 
 void Diagnostics::SetMaxProblemsCount(uint64_t maxNumberOfProblems)
 {
-    logger()->trace("Set max number of problems: {}", maxNumberOfProblems);
+    SPDLOG_LOGGER_TRACE(logger(), "Set max number of problems: {}", maxNumberOfProblems);
     m_maxNumberOfProblems = maxNumberOfProblems;
 }
 
 void Diagnostics::SetOpenCLDevice(uint32_t identifier)
 {
-    logger()->trace("Selecting OpenCL device [{}]...", identifier);
+    SPDLOG_LOGGER_TRACE(logger(), "Selecting OpenCL device [{}]...", identifier);
 
     const auto devices = m_clInfo->GetDevices();
 
@@ -215,19 +223,29 @@ std::string Diagnostics::GetBuildLog(const Source& source)
     {
         throw std::runtime_error("missing OpenCL device");
     }
-    logger()->trace("Getting diagnostics...");
+    SPDLOG_LOGGER_TRACE(logger(), "Getting diagnostics...");
     return BuildSource(source.text);
 }
 
-nlohmann::json Diagnostics::GetDiagnostics(const Source& source)
+std::vector<Diagnostic> Diagnostics::GetDiagnostics(const Source& source, const CancellationToken& token)
 {
+    if (token.IsCancelled())
+    {
+        return {};
+    }
+
     std::string srcName;
     if (!source.filePath.empty())
     {
         srcName = std::filesystem::path(source.filePath).filename().string();
     }
     std::string buildLog = GetBuildLog(source);
-    logger()->trace("BuildLog:\n{}", buildLog);
+    if (token.IsCancelled())
+    {
+        logger()->debug("Diagnostics for '{}' are cancelled", srcName);
+        return {};
+    }
+    SPDLOG_LOGGER_TRACE(logger(), "BuildLog:\n{}", buildLog);
     return m_parser->ParseDiagnostics(buildLog, srcName, m_maxNumberOfProblems);
 }
 
@@ -252,7 +270,7 @@ std::optional<ocls::Device> Diagnostics::SelectOpenCLDevice(
 {
     if (identifier > 0)
     {
-        logger()->trace("Searching for the device by ID '{}'...", identifier);
+        SPDLOG_LOGGER_TRACE(logger(), "Searching for the device by ID '{}'...", identifier);
         auto it = std::find_if(devices.begin(), devices.end(), [&identifier](const ocls::Device& device) {
             try
             {
@@ -271,7 +289,7 @@ std::optional<ocls::Device> Diagnostics::SelectOpenCLDevice(
     }
 
     // If device is not found by identifier, then find the device based on power index
-    logger()->trace("Searching for the device by power index...");
+    SPDLOG_LOGGER_TRACE(logger(), "Searching for the device by power index...");
     auto device = SelectOpenCLDeviceByPowerIndex(devices);
     if (device && (!m_device || (*device).GetPowerIndex() > (*m_device).GetPowerIndex()))
     {
@@ -288,6 +306,7 @@ std::string Diagnostics::BuildSource(const std::string& source) const
         throw std::runtime_error("missing OpenCL device");
     }
 
+    TraceSpan span("BuildSource", "opencl");
     std::vector<cl::Device> ds {(*m_device).getUnderlyingDevice()};
     cl::Context context(ds, nullptr, nullptr, nullptr);
     cl::Program program;
@@ -298,6 +317,8 @@ std::string Diagnostics::BuildSource(const std::string& source) const
         // preamble injected before this point is invisible to error reporting
         std::string patchedSource = "#line 1\n" + source;
         program = cl::Program(context, patchedSource, false);
+        LatencyTimer timer(&GetStatistics().Of(Probe::buildProgram));
+        TraceSpan buildSpan("clBuildProgram", "opencl");
         program.build(ds, m_buildOptions.c_str());
     }
     catch (cl::Error& err)
@@ -0,0 +1,248 @@
+//
+//  document.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "document.hpp"
+
+#include <algorithm>
+
+namespace ocls {
+
+// Buffer
+
+void Document::Buffer::Assign(std::string value)
+{
+    text = std::move(value);
+    newlines.clear();
+    for (auto pos = text.find('\n'); pos != std::string::npos; pos = text.find('\n', pos + 1))
+    {
+        newlines.push_back(pos);
+    }
+}
+
+void Document::Buffer::Append(std::string_view value)
+{
+    const auto base = text.size();
+    text.append(value);
+    for (auto pos = value.find('\n'); pos != std::string_view::npos; pos = value.find('\n', pos + 1))
+    {
+        newlines.push_back(base + pos);
+    }
+}
+
+size_t Document::Buffer::CountNewlines(size_t begin, size_t end) const
+{
+    const auto first = std::lower_bound(newlines.begin(), newlines.end(), begin);
+    const auto last = std::lower_bound(first, newlines.end(), end);
+    return static_cast<size_t>(last - first);
+}
+
+// Document
+
+Document::Document(std::string text)
+{
+    Reset(std::move(text));
+}
+
+void Document::Apply(const TextChange &change)
+{
+    if (!change.range)
+    {
+        Reset(change.text);
+        return;
+    }
+
+    const auto begin = OffsetAt(change.range->start);
+    const auto end = std::max(begin, OffsetAt(change.range->end));
+    Replace(begin, end, change.text);
+}
+
+const std::string &Document::Materialize()
+{
+    if (!Contiguous())
+    {
+        Reset(Text());
+    }
+    return m_original.text;
+}
+
+const std::string *Document::Contiguous() const
+{
+    if (m_pieces.empty())
+    {
+        return m_original.text.empty() ? &m_original.text : nullptr;
+    }
+    const auto &piece = m_pieces.front();
+    const bool isOriginal = m_pieces.size() == 1 && piece.source == Source::original && piece.offset == 0 &&
+                            piece.length == m_original.text.size();
+    return isOriginal ? &m_original.text : nullptr;
+}
+
+std::string Document::Text() const
+{
+    std::string text;
+    text.reserve(m_size);
+    for (const auto &piece : m_pieces)
+    {
+        text.append(View(piece));
+    }
+    return text;
+}
+
+size_t Document::Size() const
+{
+    return m_size;
+}
+
+size_t Document::PieceCount() const
+{
+    return m_pieces.size();
+}
+
+size_t Document::OffsetAt(const TextPosition &position) const
+{
+    // Find the piece the line starts in using the newline index
+    size_t pieceStart = 0;
+    size_t inPiece = 0;
+    size_t index = 0;
+    size_t line = 0;
+    for (; index < m_pieces.size(); ++index)
+    {
+        const auto &piece = m_pieces[index];
+        const auto &buffer = BufferOf(piece);
+        const auto count = buffer.CountNewlines(piece.offset, piece.offset + piece.length);
+        if (line + count >= position.line)
+        {
+            if (line < position.line)
+            {
+                const auto first = std::lower_bound(buffer.newlines.begin(), buffer.newlines.end(), piece.offset);
+                const auto newline = *(first + static_cast<std::ptrdiff_t>(position.line - line - 1));
+                inPiece = newline + 1 - piece.offset;
+            }
+            break;
+        }
+        line += count;
+        pieceStart += piece.length;
+    }
+
+    // Walk the line counting UTF-16 code units, a character outside of the BMP takes two of them
+    size_t units = 0;
+    for (; index < m_pieces.size(); ++index, inPiece = 0)
+    {
+        const auto view = View(m_pieces[index]);
+        for (; inPiece < view.size(); ++inPiece)
+        {
+            const auto c = static_cast<unsigned char>(view[inPiece]);
+            if ((c & 0xC0) == 0x80)
+            {
+                // UTF-8 continuation byte
+                continue;
+            }
+            if (units >= position.character || c == '\n' || c == '\r')
+            {
+                return pieceStart + inPiece;
+            }
+            units += c >= 0xF0 ? 2 : 1;
+        }
+        pieceStart += view.size();
+    }
+    return m_size;
+}
+
+// private
+
+const Document::Buffer &Document::BufferOf(const Piece &piece) const
+{
+    return piece.source == Source::original ? m_original : m_added;
+}
+
+std::string_view Document::View(const Piece &piece) const
+{
+    return std::string_view(BufferOf(piece).text).substr(piece.offset, piece.length);
+}
+
+void Document::Replace(size_t begin, size_t end, std::string_view text)
+{
+    std::optional<Piece> insertion;
+    if (!text.empty())
+    {
+        insertion = Piece {Source::added, m_added.text.size(), text.size()};
+        m_added.Append(text);
+    }
+
+    std::vector<Piece> pieces;
+    pieces.reserve(m_pieces.size() + 2);
+    const auto push = [&pieces](const Piece &piece) {
+        if (piece.length == 0)
+        {
+            return;
+        }
+        // Typing appends to the end of the added buffer, extend the previous piece instead of adding a new one
+        if (!pieces.empty())
+        {
+            auto &last = pieces.back();
+            if (last.source == piece.source && last.offset + last.length == piece.offset)
+            {
+                last.length += piece.length;
+                return;
+            }
+        }
+        pieces.push_back(piece);
+    };
+    const auto insert = [&]() {
+        if (insertion)
+        {
+            push(*insertion);
+            insertion.reset();
+        }
+    };
+
+    size_t pos = 0;
+    for (const auto &piece : m_pieces)
+    {
+        const auto pieceEnd = pos + piece.length;
+        if (pieceEnd <= begin)
+        {
+            push(piece);
+        }
+        else if (pos >= end)
+        {
+            insert();
+            push(piece);
+        }
+        else
+        {
+            if (pos < begin)
+            {
+                push(Piece {piece.source, piece.offset, begin - pos});
+            }
+            insert();
+            if (pieceEnd > end)
+            {
+                push(Piece {piece.source, piece.offset + (end - pos), pieceEnd - end});
+            }
+        }
+        pos = pieceEnd;
+    }
+    insert();
+
+    m_pieces = std::move(pieces);
+    m_size = m_size - (end - begin) + text.size();
+}
+
+void Document::Reset(std::string text)
+{
+    m_size = text.size();
+    m_original.Assign(std::move(text));
+    m_added = {};
+    m_pieces.clear();
+    if (m_size > 0)
+    {
+        m_pieces.push_back(Piece {Source::original, 0, m_size});
+    }
+}
+
+} // namespace ocls
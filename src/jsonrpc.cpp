@@ -7,12 +7,17 @@
 
 #include "jsonrpc.hpp"
 #include "log.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
+#include <charconv>
+#include <chrono>
 #include <iostream>
-#include <regex>
-#include <sstream>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using namespace nlohmann;
 
@@ -20,9 +25,63 @@ namespace ocls {
 
 namespace {
 
-auto logger() { return spdlog::get(ocls::LogName::jrpc); }
+const auto& logger() { return ocls::Loggers::jrpc; }
 
 constexpr char LE[] = "\r\n";
+constexpr char ContentLengthHeader[] = "Content-Length";
+
+// Removes leading and trailing spaces/tabs from a header token
+std::string_view TrimHeaderToken(std::string_view token)
+{
+    const auto first = token.find_first_not_of(" \t");
+    if (first == std::string_view::npos)
+    {
+        return {};
+    }
+    const auto last = token.find_last_not_of(" \t");
+    return token.substr(first, last - first + 1);
+}
+
+// Joins the serialized responds of a batch into a single array body
+SerializedMessage JoinBatchResponds(const std::vector<std::string>& responds)
+{
+    size_t size = 2 + responds.size();
+    for (const auto& respond : responds)
+    {
+        size += respond.size();
+    }
+    std::string body;
+    body.reserve(size);
+    body.push_back('[');
+    for (const auto& respond : responds)
+    {
+        if (body.size() > 1)
+        {
+            body.push_back(',');
+        }
+        body.append(respond);
+    }
+    body.push_back(']');
+    return {std::move(body)};
+}
+
+// Document the message refers to, the spans of the message are tagged with it
+std::string ExtractUri(const JRPCMessage& message)
+{
+    if (!message.HasMethod())
+    {
+        return {};
+    }
+    try
+    {
+        auto uri = message.ExtractString({"textDocument", "uri"});
+        return uri ? std::move(*uri) : std::string();
+    }
+    catch (std::exception&)
+    {
+        return {};
+    }
+}
 
 } // namespace
 
@@ -40,6 +99,10 @@ public:
      All unregistered notifications will be responded with MethodNotFound automatically.
      */
     void RegisterMethodCallback(const std::string& method, InputCallbackFunc&& func);
+    /**
+     Register dispatcher to be consulted before the method callbacks.
+     */
+    void RegisterDispatcher(DispatchFunc&& func);
     /**
      Register callback to be notified on client responds to server (our) requests.
      */
@@ -49,10 +112,19 @@ public:
      Basically it should be redirected to the stdout.
      */
     void RegisterOutputCallback(OutputCallbackFunc&& func);
+    /**
+     Register asynchronous writer to deliver messages to the client.
+     */
+    void RegisterOutputWriter(std::shared_ptr<IMessageWriter> writer);
+    /**
+     Register recorder to capture the bodies of every inbound and outbound message.
+     */
+    void RegisterRecorder(std::shared_ptr<ISessionRecorder> recorder);
 
-    void Consume(char c);
+    size_t Consume(std::string_view data);
     bool IsReady() const;
-    void Write(const nlohmann::json& data) const;
+    void Write(nlohmann::json data) const;
+    void Write(SerializedMessage message) const;
     void Reset();
     /**
      Send trace message to client.
@@ -61,68 +133,123 @@ public:
     void WriteError(JRPCErrorCode errorCode, const std::string& message) const;
 
 private:
-    void ProcessBufferContent();
-    void ProcessMethod();
-    void ProcessBufferHeader();
-
-    void OnInitialize();
-    void OnTracingChanged(const nlohmann::json& data);
-    bool ReadHeader();
-    void FireMethodCallback();
-    void FireRespondCallback();
-
-    void LogBufferContent() const;
-    void LogMessage(const std::string& message) const;
-    void LogAndHandleParseError(std::exception& e);
+    enum class FrameState
+    {
+        header, ///< Reading header lines until an empty line
+        content ///< Reading exactly m_contentLength bytes of the body
+    };
+
+    /**
+     Responds to the requests of a batch, written as a single message once every request is responded.
+     */
+    struct Batch
+    {
+        // Serialized ids of the requests waiting for a respond
+        std::unordered_set<std::string> pending;
+        std::vector<std::string> responds;
+        // Set while the items are being dispatched, the batch cannot complete before that
+        bool dispatching = true;
+    };
+
+    size_t ConsumeHeader(std::string_view data);
+    size_t ConsumeContent(std::string_view data);
+    void ProcessHeaderLine();
+    void ProcessBufferContent(std::string_view content);
+    void ProcessBatch(std::string_view content);
+    void ProcessMessage(const JRPCMessage& message);
+    void ProcessMethod(const JRPCMessage& message);
+    bool HasOpenBatches() const;
+    bool CollectBatchRespond(const nlohmann::json& id, std::string& body) const;
+    void ReleaseBatchRequest(const nlohmann::json& id);
+    void Deliver(SerializedMessage message) const;
+
+    void OnInitialize(const JRPCMessage& message);
+    void OnTracingChanged(const JRPCMessage& message);
+    void OnCancelRequest(const JRPCMessage& message);
+    void FireMethodCallback(const JRPCMessage& message);
+    void FireRespondCallback(const JRPCMessage& message);
+
+    void LogBufferContent(std::string_view content) const;
+    void LogMessage(const nlohmann::json& message) const;
+    void LogMessage(std::string_view message) const;
+    void LogAndHandleParseError(std::exception& e, std::string_view content);
     void LogAndHandleUnexpectedMessage();
 
 private:
     std::string m_method;
+    // Holds the body only when it arrives split across several chunks
     std::string m_buffer;
-    nlohmann::json m_body;
+    std::string m_headerLine;
     std::unordered_map<std::string, std::string> m_headers;
     std::unordered_map<std::string, InputCallbackFunc> m_callbacks;
+    DispatchFunc m_dispatcher;
     OutputCallbackFunc m_outputCallback;
+    std::shared_ptr<IMessageWriter> m_writer;
+    std::shared_ptr<ISessionRecorder> m_recorder;
     InputCallbackFunc m_respondCallback;
+    // Id of the request being dispatched, errors reported during the dispatch refer to it.
+    // Only the reading thread touches it, see WriteError
+    nlohmann::json m_currentId;
+    // Arrival of the first header byte of the current message, set only while tracing
+    Tracer::Clock::time_point m_frameStart;
+    // Responds are written from the scheduler threads, the batches they belong to are looked up under the mutex
+    mutable std::mutex m_batchMutex;
+    mutable std::unordered_map<std::string, std::shared_ptr<Batch>> m_batchRequests;
+    // Batch being dispatched, it collects the errors that have no id
+    std::shared_ptr<Batch> m_currentBatch;
+    FrameState m_state = FrameState::header;
     bool m_isProcessing = true;
     bool m_initialized = false;
-    bool m_validHeader = false;
     bool m_tracing = false;
     bool m_verbosity = false;
-    unsigned long m_contentLength = 0;
-    std::regex m_headerRegex {"([\\w-]+): (.+)\\r\\n(?:([^:]+)\\r\\n)?"};
+    size_t m_contentLength = 0;
 };
 
 void JsonRPC::RegisterMethodCallback(const std::string& method, InputCallbackFunc&& func)
 {
-    logger()->trace("Set callback for method: {}", method);
+    SPDLOG_LOGGER_TRACE(logger(), "Set callback for method: {}", method);
     m_callbacks[method] = std::move(func);
 }
 
+void JsonRPC::RegisterDispatcher(DispatchFunc&& func)
+{
+    SPDLOG_LOGGER_TRACE(logger(), "Set method dispatcher");
+    m_dispatcher = std::move(func);
+}
+
 void JsonRPC::RegisterInputCallback(InputCallbackFunc&& func)
 {
-    logger()->trace("Set callback for client responds");
+    SPDLOG_LOGGER_TRACE(logger(), "Set callback for client responds");
     m_respondCallback = std::move(func);
 }
 
 void JsonRPC::RegisterOutputCallback(OutputCallbackFunc&& func)
 {
-    logger()->trace("Set output callback");
+    SPDLOG_LOGGER_TRACE(logger(), "Set output callback");
     m_outputCallback = std::move(func);
 }
 
-void JsonRPC::Consume(char c)
+void JsonRPC::RegisterOutputWriter(std::shared_ptr<IMessageWriter> writer)
 {
-    m_buffer += c;
+    SPDLOG_LOGGER_TRACE(logger(), "Set output writer");
+    m_writer = std::move(writer);
+}
 
-    if (m_validHeader)
-    {
-        ProcessBufferContent();
-    }
-    else
+void JsonRPC::RegisterRecorder(std::shared_ptr<ISessionRecorder> recorder)
+{
+    SPDLOG_LOGGER_TRACE(logger(), "Set session recorder");
+    m_recorder = std::move(recorder);
+}
+
+size_t JsonRPC::Consume(std::string_view data)
+{
+    size_t consumed = 0;
+    while (consumed < data.size() && m_isProcessing)
     {
-        ProcessBufferHeader();
+        const auto rest = data.substr(consumed);
+        consumed += m_state == FrameState::header ? ConsumeHeader(rest) : ConsumeContent(rest);
     }
+    return consumed;
 }
 
 bool JsonRPC::IsReady() const
@@ -130,23 +257,36 @@ bool JsonRPC::IsReady() const
     return !m_isProcessing;
 }
 
-void JsonRPC::Write(const json& data) const
+void JsonRPC::Write(json data) const
 {
-    assert(m_outputCallback);
+    assert(m_writer || m_outputCallback);
+
+    data.emplace("jsonrpc", "2.0");
+    if (!data.contains("method") && HasOpenBatches())
+    {
+        auto body = data.dump();
+        const auto id = data.find("id");
+        if (CollectBatchRespond(id == data.end() ? json() : *id, body))
+        {
+            return;
+        }
+    }
+    LogMessage(data);
+    if (m_recorder)
+    {
+        m_recorder->Record(RecordDirection::outbound, data.dump());
+    }
+    if (m_writer)
+    {
+        m_writer->Push(std::move(data));
+        return;
+    }
 
     std::string message;
     try
     {
-        json body = data;
-        body.emplace("jsonrpc", "2.0");
-        std::string content = body.dump();
-        message.append(std::string("Content-Length: ") + std::to_string(content.size()) + LE);
-        message.append(std::string("Content-Type: application/vscode-jsonrpc;charset=utf-8") + LE);
-        message.append(LE);
-        message.append(content);
-
-        LogMessage(message);
-
+        std::string content;
+        AppendFramedMessage(data, content, message);
         m_outputCallback(message);
     }
     catch (std::exception& err)
@@ -155,13 +295,29 @@ void JsonRPC::Write(const json& data) const
     }
 }
 
+void JsonRPC::Write(SerializedMessage message) const
+{
+    assert(m_writer || m_outputCallback);
+
+    if (HasOpenBatches())
+    {
+        // The body is scanned only while a batch waits for its responds
+        const auto parsed = JRPCMessage::FromView(message.body);
+        if (!parsed.HasMethod() && CollectBatchRespond(parsed.Id(), message.body))
+        {
+            return;
+        }
+    }
+    Deliver(std::move(message));
+}
+
 void JsonRPC::Reset()
 {
     m_method = std::string();
     m_buffer.clear();
-    m_body.clear();
+    m_headerLine.clear();
     m_headers.clear();
-    m_validHeader = false;
+    m_state = FrameState::header;
     m_contentLength = 0;
     m_isProcessing = true;
 }
@@ -171,14 +327,14 @@ void JsonRPC::WriteTrace(const std::string& message, const std::string& verbose)
     if (!m_tracing)
     {
         logger()->debug("JRPC tracing is disabled");
-        logger()->trace("The message was: '{}', verbose: {}", message, verbose);
+        SPDLOG_LOGGER_TRACE(logger(), "The message was: '{}', verbose: {}", message, verbose);
         return;
     }
 
     if (!verbose.empty() && !m_verbosity)
     {
         logger()->debug("JRPC verbose tracing is disabled");
-        logger()->trace("The verbose message was: {}", verbose);
+        SPDLOG_LOGGER_TRACE(logger(), "The verbose message was: {}", verbose);
     }
 
     // clang-format off
@@ -194,85 +350,252 @@ void JsonRPC::WriteTrace(const std::string& message, const std::string& verbose)
 
 // private
 
-void JsonRPC::ProcessBufferContent()
+size_t JsonRPC::ConsumeHeader(std::string_view data)
 {
-    if (m_buffer.length() != m_contentLength)
+    if (m_headerLine.empty() && m_headers.empty() && GetTracer().IsEnabled())
     {
-        return;
+        m_frameStart = Tracer::Clock::now();
+    }
+    const auto lineEnd = data.find('\n');
+    if (lineEnd == std::string_view::npos)
+    {
+        m_headerLine.append(data);
+        return data.size();
     }
 
-    try
+    m_headerLine.append(data.substr(0, lineEnd));
+    if (!m_headerLine.empty() && m_headerLine.back() == '\r')
     {
-        LogBufferContent();
+        m_headerLine.pop_back();
+    }
+    ProcessHeaderLine();
+    m_headerLine.clear();
+    return lineEnd + 1;
+}
 
-        m_body = json::parse(m_buffer);
-        const auto method = m_body["method"];
-        if (method.is_string())
+size_t JsonRPC::ConsumeContent(std::string_view data)
+{
+    if (m_buffer.empty() && data.size() >= m_contentLength)
+    {
+        // The whole body is available in the chunk, parse it in place
+        ProcessBufferContent(data.substr(0, m_contentLength));
+        return m_contentLength;
+    }
+
+    const auto count = std::min(data.size(), m_contentLength - m_buffer.size());
+    m_buffer.append(data.substr(0, count));
+    if (m_buffer.size() == m_contentLength)
+    {
+        ProcessBufferContent(m_buffer);
+    }
+    return count;
+}
+
+void JsonRPC::ProcessHeaderLine()
+{
+    if (m_headerLine.empty())
+    {
+        // An empty line terminates the header part
+        if (m_contentLength > 0)
         {
-            m_method = method.get<std::string>();
-            ProcessMethod();
+            m_state = FrameState::content;
+            m_buffer.clear();
         }
         else
         {
-            FireRespondCallback();
+            m_headers.clear();
+            WriteError(JRPCErrorCode::InvalidRequest, "Invalid content length");
         }
-        m_isProcessing = false;
+        return;
     }
-    catch (std::exception& e)
+
+    const auto separator = m_headerLine.find(':');
+    if (separator == std::string::npos)
     {
-        LogAndHandleParseError(e);
+        logger()->warn("Skipping malformed header: '{}'", m_headerLine);
+        return;
+    }
+
+    const std::string_view line = m_headerLine;
+    const auto key = TrimHeaderToken(line.substr(0, separator));
+    const auto value = TrimHeaderToken(line.substr(separator + 1));
+    if (key == ContentLengthHeader)
+    {
+        size_t length = 0;
+        const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+        m_contentLength = (ec == std::errc() && ptr == value.data() + value.size()) ? length : 0;
     }
+    m_headers[std::string(key)] = std::string(value);
 }
 
-void JsonRPC::ProcessMethod()
+void JsonRPC::ProcessBufferContent(std::string_view content)
 {
-    if (m_method == "initialize")
+    m_currentId = nullptr;
+    if (m_recorder)
     {
-        OnInitialize();
+        m_recorder->Record(RecordDirection::inbound, content);
     }
-    else if (!m_initialized)
+    try
     {
-        return LogAndHandleUnexpectedMessage();
+        LogBufferContent(content);
+
+        auto& tracer = GetTracer();
+        const bool tracing = tracer.IsEnabled();
+        const auto parseStart = tracing ? Tracer::Clock::now() : Tracer::Clock::time_point();
+        if (IsBatch(content))
+        {
+            tracer.Complete("Frame", "jsonrpc", m_frameStart, parseStart);
+            ProcessBatch(content);
+        }
+        else
+        {
+            // Only the top level members are located here, handlers materialize what they need
+            const auto message = JRPCMessage::FromView(content);
+            const auto parseEnd = tracing ? Tracer::Clock::now() : Tracer::Clock::time_point();
+            // The spans of the message are recorded once its id is known
+            TraceContext context(message.Id(), tracing ? ExtractUri(message) : std::string());
+            tracer.Complete("Frame", "jsonrpc", m_frameStart, parseStart);
+            tracer.Complete("Parse", "jsonrpc", parseStart, parseEnd);
+            ProcessMessage(message);
+        }
+        m_isProcessing = false;
     }
-    else if (m_method == "$/setTrace")
+    catch (std::exception& e)
     {
-        OnTracingChanged(m_body);
+        LogAndHandleParseError(e, content);
     }
-    FireMethodCallback();
+    m_currentId = nullptr;
 }
 
-void JsonRPC::ProcessBufferHeader()
+void JsonRPC::ProcessBatch(std::string_view content)
 {
-    if (ReadHeader())
+    const auto items = SplitBatch(content);
+    if (items.empty())
     {
-        m_buffer.clear();
+        WriteError(JRPCErrorCode::InvalidRequest, "Empty batch");
+        return;
     }
+    SPDLOG_LOGGER_TRACE(logger(), "Dispatching batch of {} message(s)", items.size());
 
-    if (m_buffer == LE)
+    // Requests are registered up front, the first items may be responded before the last ones are dispatched
+    std::vector<std::optional<JRPCMessage>> messages;
+    messages.reserve(items.size());
+    auto batch = std::make_shared<Batch>();
     {
-        m_buffer.clear();
-        m_validHeader = m_contentLength > 0;
-        if (m_validHeader)
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        for (const auto item : items)
         {
-            m_buffer.reserve(m_contentLength);
+            try
+            {
+                messages.push_back(JRPCMessage::FromView(item));
+            }
+            catch (std::exception& e)
+            {
+                logger()->error("Invalid batch item: '{}'; {}", e.what(), item);
+                messages.emplace_back();
+                continue;
+            }
+            const auto& message = *messages.back();
+            if (message.HasMethod() && message.HasId())
+            {
+                auto key = message.Id().dump();
+                if (!m_batchRequests.emplace(key, batch).second)
+                {
+                    // Its respond could not be told apart from the one of the pending request
+                    logger()->error("Duplicate request id in batch: {}", key);
+                    batch->responds.push_back(
+                        json {
+                            {"jsonrpc", "2.0"},
+                            {"id", message.Id()},
+                            {"error",
+                             {{"code", static_cast<int>(JRPCErrorCode::InvalidRequest)},
+                              {"message", "Duplicate request id"}}}}
+                            .dump());
+                    messages.pop_back();
+                    continue;
+                }
+                batch->pending.insert(std::move(key));
+            }
         }
-        else
+        m_currentBatch = batch;
+    }
+
+    // Each item is dispatched as a standalone message, the requests are scheduled and run concurrently
+    for (const auto& message : messages)
+    {
+        m_currentId = nullptr;
+        if (!message)
         {
-            WriteError(JRPCErrorCode::InvalidRequest, "Invalid content length");
+            WriteError(JRPCErrorCode::InvalidRequest, "Invalid request");
+            continue;
         }
+        ProcessMessage(*message);
+    }
+    m_currentId = nullptr;
+
+    std::vector<std::string> responds;
+    {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        m_currentBatch.reset();
+        batch->dispatching = false;
+        if (batch->pending.empty())
+        {
+            responds = std::move(batch->responds);
+        }
+    }
+    if (!responds.empty())
+    {
+        Deliver(JoinBatchResponds(responds));
     }
 }
 
-void JsonRPC::OnInitialize()
+void JsonRPC::ProcessMessage(const JRPCMessage& message)
+{
+    if (message.HasMethod())
+    {
+        m_method = message.Method();
+        m_currentId = message.Id();
+        ProcessMethod(message);
+    }
+    else
+    {
+        FireRespondCallback(message);
+    }
+}
+
+void JsonRPC::ProcessMethod(const JRPCMessage& message)
+{
+    if (m_method == "initialize")
+    {
+        OnInitialize(message);
+    }
+    else if (!m_initialized)
+    {
+        return LogAndHandleUnexpectedMessage();
+    }
+    else if (m_method == "$/setTrace")
+    {
+        OnTracingChanged(message);
+    }
+    else if (m_method == "$/cancelRequest")
+    {
+        OnCancelRequest(message);
+    }
+    FireMethodCallback(message);
+}
+
+void JsonRPC::OnInitialize(const JRPCMessage& message)
 {
     try
     {
-        const auto traceValue = m_body["params"]["trace"].get<std::string>();
+        const auto traceValue = message.Params().at("trace").get<std::string>();
         m_tracing = traceValue != "off";
         m_verbosity = traceValue == "verbose";
-        logger()->trace("Tracing options: is verbose: {}, is on: {}",
-                        utils::FormatBool(m_verbosity),
-                        utils::FormatBool(m_tracing));
+        SPDLOG_LOGGER_TRACE(
+            logger(),
+            "Tracing options: is verbose: {}, is on: {}",
+            utils::FormatBool(m_verbosity),
+            utils::FormatBool(m_tracing));
     }
     catch (std::exception& err)
     {
@@ -281,16 +604,18 @@ void JsonRPC::OnInitialize()
     m_initialized = true;
 }
 
-void JsonRPC::OnTracingChanged(const json& data)
+void JsonRPC::OnTracingChanged(const JRPCMessage& message)
 {
     try
     {
-        const auto traceValue = data["params"]["value"].get<std::string>();
+        const auto traceValue = message.Params().at("value").get<std::string>();
         m_tracing = traceValue != "off";
         m_verbosity = traceValue == "verbose";
-        logger()->trace("Tracing options were changed, is verbose: {}, is on: {}",
-                        utils::FormatBool(m_verbosity),
-                        utils::FormatBool(m_tracing));
+        SPDLOG_LOGGER_TRACE(
+            logger(),
+            "Tracing options were changed, is verbose: {}, is on: {}",
+            utils::FormatBool(m_verbosity),
+            utils::FormatBool(m_tracing));
     }
     catch (std::exception& err)
     {
@@ -298,115 +623,211 @@ void JsonRPC::OnTracingChanged(const json& data)
     }
 }
 
-bool JsonRPC::ReadHeader()
+void JsonRPC::OnCancelRequest(const JRPCMessage& message)
 {
-    std::sregex_iterator next(m_buffer.begin(), m_buffer.end(), m_headerRegex);
-    std::sregex_iterator end;
-    const bool found = std::distance(next, end) > 0;
-    while (next != end)
+    const auto& params = message.Params();
+    const auto id = params.is_object() ? params.find("id") : params.end();
+    if (id != params.end())
     {
-        std::smatch match = *next;
-        std::string key = match.str(1);
-        std::string value = match.str(2);
-        if (key == "Content-Length")
-        {
-            m_contentLength = std::stoul(value);
-        }
-        m_headers[key] = value;
-        ++next;
+        ReleaseBatchRequest(*id);
     }
-    return found;
 }
 
-void JsonRPC::FireRespondCallback()
+void JsonRPC::FireRespondCallback(const JRPCMessage& message)
 {
     if (m_respondCallback)
     {
-        logger()->trace("Calling handler for a client respond");
-        m_respondCallback(m_body);
+        SPDLOG_LOGGER_TRACE(logger(), "Calling handler for a client respond");
+        m_respondCallback(message);
     }
 }
 
-void JsonRPC::FireMethodCallback()
+void JsonRPC::FireMethodCallback(const JRPCMessage& message)
 {
-    assert(m_outputCallback);
-    auto callback = m_callbacks.find(m_method);
-    if (callback == m_callbacks.end())
-    {
-        const bool isRequest = m_body["id"] != nullptr;
-        const bool mustRespond = isRequest || m_method.rfind("$/", 0) == std::string::npos;
-        logger()->trace("Got request: {}, respond is required: {}",
-                        utils::FormatBool(isRequest),
-                        utils::FormatBool(mustRespond));
-        if (mustRespond)
+    assert(m_writer || m_outputCallback);
+    // Only the supported methods are recorded, so a client cannot fill the table with unknown names
+    const auto start = std::chrono::steady_clock::now();
+    const auto recordLatency = [this, start] {
+        if (auto histogram = GetStatistics().Method(m_method))
         {
-            WriteError(JRPCErrorCode::MethodNotFound, "Method '" + m_method + "' is not supported.");
+            histogram->Record(NanosecondsSince(start));
         }
-    }
-    else
+    };
+    TraceSpan span(m_method, "lsp");
+    try
     {
-        try
+        if (m_dispatcher && m_dispatcher(message))
+        {
+            recordLatency();
+            return;
+        }
+
+        auto callback = m_callbacks.find(m_method);
+        if (callback == m_callbacks.end())
         {
-            logger()->trace("Calling handler for method: '{}'", m_method);
-            callback->second(m_body);
+            const bool isRequest = message.HasId();
+            const bool mustRespond = isRequest || m_method.rfind("$/", 0) == std::string::npos;
+            SPDLOG_LOGGER_TRACE(
+                logger(),
+                "Got request: {}, respond is required: {}",
+                utils::FormatBool(isRequest),
+                utils::FormatBool(mustRespond));
+            if (mustRespond)
+            {
+                WriteError(JRPCErrorCode::MethodNotFound, "Method '" + m_method + "' is not supported.");
+            }
+            return;
         }
-        catch (std::exception& err)
+
+        SPDLOG_LOGGER_TRACE(logger(), "Calling handler for method: '{}'", m_method);
+        callback->second(message);
+        recordLatency();
+    }
+    catch (json::parse_error& err)
+    {
+        logger()->error("Failed to parse params of method '{}', err: {}", m_method, err.what());
+        WriteError(JRPCErrorCode::ParseError, "Failed to parse request");
+    }
+    catch (std::exception& err)
+    {
+        logger()->error("Failed to handle method '{}', err: {}", m_method, err.what());
+        if (message.HasId())
         {
-            logger()->error("Failed to handle method '{}', err: {}", m_method, err.what());
+            // Otherwise the request, and the batch it belongs to, would wait for a respond forever
+            WriteError(JRPCErrorCode::InternalError, "Failed to handle method '" + m_method + "'");
         }
     }
 }
 
 void JsonRPC::WriteError(JRPCErrorCode errorCode, const std::string& message) const
 {
-    logger()->trace("Reporting error: '{}' ({})", message, static_cast<int>(errorCode));
-    json obj = {
+    SPDLOG_LOGGER_TRACE(logger(), "Reporting error: '{}' ({})", message, static_cast<int>(errorCode));
+    // The id is null if the request could not be read
+    Write({
+        {"id", m_currentId},
         {"error",
          {
              {"code", static_cast<int>(errorCode)},
              {"message", message},
-         }}};
-    Write(obj);
+         }}});
 }
 
-void JsonRPC::LogBufferContent() const
+bool JsonRPC::HasOpenBatches() const
 {
-    if (spdlog::get_level() > spdlog::level::debug)
+    std::lock_guard<std::mutex> lock(m_batchMutex);
+    return !m_batchRequests.empty() || m_currentBatch;
+}
+
+bool JsonRPC::CollectBatchRespond(const json& id, std::string& body) const
+{
+    std::vector<std::string> responds;
     {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        std::shared_ptr<Batch> batch;
+        if (id.is_null())
+        {
+            batch = m_currentBatch;
+        }
+        else if (auto request = m_batchRequests.find(id.dump()); request != m_batchRequests.end())
+        {
+            batch = std::move(request->second);
+            batch->pending.erase(request->first);
+            m_batchRequests.erase(request);
+        }
+        if (!batch)
+        {
+            return false;
+        }
+
+        batch->responds.push_back(std::move(body));
+        if (batch->dispatching || !batch->pending.empty())
+        {
+            return true;
+        }
+        responds = std::move(batch->responds);
+    }
+    Deliver(JoinBatchResponds(responds));
+    return true;
+}
+
+void JsonRPC::ReleaseBatchRequest(const json& id)
+{
+    std::vector<std::string> responds;
+    {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        auto request = m_batchRequests.find(id.dump());
+        if (request == m_batchRequests.end())
+        {
+            return;
+        }
+        // A cancelled request is responded on its own, if at all, the rest of the batch does not wait for it
+        auto batch = std::move(request->second);
+        batch->pending.erase(request->first);
+        m_batchRequests.erase(request);
+        if (batch->dispatching || !batch->pending.empty() || batch->responds.empty())
+        {
+            return;
+        }
+        responds = std::move(batch->responds);
+    }
+    Deliver(JoinBatchResponds(responds));
+}
+
+void JsonRPC::Deliver(SerializedMessage message) const
+{
+    LogMessage(std::string_view {message.body});
+    if (m_recorder)
+    {
+        m_recorder->Record(RecordDirection::outbound, message.body);
+    }
+    if (m_writer)
+    {
+        m_writer->Push(std::move(message));
         return;
     }
 
-    std::stringstream ss;
-    ss << "\n>>>>>>>>>>>>>>>>\n";
-    for (auto& header : m_headers)
+    std::string framed;
+    AppendFramedMessage(message.body, framed);
+    m_outputCallback(framed);
+}
+
+void JsonRPC::LogBufferContent(std::string_view content) const
+{
+    if (!logger()->should_log(spdlog::level::debug))
     {
-        ss << header.first << ": " << header.second;
+        return;
     }
-    ss << m_buffer;
-    ss << "\n>>>>>>>>>>>>>>>>\n";
 
-    logger()->debug(ss.str());
+    std::string headers;
+    for (auto& header : m_headers)
+    {
+        headers.append(header.first).append(": ").append(header.second).append(LE);
+    }
+    logger()->debug("\n>>>>>>>>>>>>>>>>\n{}{}{}\n>>>>>>>>>>>>>>>>\n", headers, LE, TruncateLogMessage(content));
 }
 
-void JsonRPC::LogMessage(const std::string& message) const
+void JsonRPC::LogMessage(const json& message) const
 {
-    if (spdlog::get_level() > spdlog::level::debug)
+    if (!logger()->should_log(spdlog::level::debug))
     {
         return;
     }
-    
-    std::stringstream ss;
-    ss  << "\n<<<<<<<<<<<<<<<<\n"
-        << message
-        << "\n<<<<<<<<<<<<<<<<\n";
+    LogMessage(std::string_view {message.dump()});
+}
 
-    logger()->debug(ss.str());
+void JsonRPC::LogMessage(std::string_view message) const
+{
+    if (!logger()->should_log(spdlog::level::debug))
+    {
+        return;
+    }
+    logger()->debug("\n<<<<<<<<<<<<<<<<\n{}\n<<<<<<<<<<<<<<<<\n", TruncateLogMessage(message));
 }
 
-void JsonRPC::LogAndHandleParseError(std::exception& e)
+void JsonRPC::LogAndHandleParseError(std::exception& e, std::string_view content)
 {
-    logger()->error("Failed to parse request with reason: '{}'; {}", e.what(), m_buffer);
-    m_buffer.clear();
+    logger()->error("Failed to parse request with reason: '{}'; {}", e.what(), TruncateLogMessage(content));
+    m_isProcessing = false;
     WriteError(JRPCErrorCode::ParseError, "Failed to parse request");
 }
 
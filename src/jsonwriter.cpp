@@ -0,0 +1,225 @@
+//
+//  jsonwriter.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "jsonwriter.hpp"
+
+#include <charconv>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+constexpr char HexDigits[] = "0123456789abcdef";
+
+// Escape sequence for characters that have a short form, nullptr otherwise
+const char* ShortEscape(unsigned char c)
+{
+    switch (c)
+    {
+        case '"':
+            return "\\\"";
+        case '\\':
+            return "\\\\";
+        case '\b':
+            return "\\b";
+        case '\f':
+            return "\\f";
+        case '\n':
+            return "\\n";
+        case '\r':
+            return "\\r";
+        case '\t':
+            return "\\t";
+        default:
+            return nullptr;
+    }
+}
+
+bool NeedsEscape(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+template <typename Number>
+void AppendNumber(std::string& out, Number value)
+{
+    char digits[24];
+    const auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+    (void)ec;
+    out.append(digits, end);
+}
+
+} // namespace
+
+JsonWriter::JsonWriter(size_t capacity)
+{
+    m_buffer.reserve(capacity);
+}
+
+JsonWriter& JsonWriter::StartObject()
+{
+    Separate();
+    m_buffer.push_back('{');
+    m_hasMembers.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject()
+{
+    m_buffer.push_back('}');
+    m_hasMembers.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::StartArray()
+{
+    Separate();
+    m_buffer.push_back('[');
+    m_hasMembers.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray()
+{
+    m_buffer.push_back(']');
+    m_hasMembers.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(std::string_view key)
+{
+    Separate();
+    m_buffer.push_back('"');
+    AppendEscaped(key);
+    m_buffer.append("\":");
+    m_afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(std::string_view value)
+{
+    Separate();
+    m_buffer.push_back('"');
+    AppendEscaped(value);
+    m_buffer.push_back('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Integer(int64_t value)
+{
+    Separate();
+    AppendNumber(m_buffer, value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Unsigned(uint64_t value)
+{
+    Separate();
+    AppendNumber(m_buffer, value);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value)
+{
+    Separate();
+    m_buffer.append(value ? "true" : "false");
+    return *this;
+}
+
+JsonWriter& JsonWriter::Null()
+{
+    Separate();
+    m_buffer.append("null");
+    return *this;
+}
+
+JsonWriter& JsonWriter::Value(const json& value)
+{
+    Separate();
+    detail::serializer<json> serializer(detail::output_adapter<char, std::string>(m_buffer), ' ');
+    serializer.dump(value, false, false, 0);
+    return *this;
+}
+
+const std::string& JsonWriter::Buffer() const
+{
+    return m_buffer;
+}
+
+std::string JsonWriter::Release()
+{
+    m_hasMembers.clear();
+    m_afterKey = false;
+    std::string result = std::move(m_buffer);
+    m_buffer.clear();
+    return result;
+}
+
+// private
+
+void JsonWriter::Separate()
+{
+    if (m_afterKey)
+    {
+        // The value belongs to the key that has just been written
+        m_afterKey = false;
+        return;
+    }
+    if (m_hasMembers.empty())
+    {
+        return;
+    }
+    if (m_hasMembers.back())
+    {
+        m_buffer.push_back(',');
+    }
+    m_hasMembers.back() = true;
+}
+
+void JsonWriter::AppendEscaped(std::string_view value)
+{
+    size_t runBegin = 0;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        const auto c = static_cast<unsigned char>(value[i]);
+        if (!NeedsEscape(c))
+        {
+            continue;
+        }
+        // Copy the run of plain characters at once
+        m_buffer.append(value.data() + runBegin, i - runBegin);
+        runBegin = i + 1;
+        if (const auto escape = ShortEscape(c))
+        {
+            m_buffer.append(escape);
+        }
+        else
+        {
+            const char sequence[] = {'\\', 'u', '0', '0', HexDigits[c >> 4], HexDigits[c & 0xF]};
+            m_buffer.append(sequence, sizeof(sequence));
+        }
+    }
+    m_buffer.append(value.data() + runBegin, value.size() - runBegin);
+}
+
+void WriteRange(JsonWriter& writer, unsigned startLine, unsigned startCharacter, unsigned endLine, unsigned endCharacter)
+{
+    writer.StartObject();
+    writer.Key("start").StartObject();
+    writer.Key("line").Unsigned(startLine);
+    writer.Key("character").Unsigned(startCharacter);
+    writer.EndObject();
+    writer.Key("end").StartObject();
+    writer.Key("line").Unsigned(endLine);
+    writer.Key("character").Unsigned(endCharacter);
+    writer.EndObject();
+    writer.EndObject();
+}
+
+} // namespace ocls
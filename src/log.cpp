@@ -15,6 +15,9 @@
 #include <iostream>
 
 #include "spdlog/pattern_formatter.h"
+#include <spdlog/async.h>
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/sinks/base_sink.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/null_sink.h>
 
@@ -31,9 +34,80 @@ std::string LogName::typeDefinition = "typeDefinition";
 std::string LogName::declaration = "declaration";
 std::string LogName::jrpc = "jrpc";
 std::string LogName::lsp = "lsp";
+std::string LogName::daemon = "daemon";
+
+std::shared_ptr<spdlog::logger> Loggers::main;
+std::shared_ptr<spdlog::logger> Loggers::hdiscovery;
+std::shared_ptr<spdlog::logger> Loggers::clinfo;
+std::shared_ptr<spdlog::logger> Loggers::translation;
+std::shared_ptr<spdlog::logger> Loggers::diagnostics;
+std::shared_ptr<spdlog::logger> Loggers::completion;
+std::shared_ptr<spdlog::logger> Loggers::definition;
+std::shared_ptr<spdlog::logger> Loggers::typeDefinition;
+std::shared_ptr<spdlog::logger> Loggers::declaration;
+std::shared_ptr<spdlog::logger> Loggers::jrpc;
+std::shared_ptr<spdlog::logger> Loggers::lsp;
+std::shared_ptr<spdlog::logger> Loggers::daemon;
+
+namespace {
 
 const int flushIntervalSec = 5;
 
+// Owned here rather than by the spdlog registry, so the cached handles keep working after spdlog::shutdown
+std::shared_ptr<spdlog::details::thread_pool> threadPool;
+
+template <typename Mutex>
+class truncating_sink final : public spdlog::sinks::base_sink<Mutex>
+{
+public:
+    explicit truncating_sink(spdlog::sink_ptr sink) : m_sink {std::move(sink)} {}
+
+protected:
+    void sink_it_(const spdlog::details::log_msg& msg) override
+    {
+        if (msg.payload.size() <= maxLogMessageSize)
+        {
+            m_sink->log(msg);
+            return;
+        }
+        m_payload = TruncateLogMessage({msg.payload.data(), msg.payload.size()});
+        auto truncated = msg;
+        truncated.payload = m_payload;
+        m_sink->log(truncated);
+    }
+
+    void flush_() override
+    {
+        m_sink->flush();
+    }
+
+    void set_pattern_(const std::string& pattern) override
+    {
+        m_sink->set_pattern(pattern);
+    }
+
+    void set_formatter_(std::unique_ptr<spdlog::formatter> formatter) override
+    {
+        m_sink->set_formatter(std::move(formatter));
+    }
+
+private:
+    spdlog::sink_ptr m_sink;
+    std::string m_payload;
+};
+
+} // namespace
+
+std::string TruncateLogMessage(std::string_view message)
+{
+    if (message.size() <= maxLogMessageSize)
+    {
+        return std::string(message);
+    }
+    return fmt::format(
+        "{}... [{} bytes truncated]", message.substr(0, maxLogMessageSize), message.size() - maxLogMessageSize);
+}
+
 void ConfigureLogging(bool fileLogging, const std::string& filename, spdlog::level::level_enum level)
 {
     try
@@ -41,43 +115,69 @@ void ConfigureLogging(bool fileLogging, const std::string& filename, spdlog::lev
         std::vector<spdlog::sink_ptr> sinks;
         if (fileLogging)
         {
-            sinks.push_back(std::make_shared<spdlog::sinks::basic_file_sink_mt>(filename));
+            sinks.push_back(std::make_shared<truncating_sink<spdlog::details::null_mutex>>(
+                std::make_shared<spdlog::sinks::basic_file_sink_st>(filename)));
         }
         else
         {
             sinks.push_back(std::make_shared<spdlog::sinks::null_sink_mt>());
+#if !defined(__APPLE__)
+            // Nothing is written, skip formatting of the messages altogether
+            level = spdlog::level::off;
+#endif
         }
 #if defined(__APPLE__)
         sinks.push_back(std::make_shared<ocls::oslogger_sink_mt>());
 #endif
 
-        spdlog::set_default_logger(std::make_shared<spdlog::logger>(LogName::main, sinks.begin(), sinks.end()));
+        // File writes happen on a background thread, callers only copy the message into the queue.
+        // The sinks are used by that thread alone and need no locking.
+        if (fileLogging && !threadPool)
+        {
+            threadPool = std::make_shared<spdlog::details::thread_pool>(logQueueSize, 1);
+        }
+        const auto createLogger = [&](const std::string& name) -> std::shared_ptr<spdlog::logger> {
+            if (fileLogging)
+            {
+                return std::make_shared<spdlog::async_logger>(
+                    name, sinks.begin(), sinks.end(), threadPool, spdlog::async_overflow_policy::overrun_oldest);
+            }
+            return std::make_shared<spdlog::logger>(name, sinks.begin(), sinks.end());
+        };
+
+        auto mainLogger = createLogger(LogName::main);
+        spdlog::set_default_logger(mainLogger);
         spdlog::set_level(level);
-        std::vector<std::shared_ptr<spdlog::logger>> subLoggers = {
-            std::make_shared<spdlog::logger>(LogName::hdiscovery, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::clinfo, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::diagnostics, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::completion, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::definition, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::typeDefinition, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::declaration, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::translation, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::jrpc, sinks.begin(), sinks.end()),
-            std::make_shared<spdlog::logger>(LogName::lsp, sinks.begin(), sinks.end())};
-
-        for (const auto& logger : subLoggers)
+        const std::vector<std::pair<const std::string&, std::shared_ptr<spdlog::logger>&>> subLoggers = {
+            {LogName::hdiscovery, Loggers::hdiscovery},
+            {LogName::clinfo, Loggers::clinfo},
+            {LogName::diagnostics, Loggers::diagnostics},
+            {LogName::completion, Loggers::completion},
+            {LogName::definition, Loggers::definition},
+            {LogName::typeDefinition, Loggers::typeDefinition},
+            {LogName::declaration, Loggers::declaration},
+            {LogName::translation, Loggers::translation},
+            {LogName::jrpc, Loggers::jrpc},
+            {LogName::lsp, Loggers::lsp},
+            {LogName::daemon, Loggers::daemon}};
+
+        for (const auto& [name, handle] : subLoggers)
         {
+            auto logger = createLogger(name);
             logger->set_level(level);
             spdlog::register_logger(logger);
+            handle = std::move(logger);
         }
+        Loggers::main = std::move(mainLogger);
 
         if (fileLogging)
         {
-            spdlog::flush_on(level);
+            // Messages are flushed in batches, errors are flushed right away
+            spdlog::flush_on(spdlog::level::err);
             spdlog::flush_every(std::chrono::seconds(flushIntervalSec));
         }
 
-        spdlog::get(LogName::main)->info("Starting new session at {}...\n", utils::GetCurrentDateTime());
+        Loggers::main->info("Starting new session at {}...\n", utils::GetCurrentDateTime());
     }
     catch (const spdlog::spdlog_ex& ex)
     {
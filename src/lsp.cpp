@@ -5,16 +5,36 @@
 //  Created by Ilia Shoshin on 7/16/21.
 //
 
+#include "cancellation.hpp"
 #include "completion.hpp"
 #include "diagnostics.hpp"
 #include "jsonrpc.hpp"
+#include "jsonwriter.hpp"
 #include "log.hpp"
 #include "lsp.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <atomic>
-#include <iostream>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <mutex>
 #include <queue>
+#include <unordered_map>
+#include <vector>
+
+#if defined(WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
 
 using namespace nlohmann;
 
@@ -24,72 +44,238 @@ constexpr int BuildOptions = 0;
 constexpr int MaxProblemsCount = 1;
 constexpr int DeviceID = 2;
 constexpr int NumConfigurations = 3;
-
-std::optional<nlohmann::json> GetNestedValue(const nlohmann::json &j, const std::vector<std::string> &keys)
+// Size of the reusable block that stdin is read into
+constexpr size_t InputBufferSize = 64 * 1024;
+// Rough size of a serialized completion item, used to preallocate the respond buffer
+constexpr size_t CompletionItemSizeHint = 160;
+// Quiet period after the last change of a document before its diagnostics are built
+constexpr std::chrono::milliseconds DefaultDiagnosticsDelay {300};
+// Longest time a build can be postponed while the document keeps changing
+constexpr std::chrono::milliseconds DefaultDiagnosticsMaxLatency {2000};
+// Longest time a request waits for the first parse of its document before it fails
+constexpr std::chrono::milliseconds ParseTimeout {10000};
+
+/**
+ Reads up to \c size bytes from the descriptor \c fd, bypassing the stream buffers.
+ Returns the number of bytes read, 0 on EOF or -1 on error.
+ */
+long long ReadInput(int fd, char *buffer, size_t size)
 {
-    const nlohmann::json *current = &j;
-    for (const auto &key : keys)
+#if defined(WIN32)
+    return _read(fd, buffer, static_cast<unsigned>(size));
+#else
+    ssize_t count;
+    do
     {
-        if (!current->contains(key))
-        {
-            return std::nullopt;
-        }
-        current = &(*current)[key];
-    }
-    return *current;
+        count = read(fd, buffer, size);
+    } while (count < 0 && errno == EINTR);
+    return count;
+#endif
 }
 
 } // namespace
 
 namespace ocls {
 
-auto logger()
+const auto& logger()
+{
+    return ocls::Loggers::lsp;
+}
+
+namespace {
+
+/**
+ Serializes a respond with the result produced by \c writeResult, without building a DOM.
+ */
+template <typename WriteResultFunc>
+SerializedMessage SerializeRespond(const RequestId &id, size_t capacity, WriteResultFunc &&writeResult)
 {
-    return spdlog::get(ocls::LogName::lsp);
+    JsonWriter writer(capacity);
+    writer.StartObject();
+    writer.Key("jsonrpc").String("2.0");
+    writer.Key("id").Value(id);
+    writer.Key("result");
+    writeResult(writer);
+    writer.EndObject();
+    return {writer.Release()};
 }
 
-struct Capabilities
+struct DispatchContext
 {
-    bool hasConfigurationCapability = false;
-    bool supportDidChangeConfiguration = false;
-    bool hasDefinitionLinkSupport = false;
-    bool hasTypeDefinitionLinkSupport = false;
-    bool hasDeclarationLinkSupport = false;
+    ILSPServerEventsHandler &handler;
+    IJsonRPC &jrpc;
+    IMessageWriter &writer;
 };
 
+using MethodHandlerFunc = void (*)(const DispatchContext &, const JRPCMessage &);
+
+struct MethodEntry
+{
+    std::string_view method;
+    MethodHandlerFunc handle;
+};
+
+template <typename Params, typename Handle>
+void DecodeAndHandle(const DispatchContext &context, const JRPCMessage &message, Handle &&handle)
+{
+    auto params = Params::Decode(message);
+    if (!params)
+    {
+        logger()->warn("Invalid params of '{}'", message.Method());
+        if (message.HasId())
+        {
+            context.jrpc.WriteError(
+                JRPCErrorCode::InvalidParams, "Invalid params of '" + std::string(message.Method()) + "'");
+        }
+        return;
+    }
+    handle(std::move(*params));
+}
+
+void HandlePositionRequest(
+    const DispatchContext &context,
+    const JRPCMessage &message,
+    void (ILSPServerEventsHandler::*method)(const RequestId &, const TextDocumentPositionParams &))
+{
+    DecodeAndHandle<TextDocumentPositionParams>(context, message, [&](TextDocumentPositionParams &&params) {
+        (context.handler.*method)(message.Id(), params);
+    });
+}
+
+// clang-format off
+// Sorted by method name, looked up with a binary search
+constexpr MethodEntry MethodTable[] = {
+    {"$/cancelRequest", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<CancelParams>(context, message, [&](CancelParams &&params) {
+            context.handler.OnCancel(params);
+        });
+    }},
+    {"$/ocls/memory", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        context.handler.OnMemory(message.Id());
+    }},
+    {"$/ocls/stats", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        context.handler.OnStats(message.Id());
+    }},
+    {"completionItem/resolve", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<CompletionResolveParams>(context, message, [&](CompletionResolveParams &&params) {
+            context.handler.OnResolveCompletion(message.Id(), params);
+        });
+    }},
+    {"exit", [](const DispatchContext &context, const JRPCMessage &)
+    {
+        // Deliver pending responses before the process terminates
+        context.writer.Flush();
+        context.handler.OnExit();
+    }},
+    {"initialize", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<InitializeParams>(context, message, [&](InitializeParams &&params) {
+            context.handler.OnInitialize(message.Id(), params);
+        });
+    }},
+    {"initialized", [](const DispatchContext &context, const JRPCMessage &)
+    {
+        context.handler.OnInitialized();
+    }},
+    {"shutdown", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        context.handler.OnShutdown(message.Id());
+    }},
+    {"textDocument/completion", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        HandlePositionRequest(context, message, &ILSPServerEventsHandler::OnCompletion);
+    }},
+    {"textDocument/declaration", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        HandlePositionRequest(context, message, &ILSPServerEventsHandler::OnDeclaration);
+    }},
+    {"textDocument/definition", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        HandlePositionRequest(context, message, &ILSPServerEventsHandler::OnDefinition);
+    }},
+    {"textDocument/didChange", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<DidChangeTextDocumentParams>(context, message, [&](DidChangeTextDocumentParams &&params) {
+            context.handler.OnTextChanged(std::move(params));
+        });
+    }},
+    {"textDocument/didClose", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<DidCloseTextDocumentParams>(context, message, [&](DidCloseTextDocumentParams &&params) {
+            context.handler.OnTextClose(params);
+        });
+    }},
+    {"textDocument/didOpen", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        DecodeAndHandle<DidOpenTextDocumentParams>(context, message, [&](DidOpenTextDocumentParams &&params) {
+            context.handler.OnTextOpen(std::move(params));
+        });
+    }},
+    {"textDocument/typeDefinition", [](const DispatchContext &context, const JRPCMessage &message)
+    {
+        HandlePositionRequest(context, message, &ILSPServerEventsHandler::OnTypeDefinition);
+    }},
+    {"workspace/didChangeConfiguration", [](const DispatchContext &context, const JRPCMessage &)
+    {
+        context.handler.GetConfiguration();
+    }},
+};
+// clang-format on
+
+constexpr bool IsSorted(const MethodEntry *begin, const MethodEntry *end)
+{
+    for (auto it = begin; it + 1 < end; ++it)
+    {
+        if (!(it->method < (it + 1)->method))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(IsSorted(std::begin(MethodTable), std::end(MethodTable)), "MethodTable must be sorted by method name");
+
+} // namespace
+
 class LSPServer final
     : public ILSPServer
     , public std::enable_shared_from_this<LSPServer>
 {
 public:
-    LSPServer(std::shared_ptr<IJsonRPC> jrpc, std::shared_ptr<ITranslationUnitStore> store, std::shared_ptr<ILSPServerEventsHandler> handler)
+    LSPServer(
+        std::shared_ptr<IJsonRPC> jrpc,
+        std::shared_ptr<ITranslationUnitStore> store,
+        std::shared_ptr<ILSPServerEventsHandler> handler,
+        std::shared_ptr<IScheduler> scheduler,
+        LSPTransport transport)
         : m_jrpc {std::move(jrpc)}
         , m_store {std::move(store)}
         , m_handler {std::move(handler)}
+        , m_scheduler {std::move(scheduler)}
+        , m_transport {std::move(transport)}
     {}
 
     int Run();
     void Interrupt();
 
 private:
-    void BuildDiagnosticsRespond(const std::string &uri, const std::string &filePath, const std::string &content);
-    void BuildDeclarationRespond(const json &data);
-    void GetConfiguration();
-    void OnInitialize(const json &data);
-    void OnInitialized(const json &data);
-    void OnTextOpen(const json &data);
-    void OnTextChanged(const json &data);
-    void OnTextClose(const json &data);
-    void OnConfiguration(const json &data);
-    void OnRespond(const json &data);
-    void OnCancel(const json &data);
-    void OnShutdown(const json &data);
-    void OnExit();
+    bool Dispatch(const JRPCMessage &message);
+    void WriteResponses();
 
 private:
     std::shared_ptr<IJsonRPC> m_jrpc;
     std::shared_ptr<ITranslationUnitStore> m_store;
     std::shared_ptr<ILSPServerEventsHandler> m_handler;
+    std::shared_ptr<IScheduler> m_scheduler;
+    std::shared_ptr<IMessageWriter> m_writer;
+    LSPTransport m_transport;
+    // Keeps the responses in the order they were produced when several threads pass them to the writer
+    std::mutex m_responsesMutex;
     std::atomic<bool> m_interrupted = {false};
 };
 
@@ -105,7 +291,8 @@ public:
         std::shared_ptr<ITypeDefinition> typeDefinition,
         std::shared_ptr<IDeclaration> declaration,
         std::shared_ptr<utils::IGenerator> generator,
-        std::shared_ptr<utils::IExitHandler> exitHandler)
+        std::shared_ptr<utils::IExitHandler> exitHandler,
+        std::shared_ptr<IScheduler> scheduler)
         : m_jrpc {std::move(jrpc)}
         , m_store {std::move(store)}
         , m_diagnostics {std::move(diagnostics)}
@@ -115,34 +302,75 @@ public:
         , m_declaration {std::move(declaration)}
         , m_generator {std::move(generator)}
         , m_exitHandler {std::move(exitHandler)}
+        , m_scheduler {std::move(scheduler)}
     {}
 
-    void BuildDiagnosticsRespond(const std::string &uri, const std::string &filePath, const std::string &content);
-    nlohmann::json BuildDefinitionRespond(const json &data, bool typeDefinition);
-    nlohmann::json BuildDeclarationRespond(const json &data);
-    void BuildCompletionRespond(const json &data);
-    void ResolveCompletion(const json &data);
+    void BuildDiagnosticsRespond(const std::string &uri, const Source &source, const CancellationToken &token);
+    void BuildDefinitionRespond(
+        const RequestId &id,
+        const TextDocumentPositionParams &params,
+        bool typeDefinition,
+        const CancellationToken &token);
+    void BuildDeclarationRespond(const RequestId &id, const TextDocumentPositionParams &params);
+    void BuildCompletionRespond(
+        const RequestId &id, const TextDocumentPositionParams &params, const CancellationToken &token);
+    void ResolveCompletion(const RequestId &id, const CompletionResolveParams &params);
 
     void GetConfiguration();
-    std::optional<json> GetNextResponse();
-    void OnInitialize(const json &data);
-    void OnInitialized(const json &data);
-    void OnTextOpen(const json &data);
-    void OnTextChanged(const json &data);
-    void OnTextClose(const json &data);
-    void OnDefinition(const json &data);
-    void OnTypeDefinition(const json &data);
-    void OnDeclaration(const json &data);
-    void OnCompletion(const json &data);
-    void OnResolveCompletion(const json &data);
+    std::optional<OutgoingMessage> GetNextResponse();
+    void OnInitialize(const RequestId &id, const InitializeParams &params);
+    void OnInitialized();
+    void OnTextOpen(DidOpenTextDocumentParams &&params);
+    void OnTextChanged(DidChangeTextDocumentParams &&params);
+    void OnTextClose(const DidCloseTextDocumentParams &params);
+    void OnDefinition(const RequestId &id, const TextDocumentPositionParams &params);
+    void OnTypeDefinition(const RequestId &id, const TextDocumentPositionParams &params);
+    void OnDeclaration(const RequestId &id, const TextDocumentPositionParams &params);
+    void OnCompletion(const RequestId &id, const TextDocumentPositionParams &params);
+    void OnResolveCompletion(const RequestId &id, const CompletionResolveParams &params);
     void OnConfiguration(const json &data);
     void OnRespond(const json &data);
-    void OnCancel(const json &data);
-    void OnShutdown(const json &data);
+    void OnCancel(const CancelParams &params);
+    void OnShutdown(const RequestId &id);
+    void OnStats(const RequestId &id);
+    void OnMemory(const RequestId &id);
     void OnExit();
 
 private:
+    using RequestTaskFunc = std::function<void(const CancellationToken &)>;
+
     void ConfigureCompletion();
+    void Respond(OutgoingMessage &&message);
+    void RespondCancelled(const RequestId &id);
+    /**
+     Responds to the request \c id with an error, workers must use it instead of \c IJsonRPC::WriteError,
+     which responds to the message being read.
+     */
+    void RespondError(const RequestId &id, JRPCErrorCode code, const std::string &message);
+    // The result of the request was computed on an older revision of the document than the one the client has
+    void NotifyStale(const RequestId &id, const std::string &uri);
+    void ScheduleDiagnostics(const std::string &uri, Source &&source, bool debounce);
+    /**
+     A \c readOnly request runs on the last parsed revision of the document \c key,
+     so it does not wait for the reparses after the first parse.
+     */
+    void ScheduleRequest(
+        const RequestId &id,
+        std::string_view method,
+        const std::string &key,
+        RequestTaskFunc &&task,
+        bool readOnly = false);
+    void SealPendingChanges(const std::string &uri);
+    /**
+     \return whether \c result was resolved in an older revision of the document \c uri than the client has
+     */
+    bool IsStale(const std::string &uri, const LocationResult &result);
+    void EnforceTranslationUnitLimits();
+    void ScheduleIdleCheck();
+    /**
+     \return the first parse of the document \c uri if it has not finished yet, otherwise an invalid future
+     */
+    std::shared_future<void> PendingParse(const std::string &uri);
 
 private:
     std::shared_ptr<IJsonRPC> m_jrpc;
@@ -154,11 +382,36 @@ private:
     std::shared_ptr<IDeclaration> m_declaration;
     std::shared_ptr<utils::IGenerator> m_generator;
     std::shared_ptr<utils::IExitHandler> m_exitHandler;
-    std::queue<json> m_outQueue;
-    Capabilities m_capabilities;
+    std::shared_ptr<IScheduler> m_scheduler;
+    // Filled from the scheduler workers, drained by the server
+    std::mutex m_outQueueMutex;
+    std::queue<OutgoingMessage> m_outQueue;
+    // Cancellation of the scheduled requests by the serialized request id,
+    // and of the diagnostics builds by the document uri
+    std::mutex m_cancellationMutex;
+    std::unordered_map<std::string, CancellationSource> m_pendingRequests;
+    std::unordered_map<std::string, CancellationSource> m_pendingDiagnostics;
+    // Changes of the documents whose store update has not started yet, new changes are appended to them
+    std::mutex m_changesMutex;
+    std::unordered_map<std::string, std::shared_ptr<std::vector<TextChange>>> m_pendingChanges;
+    // Number of scheduled store updates of the documents that have not finished yet
+    std::unordered_map<std::string, size_t> m_queuedUpdates;
+    // Uris of the open documents by file path, an eviction runs in the order of the requests to its document
+    std::mutex m_documentsMutex;
+    std::unordered_map<std::string, std::string> m_documentUris;
+    // First parses of the documents by uri, until a request finds them finished
+    std::unordered_map<std::string, std::shared_future<void>> m_parses;
+    // Time of didOpen of the documents by uri, until their first completion
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> m_openedAt;
+    bool m_limitsEnabled = false;
+    std::chrono::milliseconds m_idleTimeout {0};
+    ClientCapabilities m_capabilities;
+    std::chrono::milliseconds m_diagnosticsDelay = DefaultDiagnosticsDelay;
+    std::chrono::milliseconds m_diagnosticsMaxLatency = DefaultDiagnosticsMaxLatency;
     std::queue<std::pair<std::string, std::string>> m_requests;
     bool m_shutdown = false;
     // Cache completion results for resolve requests
+    std::mutex m_completionCacheMutex;
     std::unordered_map<std::string, ocls::CompletionResult> m_completionCache;
 };
 
@@ -168,109 +421,305 @@ void LSPServerEventsHandler::GetConfiguration()
 {
     if (!m_capabilities.hasConfigurationCapability)
     {
-        logger()->trace("Does not have configuration capability");
+        SPDLOG_LOGGER_TRACE(logger(), "Does not have configuration capability");
         return;
     }
 
-    logger()->trace("Make configuration request");
+    SPDLOG_LOGGER_TRACE(logger(), "Make configuration request");
     json buildOptions = {{"section", "OpenCL.server.buildOptions"}};
     json maxNumberOfProblems = {{"section", "OpenCL.server.maxNumberOfProblems"}};
     json openCLDeviceID = {{"section", "OpenCL.server.deviceID"}};
     const auto requestId = m_generator->GenerateID();
     m_requests.push(std::make_pair("workspace/configuration", requestId));
-    m_outQueue.push(
-        {{"id", requestId},
-         {"method", "workspace/configuration"},
-         {"params", {{"items", json::array({buildOptions, maxNumberOfProblems, openCLDeviceID})}}}});
+    Respond(json {
+        {"id", requestId},
+        {"method", "workspace/configuration"},
+        {"params", {{"items", json::array({buildOptions, maxNumberOfProblems, openCLDeviceID})}}}});
 }
 
-std::optional<json> LSPServerEventsHandler::GetNextResponse()
+std::optional<OutgoingMessage> LSPServerEventsHandler::GetNextResponse()
 {
+    std::lock_guard<std::mutex> lock(m_outQueueMutex);
     if (m_outQueue.empty())
     {
         return std::nullopt;
     }
 
-    auto data = m_outQueue.front();
+    auto data = std::move(m_outQueue.front());
     m_outQueue.pop();
     return data;
 }
 
+void LSPServerEventsHandler::Respond(OutgoingMessage &&message)
+{
+    std::lock_guard<std::mutex> lock(m_outQueueMutex);
+    m_outQueue.push(std::move(message));
+}
+
+void LSPServerEventsHandler::RespondCancelled(const RequestId &id)
+{
+    logger()->debug("Request {} is cancelled", id.dump());
+    RespondError(id, JRPCErrorCode::RequestCancelled, "Request cancelled");
+}
+
+void LSPServerEventsHandler::RespondError(const RequestId &id, JRPCErrorCode code, const std::string &message)
+{
+    Respond(json {{"id", id}, {"error", {{"code", static_cast<int>(code)}, {"message", message}}}});
+}
+
+void LSPServerEventsHandler::NotifyStale(const RequestId &id, const std::string &uri)
+{
+    // Locations are arrays, there is no room for a flag in the result, so it is sent ahead of the respond
+    Respond(json {{"method", "$/ocls/staleResult"}, {"params", {{"id", id}, {"uri", uri}}}});
+}
+
+void LSPServerEventsHandler::ScheduleDiagnostics(const std::string &uri, Source &&source, bool debounce)
+{
+    // A newer version of the document makes the pending build useless
+    CancellationSource cancellation;
+    {
+        std::lock_guard<std::mutex> lock(m_cancellationMutex);
+        auto &pending = m_pendingDiagnostics[uri];
+        pending.Cancel();
+        pending = cancellation;
+    }
+    auto task = [this, uri, source = std::move(source), token = cancellation.Token()]() {
+        if (token.IsCancelled())
+        {
+            logger()->debug("Skipping outdated diagnostics of {}", uri);
+            return;
+        }
+        TraceContext context(json(), uri);
+        TraceSpan span("diagnostics", "worker");
+        BuildDiagnosticsRespond(uri, source, token);
+    };
+    // Builds are serialized per document, but run aside of the document's store updates
+    // so slow OpenCL builds do not hold interactive requests back
+    const auto key = "diag:" + uri;
+    if (debounce)
+    {
+        // A burst of changes is built once, with the latest content
+        m_scheduler->ScheduleDebounced(
+            TaskPriority::background, key, m_diagnosticsDelay, m_diagnosticsMaxLatency, std::move(task));
+    }
+    else
+    {
+        m_scheduler->Schedule(TaskPriority::background, key, std::move(task));
+    }
+}
+
+void LSPServerEventsHandler::SealPendingChanges(const std::string &uri)
+{
+    // Changes that come after a request must not be applied before the request runs
+    std::lock_guard<std::mutex> lock(m_changesMutex);
+    m_pendingChanges.erase(uri);
+}
+
+bool LSPServerEventsHandler::IsStale(const std::string &uri, const LocationResult &result)
+{
+    if (!result.upToDate)
+    {
+        return true;
+    }
+    // Checked after the query: a read runs alongside the changes, one still queued may be what the position refers to
+    std::lock_guard<std::mutex> lock(m_changesMutex);
+    return m_queuedUpdates.count(uri) > 0;
+}
+
+void LSPServerEventsHandler::EnforceTranslationUnitLimits()
+{
+    if (!m_limitsEnabled)
+    {
+        return;
+    }
+    // The standbys go first, an edited file loses its fast reparse before any file is evicted
+    m_store->ReleaseStandbys();
+    for (const auto &filePath : m_store->GetEvictionCandidates())
+    {
+        std::string uri;
+        {
+            std::lock_guard<std::mutex> lock(m_documentsMutex);
+            auto it = m_documentUris.find(filePath);
+            if (it == m_documentUris.end())
+            {
+                // Opened only by another session of the daemon, its own check evicts the file
+                continue;
+            }
+            uri = it->second;
+        }
+        m_scheduler->Schedule(TaskPriority::background, uri, [this, filePath]() { m_store->Evict(filePath); });
+    }
+    if (m_idleTimeout.count() > 0)
+    {
+        ScheduleIdleCheck();
+    }
+}
+
+void LSPServerEventsHandler::ScheduleIdleCheck()
+{
+    // Checks again while there is something left to release, a timer so that Drain does not wait for it
+    m_scheduler->ScheduleTimer(TaskPriority::background, "memory:idle", m_idleTimeout, [this]() {
+        if (!m_store->GetMemoryUsage().empty())
+        {
+            EnforceTranslationUnitLimits();
+        }
+    });
+}
+
+void LSPServerEventsHandler::ScheduleRequest(
+    const RequestId &id, std::string_view method, const std::string &key, RequestTaskFunc &&task, bool readOnly)
+{
+    if (!key.empty())
+    {
+        SealPendingChanges(key);
+    }
+    const auto requestKey = id.dump();
+    CancellationSource cancellation;
+    {
+        std::lock_guard<std::mutex> lock(m_cancellationMutex);
+        m_pendingRequests[requestKey] = cancellation;
+    }
+    // Set by whichever comes first, the task or the parse timeout, the other one does not respond
+    auto claimed = std::make_shared<std::atomic<bool>>(false);
+    auto parse = PendingParse(key);
+    if (parse.valid())
+    {
+        // A timer, so that Drain neither fails the request early nor waits for the timeout
+        m_scheduler->ScheduleTimer(
+            TaskPriority::interactive,
+            "timeout:" + requestKey,
+            ParseTimeout,
+            [this, id, key, requestKey, parse, claimed]() {
+                if (parse.wait_for(std::chrono::seconds(0)) == std::future_status::ready || claimed->exchange(true))
+                {
+                    return;
+                }
+                logger()->warn("Request {} timed out waiting for the parse of {}", requestKey, key);
+                RespondError(id, JRPCErrorCode::RequestFailed, "The document is still being parsed");
+                std::lock_guard<std::mutex> lock(m_cancellationMutex);
+                m_pendingRequests.erase(requestKey);
+            });
+    }
+    // Until the first parse there is no revision to read, so the request waits for it like the others
+    const auto taskKey = readOnly && !parse.valid() ? "read:" + key : key;
+    m_scheduler->Schedule(
+        TaskPriority::interactive,
+        taskKey,
+        [this,
+         id,
+         key,
+         name = std::string(method),
+         requestKey,
+         claimed,
+         task = std::move(task),
+         token = cancellation.Token(),
+         histogram = GetStatistics().Request(method),
+         start = std::chrono::steady_clock::now()]() {
+            if (claimed->exchange(true))
+            {
+                // Already answered by the parse timeout
+                return;
+            }
+            TraceContext context(id, key);
+            if (token.IsCancelled())
+            {
+                RespondCancelled(id);
+            }
+            else
+            {
+                TraceSpan span(name, "worker");
+                task(token);
+            }
+            if (histogram)
+            {
+                histogram->Record(NanosecondsSince(start));
+            }
+            std::lock_guard<std::mutex> lock(m_cancellationMutex);
+            m_pendingRequests.erase(requestKey);
+        });
+}
+
+std::shared_future<void> LSPServerEventsHandler::PendingParse(const std::string &uri)
+{
+    if (uri.empty())
+    {
+        return {};
+    }
+    std::lock_guard<std::mutex> lock(m_documentsMutex);
+    auto it = m_parses.find(uri);
+    if (it == m_parses.end())
+    {
+        return {};
+    }
+    if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        m_parses.erase(it);
+        return {};
+    }
+    return it->second;
+}
+
 void LSPServerEventsHandler::ConfigureCompletion()
 {
-    logger()->trace("LSPServerEventsHandler::ConfigureCompletion");
+    SPDLOG_LOGGER_TRACE(logger(), "LSPServerEventsHandler::ConfigureCompletion");
     auto device = m_diagnostics->GetDevice();
     auto clStandard = device ? device->GetCLStandard() : "CL";
     auto options = BuildDefaultTranslationOptions(clStandard);
     m_store->SetTranslationOptions(options);
 }
 
-void LSPServerEventsHandler::OnInitialize(const json &data)
+void LSPServerEventsHandler::OnInitialize(const RequestId &id, const InitializeParams &params)
 {
-    logger()->trace("Received 'initialize' request");
-    if (!data.contains("id"))
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'initialize' request");
+    if (id.is_null())
     {
         logger()->error("'initialize' message does not contain 'id'");
         return;
     }
-    auto requestId = data["id"];
 
-    auto configurationCapability = GetNestedValue(data, {"params", "capabilities", "workspace", "configuration"});
-    if (configurationCapability)
+    m_capabilities = params.capabilities;
+    if (params.deviceID)
     {
-        m_capabilities.hasConfigurationCapability = configurationCapability->get<bool>();
+        m_diagnostics->SetOpenCLDevice(*params.deviceID);
+        ConfigureCompletion();
     }
-
-    auto didChangeConfiguration =
-        GetNestedValue(data, {"params", "capabilities", "workspace", "didChangeConfiguration", "dynamicRegistration"});
-    if (didChangeConfiguration)
+    if (params.buildOptions)
     {
-        m_capabilities.supportDidChangeConfiguration = didChangeConfiguration->get<bool>();
+        m_diagnostics->SetBuildOptions(*params.buildOptions);
     }
-
-    auto hasDefinitionLinkSupport = GetNestedValue(data, {"params", "capabilities", "textDocument", "definition", "linkSupport"});
-    auto hasTypeDefinitionLinkSupport = GetNestedValue(data, {"params", "capabilities", "textDocument", "typeDefinition", "linkSupport"});
-    auto hasDeclarationLinkSupport = GetNestedValue(data, {"params", "capabilities", "textDocument", "declaration", "linkSupport"});
-
-    if (hasDefinitionLinkSupport)
+    if (params.maxNumberOfProblems)
     {
-        m_capabilities.hasDefinitionLinkSupport = hasDefinitionLinkSupport->get<bool>();
+        m_diagnostics->SetMaxProblemsCount(*params.maxNumberOfProblems);
     }
-    if (hasTypeDefinitionLinkSupport)
+    if (params.diagnosticsDelay)
     {
-        m_capabilities.hasTypeDefinitionLinkSupport = hasTypeDefinitionLinkSupport->get<bool>();
+        m_diagnosticsDelay = std::chrono::milliseconds(*params.diagnosticsDelay);
     }
-    if (hasDeclarationLinkSupport)
+    if (params.diagnosticsMaxLatency)
     {
-        m_capabilities.hasDeclarationLinkSupport = hasDeclarationLinkSupport->get<bool>();
+        m_diagnosticsMaxLatency = std::chrono::milliseconds(*params.diagnosticsMaxLatency);
     }
-
-    auto configuration = GetNestedValue(data, {"params", "initializationOptions", "configuration"});
-    if (configuration)
+    if (params.memoryBudget || params.maxTranslationUnits || params.idleTimeout)
     {
-        auto buildOptions = GetNestedValue(*configuration, {"buildOptions"});
-        auto maxNumberOfProblems = GetNestedValue(*configuration, {"maxNumberOfProblems"});
-        auto deviceID = GetNestedValue(*configuration, {"deviceID"});
-        if (deviceID)
-        {
-            m_diagnostics->SetOpenCLDevice(*deviceID);
-            ConfigureCompletion();
-        }
-        if (buildOptions)
-        {
-            m_diagnostics->SetBuildOptions(*buildOptions);
-        }
-        if (maxNumberOfProblems)
-        {
-            m_diagnostics->SetMaxProblemsCount(*maxNumberOfProblems);
-        }
+        // Clamp before scaling, a client value too large for the unit would wrap around
+        constexpr uint64_t bytesPerMiB = 1024 * 1024;
+        constexpr uint64_t maxIdleSeconds =
+            static_cast<uint64_t>(std::chrono::milliseconds::max().count()) / 1000;
+        TranslationUnitLimits limits;
+        limits.memoryBudget =
+            std::min(params.memoryBudget.value_or(0), std::numeric_limits<uint64_t>::max() / bytesPerMiB) * bytesPerMiB;
+        limits.maxTranslationUnits = static_cast<size_t>(params.maxTranslationUnits.value_or(0));
+        limits.idleTimeout = std::chrono::seconds(std::min(params.idleTimeout.value_or(0), maxIdleSeconds));
+        m_store->SetLimits(limits);
+        m_limitsEnabled = true;
+        m_idleTimeout = limits.idleTimeout;
     }
 
     json capabilities = {
         {"textDocumentSync",
          {
              {"openClose", true},
-             {"change", 1}, // TextDocumentSyncKind.Full
+             {"change", 2}, // TextDocumentSyncKind.Incremental
              {"willSave", false},
              {"willSaveWaitUntil", false},
              {"save", false},
@@ -285,16 +734,16 @@ void LSPServerEventsHandler::OnInitialize(const json &data)
          {"declarationProvider", true}
     };
 
-    m_outQueue.push({{"id", requestId}, {"result", {{"capabilities", capabilities}}}});
+    Respond(json {{"id", id}, {"result", {{"capabilities", capabilities}}}});
 }
 
-void LSPServerEventsHandler::OnInitialized(const json &)
+void LSPServerEventsHandler::OnInitialized()
 {
-    logger()->trace("Received 'initialized' message");
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'initialized' message");
 
     if (!m_capabilities.supportDidChangeConfiguration)
     {
-        logger()->trace("Does not support didChangeConfiguration registration");
+        SPDLOG_LOGGER_TRACE(logger(), "Does not support didChangeConfiguration registration");
         return;
     }
 
@@ -307,236 +756,344 @@ void LSPServerEventsHandler::OnInitialized(const json &)
         {"registrations", registrations},
     };
 
-    m_outQueue.push({{"id", m_generator->GenerateID()}, {"method", "client/registerCapability"}, {"params", params}});
+    Respond(
+        json {{"id", m_generator->GenerateID()}, {"method", "client/registerCapability"}, {"params", params}});
 }
 
 void LSPServerEventsHandler::BuildDiagnosticsRespond(
-    const std::string &uri, const std::string &filePath, const std::string &content)
+    const std::string &uri, const Source &source, const CancellationToken &token)
 {
     try
     {
-        json diags = m_diagnostics->GetDiagnostics({filePath, content});
-        m_outQueue.push(
-            {{"method", "textDocument/publishDiagnostics"},
-             {"params",
-              {
-                  {"uri", uri},
-                  {"diagnostics", diags},
-              }}});
+        const auto diagnostics = m_diagnostics->GetDiagnostics(source, token);
+        if (token.IsCancelled())
+        {
+            // The diagnostics of the newer version are published instead
+            return;
+        }
+        JsonWriter writer;
+        writer.StartObject();
+        writer.Key("jsonrpc").String("2.0");
+        writer.Key("method").String("textDocument/publishDiagnostics");
+        writer.Key("params").StartObject();
+        writer.Key("uri").String(uri);
+        writer.Key("diagnostics").StartArray();
+        for (const auto &diagnostic : diagnostics)
+        {
+            diagnostic.writeJson(writer);
+        }
+        writer.EndArray();
+        writer.EndObject();
+        writer.EndObject();
+        Respond(SerializedMessage {writer.Release()});
     }
     catch (std::exception &err)
     {
         auto msg = std::string("Failed to get diagnostics: ") + err.what();
         logger()->error(msg);
-        m_jrpc->WriteError(JRPCErrorCode::InternalError, msg);
+        // Diagnostics are not requested, there is no id to respond to, so the user is told instead.
+        // MessageType 1 is Error
+        Respond(json {{"method", "window/showMessage"}, {"params", {{"type", 1}, {"message", msg}}}});
     }
 }
 
-nlohmann::json LSPServerEventsHandler::BuildDefinitionRespond(const json &data, bool typeDefinition)
+void LSPServerEventsHandler::BuildDefinitionRespond(
+    const RequestId &id, const TextDocumentPositionParams &params, bool typeDefinition, const CancellationToken &token)
 {
-    nlohmann::json result = nlohmann::json::array();
+    LocationResult targets;
     try
     {
-        auto uri = GetNestedValue(data, {"params", "textDocument", "uri"});
-        auto character = GetNestedValue(data, {"params", "position", "character"});
-        auto line = GetNestedValue(data, {"params", "position", "line"});
-        if (uri && character && line)
-        {
-            const auto filePath = utils::UriToFilePath(*uri);
-            // Convert zero-based values to one-based
-            const unsigned lineno = static_cast<unsigned>(*line) + 1;
-            const unsigned columnno = static_cast<unsigned>(*character) + 1;
-            auto targets = typeDefinition 
-                         ? m_typeDefinition->GetTypeDefinitions(filePath, lineno, columnno) 
-                         : m_definition->GetDefinitions(filePath, lineno, columnno);
-            const bool hasLinkSupport = typeDefinition ? m_capabilities.hasTypeDefinitionLinkSupport : m_capabilities.hasDefinitionLinkSupport;
-            for (const auto &target : targets) {
-                // a. LocationLink — richer, includes target's full range + narrow selection range
-                // b. Location — the pre-3.14 plain form; use the narrow selection
-                //    range since plain Location has no room for a separate full range.
-                result.emplace_back(target.toJson(hasLinkSupport));
-            }
-        }
+        const auto filePath = utils::UriToFilePath(params.uri);
+        // Convert zero-based values to one-based
+        const unsigned lineno = params.line + 1;
+        const unsigned columnno = params.character + 1;
+        targets = typeDefinition 
+                ? m_typeDefinition->GetTypeDefinitions(filePath, lineno, columnno) 
+                : m_definition->GetDefinitions(filePath, lineno, columnno, token);
     }
     catch (std::exception &err)
     {
         auto msg = std::string("Failed to get definition: ") + err.what();
         logger()->error(msg);
-        m_jrpc->WriteError(JRPCErrorCode::InternalError, msg);
+        RespondError(id, JRPCErrorCode::InternalError, msg);
+        return;
+    }
+
+    if (token.IsCancelled())
+    {
+        RespondCancelled(id);
+        return;
     }
-    return result;
+
+    if (IsStale(params.uri, targets))
+    {
+        NotifyStale(id, params.uri);
+    }
+    const bool hasLinkSupport = typeDefinition ? m_capabilities.hasTypeDefinitionLinkSupport : m_capabilities.hasDefinitionLinkSupport;
+    Respond(SerializeRespond(id, 0, [&](JsonWriter &writer) {
+        writer.StartArray();
+        for (const auto &target : targets.locations)
+        {
+            // a. LocationLink — richer, includes target's full range + narrow selection range
+            // b. Location — the pre-3.14 plain form; use the narrow selection
+            //    range since plain Location has no room for a separate full range.
+            target.writeJson(writer, hasLinkSupport);
+        }
+        writer.EndArray();
+    }));
 }
 
-nlohmann::json LSPServerEventsHandler::BuildDeclarationRespond(const json &data)
+void LSPServerEventsHandler::BuildDeclarationRespond(const RequestId &id, const TextDocumentPositionParams &params)
 {
-    nlohmann::json result = nlohmann::json::array();
+    LocationResult targets;
     try
     {
-        auto uri = GetNestedValue(data, {"params", "textDocument", "uri"});
-        auto character = GetNestedValue(data, {"params", "position", "character"});
-        auto line = GetNestedValue(data, {"params", "position", "line"});
-        if (uri && character && line)
-        {
-            const auto filePath = utils::UriToFilePath(*uri);
-            // Convert zero-based values to one-based
-            const unsigned lineno = static_cast<unsigned>(*line) + 1;
-            const unsigned columnno = static_cast<unsigned>(*character) + 1;
-            auto targets = m_declaration->GetDeclarations(filePath, lineno, columnno);
-            for (const auto &target : targets)
-            {
-                result.emplace_back(target.toJson(m_capabilities.hasDeclarationLinkSupport));
-            }
-        }
+        const auto filePath = utils::UriToFilePath(params.uri);
+        // Convert zero-based values to one-based
+        const unsigned lineno = params.line + 1;
+        const unsigned columnno = params.character + 1;
+        targets = m_declaration->GetDeclarations(filePath, lineno, columnno);
     }
     catch (std::exception &err)
     {
         auto msg = std::string("Failed to get declaration: ") + err.what();
         logger()->error(msg);
-        m_jrpc->WriteError(JRPCErrorCode::InternalError, msg);
+        RespondError(id, JRPCErrorCode::InternalError, msg);
+        return;
+    }
+
+    if (IsStale(params.uri, targets))
+    {
+        NotifyStale(id, params.uri);
     }
-    return result;
+    Respond(SerializeRespond(id, 0, [&](JsonWriter &writer) {
+        writer.StartArray();
+        for (const auto &target : targets.locations)
+        {
+            target.writeJson(writer, m_capabilities.hasDeclarationLinkSupport);
+        }
+        writer.EndArray();
+    }));
 }
 
-void LSPServerEventsHandler::BuildCompletionRespond(const json &data)
+void LSPServerEventsHandler::BuildCompletionRespond(
+    const RequestId &id, const TextDocumentPositionParams &params, const CancellationToken &token)
 {
     try
     {
-        auto uri = GetNestedValue(data, {"params", "textDocument", "uri"});
-        auto triggerKind = GetNestedValue(data, {"params", "context", "triggerKind"});
-        auto character = GetNestedValue(data, {"params", "position", "character"});
-        auto line = GetNestedValue(data, {"params", "position", "line"});
-        nlohmann::json completionItems = nlohmann::json::array();
-        m_completionCache.clear();
-
-        if (uri && character && line)
+        const auto filePath = utils::UriToFilePath(params.uri);
+        // Convert zero-based values to one-based
+        auto completions = m_completion->GetCompletions(filePath, params.line + 1, params.character + 1, token);
+        if (token.IsCancelled())
         {
-            const auto filePath = utils::UriToFilePath(*uri);
-            const unsigned lineno = static_cast<unsigned>(*line);
-            const unsigned columnno = static_cast<unsigned>(*character);
-            // Convert zero-based values to one-based
-            auto completions = m_completion->GetCompletions(filePath, lineno + 1, columnno + 1);
+            // Keep the cache of the previous completion, its items may still be resolved
+            RespondCancelled(id);
+            return;
+        }
+
+        // Return CompletionList with isIncomplete flag
+        auto respond = SerializeRespond(id, completions.size() * CompletionItemSizeHint, [&](JsonWriter &writer) {
+            writer.StartObject();
+            writer.Key("isIncomplete").Bool(false);
+            writer.Key("items").StartArray();
+            for (const auto &item : completions)
+            {
+                // Return only basic info for quick display
+                item.writeJsonIncomplete(writer);
+            }
+            writer.EndArray();
+            writer.EndObject();
+        });
 
+        {
+            std::lock_guard<std::mutex> lock(m_completionCacheMutex);
+            m_completionCache.clear();
             for (auto &item : completions)
             {
-                const auto key = item.makeKey();
                 // Cache full result for later resolution
-                m_completionCache[key] = item;
-                // Return only basic info for quick display
-                completionItems.emplace_back(item.toJsonIncomplete());
+                auto key = item.makeKey();
+                m_completionCache[std::move(key)] = std::move(item);
             }
         }
-
-        // Return CompletionList with isIncomplete flag
-        nlohmann::json result = {{"isIncomplete", false}, {"items", completionItems}};
-        m_outQueue.push({{"id", data["id"]}, {"result", result}});
+        Respond(std::move(respond));
     }
     catch (std::exception &err)
     {
         auto msg = std::string("Failed to get completion: ") + err.what();
         logger()->error(msg);
-        m_jrpc->WriteError(JRPCErrorCode::InternalError, msg);
+        RespondError(id, JRPCErrorCode::InternalError, msg);
     }
 }
 
-void LSPServerEventsHandler::ResolveCompletion(const json &data)
+void LSPServerEventsHandler::ResolveCompletion(const RequestId &id, const CompletionResolveParams &params)
 {
     try
     {
-        auto label = GetNestedValue(data, {"params", "label"});
-        auto index = GetNestedValue(data, {"params", "data", "index"});
-        if (label && index)
+        if (params.label && params.index)
         {
-            auto key = CompletionResult::makeKey(label->get<std::string>(), index->get<unsigned>());
+            auto key = CompletionResult::makeKey(*params.label, *params.index);
+            std::lock_guard<std::mutex> lock(m_completionCacheMutex);
             auto it = m_completionCache.find(key);
             if (it != m_completionCache.end())
             {
                 // Return full completion item with all details
-                m_outQueue.push({{"id", data["id"]}, {"result", it->second.toJson()}});
+                Respond(SerializeRespond(id, CompletionItemSizeHint, [&](JsonWriter &writer) {
+                    it->second.writeJson(writer);
+                }));
                 return;
             }
         }
         logger()->warn("Cache missed in 'completionItem/resolve'");
         // Fallback: return params if not in cache
-        m_outQueue.push({{"id", data["id"]}, {"result", data["params"]}});
+        Respond(json {{"id", id}, {"result", params.item}});
     }
     catch (std::exception &err)
     {
         auto msg = std::string("Failed to resolve completion: ") + err.what();
         logger()->error(msg);
-        m_jrpc->WriteError(JRPCErrorCode::InternalError, msg);
+        RespondError(id, JRPCErrorCode::InternalError, msg);
     }
 }
 
-void LSPServerEventsHandler::OnTextOpen(const json &data)
+void LSPServerEventsHandler::OnTextOpen(DidOpenTextDocumentParams &&params)
 {
-    logger()->trace("Received 'textOpen' message");
-    auto uriParam = GetNestedValue(data, {"params", "textDocument", "uri"});
-    auto contentParam = GetNestedValue(data, {"params", "textDocument", "text"});
-    if (uriParam && contentParam)
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'textOpen' message");
+    Source source {utils::UriToFilePath(params.uri), std::move(params.text)};
+    SPDLOG_LOGGER_TRACE(logger(), "'{}' -> '{}'", params.uri, source.filePath);
+    SealPendingChanges(params.uri);
+    auto parsed = std::make_shared<std::promise<void>>();
     {
-        const auto uri = uriParam->get<std::string>();
-        const auto filePath = utils::UriToFilePath(uri);
-        const auto content = contentParam->get<std::string>();
-        logger()->trace("'{}' -> '{}'", uri, filePath);
-        m_store->OnFileOpen(filePath, content);
-        BuildDiagnosticsRespond(uri, filePath, content);
+        std::lock_guard<std::mutex> lock(m_documentsMutex);
+        m_documentUris[source.filePath] = params.uri;
+        m_parses[params.uri] = parsed->get_future().share();
+        m_openedAt[params.uri] = std::chrono::steady_clock::now();
     }
+    // The store and the diagnostics build run concurrently, so each of them gets its own copy of the text.
+    // Parses of different documents run on different workers, a request waits only for the parse of its document.
+    m_scheduler->Schedule(
+        TaskPriority::background,
+        params.uri,
+        [this, uri = params.uri, filePath = source.filePath, text = source.text, parsed]() mutable {
+            TraceContext context(json(), uri);
+            TraceSpan span("textDocument/didOpen", "worker");
+            m_store->OnFileOpen(filePath, std::move(text));
+            parsed->set_value();
+            EnforceTranslationUnitLimits();
+        });
+    ScheduleDiagnostics(params.uri, std::move(source), false);
 }
 
-void LSPServerEventsHandler::OnTextChanged(const json &data)
+void LSPServerEventsHandler::OnTextChanged(DidChangeTextDocumentParams &&params)
 {
-    logger()->trace("Received 'textChanged' message");
-    auto uriParam = GetNestedValue(data, {"params", "textDocument", "uri"});
-    auto contentChanges = GetNestedValue(data, {"params", "contentChanges"});
-    if (contentChanges && contentChanges->size() > 0)
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'textChanged' message");
+    std::shared_ptr<std::vector<TextChange>> pending;
     {
-        // Only one content change with the full content of the document is supported.
-        auto lastIdx = contentChanges->size() - 1;
-        auto lastContent = (*contentChanges)[lastIdx];
-        if (lastContent.contains("text"))
+        std::lock_guard<std::mutex> lock(m_changesMutex);
+        auto it = m_pendingChanges.find(params.uri);
+        if (it != m_pendingChanges.end())
         {
-            auto text = lastContent["text"].get<std::string>();
-            const auto uri = uriParam->get<std::string>();
-            const auto filePath = utils::UriToFilePath(uri);
-            logger()->trace("'{}' -> '{}'", uri, filePath);
-            m_store->OnFileChange(filePath, text);
-            BuildDiagnosticsRespond(uri, filePath, text);
+            // The store update has not started yet, it applies these changes too with a single reparse
+            auto &changes = *it->second;
+            std::move(params.contentChanges.begin(), params.contentChanges.end(), std::back_inserter(changes));
+            return;
         }
+        pending = std::make_shared<std::vector<TextChange>>(std::move(params.contentChanges));
+        m_pendingChanges.emplace(params.uri, pending);
+        m_queuedUpdates[params.uri]++;
     }
+
+    const auto filePath = utils::UriToFilePath(params.uri);
+    SPDLOG_LOGGER_TRACE(logger(), "'{}' -> '{}'", params.uri, filePath);
+    m_scheduler->Schedule(TaskPriority::background, params.uri, [this, uri = params.uri, filePath, pending]() {
+        TraceContext context(json(), uri);
+        TraceSpan span("textDocument/didChange", "worker");
+        std::vector<TextChange> changes;
+        {
+            std::lock_guard<std::mutex> lock(m_changesMutex);
+            auto it = m_pendingChanges.find(uri);
+            if (it != m_pendingChanges.end() && it->second == pending)
+            {
+                m_pendingChanges.erase(it);
+            }
+            changes = std::move(*pending);
+        }
+        m_store->OnFileChange(filePath, std::move(changes));
+        {
+            std::lock_guard<std::mutex> lock(m_changesMutex);
+            auto it = m_queuedUpdates.find(uri);
+            if (it != m_queuedUpdates.end() && --it->second == 0)
+            {
+                m_queuedUpdates.erase(it);
+            }
+        }
+        EnforceTranslationUnitLimits();
+
+        // The client sends only the edits, the build takes the text the store has just joined
+        const auto content = m_store->GetContent(filePath);
+        if (!content)
+        {
+            logger()->warn("Content of {} is not available for diagnostics", uri);
+            return;
+        }
+        ScheduleDiagnostics(uri, Source {filePath, *content}, true);
+    });
 }
 
-void LSPServerEventsHandler::OnTextClose(const json &data)
+void LSPServerEventsHandler::OnTextClose(const DidCloseTextDocumentParams &params)
 {
-    logger()->trace("Received 'textClose' message");
-    auto uriParam = GetNestedValue(data, {"params", "textDocument", "uri"});
-    if (uriParam)
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'textClose' message");
+    const auto filePath = utils::UriToFilePath(params.uri);
+    SPDLOG_LOGGER_TRACE(logger(), "'{}' -> '{}'", params.uri, filePath);
+    SealPendingChanges(params.uri);
     {
-        const auto uri = uriParam->get<std::string>();
-        const auto filePath = utils::UriToFilePath(uri);
-        logger()->trace("'{}' -> '{}'", uri, filePath);
-        m_store->OnFileClose(filePath);
+        std::lock_guard<std::mutex> lock(m_cancellationMutex);
+        auto pending = m_pendingDiagnostics.find(params.uri);
+        if (pending != m_pendingDiagnostics.end())
+        {
+            pending->second.Cancel();
+            m_pendingDiagnostics.erase(pending);
+        }
     }
+    {
+        std::lock_guard<std::mutex> lock(m_documentsMutex);
+        m_documentUris.erase(filePath);
+        m_parses.erase(params.uri);
+        m_openedAt.erase(params.uri);
+    }
+    m_scheduler->Schedule(TaskPriority::background, params.uri, [this, filePath]() { m_store->OnFileClose(filePath); });
 }
 
-void LSPServerEventsHandler::OnDefinition(const json &data)
+void LSPServerEventsHandler::OnDefinition(const RequestId &id, const TextDocumentPositionParams &params)
 {
-    logger()->trace("Received 'definition' message");
-    nlohmann::json result = BuildDefinitionRespond(data, false);
-    m_outQueue.push({{"id", data["id"]}, {"result", result}});
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'definition' message");
+    ScheduleRequest(
+        id,
+        "textDocument/definition",
+        params.uri,
+        [this, id, params](const CancellationToken &token) { BuildDefinitionRespond(id, params, false, token); },
+        true);
 }
 
-void LSPServerEventsHandler::OnTypeDefinition(const json &data)
+void LSPServerEventsHandler::OnTypeDefinition(const RequestId &id, const TextDocumentPositionParams &params)
 {
-    logger()->trace("Received 'typeDefinition' message");
-    nlohmann::json result = BuildDefinitionRespond(data, true);
-    m_outQueue.push({{"id", data["id"]}, {"result", result}});
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'typeDefinition' message");
+    ScheduleRequest(
+        id,
+        "textDocument/typeDefinition",
+        params.uri,
+        [this, id, params](const CancellationToken &token) { BuildDefinitionRespond(id, params, true, token); },
+        true);
 }
 
-void LSPServerEventsHandler::OnDeclaration(const json &data)
+void LSPServerEventsHandler::OnDeclaration(const RequestId &id, const TextDocumentPositionParams &params)
 {
-    logger()->trace("Received 'declaration' message");
-    nlohmann::json result = BuildDeclarationRespond(data);
-    m_outQueue.push({{"id", data["id"]}, {"result", result}});
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'declaration' message");
+    ScheduleRequest(
+        id,
+        "textDocument/declaration",
+        params.uri,
+        [this, id, params](const CancellationToken &) { BuildDeclarationRespond(id, params); },
+        true);
 }
 
 //{
@@ -556,23 +1113,40 @@ void LSPServerEventsHandler::OnDeclaration(const json &data)
 //        }
 //    }
 //}
-void LSPServerEventsHandler::OnCompletion(const json &data)
+void LSPServerEventsHandler::OnCompletion(const RequestId &id, const TextDocumentPositionParams &params)
 {
-    logger()->trace("Received 'completion' message");
-    BuildCompletionRespond(data);
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'completion' message");
+    ScheduleRequest(id, "textDocument/completion", params.uri, [this, id, params](const CancellationToken &token) {
+        BuildCompletionRespond(id, params, token);
+        std::optional<std::chrono::steady_clock::time_point> openedAt;
+        {
+            std::lock_guard<std::mutex> lock(m_documentsMutex);
+            auto it = m_openedAt.find(params.uri);
+            if (it != m_openedAt.end())
+            {
+                openedAt = it->second;
+                m_openedAt.erase(it);
+            }
+        }
+        if (openedAt)
+        {
+            GetStatistics().Of(Probe::openToFirstCompletion).Record(NanosecondsSince(*openedAt));
+        }
+    });
 }
 
 // {"jsonrpc":"2.0","id":19,"method":"completionItem/resolve","params":{"label":"getChannel","detail":"int (__private
 // uint rgb, __private int channel)","insertTextFormat":1,"kind":3,"sortText":"00050","data":{"index":4244}}}
-void LSPServerEventsHandler::OnResolveCompletion(const json &data)
+void LSPServerEventsHandler::OnResolveCompletion(const RequestId &id, const CompletionResolveParams &params)
 {
-    logger()->trace("Received 'completionItem/resolve' message");
-    ResolveCompletion(data);
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'completionItem/resolve' message");
+    ScheduleRequest(
+        id, "completionItem/resolve", {}, [this, id, params](const CancellationToken &) { ResolveCompletion(id, params); });
 }
 
 void LSPServerEventsHandler::OnConfiguration(const json &data)
 {
-    logger()->trace("Received 'configuration' respond");
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'configuration' respond");
 
     try
     {
@@ -588,7 +1162,10 @@ void LSPServerEventsHandler::OnConfiguration(const json &data)
             logger()->warn("Unexpected number of options");
             return;
         }
-        
+
+        // Running tasks read the settings and the translation units, wait for them before any update
+        m_scheduler->Drain();
+
         if (result[DeviceID].is_number_integer())
         {
             auto deviceID = result[DeviceID].get<int64_t>();
@@ -616,7 +1193,7 @@ void LSPServerEventsHandler::OnConfiguration(const json &data)
 
 void LSPServerEventsHandler::OnRespond(const json &data)
 {
-    logger()->trace("Received client respond");
+    SPDLOG_LOGGER_TRACE(logger(), "Received client respond");
     if (m_requests.empty())
     {
         logger()->warn("Unexpected respond {}", data.dump());
@@ -644,26 +1221,52 @@ void LSPServerEventsHandler::OnRespond(const json &data)
 }
 
 // {"jsonrpc":"2.0","method":"$/cancelRequest","params":{"id":1}}
-void LSPServerEventsHandler::OnCancel(const json &data)
+void LSPServerEventsHandler::OnCancel(const CancelParams &params)
 {
-    auto id = GetNestedValue(data, {"params", "id"});
-    if (id)
+    const auto requestKey = params.id.dump();
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'cancel' notification: {}", requestKey);
+    // The request replies with RequestCancelled at its next checkpoint
+    std::lock_guard<std::mutex> lock(m_cancellationMutex);
+    auto pending = m_pendingRequests.find(requestKey);
+    if (pending == m_pendingRequests.end())
     {
-        logger()->trace("Received 'cancel' notification: {}", id->get<int64_t>());
-        // TODO: Cancel request when/if multi-threaded mode is enabled
+        SPDLOG_LOGGER_TRACE(logger(), "Request {} is already completed", requestKey);
+        return;
     }
+    pending->second.Cancel();
 }
 
-void LSPServerEventsHandler::OnShutdown(const json &data)
+void LSPServerEventsHandler::OnShutdown(const RequestId &id)
 {
-    logger()->trace("Received 'shutdown' request");
-    m_outQueue.push({{"id", data["id"]}, {"result", nullptr}});
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'shutdown' request");
+    // Let the requests received before 'shutdown' complete
+    m_scheduler->Drain();
+    Respond(json {{"id", id}, {"result", nullptr}});
     m_shutdown = true;
 }
 
+void LSPServerEventsHandler::OnStats(const RequestId &id)
+{
+    SPDLOG_LOGGER_TRACE(logger(), "Received '$/ocls/stats' request");
+    Respond(json {{"id", id}, {"result", GetStatistics().ToJson()}});
+}
+
+void LSPServerEventsHandler::OnMemory(const RequestId &id)
+{
+    SPDLOG_LOGGER_TRACE(logger(), "Received '$/ocls/memory' request");
+    uint64_t total = 0;
+    auto translationUnits = json::array();
+    for (const auto &memory : m_store->GetMemoryUsage())
+    {
+        total += memory.total;
+        translationUnits.emplace_back(ToJson(memory));
+    }
+    Respond(json {{"id", id}, {"result", {{"totalBytes", total}, {"translationUnits", std::move(translationUnits)}}}});
+}
+
 void LSPServerEventsHandler::OnExit()
 {
-    logger()->trace("Received 'exit', after 'shutdown': {}", utils::FormatBool(m_shutdown));
+    SPDLOG_LOGGER_TRACE(logger(), "Received 'exit', after 'shutdown': {}", utils::FormatBool(m_shutdown));
     if (m_shutdown)
     {
         m_exitHandler->OnExit(EXIT_SUCCESS);
@@ -678,114 +1281,107 @@ void LSPServerEventsHandler::OnExit()
 
 int LSPServer::Run()
 {
-    logger()->trace("Setting up...");
+    SPDLOG_LOGGER_TRACE(logger(), "Setting up...");
+    // The callbacks are invoked only while Run keeps the server alive, capturing 'self' in them
+    // would form a reference cycle through the jrpc and the scheduler that outlives the session
     auto self = this->shared_from_this();
     // clang-format off
-    // Register handlers for methods
-    m_jrpc->RegisterMethodCallback("initialize", [self](const json &request)
-    {
-        self->m_handler->OnInitialize(request);
-    });
-    m_jrpc->RegisterMethodCallback("initialized", [self](const json &request)
-    {
-        self->m_handler->OnInitialized(request);
-    });
-    m_jrpc->RegisterMethodCallback("shutdown", [self](const json &request)
-    {
-        self->m_handler->OnShutdown(request);
-    });
-    m_jrpc->RegisterMethodCallback("exit", [self](const json &)
-    {
-        self->m_handler->OnExit();
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/didOpen", [self](const json &request)
-    {
-        self->m_handler->OnTextOpen(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/didChange", [self](const json &request)
-    {
-        self->m_handler->OnTextChanged(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/didClose", [self](const json &request)
-    {
-        self->m_handler->OnTextClose(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/definition", [self](const json &request)
-    {
-        self->m_handler->OnDefinition(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/typeDefinition", [self](const json &request)
-    {
-        self->m_handler->OnTypeDefinition(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/declaration", [self](const json &request)
-    {
-        self->m_handler->OnDeclaration(request);
-    });
-    m_jrpc->RegisterMethodCallback("textDocument/completion", [self](const json &request)
-    {
-        self->m_handler->OnCompletion(request);
-    });
-    m_jrpc->RegisterMethodCallback("completionItem/resolve", [self](const json &request)
-    {
-        self->m_handler->OnResolveCompletion(request);
-    });
-    m_jrpc->RegisterMethodCallback("workspace/didChangeConfiguration", [self](const json &)
-    {
-        self->m_handler->GetConfiguration();
-    });
-    m_jrpc->RegisterMethodCallback("$/cancelRequest", [self](const json &request)
+    // Dispatch methods through the static method table
+    m_jrpc->RegisterDispatcher([this](const JRPCMessage &message)
     {
-        self->m_handler->OnCancel(request);
+        return Dispatch(message);
     });
     // Register handler for client responds
-    m_jrpc->RegisterInputCallback([self](const json &respond)
+    m_jrpc->RegisterInputCallback([this](const JRPCMessage &respond)
     {
-        self->m_handler->OnRespond(respond);
-    });
-    // Register handler for message delivery
-    m_jrpc->RegisterOutputCallback([](const std::string &message)
-    {
-        #if defined(WIN32)
-            printf_s("%s", message.c_str());
-            fflush(stdout);
-        #else
-            std::cout << message << std::flush;
-        #endif    
+        m_handler->OnRespond(respond.Json());
     });
+    // Register writer for message delivery, it frames and writes responses on its own thread
+    m_writer = CreateMessageWriter(m_transport.output);
+    m_jrpc->RegisterOutputWriter(m_writer);
     // clang-format on
 
-    logger()->trace("Listening...");
-    char c;
-    while (std::cin.get(c))
+    m_writer->Start();
+    // Deliver responses as soon as a task produces them
+    m_scheduler->Start([this] { WriteResponses(); });
+    SPDLOG_LOGGER_TRACE(logger(), "Listening...");
+    std::vector<char> buffer(InputBufferSize);
+    while (true)
     {
+        const auto count = ReadInput(m_transport.input, buffer.data(), buffer.size());
         if (m_interrupted.load())
         {
+            m_scheduler->Stop();
+            m_writer->Stop();
             return EINTR;
         }
-        m_jrpc->Consume(c);
-        if (m_jrpc->IsReady())
+        if (count <= 0)
+        {
+            break;
+        }
+
+        std::string_view chunk(buffer.data(), static_cast<size_t>(count));
+        while (!chunk.empty())
         {
-            m_jrpc->Reset();
-            while (true)
+            chunk.remove_prefix(m_jrpc->Consume(chunk));
+            if (m_jrpc->IsReady())
             {
-                auto data = m_handler->GetNextResponse();
-                if (!data.has_value())
-                {
-                    break;
-                }
-                m_jrpc->Write(*data);
+                m_jrpc->Reset();
+                WriteResponses();
             }
         }
     }
+    m_scheduler->Drain();
+    m_scheduler->Stop();
+    m_writer->Stop();
     return 0;
 }
 
+void LSPServer::WriteResponses()
+{
+    std::lock_guard<std::mutex> lock(m_responsesMutex);
+    while (true)
+    {
+        auto data = m_handler->GetNextResponse();
+        if (!data.has_value())
+        {
+            break;
+        }
+        std::visit([this](auto &&message) { m_jrpc->Write(std::move(message)); }, std::move(*data));
+    }
+}
+
+bool LSPServer::Dispatch(const JRPCMessage &message)
+{
+    const auto method = message.Method();
+    const auto entry = std::lower_bound(
+        std::begin(MethodTable), std::end(MethodTable), method, [](const MethodEntry &entry, std::string_view name) {
+            return entry.method < name;
+        });
+    if (entry == std::end(MethodTable) || entry->method != method)
+    {
+        return false;
+    }
+
+    SPDLOG_LOGGER_TRACE(logger(), "Dispatching method: '{}'", method);
+    entry->handle({*m_handler, *m_jrpc, *m_writer}, message);
+    return true;
+}
+
 void LSPServer::Interrupt()
 {
     m_interrupted.store(true);
 }
 
+LSPTransport CreateStdioTransport()
+{
+#if defined(WIN32)
+    return LSPTransport {_fileno(stdin), CreateStdoutSink()};
+#else
+    return LSPTransport {STDIN_FILENO, CreateStdoutSink()};
+#endif
+}
+
 std::shared_ptr<ILSPServerEventsHandler> CreateLSPEventsHandler(
     std::shared_ptr<IJsonRPC> jrpc,
     std::shared_ptr<ITranslationUnitStore> store,
@@ -795,15 +1391,31 @@ std::shared_ptr<ILSPServerEventsHandler> CreateLSPEventsHandler(
     std::shared_ptr<ITypeDefinition> typeDefinition,
     std::shared_ptr<IDeclaration> declaration,
     std::shared_ptr<utils::IGenerator> generator,
-    std::shared_ptr<utils::IExitHandler> exitHandler)
+    std::shared_ptr<utils::IExitHandler> exitHandler,
+    std::shared_ptr<IScheduler> scheduler)
 {
-    return std::make_shared<LSPServerEventsHandler>(std::move(jrpc), std::move(store), std::move(diagnostics), std::move(completion), std::move(definition), std::move(typeDefinition), std::move(declaration), std::move(generator), std::move(exitHandler));
+    return std::make_shared<LSPServerEventsHandler>(std::move(jrpc), std::move(store), std::move(diagnostics), std::move(completion), std::move(definition), std::move(typeDefinition), std::move(declaration), std::move(generator), std::move(exitHandler), std::move(scheduler));
 }
 
 std::shared_ptr<ILSPServer> CreateLSPServer(
-    std::shared_ptr<IJsonRPC> jrpc, std::shared_ptr<ITranslationUnitStore> store, std::shared_ptr<ILSPServerEventsHandler> handler)
+    std::shared_ptr<IJsonRPC> jrpc,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ILSPServerEventsHandler> handler,
+    std::shared_ptr<IScheduler> scheduler)
 {
-    return std::make_shared<LSPServer>(std::move(jrpc), std::move(store), std::move(handler));
+    return CreateLSPServer(
+        std::move(jrpc), std::move(store), std::move(handler), std::move(scheduler), CreateStdioTransport());
+}
+
+std::shared_ptr<ILSPServer> CreateLSPServer(
+    std::shared_ptr<IJsonRPC> jrpc,
+    std::shared_ptr<ITranslationUnitStore> store,
+    std::shared_ptr<ILSPServerEventsHandler> handler,
+    std::shared_ptr<IScheduler> scheduler,
+    LSPTransport transport)
+{
+    return std::make_shared<LSPServer>(
+        std::move(jrpc), std::move(store), std::move(handler), std::move(scheduler), std::move(transport));
 }
 
 std::shared_ptr<ILSPServer> CreateLSPServer(
@@ -817,6 +1429,7 @@ std::shared_ptr<ILSPServer> CreateLSPServer(
 {
     auto generator = utils::CreateDefaultGenerator();
     auto exitHandler = utils::CreateDefaultExitHandler();
+    auto scheduler = CreateScheduler();
     auto handler = std::make_shared<LSPServerEventsHandler>(
         jrpc, 
         store, 
@@ -826,12 +1439,15 @@ std::shared_ptr<ILSPServer> CreateLSPServer(
         std::move(typeDefinition),
         std::move(declaration),
         std::move(generator),
-        std::move(exitHandler)
+        std::move(exitHandler),
+        scheduler
     );
     return std::make_shared<LSPServer>(
         std::move(jrpc), 
         std::move(store), 
-        std::move(handler)
+        std::move(handler),
+        std::move(scheduler),
+        CreateStdioTransport()
     );
 }
 
@@ -8,6 +8,7 @@
 #include "commands.hpp"
 #include "clinfo.hpp"
 #include "completion.hpp"
+#include "daemon.hpp"
 #include "definition.hpp"
 #include "typedef.hpp"
 #include "declaration.hpp"
@@ -15,6 +16,7 @@
 #include "jsonrpc.hpp"
 #include "log.hpp"
 #include "lsp.hpp"
+#include "tracing.hpp"
 #include "version.hpp"
 
 #include <CLI/CLI.hpp>
@@ -33,9 +35,9 @@ using namespace ocls;
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::main);
+    return ocls::Loggers::main;
 }
 
 std::shared_ptr<ILSPServer> server;
@@ -71,6 +73,13 @@ int main(int argc, char* argv[])
     bool flagLogTofile = false;
     bool flagStdioMode = true;
     std::string optLogFile = "opencl-language-server.log";
+    std::string optListenSocket;
+    std::string optConnectSocket;
+    std::string optRecordFile;
+    std::string optTraceFile;
+    std::string optASTCacheDir;
+    uint64_t optASTCacheSize = 1024;
+    PreambleStorage optPreambles;
     spdlog::level::level_enum optLogLevel = spdlog::level::trace;
 
     CLI::App app {"OpenCL Language Server\n"
@@ -91,6 +100,38 @@ int main(int argc, char* argv[])
         ->required(false)
         ->capture_default_str();
     app.add_flag("--stdio", flagStdioMode, "Use stdio transport channel for the language server");
+    auto listenOption = app.add_option(
+        "--listen",
+        optListenSocket,
+        "Run as a daemon serving several clients on the Unix domain socket, the clients share translation units and "
+        "the list of devices");
+    app.add_option("--connect", optConnectSocket, "Relay stdio to the daemon listening on the Unix domain socket")
+        ->excludes(listenOption);
+    app.add_option(
+           "--record",
+           optRecordFile,
+           "Record the messages of the stdio session with timestamps, see the 'replay' subcommand")
+        ->excludes(listenOption);
+    app.add_option(
+        "--trace-file",
+        optTraceFile,
+        "Write the spans of message handling, libclang calls and OpenCL builds as Chrome trace events");
+    auto astCacheOption = app.add_option(
+        "--ast-cache",
+        optASTCacheDir,
+        "Keep parsed translation units in the directory between runs, reopened files are restored from it");
+    app.add_option("--ast-cache-size", optASTCacheSize, "Size of the AST cache in MiB")
+        ->needs(astCacheOption)
+        ->capture_default_str();
+    auto preamblesInMemoryFlag = app.add_flag(
+        "--preambles-in-memory",
+        optPreambles.inMemory,
+        "Keep the precompiled preambles of the translation units in memory instead of temporary files");
+    app.add_option(
+           "--preamble-dir",
+           optPreambles.directory,
+           "Directory for the precompiled preambles, e.g. on a tmpfs, the system temporary directory by default")
+        ->excludes(preamblesInMemoryFlag);
     app.add_flag_callback(
         "-v,--version",
         []() {
@@ -103,6 +144,8 @@ int main(int argc, char* argv[])
         std::make_shared<CLInfoSubCommand>(app),
         std::make_shared<DiagnosticsSubCommand>(app),
         std::make_shared<CompletionSubCommand>(app),
+        std::make_shared<ReplaySubCommand>(app),
+        std::make_shared<MemorySubCommand>(app),
         MakeDefinitionSubCommand(app),
         MakeDeclarationSubCommand(app),
         MakeTypeDefinitionSubCommand(app)};
@@ -137,23 +180,78 @@ int main(int argc, char* argv[])
         SetupBinaryStreamMode();
         std::signal(SIGINT, SignalHandler);
 
+        if (!optConnectSocket.empty())
+        {
+            server = CreateLSPProxy(optConnectSocket);
+            result = server->Run();
+            break;
+        }
+
+        if (!optTraceFile.empty())
+        {
+            try
+            {
+                GetTracer().Start(optTraceFile);
+            }
+            catch (std::exception& err)
+            {
+                logger()->error("{}", err.what());
+                result = EXIT_FAILURE;
+                break;
+            }
+        }
+
         auto jrpc = CreateJsonRPC();
+        if (!optRecordFile.empty())
+        {
+            try
+            {
+                jrpc->RegisterRecorder(CreateSessionRecorder(optRecordFile));
+            }
+            catch (std::exception& err)
+            {
+                logger()->error("{}", err.what());
+                result = EXIT_FAILURE;
+                break;
+            }
+        }
         auto clinfo = CreateCLInfo();
         auto diagnostics = CreateDiagnostics(clinfo);
         auto device = diagnostics->GetDevice();
         auto clStandard = device ? device->GetCLStandard() : "CL";
         auto options = BuildDefaultTranslationOptions(clStandard);
-        auto store = CreateTranslationUnitStore();
+        auto store = CreateTranslationUnitStore(optPreambles);
         auto completion = CreateCompletion(store);
         auto definition = CreateDefinition(store);
         auto typeDefinition = CreateTypeDefinition(store);
         auto declaration = CreateDeclaration(store);
+        if (!optASTCacheDir.empty())
+        {
+            try
+            {
+                store->EnableASTCache(optASTCacheDir, optASTCacheSize * 1024 * 1024);
+            }
+            catch (std::exception& err)
+            {
+                logger()->error("{}", err.what());
+                result = EXIT_FAILURE;
+                break;
+            }
+        }
         store->SaveHeaders();
         store->SetTranslationOptions(options);
-        server = CreateLSPServer(jrpc, store, diagnostics, completion, definition, typeDefinition, declaration);
+        if (!optListenSocket.empty())
+        {
+            server = CreateLSPDaemon(optListenSocket, store, clinfo);
+        }
+        else
+        {
+            server = CreateLSPServer(jrpc, store, diagnostics, completion, definition, typeDefinition, declaration);
+        }
         result = server->Run();
     } while (false);
 
+    GetTracer().Stop();
     logger()->info("Shutting down...\n\n");
     spdlog::shutdown();
     return result;
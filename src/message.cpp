@@ -0,0 +1,519 @@
+//
+//  message.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "message.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+/**
+ Forward-only scanner that finds value boundaries without decoding them.
+ Values are not validated here, malformed nested content is reported when it gets materialized.
+ */
+class Scanner
+{
+public:
+    explicit Scanner(std::string_view content) : m_content {content} {}
+
+    size_t Position() const
+    {
+        return m_pos;
+    }
+
+    bool AtEnd()
+    {
+        SkipWhitespace();
+        return m_pos >= m_content.size();
+    }
+
+    bool Consume(char c)
+    {
+        SkipWhitespace();
+        if (m_pos < m_content.size() && m_content[m_pos] == c)
+        {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void Expect(char c)
+    {
+        if (!Consume(c))
+        {
+            Fail(std::string("expected '") + c + "'");
+        }
+    }
+
+    // Returns the string contents without quotes
+    std::string_view String()
+    {
+        Expect('"');
+        const auto begin = m_pos;
+        SkipStringTail();
+        return m_content.substr(begin, m_pos - begin - 1);
+    }
+
+    void SkipValue()
+    {
+        SkipWhitespace();
+        if (m_pos >= m_content.size())
+        {
+            Fail("unexpected end of input");
+        }
+
+        const char c = m_content[m_pos];
+        if (c == '"')
+        {
+            m_pos++;
+            SkipStringTail();
+        }
+        else if (c == '{' || c == '[')
+        {
+            SkipContainer();
+        }
+        else
+        {
+            const auto end = m_content.find_first_of(",}] \t\r\n", m_pos);
+            if (end == m_pos)
+            {
+                Fail("unexpected character");
+            }
+            m_pos = end == std::string_view::npos ? m_content.size() : end;
+        }
+    }
+
+    void SkipWhitespace()
+    {
+        while (m_pos < m_content.size())
+        {
+            const char c = m_content[m_pos];
+            if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            {
+                break;
+            }
+            m_pos++;
+        }
+    }
+
+    [[noreturn]] void Fail(const std::string& reason) const
+    {
+        throw std::invalid_argument("Malformed message at byte " + std::to_string(m_pos) + ": " + reason);
+    }
+
+private:
+    // Moves past the closing quote, m_pos must point right after the opening one
+    void SkipStringTail()
+    {
+        while (true)
+        {
+            const auto quote = m_content.find('"', m_pos);
+            if (quote == std::string_view::npos)
+            {
+                m_pos = m_content.size();
+                Fail("unterminated string");
+            }
+            // The quote is escaped if it is preceded by an odd number of backslashes
+            size_t backslashes = 0;
+            while (quote - backslashes > m_pos && m_content[quote - backslashes - 1] == '\\')
+            {
+                backslashes++;
+            }
+            m_pos = quote + 1;
+            if (backslashes % 2 == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    void SkipContainer()
+    {
+        size_t depth = 0;
+        while (m_pos < m_content.size())
+        {
+            const char c = m_content[m_pos++];
+            if (c == '"')
+            {
+                SkipStringTail();
+            }
+            else if (c == '{' || c == '[')
+            {
+                depth++;
+            }
+            else if ((c == '}' || c == ']') && --depth == 0)
+            {
+                return;
+            }
+        }
+        Fail("unterminated container");
+    }
+
+private:
+    std::string_view m_content;
+    size_t m_pos = 0;
+};
+
+/**
+ SAX consumer that captures scalar values at the given key paths.
+ Only object keys are counted as path elements, arrays are transparent.
+ */
+class FieldExtractor
+{
+public:
+    FieldExtractor(std::initializer_list<JRPCField> fields, std::initializer_list<JRPCArrayField> arrays)
+        : m_fields(fields)
+        , m_arrays(arrays)
+    {}
+
+    const std::string& Error() const
+    {
+        return m_error;
+    }
+
+    bool null()
+    {
+        return true;
+    }
+
+    bool boolean(bool value)
+    {
+        Assign<std::optional<bool>*>(value);
+        return true;
+    }
+
+    bool number_integer(json::number_integer_t value)
+    {
+        Assign<std::optional<int64_t>*>(static_cast<int64_t>(value));
+        return true;
+    }
+
+    bool number_unsigned(json::number_unsigned_t value)
+    {
+        Assign<std::optional<int64_t>*>(static_cast<int64_t>(value));
+        return true;
+    }
+
+    bool number_float(json::number_float_t, const json::string_t&)
+    {
+        return true;
+    }
+
+    bool string(json::string_t& value)
+    {
+        // The parser hands over its own buffer, take it instead of copying
+        Assign<std::optional<std::string>*>(std::move(value));
+        return true;
+    }
+
+    bool binary(json::binary_t&)
+    {
+        return true;
+    }
+
+    bool start_object(std::size_t)
+    {
+        const JRPCArrayField* element = nullptr;
+        for (const auto& array : m_arrays)
+        {
+            if (IsCurrentPath(array.path))
+            {
+                element = &array;
+                for (const auto& field : array.fields)
+                {
+                    std::visit([](auto target) { *target = std::nullopt; }, field.target);
+                }
+                break;
+            }
+        }
+        m_elements.push_back(element);
+        m_keys.emplace_back();
+        return true;
+    }
+
+    bool key(json::string_t& value)
+    {
+        m_keys.back().assign(value);
+        return true;
+    }
+
+    bool end_object()
+    {
+        m_keys.pop_back();
+        if (const auto element = m_elements.back(); element && element->onElement)
+        {
+            element->onElement();
+        }
+        m_elements.pop_back();
+        return true;
+    }
+
+    bool start_array(std::size_t)
+    {
+        return true;
+    }
+
+    bool end_array()
+    {
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const json::exception& ex)
+    {
+        m_error = ex.what();
+        return false;
+    }
+
+private:
+    bool IsCurrentPath(std::initializer_list<std::string_view> path) const
+    {
+        return path.size() == m_keys.size() && std::equal(path.begin(), path.end(), m_keys.begin());
+    }
+
+    template <typename Target, typename Value>
+    void Assign(Value&& value)
+    {
+        if (AssignIn<Target>(m_fields, value))
+        {
+            return;
+        }
+        for (const auto& array : m_arrays)
+        {
+            if (AssignIn<Target>(array.fields, value))
+            {
+                return;
+            }
+        }
+    }
+
+    template <typename Target, typename Value>
+    bool AssignIn(std::initializer_list<JRPCField> fields, Value& value)
+    {
+        for (const auto& field : fields)
+        {
+            const auto target = std::get_if<Target>(&field.target);
+            if (target && IsCurrentPath(field.path))
+            {
+                **target = std::move(value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::initializer_list<JRPCField> m_fields;
+    std::initializer_list<JRPCArrayField> m_arrays;
+    // Key of the current member for each enclosing object
+    std::vector<std::string> m_keys;
+    // Array whose element each enclosing object is, if any
+    std::vector<const JRPCArrayField*> m_elements;
+    std::string m_error;
+};
+
+const json NullValue;
+
+} // namespace
+
+bool IsBatch(std::string_view content)
+{
+    const auto first = content.find_first_not_of(" \t\r\n");
+    return first != std::string_view::npos && content[first] == '[';
+}
+
+std::vector<std::string_view> SplitBatch(std::string_view content)
+{
+    std::vector<std::string_view> items;
+    Scanner scanner(content);
+    scanner.Expect('[');
+    if (!scanner.Consume(']'))
+    {
+        do
+        {
+            scanner.SkipWhitespace();
+            const auto begin = scanner.Position();
+            scanner.SkipValue();
+            items.push_back(content.substr(begin, scanner.Position() - begin));
+        } while (scanner.Consume(','));
+        scanner.Expect(']');
+    }
+    if (!scanner.AtEnd())
+    {
+        scanner.Fail("unexpected trailing content");
+    }
+    return items;
+}
+
+JRPCMessage JRPCMessage::FromView(std::string_view content)
+{
+    JRPCMessage message;
+    message.m_view = content;
+    message.Scan();
+    return message;
+}
+
+JRPCMessage::JRPCMessage(const json& body) : m_storage {body.dump()}, m_owning {true}, m_jsonValue {body}
+{
+    Scan();
+}
+
+bool JRPCMessage::HasMethod() const
+{
+    return m_method.has_value();
+}
+
+std::string_view JRPCMessage::Method() const
+{
+    if (m_decodedMethod)
+    {
+        return *m_decodedMethod;
+    }
+    return m_method ? View(*m_method) : std::string_view {};
+}
+
+bool JRPCMessage::HasId() const
+{
+    return m_id && View(*m_id) != "null";
+}
+
+const json& JRPCMessage::Id() const
+{
+    if (!m_id)
+    {
+        return NullValue;
+    }
+    if (!m_idValue)
+    {
+        const auto raw = View(*m_id);
+        m_idValue = json::parse(raw.begin(), raw.end());
+    }
+    return *m_idValue;
+}
+
+std::string_view JRPCMessage::RawParams() const
+{
+    return m_params ? View(*m_params) : std::string_view {};
+}
+
+const json& JRPCMessage::Params() const
+{
+    if (!m_params)
+    {
+        return NullValue;
+    }
+    if (!m_paramsValue)
+    {
+        if (m_jsonValue)
+        {
+            m_paramsValue = (*m_jsonValue)["params"];
+        }
+        else
+        {
+            const auto raw = View(*m_params);
+            m_paramsValue = json::parse(raw.begin(), raw.end());
+        }
+    }
+    return *m_paramsValue;
+}
+
+const json& JRPCMessage::Json() const
+{
+    if (!m_jsonValue)
+    {
+        const auto raw = Raw();
+        m_jsonValue = json::parse(raw.begin(), raw.end());
+    }
+    return *m_jsonValue;
+}
+
+std::string_view JRPCMessage::Raw() const
+{
+    return m_owning ? std::string_view {m_storage} : m_view;
+}
+
+std::optional<std::string> JRPCMessage::ExtractString(std::initializer_list<std::string_view> path) const
+{
+    std::optional<std::string> result;
+    Decode({{path, &result}});
+    return result;
+}
+
+void JRPCMessage::Decode(std::initializer_list<JRPCField> fields, std::initializer_list<JRPCArrayField> arrays) const
+{
+    if (!m_params)
+    {
+        return;
+    }
+
+    const auto raw = View(*m_params);
+    FieldExtractor extractor(fields, arrays);
+    if (!json::sax_parse(raw.begin(), raw.end(), &extractor))
+    {
+        throw std::runtime_error("Failed to parse params: " + extractor.Error());
+    }
+}
+
+// private
+
+void JRPCMessage::Scan()
+{
+    const auto content = Raw();
+    Scanner scanner(content);
+    scanner.Expect('{');
+    if (!scanner.Consume('}'))
+    {
+        do
+        {
+            const auto key = scanner.String();
+            scanner.Expect(':');
+            scanner.SkipWhitespace();
+            const auto begin = scanner.Position();
+            scanner.SkipValue();
+            const Range range {begin, scanner.Position() - begin};
+            if (key == "method")
+            {
+                if (content[begin] == '"')
+                {
+                    m_method = Range {begin + 1, range.size - 2};
+                }
+            }
+            else if (key == "id")
+            {
+                m_id = range;
+            }
+            else if (key == "params")
+            {
+                m_params = range;
+            }
+        } while (scanner.Consume(','));
+        scanner.Expect('}');
+    }
+    if (!scanner.AtEnd())
+    {
+        scanner.Fail("unexpected trailing content");
+    }
+
+    if (m_method && View(*m_method).find('\\') != std::string_view::npos)
+    {
+        const auto raw = content.substr(m_method->offset - 1, m_method->size + 2);
+        m_decodedMethod = json::parse(raw.begin(), raw.end()).get<std::string>();
+    }
+}
+
+std::string_view JRPCMessage::View(const Range& range) const
+{
+    return Raw().substr(range.offset, range.size);
+}
+
+} // namespace ocls
@@ -0,0 +1,254 @@
+//
+//  protocol.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "protocol.hpp"
+
+#include <limits>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+// Returns a pointer to the nested value or nullptr, nothing is copied
+const json *FindValue(const json &j, std::initializer_list<const char *> keys)
+{
+    const json *current = &j;
+    for (const auto key : keys)
+    {
+        if (!current->is_object())
+        {
+            return nullptr;
+        }
+        auto it = current->find(key);
+        if (it == current->end())
+        {
+            return nullptr;
+        }
+        current = &(*it);
+    }
+    return current;
+}
+
+bool FindFlag(const json &j, std::initializer_list<const char *> keys)
+{
+    const auto value = FindValue(j, keys);
+    return value && value->is_boolean() && value->get<bool>();
+}
+
+std::optional<unsigned> ToUnsigned(const std::optional<int64_t> &value)
+{
+    if (!value || *value < 0)
+    {
+        return std::nullopt;
+    }
+    return static_cast<unsigned>(*value);
+}
+
+} // namespace
+
+std::optional<InitializeParams> InitializeParams::Decode(const JRPCMessage &message)
+{
+    // The message is small and read once per session, the DOM is fine here
+    const auto &params = message.Params();
+    if (!params.is_object())
+    {
+        return std::nullopt;
+    }
+
+    InitializeParams result;
+    auto &capabilities = result.capabilities;
+    capabilities.hasConfigurationCapability = FindFlag(params, {"capabilities", "workspace", "configuration"});
+    capabilities.supportDidChangeConfiguration =
+        FindFlag(params, {"capabilities", "workspace", "didChangeConfiguration", "dynamicRegistration"});
+    capabilities.hasDefinitionLinkSupport =
+        FindFlag(params, {"capabilities", "textDocument", "definition", "linkSupport"});
+    capabilities.hasTypeDefinitionLinkSupport =
+        FindFlag(params, {"capabilities", "textDocument", "typeDefinition", "linkSupport"});
+    capabilities.hasDeclarationLinkSupport =
+        FindFlag(params, {"capabilities", "textDocument", "declaration", "linkSupport"});
+
+    if (const auto configuration = FindValue(params, {"initializationOptions", "configuration"}))
+    {
+        if (const auto buildOptions = FindValue(*configuration, {"buildOptions"}))
+        {
+            result.buildOptions = *buildOptions;
+        }
+        const auto maxNumberOfProblems = FindValue(*configuration, {"maxNumberOfProblems"});
+        if (maxNumberOfProblems && maxNumberOfProblems->is_number_unsigned())
+        {
+            result.maxNumberOfProblems = maxNumberOfProblems->get<uint64_t>();
+        }
+        const auto deviceID = FindValue(*configuration, {"deviceID"});
+        if (deviceID && deviceID->is_number_unsigned()
+            && deviceID->get<uint64_t>() <= std::numeric_limits<uint32_t>::max())
+        {
+            result.deviceID = deviceID->get<uint32_t>();
+        }
+        const auto diagnosticsDelay = FindValue(*configuration, {"diagnosticsDelay"});
+        if (diagnosticsDelay && diagnosticsDelay->is_number_unsigned())
+        {
+            result.diagnosticsDelay = diagnosticsDelay->get<uint64_t>();
+        }
+        const auto diagnosticsMaxLatency = FindValue(*configuration, {"diagnosticsMaxLatency"});
+        if (diagnosticsMaxLatency && diagnosticsMaxLatency->is_number_unsigned())
+        {
+            result.diagnosticsMaxLatency = diagnosticsMaxLatency->get<uint64_t>();
+        }
+        const auto memoryBudget = FindValue(*configuration, {"memoryBudget"});
+        if (memoryBudget && memoryBudget->is_number_unsigned())
+        {
+            result.memoryBudget = memoryBudget->get<uint64_t>();
+        }
+        const auto maxTranslationUnits = FindValue(*configuration, {"maxTranslationUnits"});
+        if (maxTranslationUnits && maxTranslationUnits->is_number_unsigned())
+        {
+            result.maxTranslationUnits = maxTranslationUnits->get<uint64_t>();
+        }
+        const auto idleTimeout = FindValue(*configuration, {"idleTimeout"});
+        if (idleTimeout && idleTimeout->is_number_unsigned())
+        {
+            result.idleTimeout = idleTimeout->get<uint64_t>();
+        }
+    }
+    return result;
+}
+
+std::optional<DidOpenTextDocumentParams> DidOpenTextDocumentParams::Decode(const JRPCMessage &message)
+{
+    std::optional<std::string> uri;
+    std::optional<std::string> text;
+    message.Decode({
+        {{"textDocument", "uri"}, &uri},
+        {{"textDocument", "text"}, &text},
+    });
+    if (!uri || !text)
+    {
+        return std::nullopt;
+    }
+    return DidOpenTextDocumentParams {std::move(*uri), std::move(*text)};
+}
+
+std::optional<DidChangeTextDocumentParams> DidChangeTextDocumentParams::Decode(const JRPCMessage &message)
+{
+    std::optional<std::string> uri;
+    std::vector<TextChange> changes;
+    // Members of the current change, taken over when it ends
+    std::optional<std::string> text;
+    std::optional<int64_t> startLine;
+    std::optional<int64_t> startCharacter;
+    std::optional<int64_t> endLine;
+    std::optional<int64_t> endCharacter;
+    // A change that cannot be applied as sent would silently edit the wrong span
+    bool valid = true;
+    message.Decode(
+        {
+            {{"textDocument", "uri"}, &uri},
+        },
+        {
+            {{"contentChanges"},
+             {
+                 {{"contentChanges", "text"}, &text},
+                 {{"contentChanges", "range", "start", "line"}, &startLine},
+                 {{"contentChanges", "range", "start", "character"}, &startCharacter},
+                 {{"contentChanges", "range", "end", "line"}, &endLine},
+                 {{"contentChanges", "range", "end", "character"}, &endCharacter},
+             },
+             [&]() {
+                 if (!text)
+                 {
+                     valid = false;
+                     return;
+                 }
+                 auto &change = changes.emplace_back();
+                 change.text = std::move(*text);
+                 if (startLine || startCharacter || endLine || endCharacter)
+                 {
+                     const auto fromLine = ToUnsigned(startLine);
+                     const auto fromCharacter = ToUnsigned(startCharacter);
+                     const auto toLine = ToUnsigned(endLine);
+                     const auto toCharacter = ToUnsigned(endCharacter);
+                     if (!fromLine || !fromCharacter || !toLine || !toCharacter)
+                     {
+                         valid = false;
+                         return;
+                     }
+                     change.range = TextRange {{*fromLine, *fromCharacter}, {*toLine, *toCharacter}};
+                 }
+             }},
+        });
+    if (!uri || changes.empty() || !valid)
+    {
+        return std::nullopt;
+    }
+    return DidChangeTextDocumentParams {std::move(*uri), std::move(changes)};
+}
+
+std::optional<DidCloseTextDocumentParams> DidCloseTextDocumentParams::Decode(const JRPCMessage &message)
+{
+    auto uri = message.ExtractString({"textDocument", "uri"});
+    if (!uri)
+    {
+        return std::nullopt;
+    }
+    return DidCloseTextDocumentParams {std::move(*uri)};
+}
+
+std::optional<TextDocumentPositionParams> TextDocumentPositionParams::Decode(const JRPCMessage &message)
+{
+    std::optional<std::string> uri;
+    std::optional<int64_t> line;
+    std::optional<int64_t> character;
+    message.Decode({
+        {{"textDocument", "uri"}, &uri},
+        {{"position", "line"}, &line},
+        {{"position", "character"}, &character},
+    });
+    const auto lineno = ToUnsigned(line);
+    const auto columnno = ToUnsigned(character);
+    if (!uri || !lineno || !columnno)
+    {
+        return std::nullopt;
+    }
+    return TextDocumentPositionParams {std::move(*uri), *lineno, *columnno};
+}
+
+std::optional<CompletionResolveParams> CompletionResolveParams::Decode(const JRPCMessage &message)
+{
+    const auto &params = message.Params();
+    if (!params.is_object())
+    {
+        return std::nullopt;
+    }
+
+    CompletionResolveParams result;
+    result.item = params;
+    const auto label = FindValue(params, {"label"});
+    if (label && label->is_string())
+    {
+        result.label = label->get<std::string>();
+    }
+    const auto index = FindValue(params, {"data", "index"});
+    if (index && index->is_number_unsigned())
+    {
+        result.index = index->get<unsigned>();
+    }
+    return result;
+}
+
+std::optional<CancelParams> CancelParams::Decode(const JRPCMessage &message)
+{
+    const auto id = FindValue(message.Params(), {"id"});
+    if (!id || !(id->is_number_integer() || id->is_string()))
+    {
+        return std::nullopt;
+    }
+    return CancelParams {*id};
+}
+
+} // namespace ocls
@@ -0,0 +1,258 @@
+//
+//  recording.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "recording.hpp"
+#include "log.hpp"
+#include "message.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+const auto& logger()
+{
+    return ocls::Loggers::jrpc;
+}
+
+constexpr char InboundTag[] = "in";
+constexpr char OutboundTag[] = "out";
+constexpr char PublishDiagnosticsMethod[] = "textDocument/publishDiagnostics";
+
+// Calls func for every message of body, the items of a batch are visited one by one
+template <typename Func>
+void ForEachMessage(std::string_view body, Func&& func)
+{
+    try
+    {
+        if (!IsBatch(body))
+        {
+            func(JRPCMessage::FromView(body));
+            return;
+        }
+        for (const auto item : SplitBatch(body))
+        {
+            func(JRPCMessage::FromView(item));
+        }
+    }
+    catch (std::exception& err)
+    {
+        logger()->warn("Skipping malformed recorded message, {}", err.what());
+    }
+}
+
+} // namespace
+
+// SessionRecorder
+
+class SessionRecorder final : public ISessionRecorder
+{
+public:
+    explicit SessionRecorder(const std::string& filePath)
+        : m_file {filePath, std::ios::out | std::ios::trunc | std::ios::binary}
+        , m_start {std::chrono::steady_clock::now()}
+    {
+        if (!m_file)
+        {
+            throw std::runtime_error("Failed to open '" + filePath + "' for recording");
+        }
+    }
+
+    void Record(RecordDirection direction, std::string_view body);
+
+private:
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+void SessionRecorder::Record(RecordDirection direction, std::string_view body)
+{
+    const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - m_start)
+                               .count();
+    // The body is kept as a string, a malformed inbound message must not break the line
+    const auto line = json {
+        {"t", timestamp},
+        {"dir", direction == RecordDirection::inbound ? InboundTag : OutboundTag},
+        {"body", body}}.dump(-1, ' ', false, json::error_handler_t::replace);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file << line << '\n';
+    m_file.flush();
+}
+
+std::shared_ptr<ISessionRecorder> CreateSessionRecorder(const std::string& filePath)
+{
+    return std::make_shared<SessionRecorder>(filePath);
+}
+
+std::vector<RecordEntry> ReadRecording(const std::string& filePath)
+{
+    std::ifstream file(filePath, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open recording '" + filePath + "'");
+    }
+
+    std::vector<RecordEntry> entries;
+    std::string line;
+    size_t lineno = 0;
+    while (std::getline(file, line))
+    {
+        lineno++;
+        if (line.empty())
+        {
+            continue;
+        }
+        try
+        {
+            auto value = json::parse(line);
+            RecordEntry entry;
+            entry.timestamp = value.at("t").get<uint64_t>();
+            entry.direction =
+                value.at("dir").get<std::string>() == InboundTag ? RecordDirection::inbound : RecordDirection::outbound;
+            entry.body = std::move(value.at("body").get_ref<std::string&>());
+            entries.push_back(std::move(entry));
+        }
+        catch (std::exception& err)
+        {
+            throw std::runtime_error("Malformed recording line " + std::to_string(lineno) + ": " + err.what());
+        }
+    }
+    return entries;
+}
+
+std::vector<std::string> TakeFramedMessages(std::string& buffer)
+{
+    constexpr std::string_view HeaderEnd = "\r\n\r\n";
+    constexpr std::string_view ContentLength = "Content-Length:";
+
+    std::vector<std::string> bodies;
+    size_t pos = 0;
+    while (true)
+    {
+        const auto headerEnd = buffer.find(HeaderEnd, pos);
+        if (headerEnd == std::string::npos)
+        {
+            break;
+        }
+        const auto header = std::string_view(buffer).substr(pos, headerEnd - pos);
+        const auto field = header.find(ContentLength);
+        if (field == std::string_view::npos)
+        {
+            throw std::runtime_error("Framed message without Content-Length");
+        }
+        const auto length = std::stoul(std::string(header.substr(field + ContentLength.size())));
+        const auto bodyStart = headerEnd + HeaderEnd.size();
+        if (buffer.size() - bodyStart < length)
+        {
+            break;
+        }
+        bodies.push_back(buffer.substr(bodyStart, length));
+        pos = bodyStart + length;
+    }
+    buffer.erase(0, pos);
+    return bodies;
+}
+
+LatencyPercentiles ComputePercentiles(std::vector<uint64_t> samples)
+{
+    LatencyPercentiles result;
+    result.count = samples.size();
+    if (samples.empty())
+    {
+        return result;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const auto rank = [&samples](double percentile) {
+        const auto index = static_cast<size_t>(std::ceil(percentile * static_cast<double>(samples.size())));
+        return samples[std::clamp<size_t>(index, 1, samples.size()) - 1];
+    };
+    result.p50 = rank(0.50);
+    result.p90 = rank(0.90);
+    result.p99 = rank(0.99);
+    result.max = samples.back();
+    return result;
+}
+
+// LatencyTracker
+
+void LatencyTracker::OnInbound(std::string_view body, uint64_t timestamp)
+{
+    ForEachMessage(body, [&](const JRPCMessage& message) {
+        if (!message.HasMethod())
+        {
+            return;
+        }
+        const auto method = message.Method();
+        if (message.HasId())
+        {
+            m_requests[message.Id().dump()] = Pending {std::string(method), timestamp};
+        }
+        else if (method == "textDocument/didOpen" || method == "textDocument/didChange")
+        {
+            if (auto uri = message.ExtractString({"textDocument", "uri"}))
+            {
+                m_documents[*uri] = timestamp;
+            }
+        }
+    });
+}
+
+void LatencyTracker::OnOutbound(std::string_view body, uint64_t timestamp)
+{
+    ForEachMessage(body, [&](const JRPCMessage& message) {
+        if (message.HasMethod())
+        {
+            if (message.Method() != PublishDiagnosticsMethod)
+            {
+                return;
+            }
+            const auto uri = message.ExtractString({"uri"});
+            const auto document = uri ? m_documents.find(*uri) : m_documents.end();
+            if (document != m_documents.end())
+            {
+                m_samples[PublishDiagnosticsMethod].push_back(timestamp - std::min(timestamp, document->second));
+                m_documents.erase(document);
+            }
+            return;
+        }
+        if (!message.HasId())
+        {
+            return;
+        }
+        const auto request = m_requests.find(message.Id().dump());
+        if (request != m_requests.end())
+        {
+            m_samples[request->second.method].push_back(timestamp - std::min(timestamp, request->second.timestamp));
+            m_requests.erase(request);
+        }
+    });
+}
+
+std::map<std::string, LatencyPercentiles> LatencyTracker::Report() const
+{
+    std::map<std::string, LatencyPercentiles> report;
+    for (const auto& [method, samples] : m_samples)
+    {
+        report[method] = ComputePercentiles(samples);
+    }
+    return report;
+}
+
+} // namespace ocls
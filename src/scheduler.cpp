@@ -0,0 +1,632 @@
+//
+//  scheduler.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "scheduler.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ocls {
+
+namespace {
+
+const auto& logger() { return ocls::Loggers::lsp; }
+
+constexpr size_t MinWorkers = 2;
+
+using Clock = std::chrono::steady_clock;
+
+struct Task
+{
+    TaskPriority priority = TaskPriority::background;
+    std::string key;
+    TaskFunc run;
+};
+
+Gauge QueueGauge(TaskPriority priority)
+{
+    return priority == TaskPriority::interactive ? Gauge::interactiveTasks : Gauge::backgroundTasks;
+}
+
+struct DebouncedTask
+{
+    Task task;
+    Clock::time_point due;
+    // Due time of the burst cannot be moved past this point
+    Clock::time_point limit;
+};
+
+std::optional<Clock::time_point> Earliest(std::optional<Clock::time_point> a, std::optional<Clock::time_point> b)
+{
+    if (a && b)
+    {
+        return std::min(*a, *b);
+    }
+    return a ? a : b;
+}
+
+} // namespace
+
+class Scheduler final : public IScheduler
+{
+public:
+    explicit Scheduler(size_t workers) : m_workers {workers} {}
+
+    ~Scheduler()
+    {
+        Stop();
+        // Tasks scheduled without starting the workers
+        std::lock_guard<std::mutex> lock(m_mutex);
+        DropPending();
+    }
+
+    void Start(TaskFunc onTaskFinished);
+    void Schedule(TaskPriority priority, const std::string& key, TaskFunc task);
+    void ScheduleDebounced(
+        TaskPriority priority,
+        const std::string& key,
+        std::chrono::milliseconds delay,
+        std::chrono::milliseconds maxLatency,
+        TaskFunc task);
+    void ScheduleTimer(TaskPriority priority, const std::string& key, std::chrono::milliseconds delay, TaskFunc task);
+    void Drain();
+    void Stop();
+
+private:
+    void Loop();
+    // Requires m_mutex to be held
+    bool HasRunnableTask() const;
+    Task PopRunnableTask();
+    void Enqueue(Task&& task);
+    void MakeReady(Task&& task);
+    void Boost(const std::string& key);
+    bool HasInteractiveWaiter(const std::string& key) const;
+    void Complete(const Task& task);
+    void DropPending();
+    // Enqueues debounced tasks due by \c now and returns the closest due time of the remaining ones
+    std::optional<Clock::time_point> PromoteDebounced(Clock::time_point now);
+    // Same for the timers
+    std::optional<Clock::time_point> PromoteTimers(Clock::time_point now);
+
+private:
+    const size_t m_workers;
+    TaskFunc m_onTaskFinished;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_hasWork;
+    std::condition_variable m_drained;
+    // Tasks that can run right away, one queue per priority
+    std::deque<Task> m_interactive;
+    std::deque<Task> m_background;
+    // Tasks waiting for the previous task with the same key, the key is present while any of its tasks is queued or running
+    std::unordered_map<std::string, std::deque<Task>> m_blocked;
+    // Tasks waiting for their debounce window to pass, at most one per key
+    std::unordered_map<std::string, DebouncedTask> m_debounced;
+    // Tasks waiting for their delay, Drain does not wait for them
+    std::unordered_map<std::string, DebouncedTask> m_timers;
+    size_t m_running = 0;
+    size_t m_runningBackground = 0;
+    bool m_stopping = false;
+};
+
+void Scheduler::Start(TaskFunc onTaskFinished)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_threads.empty())
+    {
+        return;
+    }
+    m_onTaskFinished = std::move(onTaskFinished);
+    m_stopping = false;
+    for (size_t i = 0; i < m_workers; i++)
+    {
+        m_threads.emplace_back(&Scheduler::Loop, this);
+    }
+    logger()->debug("Scheduler started with {} workers", m_workers);
+}
+
+void Scheduler::Schedule(TaskPriority priority, const std::string& key, TaskFunc task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Enqueue(Task {priority, key, std::move(task)});
+    }
+    m_hasWork.notify_all();
+}
+
+void Scheduler::ScheduleDebounced(
+    TaskPriority priority,
+    const std::string& key,
+    std::chrono::milliseconds delay,
+    std::chrono::milliseconds maxLatency,
+    TaskFunc task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto now = Clock::now();
+        auto [it, inserted] = m_debounced.try_emplace(key);
+        auto& entry = it->second;
+        if (inserted)
+        {
+            entry.limit = now + std::max(delay, maxLatency);
+            GetStatistics().Add(Gauge::debouncedTasks, 1);
+        }
+        entry.task = Task {priority, key, std::move(task)};
+        entry.due = std::min(now + delay, entry.limit);
+    }
+    // Workers wake up to pick the new due time
+    m_hasWork.notify_all();
+}
+
+void Scheduler::ScheduleTimer(
+    TaskPriority priority, const std::string& key, std::chrono::milliseconds delay, TaskFunc task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto due = Clock::now() + delay;
+        m_timers[key] = DebouncedTask {Task {priority, key, std::move(task)}, due, due};
+    }
+    m_hasWork.notify_all();
+}
+
+void Scheduler::Drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_threads.empty())
+    {
+        return;
+    }
+    if (!m_debounced.empty())
+    {
+        PromoteDebounced(Clock::time_point::max());
+        m_hasWork.notify_all();
+    }
+    m_drained.wait(lock, [this] {
+        return (m_interactive.empty() && m_background.empty() && m_blocked.empty() && m_debounced.empty() &&
+                m_running == 0) ||
+               m_stopping;
+    });
+}
+
+void Scheduler::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_threads.empty())
+        {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_hasWork.notify_all();
+    m_drained.notify_all();
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_threads.clear();
+    DropPending();
+}
+
+// private
+
+void Scheduler::Loop()
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                const auto now = Clock::now();
+                const auto nextDue = Earliest(PromoteDebounced(now), PromoteTimers(now));
+                if (m_stopping || HasRunnableTask())
+                {
+                    break;
+                }
+                if (nextDue)
+                {
+                    m_hasWork.wait_until(lock, *nextDue);
+                }
+                else
+                {
+                    m_hasWork.wait(lock);
+                }
+            }
+            if (m_stopping)
+            {
+                return;
+            }
+            task = PopRunnableTask();
+            if (HasRunnableTask())
+            {
+                // Several debounced tasks may have been promoted at once
+                m_hasWork.notify_one();
+            }
+        }
+
+        try
+        {
+            task.run();
+        }
+        catch (std::exception& err)
+        {
+            logger()->error("Task '{}' failed, error: {}", task.key, err.what());
+        }
+
+        if (m_onTaskFinished)
+        {
+            m_onTaskFinished();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Complete(task);
+        }
+        // Completing a task can unblock the next one with the same key or free a slot for background work
+        m_hasWork.notify_all();
+        m_drained.notify_all();
+    }
+}
+
+bool Scheduler::HasRunnableTask() const
+{
+    // Keep the last worker for interactive requests
+    return !m_interactive.empty() || (!m_background.empty() && m_runningBackground + 1 < m_workers);
+}
+
+Task Scheduler::PopRunnableTask()
+{
+    auto& queue = m_interactive.empty() ? m_background : m_interactive;
+    Task task = std::move(queue.front());
+    queue.pop_front();
+    auto& statistics = GetStatistics();
+    statistics.Add(QueueGauge(task.priority), -1);
+    statistics.Add(Gauge::runningTasks, 1);
+    m_running++;
+    if (task.priority == TaskPriority::background)
+    {
+        m_runningBackground++;
+    }
+    return task;
+}
+
+void Scheduler::Enqueue(Task&& task)
+{
+    GetStatistics().Add(QueueGauge(task.priority), 1);
+    if (task.key.empty())
+    {
+        MakeReady(std::move(task));
+        return;
+    }
+
+    auto [it, inserted] = m_blocked.try_emplace(task.key);
+    if (inserted)
+    {
+        // Nothing else is queued for the key
+        MakeReady(std::move(task));
+    }
+    else
+    {
+        if (task.priority == TaskPriority::interactive)
+        {
+            Boost(task.key);
+        }
+        it->second.push_back(std::move(task));
+    }
+}
+
+void Scheduler::MakeReady(Task&& task)
+{
+    // A boosted task keeps its priority, so it is still accounted as background work
+    const bool interactive = task.priority == TaskPriority::interactive || HasInteractiveWaiter(task.key);
+    auto& queue = interactive ? m_interactive : m_background;
+    queue.push_back(std::move(task));
+}
+
+void Scheduler::Boost(const std::string& key)
+{
+    // Only the first task of a key can be ready, the others are blocked behind it
+    auto it = std::find_if(m_background.begin(), m_background.end(), [&key](const Task& task) {
+        return task.key == key;
+    });
+    if (it == m_background.end())
+    {
+        return;
+    }
+    m_interactive.push_back(std::move(*it));
+    m_background.erase(it);
+}
+
+bool Scheduler::HasInteractiveWaiter(const std::string& key) const
+{
+    if (key.empty())
+    {
+        return false;
+    }
+    auto it = m_blocked.find(key);
+    return it != m_blocked.end() && std::any_of(it->second.begin(), it->second.end(), [](const Task& task) {
+               return task.priority == TaskPriority::interactive;
+           });
+}
+
+void Scheduler::Complete(const Task& task)
+{
+    GetStatistics().Add(Gauge::runningTasks, -1);
+    m_running--;
+    if (task.priority == TaskPriority::background)
+    {
+        m_runningBackground--;
+    }
+    if (task.key.empty())
+    {
+        return;
+    }
+
+    auto it = m_blocked.find(task.key);
+    if (it == m_blocked.end())
+    {
+        return;
+    }
+    if (it->second.empty())
+    {
+        m_blocked.erase(it);
+        return;
+    }
+    Task next = std::move(it->second.front());
+    it->second.pop_front();
+    MakeReady(std::move(next));
+}
+
+void Scheduler::DropPending()
+{
+    auto& statistics = GetStatistics();
+    statistics.Add(Gauge::interactiveTasks, -static_cast<int64_t>(m_interactive.size()));
+    statistics.Add(Gauge::backgroundTasks, -static_cast<int64_t>(m_background.size()));
+    for (const auto& [key, tasks] : m_blocked)
+    {
+        for (const auto& task : tasks)
+        {
+            statistics.Add(QueueGauge(task.priority), -1);
+        }
+    }
+    statistics.Add(Gauge::debouncedTasks, -static_cast<int64_t>(m_debounced.size()));
+    m_interactive.clear();
+    m_background.clear();
+    m_blocked.clear();
+    m_debounced.clear();
+    m_timers.clear();
+}
+
+std::optional<Clock::time_point> Scheduler::PromoteDebounced(Clock::time_point now)
+{
+    std::optional<Clock::time_point> nextDue;
+    for (auto it = m_debounced.begin(); it != m_debounced.end();)
+    {
+        if (it->second.due <= now)
+        {
+            Enqueue(std::move(it->second.task));
+            it = m_debounced.erase(it);
+            GetStatistics().Add(Gauge::debouncedTasks, -1);
+            continue;
+        }
+        if (!nextDue || it->second.due < *nextDue)
+        {
+            nextDue = it->second.due;
+        }
+        ++it;
+    }
+    return nextDue;
+}
+
+std::optional<Clock::time_point> Scheduler::PromoteTimers(Clock::time_point now)
+{
+    std::optional<Clock::time_point> nextDue;
+    for (auto it = m_timers.begin(); it != m_timers.end();)
+    {
+        if (it->second.due <= now)
+        {
+            // Enqueued without the key, it only identifies the timer
+            auto task = std::move(it->second.task);
+            task.key.clear();
+            Enqueue(std::move(task));
+            it = m_timers.erase(it);
+            continue;
+        }
+        if (!nextDue || it->second.due < *nextDue)
+        {
+            nextDue = it->second.due;
+        }
+        ++it;
+    }
+    return nextDue;
+}
+
+// ScopedScheduler
+
+class ScopedScheduler final : public IScheduler
+{
+public:
+    ScopedScheduler(std::shared_ptr<IScheduler> scheduler, std::string scope)
+        : m_scheduler {std::move(scheduler)}
+        , m_scope {std::move(scope)}
+        , m_state {std::make_shared<State>()}
+    {}
+
+    ~ScopedScheduler()
+    {
+        Stop();
+    }
+
+    void Start(TaskFunc onTaskFinished);
+    void Schedule(TaskPriority priority, const std::string& key, TaskFunc task);
+    void ScheduleDebounced(
+        TaskPriority priority,
+        const std::string& key,
+        std::chrono::milliseconds delay,
+        std::chrono::milliseconds maxLatency,
+        TaskFunc task);
+    void ScheduleTimer(TaskPriority priority, const std::string& key, std::chrono::milliseconds delay, TaskFunc task);
+    void Drain();
+    void Stop();
+
+private:
+    // Shared with the wrapped tasks, which may outlive the view in the queues of the shared pool
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        TaskFunc onTaskFinished;
+        size_t outstanding = 0;
+        size_t running = 0;
+        bool stopped = false;
+    };
+
+    // Counts a task as outstanding until the last copy of its wrapper is destroyed,
+    // which also covers the debounced tasks replaced before they run
+    class Ticket
+    {
+    public:
+        explicit Ticket(std::shared_ptr<State> state) : m_state {std::move(state)}
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            ++m_state->outstanding;
+        }
+
+        ~Ticket()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_state->mutex);
+                --m_state->outstanding;
+            }
+            m_state->changed.notify_all();
+        }
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+    private:
+        std::shared_ptr<State> m_state;
+    };
+
+    // Timers are not counted, so Drain does not wait for them
+    TaskFunc Wrap(TaskFunc task, bool counted = true);
+
+private:
+    std::shared_ptr<IScheduler> m_scheduler;
+    std::string m_scope;
+    std::shared_ptr<State> m_state;
+};
+
+void ScopedScheduler::Start(TaskFunc onTaskFinished)
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->onTaskFinished = std::move(onTaskFinished);
+    m_state->stopped = false;
+}
+
+void ScopedScheduler::Schedule(TaskPriority priority, const std::string& key, TaskFunc task)
+{
+    m_scheduler->Schedule(priority, key, Wrap(std::move(task)));
+}
+
+void ScopedScheduler::ScheduleDebounced(
+    TaskPriority priority,
+    const std::string& key,
+    std::chrono::milliseconds delay,
+    std::chrono::milliseconds maxLatency,
+    TaskFunc task)
+{
+    m_scheduler->ScheduleDebounced(priority, m_scope + key, delay, maxLatency, Wrap(std::move(task)));
+}
+
+void ScopedScheduler::ScheduleTimer(
+    TaskPriority priority, const std::string& key, std::chrono::milliseconds delay, TaskFunc task)
+{
+    m_scheduler->ScheduleTimer(priority, m_scope + key, delay, Wrap(std::move(task), false));
+}
+
+void ScopedScheduler::Drain()
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    m_state->changed.wait(lock, [this] { return m_state->outstanding == 0 || m_state->stopped; });
+}
+
+void ScopedScheduler::Stop()
+{
+    // Tasks still queued in the shared pool turn into no-ops, the running ones are waited for
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    m_state->stopped = true;
+    m_state->changed.notify_all();
+    m_state->changed.wait(lock, [this] { return m_state->running == 0; });
+    m_state->onTaskFinished = nullptr;
+}
+
+// private
+
+TaskFunc ScopedScheduler::Wrap(TaskFunc task, bool counted)
+{
+    auto ticket = counted ? std::make_shared<Ticket>(m_state) : nullptr;
+    return [state = m_state, ticket = std::move(ticket), task = std::move(task)]() {
+        TaskFunc onTaskFinished;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->stopped)
+            {
+                return;
+            }
+            ++state->running;
+            onTaskFinished = state->onTaskFinished;
+        }
+        try
+        {
+            task();
+        }
+        catch (std::exception& err)
+        {
+            logger()->error("Scoped task failed, error: {}", err.what());
+        }
+        if (onTaskFinished)
+        {
+            onTaskFinished();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            --state->running;
+        }
+        state->changed.notify_all();
+    };
+}
+
+std::shared_ptr<IScheduler> CreateScheduler(size_t workers)
+{
+    if (workers == 0)
+    {
+        // Background tasks never take the last worker, one more keeps a background parse per core
+        workers = std::thread::hardware_concurrency() + 1;
+    }
+    return std::make_shared<Scheduler>(std::max(workers, MinWorkers));
+}
+
+std::shared_ptr<IScheduler> CreateScopedScheduler(std::shared_ptr<IScheduler> scheduler, std::string scope)
+{
+    return std::make_shared<ScopedScheduler>(std::move(scheduler), std::move(scope));
+}
+
+} // namespace ocls
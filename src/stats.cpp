@@ -0,0 +1,208 @@
+//
+//  stats.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "stats.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <thread>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+double ToMilliseconds(uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e6;
+}
+
+constexpr std::string_view ProbeNames[] = {
+    "clang_parseTranslationUnit2",
+    "clang_reparseTranslationUnit",
+    "clang_createTranslationUnit2",
+    "clang_codeCompleteAt",
+    "openToFirstCompletion",
+    "cl::Program::build",
+};
+static_assert(std::size(ProbeNames) == static_cast<size_t>(Probe::buildProgram) + 1, "Every probe must be named");
+
+} // namespace
+
+json ToJson(const LatencyPercentiles& percentiles)
+{
+    return {
+        {"count", percentiles.count},
+        {"p50Ms", ToMilliseconds(percentiles.p50)},
+        {"p90Ms", ToMilliseconds(percentiles.p90)},
+        {"p99Ms", ToMilliseconds(percentiles.p99)},
+        {"maxMs", ToMilliseconds(percentiles.max)}};
+}
+
+// LatencyHistogram
+
+void LatencyHistogram::Record(uint64_t nanoseconds) noexcept
+{
+    m_buckets[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    auto max = m_max.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !m_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+    {}
+}
+
+LatencyPercentiles LatencyHistogram::Percentiles() const
+{
+    // The buckets may change while they are read, the copy is used for every percentile
+    std::array<uint64_t, BucketCount> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < BucketCount; i++)
+    {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    LatencyPercentiles result;
+    result.count = total;
+    if (total == 0)
+    {
+        return result;
+    }
+    result.max = m_max.load(std::memory_order_relaxed);
+
+    const auto valueAt = [&](double percentile) {
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile * static_cast<double>(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; i++)
+        {
+            seen += counts[i];
+            if (seen >= rank)
+            {
+                return std::min(BucketHighest(i), result.max);
+            }
+        }
+        return result.max;
+    };
+    result.p50 = valueAt(0.50);
+    result.p90 = valueAt(0.90);
+    result.p99 = valueAt(0.99);
+    return result;
+}
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) noexcept
+{
+    if (value < SubBucketCount)
+    {
+        return static_cast<size_t>(value);
+    }
+    // Position of the highest bit, the next SubBucketBits bits select the bucket within the power of two
+    unsigned exponent = 63;
+    while (!(value >> exponent))
+    {
+        exponent--;
+    }
+    const auto shift = exponent - SubBucketBits;
+    const auto subBucket = static_cast<size_t>(value >> shift) - SubBucketCount;
+    return (shift + 1) * SubBucketCount + subBucket;
+}
+
+uint64_t LatencyHistogram::BucketHighest(size_t index) noexcept
+{
+    if (index < SubBucketCount)
+    {
+        return index;
+    }
+    const auto shift = index / SubBucketCount - 1;
+    const auto subBucket = index % SubBucketCount;
+    const auto lowest = static_cast<uint64_t>(SubBucketCount + subBucket) << shift;
+    return lowest + ((uint64_t {1} << shift) - 1);
+}
+
+// Statistics
+
+LatencyHistogram* Statistics::HistogramTable::Find(std::string_view name) noexcept
+{
+    if (name.empty() || name.size() > MaxNameLength)
+    {
+        return nullptr;
+    }
+
+    const auto start = std::hash<std::string_view> {}(name) % Capacity;
+    for (size_t i = 0; i < Capacity; i++)
+    {
+        auto& slot = m_slots[(start + i) % Capacity];
+        int state = slot.state.load(std::memory_order_acquire);
+        if (state == empty)
+        {
+            if (slot.state.compare_exchange_strong(state, claimed, std::memory_order_acquire))
+            {
+                std::memcpy(slot.name, name.data(), name.size());
+                slot.length = name.size();
+                slot.state.store(ready, std::memory_order_release);
+                return &slot.histogram;
+            }
+        }
+        // Another thread is naming the slot, this happens once per name
+        while (state == claimed)
+        {
+            std::this_thread::yield();
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        if (std::string_view(slot.name, slot.length) == name)
+        {
+            return &slot.histogram;
+        }
+    }
+    return nullptr;
+}
+
+json Statistics::HistogramTable::ToJson() const
+{
+    auto result = json::object();
+    for (const auto& slot : m_slots)
+    {
+        if (slot.state.load(std::memory_order_acquire) == ready)
+        {
+            result[std::string(slot.name, slot.length)] = ocls::ToJson(slot.histogram.Percentiles());
+        }
+    }
+    return result;
+}
+
+json Statistics::ToJson() const
+{
+    auto probes = json::object();
+    for (size_t i = 0; i < m_probes.size(); i++)
+    {
+        probes[std::string(ProbeNames[i])] = ocls::ToJson(m_probes[i].Percentiles());
+    }
+    return {
+        {"methods", m_methods.ToJson()},
+        {"requests", m_requests.ToJson()},
+        {"probes", probes},
+        {"queues",
+         {{"interactiveTasks", Get(Gauge::interactiveTasks)},
+          {"backgroundTasks", Get(Gauge::backgroundTasks)},
+          {"debouncedTasks", Get(Gauge::debouncedTasks)},
+          {"runningTasks", Get(Gauge::runningTasks)},
+          {"outgoingMessages", Get(Gauge::outgoingMessages)}}},
+        {"translationUnits", Get(Gauge::translationUnits)},
+        {"translationUnitMemoryBytes", Get(Gauge::translationUnitMemory)},
+        {"preambleMemoryBytes", Get(Gauge::preambleMemory)},
+        {"translationUnitMemoryBudget", Get(Gauge::translationUnitMemoryBudget)},
+        {"maxTranslationUnits", Get(Gauge::maxTranslationUnits)},
+        {"evictedTranslationUnits", Get(Gauge::evictedTranslationUnits)}};
+}
+
+Statistics& GetStatistics()
+{
+    static Statistics statistics;
+    return statistics;
+}
+
+} // namespace ocls
@@ -0,0 +1,221 @@
+//
+//  tracing.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "tracing.hpp"
+
+#include <stdexcept>
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+constexpr auto FlushInterval = std::chrono::milliseconds(200);
+
+std::atomic<uint64_t> tracerCount {0};
+
+// Buffer of the calling thread, tied to the tracer that created it
+struct ThreadBufferSlot
+{
+    uint64_t tracer = 0;
+    std::shared_ptr<void> buffer;
+};
+
+thread_local ThreadBufferSlot threadBuffer;
+thread_local const TraceContext* currentContext = nullptr;
+
+uint64_t ToNanoseconds(Tracer::Clock::duration duration)
+{
+    const auto count = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return count > 0 ? static_cast<uint64_t>(count) : 0;
+}
+
+} // namespace
+
+// Tracer
+
+Tracer::Tracer() : m_identifier {++tracerCount} {}
+
+Tracer::~Tracer()
+{
+    Stop();
+}
+
+void Tracer::Start(const std::string& filePath)
+{
+    Stop();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.open(filePath, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to open '" + filePath + "' for tracing");
+    }
+    // The closing bracket is optional in the array format, a trace of a crashed session still loads
+    m_file << "[\n";
+    m_empty = true;
+    m_stopping = false;
+    m_origin = Clock::now();
+    m_thread = std::thread(&Tracer::Loop, this);
+    m_enabled.store(true);
+}
+
+void Tracer::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        m_enabled.store(false);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Flush();
+    m_file << "\n]\n";
+    m_file.close();
+}
+
+void Tracer::Complete(std::string_view name, const char* category, Clock::time_point start, Clock::time_point end)
+{
+    // Pairs with the store in Start, the origin is set by then
+    if (!m_enabled.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    try
+    {
+        Event event;
+        event.name = name;
+        event.category = category;
+        event.startNs = ToNanoseconds(start - m_origin);
+        event.durationNs = ToNanoseconds(end - start);
+        if (auto context = TraceContext::Current())
+        {
+            event.id = context->Id();
+            event.uri = context->Uri();
+        }
+        auto& buffer = GetThreadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back(std::move(event));
+    }
+    catch (std::exception&)
+    {
+        // Tracing must never break the request
+    }
+}
+
+Tracer::ThreadBuffer& Tracer::GetThreadBuffer()
+{
+    if (threadBuffer.tracer != m_identifier)
+    {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            buffer->tid = ++m_nextTid;
+            m_buffers.push_back(buffer);
+        }
+        threadBuffer = {m_identifier, buffer};
+    }
+    return *static_cast<ThreadBuffer*>(threadBuffer.buffer.get());
+}
+
+void Tracer::Loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        m_wake.wait_for(lock, FlushInterval, [this] { return m_stopping; });
+        Flush();
+    }
+}
+
+void Tracer::Flush()
+{
+    std::vector<Event> events;
+    for (auto it = m_buffers.begin(); it != m_buffers.end();)
+    {
+        auto& buffer = **it;
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            std::swap(events, buffer.events);
+        }
+        for (const auto& event : events)
+        {
+            auto args = json::object();
+            if (!event.id.empty())
+            {
+                args["id"] = event.id;
+            }
+            if (!event.uri.empty())
+            {
+                args["uri"] = event.uri;
+            }
+            const json value = {
+                {"name", event.name},
+                {"cat", event.category},
+                {"ph", "X"},
+                {"ts", static_cast<double>(event.startNs) / 1000.0},
+                {"dur", static_cast<double>(event.durationNs) / 1000.0},
+                {"pid", 1},
+                {"tid", buffer.tid},
+                {"args", std::move(args)}};
+            m_output.clear();
+            if (!m_empty)
+            {
+                m_output.append(",\n");
+            }
+            m_output.append(value.dump(-1, ' ', false, json::error_handler_t::replace));
+            m_file << m_output;
+            m_empty = false;
+        }
+        events.clear();
+        // The thread has exited and everything it recorded is written
+        it = it->use_count() == 1 ? m_buffers.erase(it) : it + 1;
+    }
+    m_file.flush();
+}
+
+Tracer& GetTracer()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+// TraceContext
+
+TraceContext::TraceContext(const json& id, std::string_view uri)
+{
+    if (!GetTracer().IsEnabled())
+    {
+        return;
+    }
+    m_active = true;
+    m_id = id.is_null() ? std::string() : id.is_string() ? id.get<std::string>() : id.dump();
+    m_uri = uri;
+    m_previous = currentContext;
+    currentContext = this;
+}
+
+TraceContext::~TraceContext()
+{
+    if (m_active)
+    {
+        currentContext = m_previous;
+    }
+}
+
+const TraceContext* TraceContext::Current() noexcept
+{
+    return currentContext;
+}
+
+} // namespace ocls
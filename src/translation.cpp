@@ -7,15 +7,34 @@
 
 #include "translation.hpp"
 #include "log.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
 #include "utils.hpp"
 #include "version.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <clang-c/Index.h>
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#if defined(__linux__)
+    #include <malloc.h>
+#endif
+
 // Generated
 #include "embedded_headers.h"
 
@@ -23,124 +42,488 @@ namespace fs = std::filesystem;
 
 namespace {
 
-constexpr int excludeDeclsFromPCH = 0;
-constexpr int displayDiagnostics = 0;
+constexpr unsigned excludeDeclsFromPCH = 0;
+constexpr unsigned displayDiagnostics = 0;
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::translation);
+    return ocls::Loggers::translation;
+}
+
+// Read by parallel parses, so a code libclang adds later must not be inserted into a shared table
+std::string TranslationErrorSpelling(int code)
+{
+    switch (code)
+    {
+        case CXError_Success:
+            return "Success";
+        case CXError_Failure:
+            return "Failure";
+        case CXError_Crashed:
+            return "Crashed";
+        case CXError_InvalidArguments:
+            return "InvalidArguments";
+        case CXError_ASTReadError:
+            return "ASTReadError";
+        default:
+            return "Unknown error " + std::to_string(code);
+    }
 }
 
-std::unordered_map<CXErrorCode, std::string> translationErrorSpellingMap = {
-    {CXError_Failure, "Failure"},
-    {CXError_Crashed, "Crashed"},
-    {CXError_InvalidArguments, "InvalidArguments"},
-    {CXError_ASTReadError, "ASTReadError"},
-    {CXError_Success, "Success"}};
+using Clock = std::chrono::steady_clock;
+
+/**
+ Reader/writer lock of a document. A waiting writer closes the turnstile, so a stream of
+ shared leases cannot starve an exclusive one.
+ */
+struct DocumentLock
+{
+    std::mutex turnstile;
+    std::shared_mutex mutex;
+};
+
+struct DocumentState
+{
+    ocls::Document document;
+    // Snapshot of the latest content, leases keep it while the document changes.
+    // Dropped by a change and joined from the pieces only when the content is read
+    mutable std::shared_ptr<const std::string> content;
+    // Grows with every open and change of any file, so a unit parsed from an older content
+    // is never installed over a newer one
+    uint64_t revision = 0;
+    // Shared by the leases that read the translation unit, exclusive for the ones that change it
+    std::shared_ptr<DocumentLock> lock = std::make_shared<DocumentLock>();
+    // Set while a lease parses the evicted unit again, the other leases wait for it instead of parsing too
+    std::shared_future<void> parsing;
+
+    std::shared_ptr<const std::string> Content() const
+    {
+        if (!content)
+        {
+            content = std::make_shared<const std::string>(document.Text());
+        }
+        return content;
+    }
+};
+
+// Edits split the pieces of a document, it is compacted into a single buffer once there are this many
+constexpr size_t MaxDocumentPieces = 256;
 
 struct TranslationUnitEntry
 {
-    CXTranslationUnit tu;
-    CXIndex index;
+    // Served to the queries
+    ocls::TranslationUnitRef tu;
+    std::shared_ptr<const std::string> content;
+    // The previous revision, reparsed into the next one while tu keeps serving
+    ocls::TranslationUnitRef standby;
+    ocls::TranslationUnitMemory memory;
+    ocls::TranslationUnitMemory standbyMemory;
+    Clock::time_point lastUsed;
+    // Revision of the content tu was parsed from
+    uint64_t revision = 0;
+    // Loaded from the AST cache, libclang cannot reparse it or complete code in it
+    bool restored = false;
+
+    ocls::TranslationUnitMemory Memory() const
+    {
+        return {{},
+                memory.ast + standbyMemory.ast,
+                memory.preamble + standbyMemory.preamble,
+                memory.total + standbyMemory.total};
+    }
+};
+
+ocls::TranslationUnitRef Share(CXTranslationUnit tu)
+{
+    return {tu, [](CXTranslationUnit unit) {
+                ocls::TraceSpan span("clang_disposeTranslationUnit", "libclang");
+                clang_disposeTranslationUnit(unit);
+            }};
+}
+
+/**
+ Locks the document in \c mode until the last copy of the returned holder is released.
+ */
+std::shared_ptr<void> LockDocument(const std::shared_ptr<DocumentLock> &lock, ocls::LeaseMode mode)
+{
+    if (mode == ocls::LeaseMode::exclusive)
+    {
+        std::lock_guard<std::mutex> turnstile(lock->turnstile);
+        lock->mutex.lock();
+        return {lock.get(), [lock](void *) { lock->mutex.unlock(); }};
+    }
+    {
+        std::lock_guard<std::mutex> turnstile(lock->turnstile);
+    }
+    lock->mutex.lock_shared();
+    return {lock.get(), [lock](void *) { lock->mutex.unlock_shared(); }};
+}
+
+void AccountMemory(const ocls::TranslationUnitMemory &before, const ocls::TranslationUnitMemory &after)
+{
+    ocls::GetStatistics().Add(
+        ocls::Gauge::translationUnitMemory, static_cast<int64_t>(after.total) - static_cast<int64_t>(before.total));
+    ocls::GetStatistics().Add(
+        ocls::Gauge::preambleMemory, static_cast<int64_t>(after.preamble) - static_cast<int64_t>(before.preamble));
+}
+
+ocls::TranslationUnitMemory SampleMemory(CXTranslationUnit tu)
+{
+    ocls::TranslationUnitMemory memory;
+    CXTUResourceUsage usage = clang_getCXTUResourceUsage(tu);
+    for (unsigned i = 0; i < usage.numEntries; i++)
+    {
+        const auto &entry = usage.entries[i];
+        switch (entry.kind)
+        {
+            case CXTUResourceUsage_AST:
+            case CXTUResourceUsage_AST_SideTables:
+            case CXTUResourceUsage_Identifiers:
+            case CXTUResourceUsage_Selectors:
+                memory.ast += entry.amount;
+                break;
+            // The preamble is read back as an external AST source
+            case CXTUResourceUsage_ExternalASTSource_Membuffer_Malloc:
+            case CXTUResourceUsage_ExternalASTSource_Membuffer_MMap:
+                memory.preamble += entry.amount;
+                break;
+            default:
+                break;
+        }
+        memory.total += entry.amount;
+    }
+    clang_disposeCXTUResourceUsage(usage);
+    return memory;
+}
+
+/**
+ 64-bit FNV-1a, stable across runs and platforms unlike \c std::hash, it names the files of the AST cache.
+ */
+class ContentHash
+{
+public:
+    ContentHash &Add(std::string_view data)
+    {
+        for (const unsigned char c : data)
+        {
+            m_value = (m_value ^ c) * 0x100000001b3ull;
+        }
+        // Separates the parts, so that "ab" + "c" and "a" + "bc" differ
+        m_value = (m_value ^ 0xff) * 0x100000001b3ull;
+        return *this;
+    }
+
+    std::string ToString() const
+    {
+        std::ostringstream stream;
+        stream << std::hex << std::setw(16) << std::setfill('0') << m_value;
+        return stream.str();
+    }
+
+private:
+    uint64_t m_value = 0xcbf29ce484222325ull;
 };
 
+/**
+ Writes \c tu to a file unique to the thread and renames it to \c path,
+ so that a concurrent server never reads a partial file.
+ */
+bool SaveTranslationUnitAs(CXTranslationUnit tu, const fs::path &path)
+{
+    auto tempPath = path;
+    tempPath += "." + std::to_string(std::hash<std::thread::id> {}(std::this_thread::get_id())) + "." +
+                std::to_string(Clock::now().time_since_epoch().count());
+    std::error_code error;
+    int result;
+    {
+        ocls::TraceSpan span("clang_saveTranslationUnit", "libclang");
+        result = clang_saveTranslationUnit(tu, tempPath.string().c_str(), clang_defaultSaveOptions(tu));
+    }
+    if (result != CXSaveError_None)
+    {
+        logger()->debug("Failed to save {}, error: {}", path.string(), result);
+        fs::remove(tempPath, error);
+        return false;
+    }
+    fs::rename(tempPath, path, error);
+    if (error)
+    {
+        logger()->error("Failed to store {}: {}", path.string(), error.message());
+        fs::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+/**
+ Per-user cache directory of the server. The headers and the precompiled headers stored there are never removed
+ by a store, so concurrent servers and later runs share them.
+ */
+fs::path DefaultCacheDirectory()
+{
+    const auto env = [](const char *name) -> std::optional<fs::path> {
+        const char *value = std::getenv(name);
+        if (value == nullptr || *value == '\0')
+        {
+            return std::nullopt;
+        }
+        return fs::path(value);
+    };
+#if defined(WIN32)
+    if (const auto localAppData = env("LOCALAPPDATA"))
+    {
+        return *localAppData / "opencl-language-server";
+    }
+#elif defined(__APPLE__)
+    if (const auto home = env("HOME"))
+    {
+        return *home / "Library" / "Caches" / "com.galarius.opencl-language-server";
+    }
+#else
+    if (const auto cacheHome = env("XDG_CACHE_HOME"))
+    {
+        return *cacheHome / "opencl-language-server";
+    }
+    if (const auto home = env("HOME"))
+    {
+        return *home / ".cache" / "opencl-language-server";
+    }
+#endif
+    return fs::temp_directory_path() / "opencl-language-server";
+}
+
+/**
+ Writes \c contents to a temporary file renamed over \c path, so a concurrent reader sees either file as a whole.
+ */
+void WriteFileAtomically(const fs::path &path, std::string_view contents)
+{
+    auto tempPath = path;
+    tempPath += "." + std::to_string(std::hash<std::thread::id> {}(std::this_thread::get_id())) + "." +
+                std::to_string(Clock::now().time_since_epoch().count());
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file.is_open())
+        {
+            logger()->error("Failed to write {}", tempPath.string());
+            return;
+        }
+        file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    }
+    std::error_code error;
+    fs::rename(tempPath, path, error);
+    if (error)
+    {
+        logger()->error("Failed to store {}: {}", path.string(), error.message());
+        fs::remove(tempPath, error);
+    }
+}
+
+CXIndex CreateIndex(const ocls::PreambleStorage &preambles)
+{
+    CXIndexOptions options {};
+    options.Size = sizeof(CXIndexOptions);
+    options.StorePreamblesInMemory = preambles.inMemory;
+    // Copied by libclang
+    options.PreambleStoragePath = preambles.directory.empty() ? nullptr : preambles.directory.c_str();
+    // libclang runs parses, reparses and completions on a helper thread, only that thread is deprioritized
+    options.ThreadBackgroundPriorityForIndexing = CXChoice_Enabled;
+    options.ThreadBackgroundPriorityForEditing = CXChoice_Enabled;
+    options.ExcludeDeclarationsFromPCH = excludeDeclsFromPCH;
+    options.DisplayDiagnostics = displayDiagnostics;
+    CXIndex index = clang_createIndexWithOptions(&options);
+    if (!index)
+    {
+        // libclang is older than the options structure
+        logger()->warn("The preamble storage cannot be configured with this libclang");
+        index = clang_createIndex(excludeDeclsFromPCH, displayDiagnostics);
+        clang_CXIndex_setGlobalOptions(index, CXGlobalOpt_ThreadBackgroundPriorityForAll);
+    }
+    return index;
+}
+
+void ReleaseFreeHeap()
+{
+#if defined(__GLIBC__)
+    // Freed AST nodes otherwise stay in the malloc arenas of the process
+    malloc_trim(0);
+#endif
+}
+
+/**
+ Byte offset of the 1-based \c lineno / \c columnno in \c text, \c std::nullopt past the end of the line or the text.
+ */
+std::optional<size_t> OffsetOf(std::string_view text, unsigned lineno, unsigned columnno)
+{
+    if (lineno == 0 || columnno == 0)
+    {
+        return std::nullopt;
+    }
+    size_t lineStart = 0;
+    for (unsigned line = 1; line < lineno; line++)
+    {
+        lineStart = text.find('\n', lineStart);
+        if (lineStart == std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+        lineStart++;
+    }
+    const auto lineEnd = std::min(text.find('\n', lineStart), text.size());
+    if (columnno - 1 > lineEnd - lineStart)
+    {
+        return std::nullopt;
+    }
+    return lineStart + columnno - 1;
+}
+
 } // namespace
 
 namespace ocls {
 
+/**
+ All translation units are created in one index, it only holds the options, so units of different files
+ are still parsed in parallel.
+ */
 class TranslationUnitStore final : public ITranslationUnitStore
 {
 public:
+    explicit TranslationUnitStore(const PreambleStorage &preambles)
+        : m_index {CreateIndex(preambles)}
+    {}
+
     ~TranslationUnitStore() override
     {
         DestroyTranslationUnits();
-        DeleteCache();
+        clang_disposeIndex(m_index);
     }
 
-    void OnFileOpen(const std::string &filePath, const std::string &content) override;
-    void OnFileChange(const std::string &filePath, const std::string &content) override;
+    TranslationUnitStore(const TranslationUnitStore &) = delete;
+    TranslationUnitStore &operator=(const TranslationUnitStore &) = delete;
+
+    void OnFileOpen(const std::string &filePath, std::string content) override;
+    void OnFileChange(const std::string &filePath, std::vector<TextChange> changes) override;
     void OnFileClose(const std::string &filePath) override;
     void SetTranslationOptions(const std::vector<std::string> &options) override;
 
     void SaveHeaders() override;
+    void EnableASTCache(const std::string &directory, uint64_t capacity) override;
 
-    CXTranslationUnit GetTranslationUnit(const std::string &filePath) const override;
-    const std::string *GetContent(const std::string &filePath) const override;
+    TranslationUnitLease Lease(const std::string &filePath, LeaseMode mode) override;
+    bool IsUpToDate(const std::string &filePath) const override;
+    std::shared_ptr<const std::string> GetContent(const std::string &filePath) const override;
+    std::vector<TranslationUnitMemory> GetMemoryUsage() const override;
+    void SetLimits(const TranslationUnitLimits &limits) override;
+    void ReleaseStandbys() override;
+    std::vector<std::string> GetEvictionCandidates() const override;
+    void Evict(const std::string &filePath) override;
 
 private:
     void DestroyTranslationUnits() noexcept;
-    void DeleteCache() noexcept;
+    std::shared_ptr<const std::vector<std::string>> Arguments() const;
+    TranslationUnitRef ParseTranslationUnit(const std::string &filePath, const std::string &content);
+    bool ReparseTranslationUnit(CXTranslationUnit tu, const std::string &filePath, const std::string &content);
+    void DisposeTranslationUnit(const std::string &filePath);
+    bool InstallTranslationUnit(
+        const std::string &filePath,
+        TranslationUnitRef tu,
+        std::shared_ptr<const std::string> content,
+        uint64_t revision,
+        bool restored);
+    void ParseCurrentRevision(const std::string &filePath, bool restore);
+
+    std::optional<fs::path> GetCachedASTPath(const std::string &filePath, const std::string &content) const;
+    TranslationUnitRef RestoreTranslationUnit(const std::string &filePath, const std::string &content);
+    void SaveTranslationUnit(const std::string &filePath, const std::string &content, CXTranslationUnit tu);
+    void TrimASTCache();
+    std::optional<fs::path> BuildPrecompiledHeaders(const std::vector<std::string> &args);
 
     std::vector<CXUnsavedFile> BuildUnsavedPool(const std::string &filePath, const std::string &content);
 
 private:
-    std::optional<fs::path> m_cacheDir;
+    CXIndex m_index;
     std::optional<fs::path> m_headersDir;
-    std::vector<std::string> m_args;
-    std::unordered_map<std::string, std::string> m_fileContents;
+    std::optional<fs::path> m_astCacheDir;
+    uint64_t m_astCacheCapacity = 0;
+    std::string m_clangVersion = GetClangVersion();
+    std::mutex m_astCacheMutex;
+    // Guards the maps, the documents and the arguments, libclang calls are made outside of it
+    mutable std::mutex m_mutex;
+    // Replaced as a whole, parses in flight keep the arguments they started with
+    std::shared_ptr<const std::vector<std::string>> m_args = std::make_shared<const std::vector<std::string>>();
+    std::unordered_map<std::string, DocumentState> m_documents;
+    uint64_t m_lastRevision = 0;
+    // Units of this or an earlier revision were parsed with the previous arguments
+    uint64_t m_argsRevision = 0;
     std::unordered_map<std::string, TranslationUnitEntry> m_translationUnits;
+    // Open files whose translation units were evicted, they are parsed again on the next query
+    std::unordered_set<std::string> m_evicted;
+    TranslationUnitLimits m_limits;
 };
 
 void TranslationUnitStore::DestroyTranslationUnits() noexcept
 {
     try
     {
-        logger()->trace("TranslationUnitStore::DestroyTranslationUnits");
-        for (auto &[filePath, entry] : m_translationUnits)
+        SPDLOG_LOGGER_TRACE(logger(), "TranslationUnitStore::DestroyTranslationUnits");
+        // Disposed outside of the lock, unless a query still holds them
+        std::unordered_map<std::string, TranslationUnitEntry> translationUnits;
         {
-            m_fileContents.erase(filePath);
-            clang_disposeTranslationUnit(entry.tu);
-            clang_disposeIndex(entry.index);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &[filePath, entry] : m_translationUnits)
+            {
+                AccountMemory(entry.Memory(), {});
+            }
+            // The documents are kept, their units are parsed again on the next query
+            for (const auto &[filePath, state] : m_documents)
+            {
+                m_evicted.insert(filePath);
+            }
+            GetStatistics().Add(Gauge::translationUnits, -static_cast<int64_t>(m_translationUnits.size()));
+            translationUnits.swap(m_translationUnits);
         }
-        m_translationUnits.clear();
     }
     catch (...)
     {}
 }
 
+std::shared_ptr<const std::vector<std::string>> TranslationUnitStore::Arguments() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_args;
+}
+
 void TranslationUnitStore::SaveHeaders()
 {
-#if defined(__APPLE__)
-    auto temp = fs::temp_directory_path() / "com.galarius.opencl-language-server";
-#else
-    auto temp = fs::temp_directory_path() / "opencl-language-server";
-#endif
-    auto headersDir = temp / version / "headers";
+    // The units of the AST cache and the precompiled headers refer to the headers, so they are kept between runs
+    auto headersDir = (m_astCacheDir ? *m_astCacheDir : DefaultCacheDirectory()) / version / "headers";
 
-    logger()->debug("Using cache dir: {}", temp.string());
+    logger()->debug("Using headers dir: {}", headersDir.string());
     fs::create_directories(headersDir);
-    // Unpack embedded headers onto the disk if they don't exist yet
+    // Unpack embedded headers onto the disk unless they are there already, a rewritten header
+    // would invalidate the precompiled headers and the cached units built from it
     const auto &header_map = resources::get_headers();
     for (const auto &[filename, contents] : header_map)
     {
         fs::path targetFilePath = fs::path(headersDir) / filename;
-        if (!fs::exists(targetFilePath))
+        std::error_code error;
+        const auto size = fs::file_size(targetFilePath, error);
+        if (error || size != contents.size())
         {
-            std::ofstream file(targetFilePath, std::ios::binary);
-            if (file.is_open())
-            {
-                file.write(contents.data(), contents.size());
-            }
+            WriteFileAtomically(targetFilePath, contents);
         }
     }
 
-    m_cacheDir = temp;
     m_headersDir = headersDir;
 }
 
-void TranslationUnitStore::DeleteCache() noexcept
+void TranslationUnitStore::EnableASTCache(const std::string &directory, uint64_t capacity)
 {
-    try
-    {
-        if (m_cacheDir && fs::exists(*m_cacheDir))
-        {
-            auto cacheDir = m_cacheDir.value();
-            logger()->debug("Deleting cache dir {}", cacheDir.string());
-            fs::remove_all(cacheDir);
-        }
-    }
-    catch (...)
-    {}
+    logger()->debug("Using AST cache dir: {}, capacity: {} bytes", directory, capacity);
+    const auto astDir = fs::path(directory) / "ast";
+    fs::create_directories(astDir);
+    m_astCacheDir = fs::path(directory);
+    m_astCacheCapacity = capacity;
+    TrimASTCache();
 }
 
 std::vector<CXUnsavedFile> TranslationUnitStore::BuildUnsavedPool(
@@ -154,19 +537,40 @@ std::vector<CXUnsavedFile> TranslationUnitStore::BuildUnsavedPool(
     return unsavedPool;
 }
 
-void TranslationUnitStore::OnFileOpen(const std::string &filePath, const std::string &content)
+void TranslationUnitStore::OnFileOpen(const std::string &filePath, std::string content)
 {
-    logger()->trace("TranslationUnitStore::OnFileOpen - {}", filePath);
+    SPDLOG_LOGGER_TRACE(logger(), "TranslationUnitStore::OnFileOpen - {}", filePath);
     if (!fs::exists(filePath))
     {
         logger()->error("File does not exist: {}", filePath);
         return;
     }
 
-    m_fileContents[filePath] = content;
-
-    CXIndex index = clang_createIndex(excludeDeclsFromPCH, displayDiagnostics);
+    std::shared_ptr<const std::string> text;
+    uint64_t revision = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // A reopened document keeps its lock, the leases of the previous open may still hold it
+        auto &state = m_documents[filePath];
+        state.document = Document {std::move(content)};
+        text = state.content = std::make_shared<const std::string>(state.document.Materialize());
+        revision = state.revision = ++m_lastRevision;
+    }
+    DisposeTranslationUnit(filePath);
+    if (auto tu = RestoreTranslationUnit(filePath, *text))
+    {
+        InstallTranslationUnit(filePath, std::move(tu), text, revision, true);
+    }
+    else if (auto tu = ParseTranslationUnit(filePath, *text))
+    {
+        // Saved before it is installed, no lease may complete code in it meanwhile
+        SaveTranslationUnit(filePath, *text, tu.get());
+        InstallTranslationUnit(filePath, std::move(tu), text, revision, false);
+    }
+}
 
+TranslationUnitRef TranslationUnitStore::ParseTranslationUnit(const std::string &filePath, const std::string &content)
+{
     auto unsavedFiles = BuildUnsavedPool(filePath, content);
     unsigned options = clang_defaultEditingTranslationUnitOptions();
     options |= CXTranslationUnit_IncludeBriefCommentsInCodeCompletion;
@@ -177,132 +581,833 @@ void TranslationUnitStore::OnFileOpen(const std::string &filePath, const std::st
     options |= CXTranslationUnit_KeepGoing;
     options |= CXTranslationUnit_IgnoreNonErrorsFromIncludedFiles;
 
+    const auto args = Arguments();
     std::vector<const char *> cargs;
-    cargs.reserve(m_args.size());
-    for (const auto &arg : m_args)
+    cargs.reserve(args->size());
+    for (const auto &arg : *args)
     {
         cargs.push_back(arg.c_str());
     }
 
     CXTranslationUnit tu;
-    CXErrorCode code = clang_parseTranslationUnit2(
-        index,
-        filePath.c_str(),
-        cargs.data(),
-        static_cast<int>(cargs.size()),
-        unsavedFiles.data(),
-        static_cast<unsigned int>(unsavedFiles.size()),
-        options,
-        &tu);
+    CXErrorCode code;
+    {
+        LatencyTimer timer(&GetStatistics().Of(Probe::parseTranslationUnit));
+        TraceSpan span("clang_parseTranslationUnit2", "libclang");
+        code = clang_parseTranslationUnit2(
+            m_index,
+            filePath.c_str(),
+            cargs.data(),
+            static_cast<int>(cargs.size()),
+            unsavedFiles.data(),
+            static_cast<unsigned int>(unsavedFiles.size()),
+            options,
+            &tu);
+    }
 
     if (code != CXError_Success)
     {
-        std::string error = translationErrorSpellingMap[code];
-        logger()->error("Parsing failed with error code: {}", error);
-        clang_disposeIndex(index);
-        return;
+        logger()->error("Parsing failed with error code: {}", TranslationErrorSpelling(code));
+        return nullptr;
     }
+    return Share(tu);
+}
 
-    m_translationUnits[filePath] = {tu, index};
+bool TranslationUnitStore::ReparseTranslationUnit(
+    CXTranslationUnit tu, const std::string &filePath, const std::string &content)
+{
+    auto unsavedFiles = BuildUnsavedPool(filePath, content);
+    const unsigned options = clang_defaultReparseOptions(tu);
+
+    // Reparse is much cheaper than a full parse —
+    // reuses the precompiled preamble if it hasn't changed
+    int result;
+    {
+        LatencyTimer timer(&GetStatistics().Of(Probe::reparseTranslationUnit));
+        TraceSpan span("clang_reparseTranslationUnit", "libclang");
+        result = clang_reparseTranslationUnit(
+            tu, static_cast<unsigned int>(unsavedFiles.size()), unsavedFiles.data(), options);
+    }
+
+    if (result != 0)
+    {
+        logger()->error("Failed to reparse TU: {}", TranslationErrorSpelling(result));
+        return false;
+    }
+    return true;
 }
 
-void TranslationUnitStore::OnFileChange(const std::string &filePath, const std::string &content)
+bool TranslationUnitStore::InstallTranslationUnit(
+    const std::string &filePath,
+    TranslationUnitRef tu,
+    std::shared_ptr<const std::string> content,
+    uint64_t revision,
+    bool restored)
 {
-    logger()->trace("TranslationUnitStore::OnFileChange - {}", filePath);
-    m_fileContents[filePath] = content;
+    const auto memory = SampleMemory(tu.get());
+    logger()->debug(
+        "Memory of {}: AST {} bytes, preamble {} bytes, total {} bytes",
+        filePath,
+        memory.ast,
+        memory.preamble,
+        memory.total);
 
-    auto it = m_translationUnits.find(filePath);
-    if (it == m_translationUnits.end())
+    // Released outside of the lock
+    TranslationUnitRef retired;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_documents.count(filePath) == 0)
     {
-        logger()->debug("TU does not exist, performing full parse...");
-        // No TU yet, do a full parse
-        OnFileOpen(filePath, content);
-        return;
+        // Closed while the unit was parsed
+        return false;
+    }
+    if (revision <= m_argsRevision)
+    {
+        logger()->debug("Dropping revision {} of {}, it was parsed with the previous options", revision, filePath);
+        return false;
+    }
+    auto [it, inserted] = m_translationUnits.try_emplace(filePath);
+    auto &entry = it->second;
+    // The same revision is installed again only to replace a unit restored from the AST cache
+    if (entry.revision > revision || (entry.tu && entry.revision == revision && (restored || !entry.restored)))
+    {
+        logger()->debug(
+            "Dropping revision {} of {}, revision {} is already served", revision, filePath, entry.revision);
+        return false;
     }
 
-    auto unsavedFiles = BuildUnsavedPool(filePath, content);
-    const unsigned options = clang_defaultReparseOptions(it->second.tu);
+    const auto before = entry.Memory();
+    if (entry.tu && !entry.restored)
+    {
+        retired = std::move(entry.standby);
+        entry.standby = std::move(entry.tu);
+        entry.standbyMemory = entry.memory;
+    }
+    else
+    {
+        retired = std::move(entry.tu);
+    }
+    entry.tu = std::move(tu);
+    entry.content = std::move(content);
+    entry.memory = memory;
+    entry.revision = revision;
+    entry.restored = restored;
+    entry.lastUsed = Clock::now();
+    AccountMemory(before, entry.Memory());
+    m_evicted.erase(filePath);
+    if (inserted)
+    {
+        GetStatistics().Add(Gauge::translationUnits, 1);
+    }
+    return true;
+}
 
-    // Reparse is much cheaper than a full parse —
-    // reuses the precompiled preamble if it hasn't changed
-    int result = clang_reparseTranslationUnit(
-        it->second.tu, static_cast<unsigned int>(unsavedFiles.size()), unsavedFiles.data(), options);
+std::optional<fs::path> TranslationUnitStore::GetCachedASTPath(
+    const std::string &filePath, const std::string &content) const
+{
+    if (!m_astCacheDir)
+    {
+        return std::nullopt;
+    }
+    // The unit refers to the main file by path, so equal contents of different files do not share it
+    ContentHash hash;
+    hash.Add(m_clangVersion).Add(version).Add(filePath);
+    for (const auto &arg : *Arguments())
+    {
+        hash.Add(arg);
+    }
+    hash.Add(content);
+    return *m_astCacheDir / "ast" / (hash.ToString() + ".ast");
+}
 
-    if (result != 0)
+TranslationUnitRef TranslationUnitStore::RestoreTranslationUnit(const std::string &filePath, const std::string &content)
+{
+    const auto astPath = GetCachedASTPath(filePath, content);
+    std::error_code error;
+    if (!astPath || !fs::exists(*astPath, error))
     {
-        CXErrorCode code = static_cast<CXErrorCode>(result);
-        std::string error = translationErrorSpellingMap[code];
-        logger()->error("Failed to reparse TU: {}", error);
-        clang_disposeTranslationUnit(it->second.tu);
-        clang_disposeIndex(it->second.index);
-        m_translationUnits.erase(it);
-        OnFileOpen(filePath, content);
+        return nullptr;
+    }
+
+    CXTranslationUnit tu;
+    CXErrorCode code;
+    {
+        LatencyTimer timer(&GetStatistics().Of(Probe::createTranslationUnit));
+        TraceSpan span("clang_createTranslationUnit2", "libclang");
+        code = clang_createTranslationUnit2(m_index, astPath->string().c_str(), &tu);
     }
+    if (code != CXError_Success)
+    {
+        // Most likely one of the headers changed since the unit was saved
+        logger()->debug(
+            "Failed to restore {} from {}: {}", filePath, astPath->string(), TranslationErrorSpelling(code));
+        fs::remove(*astPath, error);
+        return nullptr;
+    }
+
+    logger()->debug("Restored {} from {}", filePath, astPath->string());
+    // The modification time orders the cache for trimming
+    fs::last_write_time(*astPath, fs::file_time_type::clock::now(), error);
+    return Share(tu);
 }
 
-void TranslationUnitStore::OnFileClose(const std::string &filePath)
+void TranslationUnitStore::SaveTranslationUnit(
+    const std::string &filePath, const std::string &content, CXTranslationUnit tu)
 {
-    logger()->trace("TranslationUnitStore::OnFileClose - {}", filePath);
-    m_fileContents.erase(filePath);
+    const auto astPath = GetCachedASTPath(filePath, content);
+    std::error_code error;
+    if (!astPath || fs::exists(*astPath, error))
+    {
+        return;
+    }
 
-    auto it = m_translationUnits.find(filePath);
-    if (it != m_translationUnits.end())
+    logger()->debug("Saving the translation unit of {} to {}", filePath, astPath->string());
+    if (SaveTranslationUnitAs(tu, *astPath))
     {
-        clang_disposeTranslationUnit(it->second.tu);
-        clang_disposeIndex(it->second.index);
+        TrimASTCache();
+    }
+}
+
+void TranslationUnitStore::TrimASTCache()
+{
+    if (!m_astCacheDir || m_astCacheCapacity == 0)
+    {
+        return;
+    }
+
+    // The precompiled headers this store parses with must stay, the units are parsed against them
+    std::optional<fs::path> pchInUse;
+    const auto args = Arguments();
+    const auto pchArg = std::find(args->begin(), args->end(), "-include-pch");
+    if (pchArg != args->end() && std::next(pchArg) != args->end())
+    {
+        pchInUse = fs::path(*std::next(pchArg));
+    }
+
+    std::lock_guard<std::mutex> lock(m_astCacheMutex);
+    std::vector<std::tuple<fs::file_time_type, uint64_t, fs::path>> files;
+    uint64_t size = 0;
+    std::error_code error;
+    // Precompiled headers and their preludes share the budget with the units, files still being written do not
+    const std::pair<fs::path, std::set<fs::path>> directories[] = {
+        {*m_astCacheDir / "ast", {".ast"}},
+        {*m_astCacheDir / version / "pch", {".pch", ".cl"}},
+    };
+    for (const auto &[directory, extensions] : directories)
+    {
+        for (const auto &entry : fs::directory_iterator(directory, error))
+        {
+            if (extensions.count(entry.path().extension()) == 0)
+            {
+                continue;
+            }
+            const auto fileSize = entry.file_size(error);
+            const auto lastWrite = entry.last_write_time(error);
+            if (!error)
+            {
+                size += fileSize;
+                if (entry.path() != pchInUse)
+                {
+                    files.emplace_back(lastWrite, fileSize, entry.path());
+                }
+            }
+        }
+    }
+    if (size <= m_astCacheCapacity)
+    {
+        return;
+    }
+
+    std::sort(files.begin(), files.end());
+    for (const auto &[lastWrite, fileSize, path] : files)
+    {
+        if (size <= m_astCacheCapacity)
+        {
+            break;
+        }
+        logger()->debug("Removing {} from the AST cache", path.string());
+        error.clear();
+        if (fs::remove(path, error))
+        {
+            size -= fileSize;
+        }
+    }
+}
+
+void TranslationUnitStore::DisposeTranslationUnit(const std::string &filePath)
+{
+    TranslationUnitEntry entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_translationUnits.find(filePath);
+        if (it == m_translationUnits.end())
+        {
+            return;
+        }
+        entry = std::move(it->second);
         m_translationUnits.erase(it);
     }
+    GetStatistics().Add(Gauge::translationUnits, -1);
+    AccountMemory(entry.Memory(), {});
+    // The units are disposed here, unless a query still holds them
 }
 
-void TranslationUnitStore::SetTranslationOptions(const std::vector<std::string> &options)
+void TranslationUnitStore::OnFileChange(const std::string &filePath, std::vector<TextChange> changes)
 {
-    m_args.clear();
+    SPDLOG_LOGGER_TRACE(logger(), "TranslationUnitStore::OnFileChange - {}, {} change(s)", filePath, changes.size());
+    std::shared_ptr<const std::string> content;
+    uint64_t revision = 0;
+    TranslationUnitRef standby;
+    // Released outside of the lock
+    TranslationUnitRef busy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto &state = m_documents[filePath];
+        for (const auto &change : changes)
+        {
+            state.document.Apply(change);
+        }
+        if (state.document.PieceCount() > MaxDocumentPieces)
+        {
+            state.document.Materialize();
+        }
+        state.content.reset();
+        revision = state.revision = ++m_lastRevision;
+        // Joined once for the reparse, the diagnostics and the leases read the same snapshot
+        content = state.Content();
+        auto it = m_translationUnits.find(filePath);
+        if (it != m_translationUnits.end() && it->second.standby)
+        {
+            auto &entry = it->second;
+            const auto before = entry.Memory();
+            // The standby is served no more, but a lease taken before the last swap may still hold it
+            if (entry.standby.use_count() == 1)
+            {
+                standby = std::move(entry.standby);
+            }
+            else
+            {
+                busy = std::move(entry.standby);
+            }
+            entry.standbyMemory = {};
+            AccountMemory(before, entry.Memory());
+        }
+    }
 
-    for (const auto &arg : options)
+    // The served unit is left untouched, queries keep reading it until the new revision is installed
+    if (standby && !ReparseTranslationUnit(standby.get(), filePath, *content))
+    {
+        standby.reset();
+    }
+    if (!standby)
+    {
+        logger()->debug("No standby TU, performing full parse...");
+        standby = ParseTranslationUnit(filePath, *content);
+    }
+    if (!standby)
     {
-        m_args.push_back(arg);
+        logger()->error("Failed to parse revision {} of {}, the previous one is served", revision, filePath);
+        return;
     }
+    InstallTranslationUnit(filePath, std::move(standby), std::move(content), revision, false);
+}
+
+void TranslationUnitStore::OnFileClose(const std::string &filePath)
+{
+    SPDLOG_LOGGER_TRACE(logger(), "TranslationUnitStore::OnFileClose - {}", filePath);
+    if (m_astCacheDir)
+    {
+        // The last state of the file is the one most likely opened next time
+        std::shared_ptr<DocumentLock> mutex;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto document = m_documents.find(filePath);
+            if (document != m_documents.end())
+            {
+                mutex = document->second.lock;
+            }
+        }
+        // Saving reads the unit like a shared lease, so it must not overlap with a completion in it
+        const auto documentLock = mutex ? LockDocument(mutex, LeaseMode::shared) : nullptr;
+        TranslationUnitRef tu;
+        std::shared_ptr<const std::string> content;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_translationUnits.find(filePath);
+            auto document = m_documents.find(filePath);
+            if (it != m_translationUnits.end() && !it->second.restored && document != m_documents.end()
+                && document->second.revision == it->second.revision)
+            {
+                tu = it->second.tu;
+                content = it->second.content;
+            }
+        }
+        if (tu && content)
+        {
+            SaveTranslationUnit(filePath, *content, tu.get());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_documents.erase(filePath);
+        m_evicted.erase(filePath);
+    }
+    DisposeTranslationUnit(filePath);
+}
 
+void TranslationUnitStore::SetTranslationOptions(const std::vector<std::string> &options)
+{
+    std::vector<std::string> args = options;
     if (m_headersDir)
     {
-        m_args.push_back("-I" + m_headersDir.value().string());
-        const auto &headers = resources::get_headers();
-        for (const auto &[filename, _] : headers)
+        args.push_back("-I" + m_headersDir.value().string());
+        if (const auto pchPath = BuildPrecompiledHeaders(args))
         {
-            m_args.push_back("-include");
-            m_args.push_back(filename);
+            args.push_back("-include-pch");
+            args.push_back(pchPath->string());
+        }
+        else
+        {
+            const auto &headers = resources::get_headers();
+            for (const auto &[filename, _] : headers)
+            {
+                args.push_back("-include");
+                args.push_back(filename);
+            }
         }
     }
 
-    logger()->debug("TranslationUnitStore::SetTranslationOptions - {}", utils::FormatVector(m_args));
+    logger()->debug("TranslationUnitStore::SetTranslationOptions - {}", utils::FormatVector(args));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_args = std::make_shared<const std::vector<std::string>>(std::move(args));
+        // A parse that read the previous arguments has an older revision than any document now
+        m_argsRevision = m_lastRevision;
+        for (auto &[filePath, state] : m_documents)
+        {
+            state.revision = ++m_lastRevision;
+        }
+    }
 
     // We need to re-parse sources with new options
     DestroyTranslationUnits();
+    // A new PCH may have pushed the cache over its capacity
+    TrimASTCache();
+}
+
+std::optional<fs::path> TranslationUnitStore::BuildPrecompiledHeaders(const std::vector<std::string> &args)
+{
+    std::vector<std::string> filenames;
+    for (const auto &[filename, _] : resources::get_headers())
+    {
+        filenames.push_back(filename);
+    }
+    // Sorted, so that the prelude does not depend on the order of the map
+    std::sort(filenames.begin(), filenames.end());
+    std::string prelude;
+    for (const auto &filename : filenames)
+    {
+        prelude += "#include \"" + filename + "\"\n";
+    }
+
+    // The PCH is only valid for the language options and the headers it was built with
+    ContentHash hash;
+    hash.Add(m_clangVersion).Add(version);
+    for (const auto &arg : args)
+    {
+        hash.Add(arg);
+    }
+    hash.Add(prelude);
+    for (const auto &filename : filenames)
+    {
+        hash.Add(resources::get_headers().at(filename));
+    }
+    // Next to the headers, in a directory kept between runs, so that later runs and subcommands reuse it
+    const auto pchDir = m_headersDir->parent_path() / "pch";
+    const auto pchPath = pchDir / (hash.ToString() + ".pch");
+    std::error_code error;
+    if (fs::exists(pchPath, error))
+    {
+        logger()->debug("Using precompiled headers: {}", pchPath.string());
+        if (m_astCacheDir)
+        {
+            // Recently used, so that the trim of the AST cache removes it last
+            fs::last_write_time(pchPath, fs::file_time_type::clock::now(), error);
+        }
+        return pchPath;
+    }
+    fs::create_directories(pchDir, error);
+
+    // Named like the kernels, so that without an explicit '-x cl' the language is inferred the same way
+    const auto preludePath = (pchDir / (hash.ToString() + ".cl")).string();
+    auto unsavedFiles = BuildUnsavedPool(preludePath, prelude);
+    std::vector<const char *> cargs;
+    cargs.reserve(args.size());
+    for (const auto &arg : args)
+    {
+        cargs.push_back(arg.c_str());
+    }
+
+    logger()->debug("Building precompiled headers: {}", pchPath.string());
+    TraceSpan span("BuildPrecompiledHeaders", "libclang");
+    CXTranslationUnit tu;
+    const CXErrorCode code = clang_parseTranslationUnit2(
+        m_index,
+        preludePath.c_str(),
+        cargs.data(),
+        static_cast<int>(cargs.size()),
+        unsavedFiles.data(),
+        static_cast<unsigned int>(unsavedFiles.size()),
+        CXTranslationUnit_ForSerialization | CXTranslationUnit_Incomplete,
+        &tu);
+    if (code != CXError_Success)
+    {
+        logger()->error("Failed to build precompiled headers: {}", TranslationErrorSpelling(code));
+        return std::nullopt;
+    }
+    const bool saved = SaveTranslationUnitAs(tu, pchPath);
+    clang_disposeTranslationUnit(tu);
+    if (!saved)
+    {
+        return std::nullopt;
+    }
+    return pchPath;
+}
+
+void TranslationUnitStore::ParseCurrentRevision(const std::string &filePath, bool restore)
+{
+    std::shared_ptr<const std::string> content;
+    uint64_t revision = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto document = m_documents.find(filePath);
+        if (document == m_documents.end())
+        {
+            return;
+        }
+        content = document->second.Content();
+        revision = document->second.revision;
+    }
+    if (restore)
+    {
+        if (auto tu = RestoreTranslationUnit(filePath, *content))
+        {
+            InstallTranslationUnit(filePath, std::move(tu), std::move(content), revision, true);
+            return;
+        }
+    }
+    if (auto tu = ParseTranslationUnit(filePath, *content))
+    {
+        InstallTranslationUnit(filePath, std::move(tu), std::move(content), revision, false);
+    }
 }
 
-CXTranslationUnit TranslationUnitStore::GetTranslationUnit(const std::string &filePath) const
+TranslationUnitLease TranslationUnitStore::Lease(const std::string &filePath, LeaseMode mode)
 {
+    std::shared_ptr<DocumentLock> mutex;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto document = m_documents.find(filePath);
+        if (document == m_documents.end())
+        {
+            return {};
+        }
+        mutex = document->second.lock;
+    }
+    // Locked before the unit is looked up, so an exclusive lease gets a unit no shared lease reads
+    auto documentLock = LockDocument(mutex, mode);
+
+    for (bool parsed = false;; parsed = true)
+    {
+        std::shared_future<void> pending;
+        std::promise<void> parse;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto document = m_documents.find(filePath);
+            if (document == m_documents.end())
+            {
+                return {};
+            }
+            auto it = m_translationUnits.find(filePath);
+            if (it != m_translationUnits.end() && (mode == LeaseMode::shared || !it->second.restored))
+            {
+                auto &entry = it->second;
+                entry.lastUsed = Clock::now();
+                const bool upToDate = entry.revision == document->second.revision;
+                return {
+                    entry.tu,
+                    entry.content,
+                    upToDate ? nullptr : document->second.Content(),
+                    std::move(documentLock)};
+            }
+            if (parsed || (it == m_translationUnits.end() && m_evicted.count(filePath) == 0))
+            {
+                return {};
+            }
+            if (it == m_translationUnits.end())
+            {
+                logger()->debug("Parsing evicted translation unit of {} again", filePath);
+            }
+            else
+            {
+                logger()->debug("Parsing the translation unit of {} restored from the AST cache", filePath);
+            }
+            auto &parsing = document->second.parsing;
+            if (parsing.valid())
+            {
+                pending = parsing;
+            }
+            else
+            {
+                parsing = parse.get_future().share();
+            }
+        }
+        if (pending.valid())
+        {
+            // Another shared lease is parsing the same revision
+            pending.wait();
+            continue;
+        }
+        ParseCurrentRevision(filePath, mode == LeaseMode::shared);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto document = m_documents.find(filePath);
+            if (document != m_documents.end())
+            {
+                document->second.parsing = {};
+            }
+        }
+        parse.set_value();
+    }
+}
+
+bool TranslationUnitStore::IsUpToDate(const std::string &filePath) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto it = m_translationUnits.find(filePath);
-    if (it == m_translationUnits.end())
+    auto document = m_documents.find(filePath);
+    // Without a unit the next lease parses the latest content
+    return it == m_translationUnits.end() || document == m_documents.end()
+        || it->second.revision == document->second.revision;
+}
+
+std::shared_ptr<const std::string> TranslationUnitStore::GetContent(const std::string &filePath) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_documents.find(filePath);
+    if (it == m_documents.end())
     {
         return nullptr;
     }
-    return it->second.tu;
+    return it->second.Content();
 }
 
-const std::string *TranslationUnitStore::GetContent(const std::string &filePath) const
+std::vector<TranslationUnitMemory> TranslationUnitStore::GetMemoryUsage() const
 {
-    auto it = m_fileContents.find(filePath);
-    if (it == m_fileContents.end())
+    std::vector<TranslationUnitMemory> result;
     {
-        return nullptr;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        result.reserve(m_translationUnits.size());
+        for (const auto &[filePath, entry] : m_translationUnits)
+        {
+            result.push_back(entry.Memory());
+            result.back().filePath = filePath;
+        }
     }
-    return &it->second;
+    std::sort(result.begin(), result.end(), [](const TranslationUnitMemory &lhs, const TranslationUnitMemory &rhs) {
+        return lhs.total > rhs.total;
+    });
+    return result;
+}
+
+void TranslationUnitStore::SetLimits(const TranslationUnitLimits &limits)
+{
+    logger()->debug(
+        "TranslationUnitStore::SetLimits - budget: {} bytes, translation units: {}, idle timeout: {} ms",
+        limits.memoryBudget,
+        limits.maxTranslationUnits,
+        limits.idleTimeout.count());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_limits = limits;
+    GetStatistics().Set(Gauge::translationUnitMemoryBudget, static_cast<int64_t>(limits.memoryBudget));
+    GetStatistics().Set(Gauge::maxTranslationUnits, static_cast<int64_t>(limits.maxTranslationUnits));
+}
+
+void TranslationUnitStore::ReleaseStandbys()
+{
+    // Released outside of the lock
+    std::vector<TranslationUnitRef> released;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::pair<Clock::time_point, TranslationUnitEntry *>> byAge;
+        uint64_t memory = 0;
+        for (auto &[filePath, entry] : m_translationUnits)
+        {
+            if (entry.standby)
+            {
+                byAge.emplace_back(entry.lastUsed, &entry);
+            }
+            memory += entry.Memory().total;
+        }
+        std::sort(byAge.begin(), byAge.end(), [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+
+        const auto now = Clock::now();
+        for (const auto &[lastUsed, entry] : byAge)
+        {
+            const bool idle = m_limits.idleTimeout.count() > 0 && now - lastUsed >= m_limits.idleTimeout;
+            const bool overBudget = m_limits.memoryBudget > 0 && memory > m_limits.memoryBudget;
+            if (!idle && !overBudget)
+            {
+                break;
+            }
+            const auto before = entry->Memory();
+            released.push_back(std::move(entry->standby));
+            entry->standbyMemory = {};
+            AccountMemory(before, entry->Memory());
+            memory -= before.total - entry->Memory().total;
+        }
+    }
+    if (!released.empty())
+    {
+        logger()->debug("Releasing {} standby translation unit(s)", released.size());
+        released.clear();
+        ReleaseFreeHeap();
+    }
+}
+
+std::vector<std::string> TranslationUnitStore::GetEvictionCandidates() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::pair<Clock::time_point, const std::string *>> byAge;
+    byAge.reserve(m_translationUnits.size());
+    uint64_t memory = 0;
+    for (const auto &[filePath, entry] : m_translationUnits)
+    {
+        byAge.emplace_back(entry.lastUsed, &filePath);
+        memory += entry.Memory().total;
+    }
+    std::sort(byAge.begin(), byAge.end());
+
+    const auto now = Clock::now();
+    size_t count = byAge.size();
+    std::vector<std::string> candidates;
+    for (size_t i = 0; i < byAge.size(); i++)
+    {
+        const auto &[lastUsed, filePath] = byAge[i];
+        const bool idle = m_limits.idleTimeout.count() > 0 && now - lastUsed >= m_limits.idleTimeout;
+        const bool overBudget = m_limits.memoryBudget > 0 && memory > m_limits.memoryBudget;
+        const bool overCap = m_limits.maxTranslationUnits > 0 && count > m_limits.maxTranslationUnits;
+        const bool mostRecent = i + 1 == byAge.size();
+        if (!idle && (mostRecent || (!overBudget && !overCap)))
+        {
+            // The rest were queried later, so they are not idle either
+            break;
+        }
+        candidates.push_back(*filePath);
+        memory -= m_translationUnits.at(*filePath).Memory().total;
+        count--;
+    }
+    return candidates;
+}
+
+void TranslationUnitStore::Evict(const std::string &filePath)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_translationUnits.count(filePath) == 0 || m_documents.count(filePath) == 0)
+        {
+            return;
+        }
+        m_evicted.insert(filePath);
+    }
+    logger()->debug("Evicting translation unit of {}", filePath);
+    DisposeTranslationUnit(filePath);
+    GetStatistics().Add(Gauge::evictedTranslationUnits, 1);
+    ReleaseFreeHeap();
+}
+
+TranslationUnitLease::TranslationUnitLease(
+    TranslationUnitRef tu,
+    std::shared_ptr<const std::string> content,
+    std::shared_ptr<const std::string> latest,
+    std::shared_ptr<void> lock)
+    : m_tu {std::move(tu)}
+    , m_content {std::move(content)}
+    , m_latest {std::move(latest)}
+    , m_lock {std::move(lock)}
+{}
+
+TranslationUnitLease::operator bool() const
+{
+    return m_tu != nullptr;
+}
+
+CXTranslationUnit TranslationUnitLease::TranslationUnit() const
+{
+    return m_tu.get();
+}
+
+const std::string *TranslationUnitLease::Content() const
+{
+    return m_content.get();
+}
+
+bool TranslationUnitLease::IsUpToDate() const
+{
+    return m_latest == nullptr;
+}
+
+bool TranslationUnitLease::MapPosition(unsigned &lineno, unsigned &columnno) const
+{
+    if (!m_latest || !m_content)
+    {
+        return true;
+    }
+    const std::string_view from = *m_latest;
+    const std::string_view to = *m_content;
+    const auto offset = OffsetOf(from, lineno, columnno);
+    if (!offset)
+    {
+        return false;
+    }
+
+    // The changes lie between the text both revisions start and end with
+    const size_t common = std::min(from.size(), to.size());
+    const size_t prefix = static_cast<size_t>(
+        std::mismatch(from.begin(), from.begin() + common, to.begin()).first - from.begin());
+    const size_t suffix = static_cast<size_t>(
+        std::mismatch(from.rbegin(), from.rbegin() + (common - prefix), to.rbegin()).first - from.rbegin());
+    size_t mapped;
+    if (*offset < prefix)
+    {
+        mapped = *offset;
+    }
+    else if (*offset >= from.size() - suffix)
+    {
+        mapped = *offset - from.size() + to.size();
+    }
+    else
+    {
+        return false;
+    }
+
+    const auto lineStart = mapped == 0 ? std::string_view::npos : to.rfind('\n', mapped - 1);
+    lineno = static_cast<unsigned>(std::count(to.begin(), to.begin() + mapped, '\n')) + 1;
+    columnno = static_cast<unsigned>(mapped - (lineStart == std::string_view::npos ? 0 : lineStart + 1)) + 1;
+    return true;
+}
+
+std::shared_ptr<ITranslationUnitStore> CreateTranslationUnitStore(const PreambleStorage &preambles)
+{
+    return std::make_shared<TranslationUnitStore>(preambles);
 }
 
-std::shared_ptr<ITranslationUnitStore> CreateTranslationUnitStore()
+nlohmann::json ToJson(const TranslationUnitMemory &memory)
 {
-    return std::make_shared<TranslationUnitStore>();
+    return {
+        {"filePath", memory.filePath},
+        {"astBytes", memory.ast},
+        {"preambleBytes", memory.preamble},
+        {"totalBytes", memory.total}};
 }
 
 std::vector<std::string> BuildDefaultTranslationOptions(const std::string &clStandard)
@@ -12,9 +12,9 @@
 
 namespace {
 
-auto logger()
+const auto& logger()
 {
-    return spdlog::get(ocls::LogName::typeDefinition);
+    return ocls::Loggers::typeDefinition;
 }
 
 /**
@@ -64,24 +64,40 @@ public:
     explicit TypeDefinition(std::shared_ptr<ITranslationUnitStore> store) 
         : m_store(std::move(store)) {}
 
-    std::vector<Location> GetTypeDefinitions(const std::string &filePath, unsigned lineno, unsigned columnno) override;
+    LocationResult GetTypeDefinitions(const std::string &filePath, unsigned lineno, unsigned columnno) override;
 
 private:
+    std::vector<Location> GetTypeDefinitions(
+        const TranslationUnitLease &lease, const std::string &filePath, unsigned lineno, unsigned columnno);
+
     std::shared_ptr<ITranslationUnitStore> m_store;
 };
 
-std::vector<Location> TypeDefinition::GetTypeDefinitions(
-    const std::string &filePath, unsigned lineno, unsigned columnno)
+LocationResult TypeDefinition::GetTypeDefinitions(const std::string &filePath, unsigned lineno, unsigned columnno)
 {
     logger()->debug("Get type definition for {}:{}:{}", filePath, lineno, columnno);
 
-    CXTranslationUnit translationUnit = m_store->GetTranslationUnit(filePath);
+    const auto lease = m_store->Lease(filePath, LeaseMode::shared);
+    return {GetTypeDefinitions(lease, filePath, lineno, columnno), lease.IsUpToDate()};
+}
+
+std::vector<Location> TypeDefinition::GetTypeDefinitions(
+    const TranslationUnitLease &lease, const std::string &filePath, unsigned lineno, unsigned columnno)
+{
+    CXTranslationUnit translationUnit = lease.TranslationUnit();
     if (!translationUnit)
     {
         logger()->error("No translation unit for {}", filePath);
         return {};
     }
 
+    // The unit may be older than the text the position refers to
+    if (!lease.MapPosition(lineno, columnno))
+    {
+        logger()->debug("{}:{}:{} was changed after the served revision", filePath, lineno, columnno);
+        return {};
+    }
+
     CXFile file = clang_getFile(translationUnit, filePath.c_str());
     if (!file)
     {
@@ -0,0 +1,293 @@
+//
+//  writer.cpp
+//  opencl-language-server
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "writer.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(WIN32)
+    #include <io.h>
+    #include <stdio.h>
+#else
+    #include <unistd.h>
+#endif
+
+using namespace nlohmann;
+
+namespace ocls {
+
+namespace {
+
+const auto& logger() { return ocls::Loggers::jrpc; }
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::string_view ContentLengthPrefix = "Content-Length: ";
+constexpr std::string_view ContentTypeHeader = "Content-Type: application/vscode-jsonrpc;charset=utf-8\r\n\r\n";
+
+struct PendingMessage
+{
+    OutgoingMessage body;
+    Clock::time_point enqueued;
+};
+
+} // namespace
+
+json ToJson(const OutgoingMessage& message)
+{
+    if (const auto serialized = std::get_if<SerializedMessage>(&message))
+    {
+        return json::parse(serialized->body);
+    }
+    return std::get<json>(message);
+}
+
+void AppendFramedMessage(const json& body, std::string& scratch, std::string& out)
+{
+    scratch.clear();
+    // Same as json::dump(), but serializes into the caller's buffer instead of a temporary string
+    detail::serializer<json> serializer(detail::output_adapter<char, std::string>(scratch), ' ');
+    serializer.dump(body, false, false, 0);
+    AppendFramedMessage(std::string_view {scratch}, out);
+}
+
+void AppendFramedMessage(std::string_view body, std::string& out)
+{
+    char length[24];
+    const auto [end, ec] = std::to_chars(std::begin(length), std::end(length), body.size());
+    (void)ec;
+
+    out.append(ContentLengthPrefix);
+    out.append(length, end);
+    out.append("\r\n");
+    out.append(ContentTypeHeader);
+    out.append(body);
+}
+
+WriteSinkFunc CreateDescriptorSink(int fd)
+{
+    return [fd](std::string_view data) {
+        while (!data.empty())
+        {
+#if defined(WIN32)
+            const auto count = _write(fd, data.data(), static_cast<unsigned>(data.size()));
+#else
+            const auto count = write(fd, data.data(), data.size());
+#endif
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                logger()->error("Failed to write to descriptor {}, errno: {}", fd, errno);
+                return false;
+            }
+            data.remove_prefix(static_cast<size_t>(count));
+        }
+        return true;
+    };
+}
+
+WriteSinkFunc CreateStdoutSink()
+{
+#if defined(WIN32)
+    return CreateDescriptorSink(_fileno(stdout));
+#else
+    return CreateDescriptorSink(STDOUT_FILENO);
+#endif
+}
+
+class MessageWriter final : public IMessageWriter
+{
+public:
+    explicit MessageWriter(WriteSinkFunc sink) : m_sink {std::move(sink)} {}
+
+    ~MessageWriter()
+    {
+        Stop();
+    }
+
+    void Start();
+    void Push(OutgoingMessage&& message);
+    void Flush();
+    void Stop();
+    MessageWriterStats GetStats() const;
+
+private:
+    void Loop();
+    void WriteBatch(std::vector<PendingMessage>& batch);
+
+private:
+    WriteSinkFunc m_sink;
+    std::thread m_thread;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_hasWork;
+    std::condition_variable m_drained;
+    std::vector<PendingMessage> m_queue;
+    // Owned by the writer thread, reused between batches to keep their capacity
+    std::string m_buffer;
+    std::string m_scratch;
+    MessageWriterStats m_stats;
+    bool m_writing = false;
+    bool m_stopping = false;
+    bool m_closed = false;
+};
+
+void MessageWriter::Start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_thread.joinable())
+    {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread(&MessageWriter::Loop, this);
+}
+
+void MessageWriter::Push(OutgoingMessage&& message)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back({std::move(message), Clock::now()});
+    }
+    GetStatistics().Add(Gauge::outgoingMessages, 1);
+    m_hasWork.notify_one();
+}
+
+void MessageWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_thread.joinable())
+    {
+        return;
+    }
+    m_drained.wait(lock, [this] { return (m_queue.empty() && !m_writing) || m_closed; });
+}
+
+void MessageWriter::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_hasWork.notify_one();
+    m_thread.join();
+
+    const auto stats = GetStats();
+    logger()->debug(
+        "Writer stopped, messages: {}, batches: {}, bytes: {}, queue wait: {} us (max {} us)",
+        stats.messages,
+        stats.batches,
+        stats.bytesWritten,
+        stats.queueWaitNs / 1000,
+        stats.maxQueueWaitNs / 1000);
+}
+
+MessageWriterStats MessageWriter::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void MessageWriter::Loop()
+{
+    std::vector<PendingMessage> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_writing = false;
+            m_drained.notify_all();
+            m_hasWork.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+            if (m_queue.empty())
+            {
+                // Stopping and nothing left to write
+                return;
+            }
+            // Take everything queued so far, producers keep pushing into the empty vector
+            std::swap(batch, m_queue);
+            m_writing = true;
+        }
+        GetStatistics().Add(Gauge::outgoingMessages, -static_cast<int64_t>(batch.size()));
+        WriteBatch(batch);
+        batch.clear();
+    }
+}
+
+void MessageWriter::WriteBatch(std::vector<PendingMessage>& batch)
+{
+    const auto now = Clock::now();
+    uint64_t waitNs = 0;
+    uint64_t maxWaitNs = 0;
+    const bool tracing = GetTracer().IsEnabled();
+    m_buffer.clear();
+    for (const auto& message : batch)
+    {
+        const auto wait =
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - message.enqueued).count());
+        waitNs += wait;
+        maxWaitNs = std::max(maxWaitNs, wait);
+        try
+        {
+            if (const auto serialized = std::get_if<SerializedMessage>(&message.body))
+            {
+                TraceSpan span("Serialize", "writer");
+                AppendFramedMessage(serialized->body, m_buffer);
+            }
+            else
+            {
+                const auto& body = std::get<json>(message.body);
+                // Responses are tagged with the id of their request
+                const auto id = tracing ? body.find("id") : body.end();
+                TraceContext context(id != body.end() ? *id : json(), {});
+                TraceSpan span("Serialize", "writer");
+                AppendFramedMessage(body, m_scratch, m_buffer);
+            }
+        }
+        catch (std::exception& err)
+        {
+            logger()->error("Failed to serialize message, error: {}", err.what());
+        }
+    }
+
+    bool closed = m_closed;
+    if (!closed)
+    {
+        TraceSpan span("Write", "writer");
+        closed = !m_sink(m_buffer);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = closed;
+    m_stats.messages += batch.size();
+    m_stats.batches++;
+    m_stats.bytesWritten += closed ? 0 : m_buffer.size();
+    m_stats.queueWaitNs += waitNs;
+    m_stats.maxQueueWaitNs = std::max(m_stats.maxQueueWaitNs, maxWaitNs);
+}
+
+std::shared_ptr<IMessageWriter> CreateMessageWriter(WriteSinkFunc sink)
+{
+    return std::make_shared<MessageWriter>(std::move(sink));
+}
+
+} // namespace ocls
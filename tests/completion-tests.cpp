@@ -60,7 +60,7 @@ protected:
 // Test basic completion at a function call site
 TEST_F(CompletionTest, CompletionAtFunctionCall)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     ASSERT_GT(results.size(), 0);
 
@@ -76,10 +76,21 @@ TEST_F(CompletionTest, CompletionAtFunctionCall)
     EXPECT_GT(it->sortText.length(), 0);
 }
 
+// Test that cancelled completion gives up before running code completion
+TEST_F(CompletionTest, CancelledCompletionReturnsNothing)
+{
+    CancellationSource cancellation;
+    cancellation.Cancel();
+
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, cancellation.Token());
+
+    EXPECT_TRUE(results.empty());
+}
+
 // Test that results include proper sort order
 TEST_F(CompletionTest, CompletionSortOrder)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     ASSERT_GT(results.size(), 0);
 
@@ -95,7 +106,7 @@ TEST_F(CompletionTest, CompletionSortOrder)
 // Test completion item kinds are properly mapped
 TEST_F(CompletionTest, CompletionItemKinds)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     ASSERT_GT(results.size(), 0);
 
@@ -116,7 +127,7 @@ TEST_F(CompletionTest, CompletionItemKinds)
 // Test that function completions have commit characters
 TEST_F(CompletionTest, FunctionCommitCharacters)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     auto it =
         std::find_if(results.begin(), results.end(), [](const CompletionResult& r) { return r.label == "getChannel"; });
@@ -130,7 +141,7 @@ TEST_F(CompletionTest, FunctionCommitCharacters)
 // Test completion has all required fields
 TEST_F(CompletionTest, CompletionResultFields)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     ASSERT_GT(results.size(), 0);
 
@@ -147,7 +158,7 @@ TEST_F(CompletionTest, CompletionResultFields)
 // Test tags for deprecated items
 TEST_F(CompletionTest, DeprecatedTags)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     for (const auto& result : results)
     {
@@ -163,7 +174,7 @@ TEST_F(CompletionTest, DeprecatedTags)
 // Test that results have detail information for functions
 TEST_F(CompletionTest, FunctionDetail)
 {
-    auto results = completion->GetCompletions(KERNEL_FILE, line, column);
+    auto results = completion->GetCompletions(KERNEL_FILE, line, column, {});
 
     auto it =
         std::find_if(results.begin(), results.end(), [](const CompletionResult& r) { return r.label == "getChannel"; });
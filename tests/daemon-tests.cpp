@@ -0,0 +1,243 @@
+//
+//  daemon-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "daemon.hpp"
+#include "clinfo-mock.hpp"
+#include "translation-mock.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+#if !defined(WIN32)
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+using namespace ocls;
+using namespace nlohmann;
+using ::testing::_;
+using ::testing::NiceMock;
+using ::testing::Return;
+
+
+TEST(SharedTranslationUnitStoreTest, ClosesFileAfterLastSession)
+{
+    auto mockStore = std::make_shared<TranslationUnitStoreMock>();
+    auto shared = CreateSharedTranslationUnitStore(mockStore);
+    auto first = shared->CreateSession();
+    auto second = shared->CreateSession();
+    ON_CALL(*mockStore, GetContent("kernel.cl"))
+        .WillByDefault(Return(std::make_shared<const std::string>("__kernel void a() {}")));
+
+    // The second session shares the translation unit of the first one
+    EXPECT_CALL(*mockStore, GetContent("kernel.cl")).Times(testing::AnyNumber());
+    EXPECT_CALL(*mockStore, OnFileOpen("kernel.cl", _)).Times(2);
+    first->OnFileOpen("kernel.cl", "__kernel void a() {}");
+    first->OnFileOpen("kernel.cl", "__kernel void a() {}");
+    second->OnFileOpen("kernel.cl", "__kernel void a() {}");
+
+    EXPECT_CALL(*mockStore, OnFileClose("kernel.cl")).Times(0);
+    first->OnFileClose("kernel.cl");
+    first->OnFileClose("kernel.cl");
+    ::testing::Mock::VerifyAndClearExpectations(mockStore.get());
+
+    EXPECT_CALL(*mockStore, OnFileClose("kernel.cl")).Times(1);
+    second->OnFileClose("kernel.cl");
+}
+
+TEST(SharedTranslationUnitStoreTest, AppliesChangesOfTheOwnerOnly)
+{
+    auto mockStore = std::make_shared<NiceMock<TranslationUnitStoreMock>>();
+    auto shared = CreateSharedTranslationUnitStore(mockStore);
+    auto first = shared->CreateSession();
+    auto second = shared->CreateSession();
+    auto third = shared->CreateSession();
+    ON_CALL(*mockStore, GetContent("kernel.cl"))
+        .WillByDefault(Return(std::make_shared<const std::string>("__kernel void a() {}")));
+    first->OnFileOpen("kernel.cl", "__kernel void a() {}");
+    second->OnFileOpen("kernel.cl", "__kernel void a() {}");
+    third->OnFileOpen("kernel.cl", "__kernel void b() {}");
+
+    EXPECT_CALL(*mockStore, OnFileChange("kernel.cl", _)).Times(1);
+    first->OnFileChange("kernel.cl", {TextChange {std::nullopt, "__kernel void c() {}"}});
+    second->OnFileChange("kernel.cl", {TextChange {std::nullopt, "__kernel void d() {}"}});
+    ::testing::Mock::VerifyAndClearExpectations(mockStore.get());
+
+    // Neither of the others has the text of the store anymore, so neither of them takes over
+    EXPECT_CALL(*mockStore, OnFileChange("kernel.cl", _)).Times(0);
+    first->OnFileClose("kernel.cl");
+    second->OnFileChange("kernel.cl", {TextChange {std::nullopt, "__kernel void e() {}"}});
+    third->OnFileChange("kernel.cl", {TextChange {std::nullopt, "__kernel void f() {}"}});
+    ::testing::Mock::VerifyAndClearExpectations(mockStore.get());
+
+    // Opening it again makes the session the owner
+    EXPECT_CALL(*mockStore, OnFileOpen("kernel.cl", _)).Times(1);
+    EXPECT_CALL(*mockStore, OnFileChange("kernel.cl", _)).Times(1);
+    third->OnFileOpen("kernel.cl", "__kernel void f() {}");
+    third->OnFileChange("kernel.cl", {TextChange {std::nullopt, "__kernel void g() {}"}});
+}
+
+TEST(SharedTranslationUnitStoreTest, ReleasesFilesOfDisconnectedSession)
+{
+    auto mockStore = std::make_shared<NiceMock<TranslationUnitStoreMock>>();
+    auto shared = CreateSharedTranslationUnitStore(mockStore);
+    auto first = shared->CreateSession();
+    auto second = shared->CreateSession();
+    first->OnFileOpen("a.cl", "");
+    first->OnFileOpen("b.cl", "");
+    second->OnFileOpen("b.cl", "");
+
+    EXPECT_CALL(*mockStore, OnFileClose("a.cl")).Times(1);
+    EXPECT_CALL(*mockStore, OnFileClose("b.cl")).Times(0);
+    first.reset();
+    ::testing::Mock::VerifyAndClearExpectations(mockStore.get());
+
+    EXPECT_CALL(*mockStore, OnFileClose("b.cl")).Times(1);
+    second.reset();
+}
+
+TEST(SharedTranslationUnitStoreTest, SetsChangedTranslationOptionsOnly)
+{
+    auto mockStore = std::make_shared<TranslationUnitStoreMock>();
+    auto shared = CreateSharedTranslationUnitStore(mockStore);
+    auto first = shared->CreateSession();
+    auto second = shared->CreateSession();
+
+    EXPECT_CALL(*mockStore, SetTranslationOptions(std::vector<std::string> {"-cl-std=CL1.2"})).Times(1);
+    EXPECT_CALL(*mockStore, SetTranslationOptions(std::vector<std::string> {"-cl-std=CL2.0"})).Times(1);
+    first->SetTranslationOptions({"-cl-std=CL1.2"});
+    second->SetTranslationOptions({"-cl-std=CL1.2"});
+    second->SetTranslationOptions({"-cl-std=CL2.0"});
+}
+
+TEST(SharedTranslationUnitStoreTest, AppliesTheStrictestLimitsOfTheSessions)
+{
+    std::vector<TranslationUnitLimits> applied;
+    auto mockStore = std::make_shared<TranslationUnitStoreMock>();
+    auto shared = CreateSharedTranslationUnitStore(mockStore);
+    auto first = shared->CreateSession();
+    auto second = shared->CreateSession();
+    EXPECT_CALL(*mockStore, SetLimits(_)).Times(4).WillRepeatedly([&applied](const TranslationUnitLimits &limits) {
+        applied.push_back(limits);
+    });
+
+    first->SetLimits({512, 0, std::chrono::milliseconds(1000)});
+    second->SetLimits({1024, 4, std::chrono::milliseconds(0)});
+    first.reset();
+    second.reset();
+
+    ASSERT_EQ(applied.size(), 4);
+    EXPECT_EQ(applied[1].memoryBudget, 512);
+    EXPECT_EQ(applied[1].maxTranslationUnits, 4);
+    EXPECT_EQ(applied[1].idleTimeout.count(), 1000);
+    EXPECT_EQ(applied[2].memoryBudget, 1024);
+    EXPECT_EQ(applied[2].maxTranslationUnits, 4);
+    EXPECT_EQ(applied[2].idleTimeout.count(), 0);
+    // No limits are left once the last session is gone
+    EXPECT_EQ(applied[3].memoryBudget, 0);
+}
+
+#if !defined(WIN32)
+
+namespace {
+
+int Connect(const std::string &socketPath)
+{
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    socketPath.copy(address.sun_path, sizeof(address.sun_path) - 1);
+    // The daemon starts listening on its own thread
+    for (int attempt = 0; attempt < 200; attempt++)
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0)
+        {
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+void Send(int fd, const json &body)
+{
+    const auto content = body.dump();
+    const auto message = "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+    ASSERT_EQ(write(fd, message.data(), message.size()), static_cast<ssize_t>(message.size()));
+}
+
+json Receive(int fd)
+{
+    std::string data;
+    char c;
+    while (data.find("\r\n\r\n") == std::string::npos && read(fd, &c, 1) == 1)
+    {
+        data.push_back(c);
+    }
+    const auto length = std::stoul(data.substr(data.find(':') + 1));
+    std::string body(length, '\0');
+    size_t received = 0;
+    while (received < length)
+    {
+        const auto count = read(fd, body.data() + received, length - received);
+        if (count <= 0)
+        {
+            break;
+        }
+        received += static_cast<size_t>(count);
+    }
+    return json::parse(body);
+}
+
+} // namespace
+
+TEST(LSPDaemonTest, ServesSeveralClients)
+{
+    const auto socketPath =
+        (std::filesystem::temp_directory_path() / ("ocls-test-" + std::to_string(getpid()) + ".sock")).string();
+    auto daemon = CreateLSPDaemon(
+        socketPath, std::make_shared<NiceMock<TranslationUnitStoreMock>>(), std::make_shared<NiceMock<CLInfoMock>>());
+    int result = -1;
+    std::thread thread([&] { result = daemon->Run(); });
+
+    const int first = Connect(socketPath);
+    const int second = Connect(socketPath);
+    ASSERT_GE(first, 0);
+    ASSERT_GE(second, 0);
+
+    Send(second, {{"jsonrpc", "2.0"}, {"id", 2}, {"method", "initialize"}, {"params", json::object()}});
+    Send(first, {{"jsonrpc", "2.0"}, {"id", 1}, {"method", "initialize"}, {"params", json::object()}});
+    const auto firstRespond = Receive(first);
+    const auto secondRespond = Receive(second);
+    EXPECT_EQ(firstRespond["id"], 1);
+    EXPECT_EQ(secondRespond["id"], 2);
+    EXPECT_TRUE(firstRespond["result"].contains("capabilities"));
+
+    // 'exit' ends the session without stopping the daemon
+    Send(first, {{"jsonrpc", "2.0"}, {"id", 3}, {"method", "shutdown"}});
+    EXPECT_EQ(Receive(first)["id"], 3);
+    Send(first, {{"jsonrpc", "2.0"}, {"method", "exit"}});
+    char c;
+    EXPECT_EQ(read(first, &c, 1), 0);
+    Send(second, {{"jsonrpc", "2.0"}, {"id", 4}, {"method", "shutdown"}});
+    EXPECT_EQ(Receive(second)["id"], 4);
+
+    daemon->Interrupt();
+    thread.join();
+    close(first);
+    close(second);
+    EXPECT_EQ(result, 0);
+    EXPECT_FALSE(std::filesystem::exists(socketPath));
+}
+
+#endif
@@ -62,7 +62,7 @@ protected:
 // Test basic declaration at a function call site
 TEST_F(DeclarationTest, DeclarationAtFunctionCall)
 {
-    auto results = declaration->GetDeclarations(KERNEL_FILE, line, column);
+    auto results = declaration->GetDeclarations(KERNEL_FILE, line, column).locations;
     ASSERT_GT(results.size(), 0);
 
     auto r = results.front();
@@ -62,7 +62,7 @@ protected:
 // Test basic definition at a function call site
 TEST_F(DefinitionTest, DefinitionAtFunctionCall)
 {
-    auto results = definition->GetDefinitions(KERNEL_FILE, line, column);
+    auto results = definition->GetDefinitions(KERNEL_FILE, line, column, {}).locations;
     ASSERT_GT(results.size(), 0);
 
     auto r = results.front();
@@ -76,3 +76,14 @@ TEST_F(DefinitionTest, DefinitionAtFunctionCall)
     ASSERT_EQ(r.selEndLine, 23);
     ASSERT_EQ(r.selEndColumn, 14);
 }
+
+// Test that cancelled lookup returns no definitions
+TEST_F(DefinitionTest, CancelledLookupReturnsNothing)
+{
+    CancellationSource cancellation;
+    cancellation.Cancel();
+
+    auto results = definition->GetDefinitions(KERNEL_FILE, line, column, cancellation.Token()).locations;
+
+    EXPECT_TRUE(results.empty());
+}
@@ -98,7 +98,7 @@ TEST(ParseDiagnosticsTest, SingleDiagnosticMessage)
     ])"_json;
     auto parser = CreateDiagnosticsParser();
     auto result = parser->ParseDiagnostics(log, "TestName", 10);
-    EXPECT_EQ(result, expectedResult);
+    EXPECT_EQ(ToJson(result), expectedResult);
 }
 
 TEST(ParseDiagnosticsTest, MultipleDiagnosticMessages)
@@ -139,7 +139,7 @@ TEST(ParseDiagnosticsTest, MultipleDiagnosticMessages)
     ])"_json;
     auto parser = CreateDiagnosticsParser();
     auto result = parser->ParseDiagnostics(log, "TestName", 10);
-    EXPECT_EQ(result, expectedResult);
+    EXPECT_EQ(ToJson(result), expectedResult);
 }
 
 TEST(ParseDiagnosticsTest, ExceedProblemsLimit)
@@ -181,7 +181,7 @@ TEST(ParseDiagnosticsTest, ExceedProblemsLimit)
     ])"_json;
     auto parser = CreateDiagnosticsParser();
     auto result = parser->ParseDiagnostics(log, "TestName", 2);
-    EXPECT_EQ(result, expectedResult);
+    EXPECT_EQ(ToJson(result), expectedResult);
 }
 
 TEST(ParseDiagnosticsTest, MalformedDiagnosticMessage)
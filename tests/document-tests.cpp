@@ -0,0 +1,111 @@
+//
+//  document-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "document.hpp"
+
+#include <gtest/gtest.h>
+
+
+using namespace ocls;
+
+namespace {
+
+TextChange Edit(unsigned startLine, unsigned startCharacter, unsigned endLine, unsigned endCharacter, std::string text)
+{
+    return {TextRange {{startLine, startCharacter}, {endLine, endCharacter}}, std::move(text)};
+}
+
+} // namespace
+
+TEST(DocumentTest, InsertsAndDeletesInPlace)
+{
+    Document document("__kernel void f()\n{\n}\n");
+
+    document.Apply(Edit(0, 14, 0, 15, "add"));
+    document.Apply(Edit(1, 1, 1, 1, "\n    int i = 0;"));
+    document.Apply(Edit(0, 0, 0, 9, ""));
+
+    EXPECT_EQ(document.Text(), "void add()\n{\n    int i = 0;\n}\n");
+    EXPECT_EQ(document.Size(), document.Text().size());
+}
+
+TEST(DocumentTest, ReplacesRangeAcrossLines)
+{
+    Document document("a\nb\nc\nd\n");
+
+    document.Apply(Edit(1, 0, 3, 0, "x\n"));
+
+    EXPECT_EQ(document.Text(), "a\nx\nd\n");
+    EXPECT_EQ(document.OffsetAt({2, 0}), 4);
+}
+
+TEST(DocumentTest, CountsCharactersInUtf16CodeUnits)
+{
+    // 'é' is one UTF-16 unit in two bytes, '😀' is two UTF-16 units in four bytes
+    Document document("// é😀x\nint a;");
+
+    EXPECT_EQ(document.OffsetAt({0, 3}), 3);
+    EXPECT_EQ(document.OffsetAt({0, 4}), 5);
+    EXPECT_EQ(document.OffsetAt({0, 6}), 9);
+
+    document.Apply(Edit(0, 6, 0, 7, "y"));
+
+    EXPECT_EQ(document.Text(), "// é😀y\nint a;");
+}
+
+TEST(DocumentTest, ClampsPositionsOutsideOfDocument)
+{
+    Document document("ab\r\ncd");
+
+    EXPECT_EQ(document.OffsetAt({0, 10}), 2);
+    EXPECT_EQ(document.OffsetAt({5, 0}), document.Size());
+
+    document.Apply(Edit(1, 1, 9, 0, "!"));
+
+    EXPECT_EQ(document.Text(), "ab\r\nc!");
+}
+
+TEST(DocumentTest, TypingExtendsLastPiece)
+{
+    Document document("int a;\n");
+
+    const std::string typed = "float b;";
+    for (unsigned i = 0; i < typed.size(); i++)
+    {
+        document.Apply(Edit(1, i, 1, i, std::string(1, typed[i])));
+    }
+
+    EXPECT_EQ(document.Text(), "int a;\nfloat b;");
+    EXPECT_EQ(document.PieceCount(), 2);
+}
+
+TEST(DocumentTest, MaterializeJoinsPieces)
+{
+    Document document("int a;\n");
+    ASSERT_NE(document.Contiguous(), nullptr);
+
+    document.Apply(Edit(0, 4, 0, 5, "b"));
+    EXPECT_EQ(document.Contiguous(), nullptr);
+
+    const auto &content = document.Materialize();
+
+    EXPECT_EQ(content, "int b;\n");
+    EXPECT_EQ(document.Contiguous(), &content);
+    EXPECT_EQ(document.PieceCount(), 1);
+    EXPECT_EQ(document.OffsetAt({1, 0}), 7);
+}
+
+TEST(DocumentTest, ChangeWithoutRangeReplacesDocument)
+{
+    Document document("int a;\n");
+    document.Apply(Edit(0, 0, 0, 0, "// "));
+
+    document.Apply(TextChange {std::nullopt, "float b;"});
+
+    EXPECT_EQ(document.Text(), "float b;");
+    EXPECT_NE(document.Contiguous(), nullptr);
+}
@@ -32,11 +32,19 @@ std::string BuildRequest(const json& obj)
     return BuildRequest(obj.dump());
 }
 
-void Send(const std::string& request, std::shared_ptr<IJsonRPC> jrpc)
+// Feeds the request in chunks of the given size, resetting the framer after each processed message
+void Send(const std::string& request, std::shared_ptr<IJsonRPC> jrpc, size_t chunkSize = 4096)
 {
-    for (auto c : request)
+    std::string_view data = request;
+    while (!data.empty())
     {
-        jrpc->Consume(c);
+        auto chunk = data.substr(0, chunkSize);
+        const auto consumed = jrpc->Consume(chunk);
+        data.remove_prefix(consumed);
+        if (jrpc->IsReady())
+        {
+            jrpc->Reset();
+        }
     }
 }
 
@@ -56,7 +64,7 @@ const std::string initRequest = BuildRequest(json::object(
 
 const auto InitializeJsonRPC = [](std::shared_ptr<IJsonRPC> jrpc) {
     jrpc->RegisterOutputCallback([](const std::string&) {});
-    jrpc->RegisterMethodCallback("initialize", [](const json&) {});
+    jrpc->RegisterMethodCallback("initialize", [](const JRPCMessage&) {});
     Send(initRequest, jrpc);
     jrpc->Reset();
 };
@@ -99,7 +107,7 @@ TEST(JsonRPCTest, MethodInitialize)
     int64_t processId = 0;
     jrpc->RegisterOutputCallback([](const std::string&) {});
     jrpc->RegisterMethodCallback(
-        "initialize", [&processId](const json& request) { processId = request["params"]["processId"].get<int64_t>(); });
+        "initialize", [&processId](const JRPCMessage& request) { processId = request.Params()["processId"].get<int64_t>(); });
 
     Send(initRequest, jrpc);
 
@@ -131,9 +139,236 @@ TEST(JsonRPCTest, RespondToSupportedMethod)
     const std::string request =
         BuildRequest(json::object({{"jsonrpc", "2.0"}, {"id", 0}, {"method", "textDocument/didOpen"}, {"params", {}}}));
     jrpc->RegisterMethodCallback(
-        "textDocument/didOpen", [&isCallbackCalled]([[maybe_unused]] const json& request) { isCallbackCalled = true; });
+        "textDocument/didOpen", [&isCallbackCalled]([[maybe_unused]] const JRPCMessage& request) { isCallbackCalled = true; });
 
     Send(request, jrpc);
 
     EXPECT_TRUE(isCallbackCalled);
-}
\ No newline at end of file
+}
+
+TEST(JsonRPCTest, RequestSplitAcrossChunks)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::string text;
+    const std::string content(10000, 'x');
+    const std::string request = BuildRequest(json::object(
+        {{"jsonrpc", "2.0"},
+         {"method", "textDocument/didOpen"},
+         {"params", {{"textDocument", {{"uri", "kernel.cl"}, {"text", content}}}}}}));
+    jrpc->RegisterMethodCallback("textDocument/didOpen", [&text](const JRPCMessage& request) {
+        text = *request.ExtractString({"textDocument", "text"});
+    });
+
+    // Byte-by-byte feeding must be equivalent to feeding the whole message at once
+    Send(request, jrpc, 1);
+    EXPECT_EQ(text, content);
+
+    text.clear();
+    Send(request, jrpc, 7);
+    EXPECT_EQ(text, content);
+}
+
+TEST(JsonRPCTest, SeveralRequestsInOneChunk)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    int callCount = 0;
+    const std::string request =
+        BuildRequest(json::object({{"jsonrpc", "2.0"}, {"method", "textDocument/didOpen"}, {"params", {}}}));
+    jrpc->RegisterMethodCallback(
+        "textDocument/didOpen", [&callCount]([[maybe_unused]] const JRPCMessage& request) { callCount++; });
+
+    const std::string batch = request + request + request;
+    std::string_view data = batch;
+    // Consume stops after each processed message
+    const auto consumed = jrpc->Consume(data);
+    EXPECT_EQ(consumed, request.size());
+    EXPECT_TRUE(jrpc->IsReady());
+    EXPECT_EQ(callCount, 1);
+
+    Send(batch.substr(consumed), jrpc);
+    EXPECT_EQ(callCount, 3);
+}
+
+TEST(JsonRPCTest, HeaderWithoutContentType)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    bool isCallbackCalled = false;
+    const std::string content =
+        json::object({{"jsonrpc", "2.0"}, {"method", "textDocument/didOpen"}, {"params", {}}}).dump();
+    const std::string request = "Content-Length:" + std::to_string(content.size()) + "\r\n\r\n" + content;
+    jrpc->RegisterMethodCallback(
+        "textDocument/didOpen", [&isCallbackCalled]([[maybe_unused]] const JRPCMessage& request) { isCallbackCalled = true; });
+
+    Send(request, jrpc);
+
+    EXPECT_TRUE(isCallbackCalled);
+}
+
+TEST(JsonRPCTest, DispatcherTakesPrecedenceOverCallbacks)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::vector<std::string> dispatched;
+    bool isCallbackCalled = false;
+    bool isErrorReported = false;
+    jrpc->RegisterOutputCallback([&isErrorReported](const std::string&) { isErrorReported = true; });
+    jrpc->RegisterDispatcher([&dispatched](const JRPCMessage& message) {
+        dispatched.emplace_back(message.Method());
+        return message.Method() == "textDocument/didOpen";
+    });
+    jrpc->RegisterMethodCallback(
+        "textDocument/didOpen", [&isCallbackCalled]([[maybe_unused]] const JRPCMessage& request) { isCallbackCalled = true; });
+    jrpc->RegisterMethodCallback(
+        "textDocument/didClose", [&isCallbackCalled]([[maybe_unused]] const JRPCMessage& request) { isCallbackCalled = true; });
+
+    Send(BuildRequest(json::object({{"jsonrpc", "2.0"}, {"method", "textDocument/didOpen"}, {"params", {}}})), jrpc);
+    EXPECT_FALSE(isCallbackCalled);
+
+    // Methods declined by the dispatcher fall back to the callbacks
+    Send(BuildRequest(json::object({{"jsonrpc", "2.0"}, {"method", "textDocument/didClose"}, {"params", {}}})), jrpc);
+    EXPECT_TRUE(isCallbackCalled);
+
+    EXPECT_EQ(dispatched, std::vector<std::string>({"textDocument/didOpen", "textDocument/didClose"}));
+    EXPECT_FALSE(isErrorReported);
+}
+
+TEST(JsonRPCTest, BatchIsRespondedWithSingleMessage)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::vector<json> responses;
+    std::vector<json> deferred;
+    int notifications = 0;
+    jrpc->RegisterOutputCallback(
+        [&responses](const std::string& message) { responses.push_back(json::parse(ParseResponse(message))); });
+    jrpc->RegisterMethodCallback("textDocument/definition", [&deferred](const JRPCMessage& request) {
+        deferred.push_back(request.Id());
+    });
+    jrpc->RegisterMethodCallback(
+        "textDocument/didOpen", [&notifications]([[maybe_unused]] const JRPCMessage& request) { notifications++; });
+
+    const json batch = {
+        {{"jsonrpc", "2.0"}, {"id", 1}, {"method", "textDocument/definition"}, {"params", {}}},
+        {{"jsonrpc", "2.0"}, {"method", "textDocument/didOpen"}, {"params", {}}},
+        {{"jsonrpc", "2.0"}, {"id", "two"}, {"method", "textDocument/definition"}, {"params", {}}},
+        {{"jsonrpc", "2.0"}, {"id", 3}, {"method", "textDocument/unknown"}, {"params", {}}},
+        42};
+    Send(BuildRequest(batch), jrpc);
+    ASSERT_EQ(deferred.size(), 2);
+    EXPECT_EQ(notifications, 1);
+    EXPECT_TRUE(responses.empty());
+
+    // Responds come from other threads in any order, the batch is written once all of them are in
+    jrpc->Write(json {{"id", deferred[1]}, {"result", nullptr}});
+    EXPECT_TRUE(responses.empty());
+    jrpc->Write(SerializedMessage {R"({"jsonrpc":"2.0","id":1,"result":[]})"});
+
+    ASSERT_EQ(responses.size(), 1);
+    const auto& items = responses[0];
+    ASSERT_TRUE(items.is_array());
+    ASSERT_EQ(items.size(), 4);
+    EXPECT_EQ(items[0]["id"], 3);
+    EXPECT_EQ(items[0]["error"]["code"], static_cast<int64_t>(JRPCErrorCode::MethodNotFound));
+    EXPECT_TRUE(items[1]["id"].is_null());
+    EXPECT_EQ(items[1]["error"]["code"], static_cast<int64_t>(JRPCErrorCode::InvalidRequest));
+    EXPECT_EQ(items[2]["id"], "two");
+    EXPECT_EQ(items[3]["id"], 1);
+
+    // Messages outside of a batch are written as usual
+    jrpc->Write(json {{"method", "textDocument/publishDiagnostics"}, {"params", {}}});
+    EXPECT_EQ(responses.size(), 2);
+}
+
+TEST(JsonRPCTest, DuplicateIdInBatchIsInvalidRequest)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::vector<json> responses;
+    jrpc->RegisterOutputCallback(
+        [&responses](const std::string& message) { responses.push_back(json::parse(ParseResponse(message))); });
+    jrpc->RegisterMethodCallback("textDocument/definition", [](const JRPCMessage&) {});
+
+    Send(BuildRequest(json {{{"jsonrpc", "2.0"}, {"id", 1}, {"method", "textDocument/definition"}, {"params", {}}}}),
+         jrpc);
+    Send(BuildRequest(json {
+             {{"jsonrpc", "2.0"}, {"id", 1}, {"method", "textDocument/definition"}, {"params", {}}},
+             {{"jsonrpc", "2.0"}, {"id", 2}, {"method", "textDocument/definition"}, {"params", {}}}}),
+         jrpc);
+    jrpc->Write(json {{"id", 2}, {"result", nullptr}});
+
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].size(), 2);
+    EXPECT_EQ(responses[0][0]["id"], 1);
+    EXPECT_EQ(responses[0][0]["error"]["code"], static_cast<int64_t>(JRPCErrorCode::InvalidRequest));
+    EXPECT_EQ(responses[0][1]["id"], 2);
+
+    // The respond of the first request still completes its own batch
+    jrpc->Write(json {{"id", 1}, {"result", nullptr}});
+    ASSERT_EQ(responses.size(), 2);
+    ASSERT_TRUE(responses[1].is_array());
+    EXPECT_EQ(responses[1][0]["id"], 1);
+    EXPECT_TRUE(responses[1][0].contains("result"));
+}
+
+TEST(JsonRPCTest, CancelledRequestDoesNotHoldItsBatch)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::vector<json> responses;
+    jrpc->RegisterOutputCallback(
+        [&responses](const std::string& message) { responses.push_back(json::parse(ParseResponse(message))); });
+    jrpc->RegisterMethodCallback("textDocument/definition", [](const JRPCMessage&) {});
+    jrpc->RegisterMethodCallback("$/cancelRequest", [](const JRPCMessage&) {});
+
+    Send(BuildRequest(json {
+             {{"jsonrpc", "2.0"}, {"id", 1}, {"method", "textDocument/definition"}, {"params", {}}},
+             {{"jsonrpc", "2.0"}, {"id", 2}, {"method", "textDocument/definition"}, {"params", {}}}}),
+         jrpc);
+    jrpc->Write(json {{"id", 2}, {"result", nullptr}});
+    EXPECT_TRUE(responses.empty());
+
+    Send(BuildRequest(json {{"jsonrpc", "2.0"}, {"method", "$/cancelRequest"}, {"params", {{"id", 1}}}}), jrpc);
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].size(), 1);
+    EXPECT_EQ(responses[0][0]["id"], 2);
+
+    // A late respond of the cancelled request is written on its own
+    jrpc->Write(json {{"id", 1}, {"error", {{"code", static_cast<int>(JRPCErrorCode::RequestCancelled)}}}});
+    ASSERT_EQ(responses.size(), 2);
+    EXPECT_EQ(responses[1]["id"], 1);
+}
+
+TEST(JsonRPCTest, FailedHandlerRespondsWithInternalError)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    std::vector<json> responses;
+    jrpc->RegisterOutputCallback(
+        [&responses](const std::string& message) { responses.push_back(json::parse(ParseResponse(message))); });
+    jrpc->RegisterMethodCallback(
+        "textDocument/definition", [](const JRPCMessage&) { throw std::runtime_error("Handler failed"); });
+
+    Send(BuildRequest(json {{{"jsonrpc", "2.0"}, {"id", 5}, {"method", "textDocument/definition"}, {"params", {}}}}),
+         jrpc);
+
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].size(), 1);
+    EXPECT_EQ(responses[0][0]["id"], 5);
+    EXPECT_EQ(responses[0][0]["error"]["code"], static_cast<int64_t>(JRPCErrorCode::InternalError));
+}
+
+TEST(JsonRPCTest, EmptyBatchIsInvalidRequest)
+{
+    auto jrpc = CreateJsonRPC();
+    InitializeJsonRPC(jrpc);
+    json response;
+    jrpc->RegisterOutputCallback(
+        [&response](const std::string& message) { response = json::parse(ParseResponse(message)); });
+
+    Send(BuildRequest(std::string("[]")), jrpc);
+
+    EXPECT_EQ(response["error"]["code"], static_cast<int64_t>(JRPCErrorCode::InvalidRequest));
+}
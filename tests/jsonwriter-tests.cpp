@@ -0,0 +1,110 @@
+//
+//  jsonwriter-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "completion.hpp"
+#include "diagnostics.hpp"
+#include "jsonwriter.hpp"
+#include "location.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+
+using namespace ocls;
+using namespace nlohmann;
+
+
+TEST(JsonWriterTest, WritesNestedContainers)
+{
+    JsonWriter writer;
+    writer.StartObject();
+    writer.Key("a").StartArray().Integer(-1).Unsigned(2).Bool(true).Null().StartObject().EndObject().EndArray();
+    writer.Key("b").StartObject().Key("c").String("d").EndObject();
+    writer.Key("e").StartArray().EndArray();
+    writer.EndObject();
+
+    EXPECT_EQ(writer.Buffer(), R"({"a":[-1,2,true,null,{}],"b":{"c":"d"},"e":[]})");
+}
+
+TEST(JsonWriterTest, EscapesStringsLikeDump)
+{
+    const std::string value = "quote \" backslash \\ tab \t newline \n control \x01\x1f unicode \xce\xbb";
+
+    JsonWriter writer;
+    writer.StartArray().String(value).EndArray();
+
+    EXPECT_EQ(writer.Buffer(), json::array({value}).dump());
+}
+
+TEST(JsonWriterTest, EmbedsDomValues)
+{
+    JsonWriter writer;
+    writer.StartObject();
+    writer.Key("id").Value("12345678");
+    writer.Key("item").Value(json {{"label", "get_global_id"}, {"data", {{"index", 4}}}});
+    writer.EndObject();
+
+    EXPECT_EQ(writer.Buffer(), R"({"id":"12345678","item":{"data":{"index":4},"label":"get_global_id"}})");
+}
+
+TEST(JsonWriterTest, ReleaseResetsWriter)
+{
+    JsonWriter writer;
+    writer.StartArray().Integer(1).EndArray();
+
+    EXPECT_EQ(writer.Release(), "[1]");
+    EXPECT_TRUE(writer.Buffer().empty());
+
+    writer.StartArray().Integer(2).EndArray();
+    EXPECT_EQ(writer.Buffer(), "[2]");
+}
+
+TEST(JsonWriterTest, CompletionResultMatchesDom)
+{
+    CompletionResult item;
+    item.index = 42;
+    item.label = "convert_float4";
+    item.detail = "float4 convert_float4(int4)";
+    item.insertText = "convert_float4(${1:int4 x})";
+    item.isSnippet = true;
+    item.documentation = "Converts \"int4\" to float4";
+    item.itemKind = CompletionItemKind::function;
+    item.sortText = "0050";
+    item.deprecated = true;
+    item.commitCharacters = {"(", ";"};
+    item.tags = {1};
+
+    JsonWriter incomplete;
+    item.writeJsonIncomplete(incomplete);
+    JsonWriter full;
+    item.writeJson(full);
+
+    EXPECT_EQ(json::parse(incomplete.Buffer()), item.toJsonIncomplete());
+    EXPECT_EQ(json::parse(full.Buffer()), item.toJson());
+}
+
+TEST(JsonWriterTest, LocationMatchesDom)
+{
+    const Location location {"file:///kernel.cl", 1, 2, 10, 1, 1, 7, 1, 13};
+
+    for (const bool linkSupport : {true, false})
+    {
+        JsonWriter writer;
+        location.writeJson(writer, linkSupport);
+        EXPECT_EQ(json::parse(writer.Buffer()), location.toJson(linkSupport));
+    }
+}
+
+TEST(JsonWriterTest, DiagnosticMatchesDom)
+{
+    const Diagnostic diagnostic {"kernel.cl", 11, 4, DiagnosticSeverity::warning, "no previous prototype for 'f'"};
+
+    JsonWriter writer;
+    diagnostic.writeJson(writer);
+
+    EXPECT_EQ(json::parse(writer.Buffer()), diagnostic.toJson());
+}
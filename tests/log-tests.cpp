@@ -0,0 +1,34 @@
+//
+//  log-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "log.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace ocls;
+
+TEST(LogTest, KeepsShortMessages)
+{
+    const std::string message(maxLogMessageSize, 'x');
+    EXPECT_EQ(TruncateLogMessage(message), message);
+}
+
+TEST(LogTest, TruncatesLongMessages)
+{
+    const std::string message = std::string(maxLogMessageSize, 'x') + "tail";
+    const auto result = TruncateLogMessage(message);
+    EXPECT_EQ(result, std::string(maxLogMessageSize, 'x') + "... [4 bytes truncated]");
+}
+
+TEST(LogTest, CachesLoggerHandles)
+{
+    ASSERT_NE(Loggers::jrpc, nullptr);
+    EXPECT_EQ(Loggers::jrpc, spdlog::get(LogName::jrpc));
+    EXPECT_EQ(Loggers::main, spdlog::default_logger());
+}
@@ -16,10 +16,13 @@
 #include "typedef-mock.hpp"
 #include "declaration-mock.hpp"
 #include "generator-mock.hpp"
+#include "scheduler-mock.hpp"
 
 #include <gtest/gtest.h>
 #include <nlohmann/json.hpp>
+#include <limits>
 #include <tuple>
+#include <unordered_map>
 
 using namespace ocls;
 using namespace nlohmann;
@@ -38,7 +41,10 @@ protected:
     std::shared_ptr<DeclarationMock> mockDeclaration;
     std::shared_ptr<GeneratorMock> mockGenerator;
     std::shared_ptr<ExitHandlerMock> mockExitHandler;
+    std::shared_ptr<SchedulerMock> mockScheduler;
     std::shared_ptr<ILSPServerEventsHandler> handler;
+    // Content kept by the store mock
+    std::unordered_map<std::string, Document> documents;
 
     void SetUp() override
     {
@@ -51,13 +57,37 @@ protected:
         mockDeclaration = std::make_shared<DeclarationMock>();
         mockGenerator = std::make_shared<GeneratorMock>();
         mockExitHandler = std::make_shared<ExitHandlerMock>();
+        mockScheduler = std::make_shared<SchedulerMock>();
 
         auto device = ocls::Device(12345678, "Some Device", 128, "3.0");
 
         ON_CALL(*mockGenerator, GenerateID()).WillByDefault(::testing::Return("12345678"));
         ON_CALL(*mockDiagnostics, GetDevice()).WillByDefault(::testing::Return(device));
-
-        handler = CreateLSPEventsHandler(mockJsonRPC, mockStore, mockDiagnostics, mockCompletion, mockDefinition, mockTypeDefinition, mockDeclaration, mockGenerator, mockExitHandler);
+        // Run scheduled tasks inline so the responses are ready right after the handler returns
+        ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+            .WillByDefault([](TaskPriority, const std::string &, TaskFunc task) { task(); });
+        ON_CALL(*mockScheduler, ScheduleDebounced(testing::_, testing::_, testing::_, testing::_, testing::_))
+            .WillByDefault([](TaskPriority, const std::string &, std::chrono::milliseconds, std::chrono::milliseconds, TaskFunc task) { task(); });
+        ON_CALL(*mockScheduler, ScheduleTimer(testing::_, testing::_, testing::_, testing::_))
+            .WillByDefault([](TaskPriority, const std::string &, std::chrono::milliseconds, TaskFunc task) { task(); });
+
+        ON_CALL(*mockStore, OnFileChange(testing::_, testing::_))
+            .WillByDefault([this](const std::string &filePath, std::vector<TextChange> changes) {
+                auto &document = documents[filePath];
+                for (const auto &change : changes)
+                {
+                    document.Apply(change);
+                }
+                document.Materialize();
+            });
+        ON_CALL(*mockStore, IsUpToDate(testing::_)).WillByDefault(::testing::Return(true));
+        ON_CALL(*mockStore, GetContent(testing::_)).WillByDefault([this](const std::string &filePath) {
+            auto it = documents.find(filePath);
+            const auto content = it == documents.end() ? nullptr : it->second.Contiguous();
+            return content ? std::make_shared<const std::string>(*content) : nullptr;
+        });
+
+        handler = CreateLSPEventsHandler(mockJsonRPC, mockStore, mockDiagnostics, mockCompletion, mockDefinition, mockTypeDefinition, mockDeclaration, mockGenerator, mockExitHandler, mockScheduler);
     }
 
     std::tuple<std::string, std::string> GetTestSource() const
@@ -73,35 +103,30 @@ protected:
         return std::make_tuple(uri, content);
     }
 
-    nlohmann::json GetTestDiagnostics(const std::string& uri) const
+    DidChangeTextDocumentParams FullChange(const std::string &uri, const std::string &text) const
     {
-        return {
-            {{"source", uri},
-             {"range",
-              {
-                  {"start",
-                   {
-                       {"line", 1},
-                       {"character", 1},
-                   }},
-                  {"end",
-                   {
-                       {"line", 1},
-                       {"character", 2},
-                   }},
-                  {"severity", 2},
-                  {"message", "message"},
-              }}}};
+        return {uri, {TextChange {std::nullopt, text}}};
+    }
+
+    DidChangeTextDocumentParams RangeChange(const std::string &uri, TextRange range, const std::string &text) const
+    {
+        return {uri, {TextChange {range, text}}};
+    }
+
+    std::vector<Diagnostic> GetTestDiagnostics(const std::string& uri) const
+    {
+        return {{uri, 1, 1, DiagnosticSeverity::warning, "message"}};
     }
 
     nlohmann::json GetTestDiagnosticsResponse(const std::string& uri) const
     {
         return {
+            {"jsonrpc", "2.0"},
             {"method", "textDocument/publishDiagnostics"},
             {"params",
              {
                  {"uri", uri},
-                 {"diagnostics", GetTestDiagnostics(uri)},
+                 {"diagnostics", ToJson(GetTestDiagnostics(uri))},
              }}};
     }
 };
@@ -138,7 +163,7 @@ TEST_F(LSPTest, OnInitialize_shouldBuildResponse_andCallDiagnosticsSetters)
             "capabilities": {
                 "textDocumentSync": {
                     "openClose": true,
-                    "change": 1,
+                    "change": 2,
                     "willSave": false,
                     "willSaveWaitUntil": false,
                     "save": false
@@ -160,11 +185,11 @@ TEST_F(LSPTest, OnInitialize_shouldBuildResponse_andCallDiagnosticsSetters)
     EXPECT_CALL(*mockDiagnostics, SetMaxProblemsCount(10)).Times(1);
     EXPECT_CALL(*mockDiagnostics, SetOpenCLDevice(1)).Times(1);
 
-    handler->OnInitialize(testData);
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
 }
 
 TEST_F(LSPTest, OnInitialize_withMissingConfigurationFields_shouldBuildResponse_andNotCallDiagnosticsSetters)
@@ -192,7 +217,7 @@ TEST_F(LSPTest, OnInitialize_withMissingConfigurationFields_shouldBuildResponse_
             "capabilities": {
                 "textDocumentSync": {
                     "openClose": true,
-                    "change": 1,
+                    "change": 2,
                     "willSave": false,
                     "willSaveWaitUntil": false,
                     "save": false
@@ -208,11 +233,11 @@ TEST_F(LSPTest, OnInitialize_withMissingConfigurationFields_shouldBuildResponse_
         }
     })"_json;
 
-    handler->OnInitialize(testData);
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
 }
 
 // OnInitialized
@@ -245,16 +270,16 @@ TEST_F(LSPTest, OnInitialized_withDidChangeConfigurationSupport_shouldBuildRespo
         }
     })"_json;
 
-    handler->OnInitialize(initData);
+    handler->OnInitialize(initData["id"], *InitializeParams::Decode(initData));
     handler->GetNextResponse();
 
     EXPECT_CALL(*mockGenerator, GenerateID()).Times(2);
 
-    handler->OnInitialized({});
+    handler->OnInitialized();
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
 }
 
 TEST_F(LSPTest, OnInitialized_withoutDidChangeConfigurationSupport_shouldNotBuildResponse)
@@ -274,10 +299,10 @@ TEST_F(LSPTest, OnInitialized_withoutDidChangeConfigurationSupport_shouldNotBuil
         "id": "1"
     })"_json;
 
-    handler->OnInitialize(initData);
+    handler->OnInitialize(initData["id"], *InitializeParams::Decode(initData));
     handler->GetNextResponse();
 
-    handler->OnInitialized(R"({"id": "1"})"_json);
+    handler->OnInitialized();
     auto response = handler->GetNextResponse();
 
     EXPECT_FALSE(response.has_value());
@@ -292,29 +317,37 @@ TEST_F(LSPTest, BuildDiagnosticsRespond_shouldBuildResponse)
     auto expectedResponse = GetTestDiagnosticsResponse(uri);
     auto filePath = utils::UriToFilePath(uri);
 
-    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
-    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content})).Times(1);
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content}, testing::_)).Times(1);
 
-    handler->BuildDiagnosticsRespond(uri, filePath, content);
+    handler->BuildDiagnosticsRespond(uri, {filePath, content}, {});
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
 }
 
-TEST_F(LSPTest, BuildDiagnosticsRespond_withException_shouldReplyWithError)
+TEST_F(LSPTest, BuildDiagnosticsRespond_withException_shouldShowErrorMessage)
 {
     auto [uri, content] = GetTestSource();
     auto filePath = utils::UriToFilePath(uri);
     Source expectedSource {uri, content};
 
-    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_))
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_))
         .WillByDefault(::testing::Throw(std::runtime_error("Exception")));
-    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(expectedSource)).Times(1);
-    EXPECT_CALL(*mockJsonRPC, WriteError(JRPCErrorCode::InternalError, "Failed to get diagnostics: Exception"))
-        .Times(1);
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(expectedSource, testing::_)).Times(1);
+    // Reported by the worker, so not through WriteError, which responds to the message being read
+    EXPECT_CALL(*mockJsonRPC, WriteError(testing::_, testing::_)).Times(0);
+
+    handler->BuildDiagnosticsRespond(uri, {filePath, content}, {});
+    auto response = handler->GetNextResponse();
 
-    handler->BuildDiagnosticsRespond(uri, filePath, content);
+    ASSERT_TRUE(response.has_value());
+    const auto message = ToJson(*response);
+    EXPECT_FALSE(message.contains("id"));
+    EXPECT_EQ(message["method"], "window/showMessage");
+    EXPECT_EQ(message["params"]["type"], 1);
+    EXPECT_EQ(message["params"]["message"], "Failed to get diagnostics: Exception");
 }
 
 // OnTextOpen
@@ -324,44 +357,351 @@ TEST_F(LSPTest, OnTextOpen_shouldBuildResponse)
     auto [uri, content] = GetTestSource();
     auto expectedDiagnostics = GetTestDiagnostics(uri);
     auto expectedResponse = GetTestDiagnosticsResponse(uri);
-    nlohmann::json request = {{"params", {{"textDocument", {{"uri", uri}, {"text", content}}}}}};
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content}, testing::_)).Times(1);
 
-    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
-    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content})).Times(1);
-
-    handler->OnTextOpen(request);
+    handler->OnTextOpen({uri, content});
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
+}
+
+TEST_F(LSPTest, OnTextOpen_shouldScheduleStoreUpdateAndDiagnosticsSeparately)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(GetTestDiagnostics(uri)));
+
+    testing::InSequence sequence;
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::background, uri, testing::_)).Times(1);
+    EXPECT_CALL(*mockStore, OnFileOpen(utils::UriToFilePath(uri), content)).Times(1);
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::background, "diag:" + uri, testing::_)).Times(1);
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content}, testing::_)).Times(1);
+
+    handler->OnTextOpen({uri, content});
 }
 
-// OnTextChanged
 
 TEST_F(LSPTest, OnTextChanged_shouldBuildResponse)
 {
     auto [uri, content] = GetTestSource();
     auto expectedDiagnostics = GetTestDiagnostics(uri);
     auto expectedResponse = GetTestDiagnosticsResponse(uri);
-    nlohmann::json request = {
-        {"params",
-         {{"textDocument",
-           {
-               {"uri", uri},
-           }},
-          {"contentChanges", {{{"text", content}}}}}}};
-
-    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
-    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content})).Times(1);
-
-    handler->OnTextChanged(request);
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(expectedDiagnostics));
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, content}, testing::_)).Times(1);
+
+    handler->OnTextChanged(FullChange(uri, content));
     auto response = handler->GetNextResponse();
 
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
+}
+
+// OnDefinition
+
+TEST_F(LSPTest, OnDefinition_shouldScheduleInteractiveTaskForDocument)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Return(LocationResult {}));
+
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::interactive, "read:" + uri, testing::_)).Times(1);
+    EXPECT_CALL(*mockDefinition, GetDefinitions(utils::UriToFilePath(uri), 2, 5, testing::_)).Times(1);
+
+    handler->OnDefinition(7, {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response), json({{"jsonrpc", "2.0"}, {"id", 7}, {"result", json::array()}}));
+}
+
+TEST_F(LSPTest, OnDefinition_withException_shouldReplyOnlyWithErrorToItsId)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Throw(std::runtime_error("Exception")));
+
+    EXPECT_CALL(*mockJsonRPC, WriteError(testing::_, testing::_)).Times(0);
+
+    handler->OnDefinition(7, {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    const auto respond = ToJson(*response);
+    EXPECT_EQ(respond["id"], 7);
+    EXPECT_EQ(respond["error"]["code"], static_cast<int>(JRPCErrorCode::InternalError));
+    EXPECT_FALSE(respond.contains("result"));
+    EXPECT_FALSE(handler->GetNextResponse().has_value());
+}
+
+TEST_F(LSPTest, OnDeclaration_withException_shouldReplyOnlyWithErrorToItsId)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDeclaration, GetDeclarations(testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Throw(std::runtime_error("Exception")));
+
+    EXPECT_CALL(*mockJsonRPC, WriteError(testing::_, testing::_)).Times(0);
+
+    handler->OnDeclaration(9, {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    const auto respond = ToJson(*response);
+    EXPECT_EQ(respond["id"], 9);
+    EXPECT_EQ(respond["error"]["message"], "Failed to get declaration: Exception");
+    EXPECT_FALSE(handler->GetNextResponse().has_value());
+}
+
+TEST_F(LSPTest, OnDefinition_whileChangeIsQueued_shouldNotifyStaleRespond)
+{
+    auto [uri, content] = GetTestSource();
+    std::vector<TaskFunc> backgroundTasks;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority priority, const std::string &, TaskFunc task) {
+            if (priority == TaskPriority::background)
+            {
+                backgroundTasks.push_back(std::move(task));
+                return;
+            }
+            task();
+        });
+    ON_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Return(LocationResult {}));
+
+    EXPECT_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_)).Times(testing::AnyNumber());
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::interactive, "read:" + uri, testing::_)).Times(2);
+    EXPECT_CALL(*mockStore, OnFileChange(testing::_, testing::_)).Times(1);
+
+    handler->OnTextChanged(FullChange(uri, content));
+    handler->OnDefinition(7, {uri, 1, 4});
+    auto notification = handler->GetNextResponse();
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(notification.has_value());
+    EXPECT_EQ(ToJson(*notification)["method"], "$/ocls/staleResult");
+    EXPECT_EQ(ToJson(*notification)["params"], json({{"id", 7}, {"uri", uri}}));
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response), json({{"jsonrpc", "2.0"}, {"id", 7}, {"result", json::array()}}));
+
+    ASSERT_EQ(backgroundTasks.size(), 1);
+    backgroundTasks.front()();
+    while (handler->GetNextResponse().has_value())
+    {
+    }
+    handler->OnDefinition(8, {uri, 1, 4});
+    response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response), json({{"jsonrpc", "2.0"}, {"id", 8}, {"result", json::array()}}));
+}
+
+TEST_F(LSPTest, OnDeclaration_fromOlderRevision_shouldNotifyStaleRespond)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDeclaration, GetDeclarations(testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Return(LocationResult {{}, false}));
+
+    handler->OnDeclaration(9, {uri, 1, 4});
+    auto notification = handler->GetNextResponse();
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(notification.has_value());
+    EXPECT_EQ(ToJson(*notification)["method"], "$/ocls/staleResult");
+    EXPECT_EQ(ToJson(*notification)["params"], json({{"id", 9}, {"uri", uri}}));
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response), json({{"jsonrpc", "2.0"}, {"id", 9}, {"result", json::array()}}));
+}
+
+// OnCancel
+
+TEST_F(LSPTest, OnCancel_beforeRequestStarts_shouldReplyWithRequestCancelled)
+{
+    auto [uri, content] = GetTestSource();
+    TaskFunc pendingTask;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority, const std::string &, TaskFunc task) { pendingTask = std::move(task); });
+
+    EXPECT_CALL(*mockCompletion, GetCompletions(testing::_, testing::_, testing::_, testing::_)).Times(0);
+
+    handler->OnCompletion(7, {uri, 1, 4});
+    handler->OnCancel({7});
+    ASSERT_TRUE(pendingTask);
+    pendingTask();
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(
+        ToJson(*response),
+        json({{"id", 7}, {"error", {{"code", -32800}, {"message", "Request cancelled"}}}}));
+}
+
+TEST_F(LSPTest, OnCancel_whileRequestIsRunning_shouldReplyWithRequestCancelled)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault([this](const std::string &, unsigned, unsigned, const CancellationToken &token) {
+            handler->OnCancel({"request-7"});
+            EXPECT_TRUE(token.IsCancelled());
+            return LocationResult {};
+        });
+
+    EXPECT_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_)).Times(1);
+
+    handler->OnDefinition("request-7", {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response)["error"]["code"], -32800);
+    EXPECT_EQ(ToJson(*response)["id"], "request-7");
+    EXPECT_FALSE(handler->GetNextResponse().has_value());
+}
+
+TEST_F(LSPTest, OnCompletion_whileDocumentIsParsed_shouldReplyWithRequestFailedAfterTimeout)
+{
+    auto [uri, content] = GetTestSource();
+    std::vector<TaskFunc> backgroundTasks;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority priority, const std::string &, TaskFunc task) {
+            if (priority == TaskPriority::background)
+            {
+                backgroundTasks.push_back(std::move(task));
+                return;
+            }
+            task();
+        });
+
+    EXPECT_CALL(*mockScheduler, ScheduleTimer(TaskPriority::interactive, "timeout:7", testing::_, testing::_)).Times(1);
+    EXPECT_CALL(*mockScheduler, ScheduleDebounced(testing::_, "timeout:7", testing::_, testing::_, testing::_)).Times(0);
+    EXPECT_CALL(*mockCompletion, GetCompletions(testing::_, testing::_, testing::_, testing::_)).Times(0);
+
+    handler->OnTextOpen({uri, content});
+    handler->OnCompletion(7, {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_EQ(ToJson(*response)["id"], 7);
+    EXPECT_EQ(ToJson(*response)["error"]["code"], -32803);
+    EXPECT_FALSE(handler->GetNextResponse().has_value());
+}
+
+TEST_F(LSPTest, OnCompletion_afterDocumentIsParsed_shouldNotScheduleTimeout)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockCompletion, GetCompletions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Return(std::vector<CompletionResult> {}));
+
+    EXPECT_CALL(*mockScheduler, ScheduleTimer(testing::_, testing::_, testing::_, testing::_)).Times(testing::AnyNumber());
+    EXPECT_CALL(*mockScheduler, ScheduleTimer(testing::_, "timeout:7", testing::_, testing::_)).Times(0);
+    EXPECT_CALL(*mockCompletion, GetCompletions(testing::_, testing::_, testing::_, testing::_)).Times(1);
+
+    handler->OnTextOpen({uri, content});
+    while (handler->GetNextResponse().has_value())
+    {
+    }
+    handler->OnCompletion(7, {uri, 1, 4});
+    auto response = handler->GetNextResponse();
+
+    ASSERT_TRUE(response.has_value());
+    EXPECT_FALSE(ToJson(*response).contains("error"));
+}
+
+TEST_F(LSPTest, OnCancel_forCompletedRequest_shouldDoNothing)
+{
+    handler->OnCancel({42});
+
+    EXPECT_FALSE(handler->GetNextResponse().has_value());
+}
+
+TEST_F(LSPTest, OnTextChanged_shouldSkipOutdatedDiagnostics)
+{
+    auto [uri, content] = GetTestSource();
+    std::vector<TaskFunc> pendingTasks;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority, const std::string &, TaskFunc task) { pendingTasks.push_back(std::move(task)); });
+    ON_CALL(*mockScheduler, ScheduleDebounced(testing::_, testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority, const std::string &, std::chrono::milliseconds, std::chrono::milliseconds, TaskFunc task) {
+            pendingTasks.push_back(std::move(task));
+        });
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(GetTestDiagnostics(uri)));
+
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, "first"}, testing::_)).Times(0);
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {uri, "second"}, testing::_)).Times(1);
+
+    handler->OnTextChanged(FullChange(uri, "first"));
+    // Store update of the first change schedules its diagnostics
+    pendingTasks[0]();
+    handler->OnTextChanged(FullChange(uri, "second"));
+    // Store update of the second change supersedes the pending build
+    pendingTasks[2]();
+    pendingTasks[1]();
+    pendingTasks[3]();
+}
+
+TEST_F(LSPTest, OnTextChanged_shouldCoalesceChangesUntilStoreUpdateStarts)
+{
+    auto [uri, content] = GetTestSource();
+    const auto filePath = utils::UriToFilePath(uri);
+    documents[filePath] = Document {"__kernel void f() {}"};
+    std::vector<TaskFunc> pendingTasks;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority, const std::string &, TaskFunc task) { pendingTasks.push_back(std::move(task)); });
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(GetTestDiagnostics(uri)));
+
+    EXPECT_CALL(*mockStore, OnFileChange(filePath, testing::SizeIs(2))).Times(1);
+    EXPECT_CALL(*mockDiagnostics, GetDiagnostics(Source {filePath, "__kernel void g(int x) {}"}, testing::_)).Times(1);
+
+    handler->OnTextChanged(RangeChange(uri, {{0, 14}, {0, 15}}, "g"));
+    handler->OnTextChanged(RangeChange(uri, {{0, 16}, {0, 16}}, "int x"));
+    ASSERT_EQ(pendingTasks.size(), 1);
+    pendingTasks[0]();
+}
+
+TEST_F(LSPTest, OnTextChanged_shouldNotMergeChangesAcrossRequests)
+{
+    auto [uri, content] = GetTestSource();
+    const auto filePath = utils::UriToFilePath(uri);
+    std::vector<TaskFunc> pendingTasks;
+    ON_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_))
+        .WillByDefault([&](TaskPriority, const std::string &, TaskFunc task) { pendingTasks.push_back(std::move(task)); });
+
+    EXPECT_CALL(*mockStore, OnFileChange(filePath, testing::SizeIs(1))).Times(2);
+
+    handler->OnTextChanged(FullChange(uri, "first"));
+    handler->OnCompletion(1, {uri, 0, 1});
+    handler->OnTextChanged(FullChange(uri, "second"));
+    ASSERT_EQ(pendingTasks.size(), 3);
+    pendingTasks[0]();
+    pendingTasks[2]();
+}
+
+TEST_F(LSPTest, OnTextChanged_shouldDebounceDiagnosticsWithConfiguredDelay)
+{
+    auto [uri, content] = GetTestSource();
+    nlohmann::json testData = R"({
+        "params": {
+            "initializationOptions": {
+                "configuration": {"diagnosticsDelay": 250, "diagnosticsMaxLatency": 1500}
+            }
+        },
+        "id": 1
+    })"_json;
+    ON_CALL(*mockDiagnostics, GetDiagnostics(testing::_, testing::_)).WillByDefault(::testing::Return(GetTestDiagnostics(uri)));
+
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::background, uri, testing::_)).Times(1);
+    EXPECT_CALL(
+        *mockScheduler,
+        ScheduleDebounced(
+            TaskPriority::background,
+            "diag:" + uri,
+            std::chrono::milliseconds(250),
+            std::chrono::milliseconds(1500),
+            testing::_))
+        .Times(1);
+
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
+    handler->OnTextChanged(FullChange(uri, content));
 }
 
-// OnConfiguration
 
 TEST_F(LSPTest, OnConfiguration_shouldUpdateSettings)
 {
@@ -421,13 +761,13 @@ TEST_F(LSPTest, GetConfiguration_whenHasConfigurationCapability_shouldBuildRespo
 
     EXPECT_CALL(*mockGenerator, GenerateID()).Times(1);
 
-    handler->OnInitialize(initialData);
+    handler->OnInitialize(initialData["id"], *InitializeParams::Decode(initialData));
     handler->GetNextResponse();
     handler->GetConfiguration();
 
     auto response = handler->GetNextResponse();
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
 }
 
 // OnRespond
@@ -465,7 +805,7 @@ TEST_F(LSPTest, OnRespond_whenConfigurationRespond_shouldUpdateSettings)
     EXPECT_CALL(*mockDiagnostics, SetMaxProblemsCount(100)).Times(1);
     EXPECT_CALL(*mockDiagnostics, SetOpenCLDevice(1)).Times(1);
 
-    handler->OnInitialize(initialData);
+    handler->OnInitialize(initialData["id"], *InitializeParams::Decode(initialData));
     handler->GetNextResponse();
     handler->GetConfiguration();
     handler->GetNextResponse();
@@ -477,19 +817,132 @@ TEST_F(LSPTest, OnRespond_whenConfigurationRespond_shouldUpdateSettings)
 
 TEST_F(LSPTest, OnShutdown_shouldBuildResponse)
 {
-    nlohmann::json data = R"({
-        "id": "12345678"
-    })"_json;
     nlohmann::json expectedResponse = R"({
         "id": "12345678",
         "result": null
     })"_json;
 
-    handler->OnShutdown(data);
+    handler->OnShutdown("12345678");
 
     auto response = handler->GetNextResponse();
     EXPECT_TRUE(response.has_value());
-    EXPECT_EQ(*response, expectedResponse);
+    EXPECT_EQ(ToJson(*response), expectedResponse);
+}
+
+// OnStats
+
+TEST_F(LSPTest, OnStats_shouldReportScheduledRequests)
+{
+    auto [uri, content] = GetTestSource();
+    ON_CALL(*mockDefinition, GetDefinitions(testing::_, testing::_, testing::_, testing::_))
+        .WillByDefault(::testing::Return(LocationResult {}));
+    handler->OnDefinition(7, {uri, 1, 4});
+    handler->GetNextResponse();
+
+    handler->OnStats(8);
+
+    auto response = handler->GetNextResponse();
+    ASSERT_TRUE(response.has_value());
+    const auto stats = ToJson(*response);
+    EXPECT_EQ(stats["id"], 8);
+    const auto &result = stats["result"];
+    EXPECT_GE(result["requests"]["textDocument/definition"]["count"].get<uint64_t>(), 1);
+    EXPECT_TRUE(result["probes"].contains("clang_codeCompleteAt"));
+    EXPECT_TRUE(result["queues"].contains("interactiveTasks"));
+    EXPECT_TRUE(result.contains("translationUnits"));
+}
+
+TEST_F(LSPTest, OnTextOpen_shouldEvictTranslationUnitsBeyondConfiguredLimits)
+{
+    nlohmann::json testData = R"({
+        "params": {
+            "initializationOptions": {
+                "configuration": {"memoryBudget": 512, "maxTranslationUnits": 1}
+            }
+        },
+        "id": 1
+    })"_json;
+    const auto firstPath = utils::UriToFilePath("first.cl");
+    EXPECT_CALL(*mockStore, SetLimits(testing::_)).WillOnce([](const TranslationUnitLimits &limits) {
+        EXPECT_EQ(limits.memoryBudget, 512ull * 1024 * 1024);
+        EXPECT_EQ(limits.maxTranslationUnits, 1);
+        EXPECT_EQ(limits.idleTimeout.count(), 0);
+    });
+    EXPECT_CALL(*mockStore, GetEvictionCandidates())
+        .WillOnce(::testing::Return(std::vector<std::string> {}))
+        .WillOnce(::testing::Return(std::vector<std::string> {firstPath, "/not/opened/by/this/session.cl"}));
+    EXPECT_CALL(*mockStore, Evict(firstPath)).Times(1);
+    EXPECT_CALL(*mockScheduler, Schedule(testing::_, testing::_, testing::_)).Times(testing::AnyNumber());
+    EXPECT_CALL(*mockScheduler, Schedule(TaskPriority::background, "first.cl", testing::_)).Times(2);
+
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
+    handler->GetNextResponse();
+    handler->OnTextOpen({"first.cl", "__kernel void first() {}"});
+    handler->OnTextOpen({"second.cl", "__kernel void second() {}"});
+}
+
+TEST_F(LSPTest, OnInitialize_withHugeLimits_shouldClampThem)
+{
+    nlohmann::json testData = R"({
+        "params": {
+            "initializationOptions": {
+                "configuration": {"memoryBudget": 18446744073709551615, "idleTimeout": 18446744073709551615}
+            }
+        },
+        "id": 1
+    })"_json;
+    EXPECT_CALL(*mockStore, SetLimits(testing::_)).WillOnce([](const TranslationUnitLimits &limits) {
+        EXPECT_EQ(limits.memoryBudget, std::numeric_limits<uint64_t>::max() / (1024 * 1024) * 1024 * 1024);
+        EXPECT_GT(limits.idleTimeout.count(), 0);
+    });
+
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
+}
+
+TEST_F(LSPTest, OnTextOpen_shouldCheckIdleTranslationUnitsWithATimer)
+{
+    nlohmann::json testData = R"({
+        "params": {
+            "initializationOptions": {
+                "configuration": {"idleTimeout": 600}
+            }
+        },
+        "id": 1
+    })"_json;
+    ON_CALL(*mockStore, GetEvictionCandidates()).WillByDefault(::testing::Return(std::vector<std::string> {}));
+
+    // A debounced check would be run and waited for by every Drain
+    EXPECT_CALL(*mockScheduler, ScheduleTimer(TaskPriority::background, "memory:idle", std::chrono::milliseconds(600000), testing::_))
+        .Times(1)
+        .WillOnce(::testing::Return());
+    EXPECT_CALL(*mockScheduler, ScheduleDebounced(testing::_, "memory:idle", testing::_, testing::_, testing::_)).Times(0);
+
+    handler->OnInitialize(testData["id"], *InitializeParams::Decode(testData));
+    handler->GetNextResponse();
+    handler->OnTextOpen({"first.cl", "__kernel void first() {}"});
+}
+
+// OnMemory
+
+TEST_F(LSPTest, OnMemory_shouldReportTranslationUnits)
+{
+    ON_CALL(*mockStore, GetMemoryUsage())
+        .WillByDefault(::testing::Return(std::vector<TranslationUnitMemory> {
+            {"b.cl", 300, 2000, 4000}, {"a.cl", 100, 1000, 1500}}));
+
+    handler->OnMemory(9);
+
+    auto response = handler->GetNextResponse();
+    ASSERT_TRUE(response.has_value());
+    const auto memory = ToJson(*response);
+    EXPECT_EQ(memory["id"], 9);
+    EXPECT_EQ(memory["result"]["totalBytes"], 5500);
+    const auto &translationUnits = memory["result"]["translationUnits"];
+    ASSERT_EQ(translationUnits.size(), 2);
+    EXPECT_EQ(translationUnits[0]["filePath"], "b.cl");
+    EXPECT_EQ(translationUnits[0]["astBytes"], 300);
+    EXPECT_EQ(translationUnits[0]["preambleBytes"], 2000);
+    EXPECT_EQ(translationUnits[0]["totalBytes"], 4000);
 }
 
 // OnExit
@@ -502,10 +955,7 @@ TEST_F(LSPTest, OnExit_shouldExitWithFailureByDefault)
 
 TEST_F(LSPTest, OnExit_shouldExitWithSuccessAfterShutdownCall)
 {
-    nlohmann::json data = R"({
-        "id": "12345678"
-    })"_json;
-    handler->OnShutdown(data);
+    handler->OnShutdown("12345678");
     EXPECT_CALL(*mockExitHandler, OnExit(EXIT_SUCCESS)).Times(1);
     handler->OnExit();
 }
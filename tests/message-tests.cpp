@@ -0,0 +1,183 @@
+//
+//  message-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "message.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+
+using namespace ocls;
+using namespace nlohmann;
+
+
+TEST(JRPCMessageTest, LocatesTopLevelMembers)
+{
+    const std::string content =
+        R"({"jsonrpc": "2.0", "id": 5, "method": "textDocument/didOpen", "params": {"textDocument": {"uri": "kernel.cl"}}})";
+
+    const auto message = JRPCMessage::FromView(content);
+
+    EXPECT_TRUE(message.HasMethod());
+    EXPECT_EQ(message.Method(), "textDocument/didOpen");
+    EXPECT_TRUE(message.HasId());
+    EXPECT_EQ(message.Id(), 5);
+    EXPECT_EQ(message.RawParams(), R"({"textDocument": {"uri": "kernel.cl"}})");
+    EXPECT_EQ(message.Params()["textDocument"]["uri"], "kernel.cl");
+}
+
+TEST(JRPCMessageTest, RespondHasNoMethod)
+{
+    const std::string content = R"({"jsonrpc":"2.0","id":"12345678","result":[["-I"],100,0]})";
+
+    const auto message = JRPCMessage::FromView(content);
+
+    EXPECT_FALSE(message.HasMethod());
+    EXPECT_EQ(message.Id(), "12345678");
+    EXPECT_TRUE(message.Params().is_null());
+    EXPECT_EQ(message.Json()["result"][1], 100);
+}
+
+TEST(JRPCMessageTest, NotificationHasNoId)
+{
+    const auto message = JRPCMessage::FromView(R"({"method":"exit","id":null})");
+
+    EXPECT_FALSE(message.HasId());
+    EXPECT_TRUE(message.Id().is_null());
+}
+
+TEST(JRPCMessageTest, DecodesEscapedMethod)
+{
+    const auto message = JRPCMessage::FromView(R"({"method":"$\/setTrace","params":{"value":"off"}})");
+
+    EXPECT_EQ(message.Method(), "$/setTrace");
+}
+
+TEST(JRPCMessageTest, SkipsBracesAndQuotesInsideStrings)
+{
+    const std::string content = R"({"params":{"text":"}{ \"method\": ][ \\"},"method":"initialize"})";
+
+    const auto message = JRPCMessage::FromView(content);
+
+    EXPECT_EQ(message.Method(), "initialize");
+    EXPECT_EQ(message.ExtractString({"text"}), R"(}{ "method": ][ \)");
+}
+
+TEST(JRPCMessageTest, ExtractsNestedString)
+{
+    const json body = {
+        {"method", "textDocument/didOpen"},
+        {"params", {{"textDocument", {{"uri", "kernel.cl"}, {"text", "__kernel void f() {}"}, {"version", 1}}}}}};
+
+    const JRPCMessage message(body);
+
+    EXPECT_EQ(message.ExtractString({"textDocument", "text"}), "__kernel void f() {}");
+    EXPECT_EQ(message.ExtractString({"textDocument", "uri"}), "kernel.cl");
+    EXPECT_FALSE(message.ExtractString({"textDocument", "version"}).has_value());
+    EXPECT_FALSE(message.ExtractString({"text"}).has_value());
+}
+
+TEST(JRPCMessageTest, ExtractsLastStringThroughArrays)
+{
+    const json body = {
+        {"method", "textDocument/didChange"},
+        {"params",
+         {{"textDocument", {{"uri", "kernel.cl"}}},
+          {"contentChanges", {{{"text", "first"}}, {{"nested", {{"text", "ignored"}}}}, {{"text", "last"}}}}}}};
+
+    const JRPCMessage message(body);
+
+    EXPECT_EQ(message.ExtractString({"contentChanges", "text"}), "last");
+}
+
+TEST(JRPCMessageTest, DecodesEveryObjectOfAnArray)
+{
+    const json body = {
+        {"method", "textDocument/didChange"},
+        {"params",
+         {{"textDocument", {{"uri", "kernel.cl"}}},
+          {"contentChanges",
+           {{{"text", "first"}, {"line", 1}}, {{"nested", {{"text", "ignored"}}}}, {{"text", "last"}}}}}}};
+    std::optional<std::string> uri;
+    std::optional<std::string> text;
+    std::optional<int64_t> line;
+    std::vector<std::pair<std::optional<std::string>, std::optional<int64_t>>> elements;
+
+    const JRPCMessage message(body);
+    message.Decode(
+        {{{"textDocument", "uri"}, &uri}},
+        {{{"contentChanges"},
+          {{{"contentChanges", "text"}, &text}, {{"contentChanges", "line"}, &line}},
+          [&]() { elements.emplace_back(text, line); }}});
+
+    EXPECT_EQ(uri, "kernel.cl");
+    ASSERT_EQ(elements.size(), 3);
+    EXPECT_EQ(elements[0].first, "first");
+    EXPECT_EQ(elements[0].second, 1);
+    // Targets are reset for every object, values of nested objects do not match
+    EXPECT_FALSE(elements[1].first.has_value());
+    EXPECT_FALSE(elements[1].second.has_value());
+    EXPECT_EQ(elements[2].first, "last");
+    EXPECT_FALSE(elements[2].second.has_value());
+}
+
+TEST(JRPCMessageTest, RejectsMalformedMessage)
+{
+    EXPECT_THROW(JRPCMessage::FromView(R"({"jsonrpc: 2.0", "id":0, [method]: "initialize"})"), std::invalid_argument);
+    EXPECT_THROW(JRPCMessage::FromView(R"({"method":"initialize")"), std::invalid_argument);
+    EXPECT_THROW(JRPCMessage::FromView(R"([1, 2])"), std::invalid_argument);
+}
+
+TEST(JRPCMessageTest, MalformedParamsFailOnExtraction)
+{
+    const auto message = JRPCMessage::FromView(R"({"method":"textDocument/didOpen","params":{"text": tru}})");
+
+    EXPECT_EQ(message.Method(), "textDocument/didOpen");
+    EXPECT_THROW(message.ExtractString({"text"}), std::runtime_error);
+}
+
+TEST(JRPCMessageTest, DecodesSeveralFieldsInOnePass)
+{
+    const json body = {
+        {"method", "textDocument/definition"},
+        {"params",
+         {{"textDocument", {{"uri", "kernel.cl"}}},
+          {"position", {{"line", 12}, {"character", "27"}}},
+          {"flag", true}}}};
+    std::optional<std::string> uri;
+    std::optional<int64_t> line;
+    std::optional<int64_t> character;
+    std::optional<bool> flag;
+
+    const JRPCMessage message(body);
+    message.Decode({
+        {{"textDocument", "uri"}, &uri},
+        {{"position", "line"}, &line},
+        {{"position", "character"}, &character},
+        {{"flag"}, &flag},
+    });
+
+    EXPECT_EQ(uri, "kernel.cl");
+    EXPECT_EQ(line, 12);
+    EXPECT_FALSE(character.has_value());
+    EXPECT_EQ(flag, true);
+}
+
+TEST(JRPCMessageTest, SplitsBatchItems)
+{
+    const std::string content = R"( [ {"id":1,"params":{"text":"],["}} , {"method":"exit"},42 ] )";
+
+    ASSERT_TRUE(IsBatch(content));
+    const auto items = SplitBatch(content);
+
+    ASSERT_EQ(items.size(), 3);
+    EXPECT_EQ(items[0], R"({"id":1,"params":{"text":"],["}})");
+    EXPECT_EQ(items[1], R"({"method":"exit"})");
+    EXPECT_EQ(items[2], "42");
+    EXPECT_FALSE(IsBatch(R"({"method":"exit"})"));
+    EXPECT_THROW(SplitBatch("[{}, "), std::invalid_argument);
+}
@@ -15,5 +15,5 @@ class CompletionMock : public ocls::ICompletion
 {
 public:
     MOCK_METHOD(
-        std::vector<ocls::CompletionResult>, GetCompletions, (const std::string &, unsigned, unsigned), (override));
+        std::vector<ocls::CompletionResult>, GetCompletions, (const std::string &, unsigned, unsigned, const ocls::CancellationToken &), (override));
 };
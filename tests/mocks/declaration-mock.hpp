@@ -15,5 +15,5 @@ class DeclarationMock : public ocls::IDeclaration
 {
 public:
     MOCK_METHOD(
-        std::vector<ocls::Location>, GetDeclarations, (const std::string &, unsigned, unsigned), (override));
+        ocls::LocationResult, GetDeclarations, (const std::string &, unsigned, unsigned), (override));
 };
@@ -15,5 +15,5 @@ class DefinitionMock : public ocls::IDefinition
 {
 public:
     MOCK_METHOD(
-        std::vector<ocls::Location>, GetDefinitions, (const std::string &, unsigned, unsigned), (override));
+        ocls::LocationResult, GetDefinitions, (const std::string &, unsigned, unsigned, const ocls::CancellationToken &), (override));
 };
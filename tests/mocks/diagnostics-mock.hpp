@@ -26,5 +26,5 @@ public:
 
     MOCK_METHOD(std::string, GetBuildLog, (const ocls::Source&), (override));
 
-    MOCK_METHOD(nlohmann::json, GetDiagnostics, (const ocls::Source&), (override));
+    MOCK_METHOD(std::vector<ocls::Diagnostic>, GetDiagnostics, (const ocls::Source&, const ocls::CancellationToken&), (override));
 };
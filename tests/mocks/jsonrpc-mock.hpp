@@ -16,15 +16,22 @@ class JsonRPCMock final : public ocls::IJsonRPC
 public:
     MOCK_METHOD(void, RegisterMethodCallback, (const std::string&, ocls::InputCallbackFunc&&), (override));
 
+    MOCK_METHOD(void, RegisterDispatcher, (ocls::DispatchFunc &&), (override));
+
     MOCK_METHOD(void, RegisterInputCallback, (ocls::InputCallbackFunc &&), (override));
 
     MOCK_METHOD(void, RegisterOutputCallback, (ocls::OutputCallbackFunc &&), (override));
 
-    MOCK_METHOD(void, Consume, (char), (override));
+    MOCK_METHOD(void, RegisterOutputWriter, (std::shared_ptr<ocls::IMessageWriter>), (override));
+
+    MOCK_METHOD(void, RegisterRecorder, (std::shared_ptr<ocls::ISessionRecorder>), (override));
+
+    MOCK_METHOD(size_t, Consume, (std::string_view), (override));
 
     MOCK_METHOD(bool, IsReady, (), (const, override));
 
-    MOCK_METHOD(void, Write, (const nlohmann::json&), (const, override));
+    MOCK_METHOD(void, Write, (nlohmann::json), (const, override));
+    MOCK_METHOD(void, Write, (ocls::SerializedMessage), (const, override));
 
     MOCK_METHOD(void, Reset, (), (override));
 
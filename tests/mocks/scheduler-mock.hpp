@@ -0,0 +1,28 @@
+//
+//  scheduler-mock.hpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#pragma once
+
+#include "scheduler.hpp"
+
+#include <gmock/gmock.h>
+
+class SchedulerMock : public ocls::IScheduler
+{
+public:
+    MOCK_METHOD(void, Start, (ocls::TaskFunc), (override));
+    MOCK_METHOD(void, Schedule, (ocls::TaskPriority, const std::string&, ocls::TaskFunc), (override));
+    MOCK_METHOD(
+        void,
+        ScheduleDebounced,
+        (ocls::TaskPriority, const std::string&, std::chrono::milliseconds, std::chrono::milliseconds, ocls::TaskFunc),
+        (override));
+    MOCK_METHOD(
+        void, ScheduleTimer, (ocls::TaskPriority, const std::string&, std::chrono::milliseconds, ocls::TaskFunc), (override));
+    MOCK_METHOD(void, Drain, (), (override));
+    MOCK_METHOD(void, Stop, (), (override));
+};
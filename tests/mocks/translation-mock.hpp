@@ -14,12 +14,19 @@
 class TranslationUnitStoreMock : public ocls::ITranslationUnitStore
 {
 public:
-    MOCK_METHOD(void, OnFileOpen, (const std::string &, const std::string &), (override));
-    MOCK_METHOD(void, OnFileChange, (const std::string &, const std::string &), (override));
+    MOCK_METHOD(void, OnFileOpen, (const std::string &, std::string), (override));
+    MOCK_METHOD(void, OnFileChange, (const std::string &, std::vector<ocls::TextChange>), (override));
     MOCK_METHOD(void, OnFileClose, (const std::string &), (override));
     MOCK_METHOD(void, SetTranslationOptions, (const std::vector<std::string> &), (override));
     MOCK_METHOD(void, SaveHeaders, (), (override));
+    MOCK_METHOD(void, EnableASTCache, (const std::string &, uint64_t), (override));
 
-    MOCK_METHOD(CXTranslationUnit, GetTranslationUnit, (const std::string &), (const override));
-    MOCK_METHOD(std::string *, GetContent, (const std::string &), (const override));    
+    MOCK_METHOD(ocls::TranslationUnitLease, Lease, (const std::string &, ocls::LeaseMode), (override));
+    MOCK_METHOD(bool, IsUpToDate, (const std::string &), (const override));
+    MOCK_METHOD(std::shared_ptr<const std::string>, GetContent, (const std::string &), (const override));
+    MOCK_METHOD(std::vector<ocls::TranslationUnitMemory>, GetMemoryUsage, (), (const override));
+    MOCK_METHOD(void, SetLimits, (const ocls::TranslationUnitLimits &), (override));
+    MOCK_METHOD(void, ReleaseStandbys, (), (override));
+    MOCK_METHOD(std::vector<std::string>, GetEvictionCandidates, (), (const override));
+    MOCK_METHOD(void, Evict, (const std::string &), (override));
 };
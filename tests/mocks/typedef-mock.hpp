@@ -15,5 +15,5 @@ class TypeDefinitionMock : public ocls::ITypeDefinition
 {
 public:
     MOCK_METHOD(
-        std::vector<ocls::Location>, GetTypeDefinitions, (const std::string &, unsigned, unsigned), (override));
+        ocls::LocationResult, GetTypeDefinitions, (const std::string &, unsigned, unsigned), (override));
 };
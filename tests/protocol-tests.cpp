@@ -0,0 +1,222 @@
+//
+//  protocol-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "protocol.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+
+using namespace ocls;
+using namespace nlohmann;
+
+
+TEST(ProtocolTest, DecodeInitializeParams)
+{
+    const json request = R"({
+        "id": 1,
+        "method": "initialize",
+        "params": {
+            "capabilities": {
+                "workspace": {"configuration": true},
+                "textDocument": {"definition": {"linkSupport": true}}
+            },
+            "initializationOptions": {
+                "configuration": {
+                    "buildOptions": ["-I", "/usr/include"],
+                    "maxNumberOfProblems": 10,
+                    "deviceID": 3,
+                    "diagnosticsDelay": 250,
+                    "diagnosticsMaxLatency": 1500,
+                    "memoryBudget": 256,
+                    "maxTranslationUnits": 8,
+                    "idleTimeout": 600
+                }
+            }
+        }
+    })"_json;
+
+    const auto params = InitializeParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_TRUE(params->capabilities.hasConfigurationCapability);
+    EXPECT_TRUE(params->capabilities.hasDefinitionLinkSupport);
+    EXPECT_FALSE(params->capabilities.supportDidChangeConfiguration);
+    EXPECT_EQ(params->buildOptions, R"(["-I", "/usr/include"])"_json);
+    EXPECT_EQ(params->maxNumberOfProblems, 10);
+    EXPECT_EQ(params->deviceID, 3);
+    EXPECT_EQ(params->diagnosticsDelay, 250);
+    EXPECT_EQ(params->diagnosticsMaxLatency, 1500);
+    EXPECT_EQ(params->memoryBudget, 256);
+    EXPECT_EQ(params->maxTranslationUnits, 8);
+    EXPECT_EQ(params->idleTimeout, 600);
+}
+
+TEST(ProtocolTest, DecodeInitializeParamsIgnoresNegativeNumbers)
+{
+    const json request = R"({
+        "id": 1,
+        "method": "initialize",
+        "params": {
+            "initializationOptions": {
+                "configuration": {"maxNumberOfProblems": -1, "deviceID": -3, "idleTimeout": -600}
+            }
+        }
+    })"_json;
+
+    const auto params = InitializeParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_FALSE(params->maxNumberOfProblems.has_value());
+    EXPECT_FALSE(params->deviceID.has_value());
+    EXPECT_FALSE(params->idleTimeout.has_value());
+}
+
+TEST(ProtocolTest, DecodeDidOpenParams)
+{
+    const json request = {
+        {"method", "textDocument/didOpen"},
+        {"params", {{"textDocument", {{"uri", "file:///kernel.cl"}, {"version", 1}, {"text", "__kernel void f() {}"}}}}}};
+
+    const auto params = DidOpenTextDocumentParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_EQ(params->uri, "file:///kernel.cl");
+    EXPECT_EQ(params->text, "__kernel void f() {}");
+}
+
+TEST(ProtocolTest, DecodeDidChangeParamsKeepsAllChanges)
+{
+    const json request = {
+        {"method", "textDocument/didChange"},
+        {"params",
+         {{"textDocument", {{"uri", "file:///kernel.cl"}}},
+          {"contentChanges", {{{"text", "old"}}, {{"text", "new"}}}}}}};
+
+    const auto params = DidChangeTextDocumentParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_EQ(params->uri, "file:///kernel.cl");
+    ASSERT_EQ(params->contentChanges.size(), 2);
+    EXPECT_FALSE(params->contentChanges[0].range.has_value());
+    EXPECT_EQ(params->contentChanges[0].text, "old");
+    EXPECT_EQ(params->contentChanges[1].text, "new");
+}
+
+TEST(ProtocolTest, DecodeDidChangeParamsWithRanges)
+{
+    const json request = R"({
+        "method": "textDocument/didChange",
+        "params": {
+            "textDocument": {"uri": "file:///kernel.cl", "version": 3},
+            "contentChanges": [
+                {"range": {"start": {"line": 1, "character": 4}, "end": {"line": 2, "character": 0}}, "rangeLength": 9, "text": "x"},
+                {"range": {"start": {"line": 0, "character": 0}, "end": {"line": 0, "character": 0}}, "text": ""}
+            ]
+        }
+    })"_json;
+
+    const auto params = DidChangeTextDocumentParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    ASSERT_EQ(params->contentChanges.size(), 2);
+    const auto &first = params->contentChanges[0];
+    ASSERT_TRUE(first.range.has_value());
+    EXPECT_EQ(first.range->start.line, 1);
+    EXPECT_EQ(first.range->start.character, 4);
+    EXPECT_EQ(first.range->end.line, 2);
+    EXPECT_EQ(first.range->end.character, 0);
+    EXPECT_EQ(first.text, "x");
+    EXPECT_TRUE(params->contentChanges[1].range.has_value());
+    EXPECT_TRUE(params->contentChanges[1].text.empty());
+}
+
+TEST(ProtocolTest, DecodeDidChangeParamsRejectsMalformedChanges)
+{
+    const auto decode = [](const json &change) {
+        const json request = {
+            {"method", "textDocument/didChange"},
+            {"params",
+             {{"textDocument", {{"uri", "file:///kernel.cl"}}}, {"contentChanges", {{{"text", "ok"}}, change}}}}};
+        return DidChangeTextDocumentParams::Decode(request);
+    };
+    const json valid = {
+        {"range", {{"start", {{"line", 1}, {"character", 0}}}, {"end", {{"line", 1}, {"character", 2}}}}},
+        {"text", ""}};
+    EXPECT_TRUE(decode(valid).has_value());
+
+    auto missingEnd = valid;
+    missingEnd["range"]["end"].erase("character");
+    EXPECT_FALSE(decode(missingEnd).has_value());
+
+    auto negativeStart = valid;
+    negativeStart["range"]["start"]["line"] = -1;
+    EXPECT_FALSE(decode(negativeStart).has_value());
+
+    auto missingText = valid;
+    missingText.erase("text");
+    EXPECT_FALSE(decode(missingText).has_value());
+
+    auto numericText = valid;
+    numericText["text"] = 5;
+    EXPECT_FALSE(decode(numericText).has_value());
+}
+
+TEST(ProtocolTest, DecodePositionParams)
+{
+    const json request = {
+        {"id", 1},
+        {"method", "textDocument/definition"},
+        {"params", {{"textDocument", {{"uri", "file:///kernel.cl"}}}, {"position", {{"line", 12}, {"character", 27}}}}}};
+
+    const auto params = TextDocumentPositionParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_EQ(params->uri, "file:///kernel.cl");
+    EXPECT_EQ(params->line, 12);
+    EXPECT_EQ(params->character, 27);
+}
+
+TEST(ProtocolTest, DecodeFailsOnMissingOrInvalidFields)
+{
+    const json noText = {{"method", "textDocument/didOpen"}, {"params", {{"textDocument", {{"uri", "kernel.cl"}}}}}};
+    const json negativeLine = {
+        {"method", "textDocument/definition"},
+        {"params", {{"textDocument", {{"uri", "kernel.cl"}}}, {"position", {{"line", -1}, {"character", 0}}}}}};
+    const json stringLine = {
+        {"method", "textDocument/definition"},
+        {"params", {{"textDocument", {{"uri", "kernel.cl"}}}, {"position", {{"line", "1"}, {"character", 0}}}}}};
+
+    EXPECT_FALSE(DidOpenTextDocumentParams::Decode(noText).has_value());
+    EXPECT_FALSE(TextDocumentPositionParams::Decode(negativeLine).has_value());
+    EXPECT_FALSE(TextDocumentPositionParams::Decode(stringLine).has_value());
+    EXPECT_FALSE(DidCloseTextDocumentParams::Decode(json {{"method", "textDocument/didClose"}}).has_value());
+}
+
+TEST(ProtocolTest, DecodeCompletionResolveParams)
+{
+    const json request = R"({
+        "id": 19,
+        "method": "completionItem/resolve",
+        "params": {"label": "getChannel", "kind": 3, "data": {"index": 4244}}
+    })"_json;
+
+    const auto params = CompletionResolveParams::Decode(request);
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_EQ(params->label, "getChannel");
+    EXPECT_EQ(params->index, 4244);
+    EXPECT_EQ(params->item, request["params"]);
+}
+
+TEST(ProtocolTest, DecodeCancelParams)
+{
+    const auto params = CancelParams::Decode(json {{"method", "$/cancelRequest"}, {"params", {{"id", "abc"}}}});
+
+    ASSERT_TRUE(params.has_value());
+    EXPECT_EQ(params->id, "abc");
+}
@@ -0,0 +1,117 @@
+//
+//  recording-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "jsonrpc.hpp"
+#include "recording.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+std::string Frame(const std::string& body)
+{
+    return "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+} // namespace
+
+TEST(RecordingTest, ComputesNearestRankPercentiles)
+{
+    std::vector<uint64_t> samples;
+    for (uint64_t i = 100; i >= 1; i--)
+    {
+        samples.push_back(i);
+    }
+
+    const auto result = ComputePercentiles(samples);
+
+    EXPECT_EQ(result.count, 100);
+    EXPECT_EQ(result.p50, 50);
+    EXPECT_EQ(result.p90, 90);
+    EXPECT_EQ(result.p99, 99);
+    EXPECT_EQ(result.max, 100);
+    EXPECT_EQ(ComputePercentiles({}).count, 0);
+    EXPECT_EQ(ComputePercentiles({7}).p99, 7);
+}
+
+TEST(RecordingTest, TakesCompleteFramedMessages)
+{
+    std::string buffer = Frame(R"({"id":1})") + Frame(R"({"id":2})");
+    const auto partial = Frame(R"({"id":3})");
+    buffer += partial.substr(0, partial.size() - 2);
+
+    const auto bodies = TakeFramedMessages(buffer);
+
+    ASSERT_EQ(bodies.size(), 2);
+    EXPECT_EQ(bodies[0], R"({"id":1})");
+    EXPECT_EQ(bodies[1], R"({"id":2})");
+    EXPECT_EQ(buffer, partial.substr(0, partial.size() - 2));
+
+    buffer += partial.substr(partial.size() - 2);
+    EXPECT_EQ(TakeFramedMessages(buffer), std::vector<std::string>({R"({"id":3})"}));
+    EXPECT_TRUE(buffer.empty());
+}
+
+TEST(RecordingTest, TracksRespondAndDiagnosticsLatencies)
+{
+    LatencyTracker tracker;
+    tracker.OnInbound(R"({"jsonrpc":"2.0","id":1,"method":"textDocument/definition","params":{}})", 100);
+    tracker.OnInbound(
+        R"([{"jsonrpc":"2.0","id":2,"method":"textDocument/definition"},{"jsonrpc":"2.0","id":"x","method":"textDocument/completion"}])",
+        200);
+    tracker.OnInbound(
+        R"({"jsonrpc":"2.0","method":"textDocument/didChange","params":{"textDocument":{"uri":"file:///k.cl"}}})", 300);
+
+    tracker.OnOutbound(R"([{"jsonrpc":"2.0","id":2,"result":[]},{"jsonrpc":"2.0","id":"x","result":[]}])", 250);
+    tracker.OnOutbound(R"({"jsonrpc":"2.0","id":1,"result":null})", 400);
+    tracker.OnOutbound(
+        R"({"jsonrpc":"2.0","method":"textDocument/publishDiagnostics","params":{"uri":"file:///k.cl","diagnostics":[]}})",
+        800);
+    // Responds to unknown ids are ignored
+    tracker.OnOutbound(R"({"jsonrpc":"2.0","id":1,"result":null})", 900);
+
+    const auto report = tracker.Report();
+
+    ASSERT_EQ(report.size(), 3);
+    EXPECT_EQ(report.at("textDocument/definition").count, 2);
+    EXPECT_EQ(report.at("textDocument/definition").p50, 50);
+    EXPECT_EQ(report.at("textDocument/definition").max, 300);
+    EXPECT_EQ(report.at("textDocument/completion").max, 50);
+    EXPECT_EQ(report.at("textDocument/publishDiagnostics").max, 500);
+}
+
+TEST(RecordingTest, RecordsMessagesOfJsonRPC)
+{
+    const auto filePath =
+        (std::filesystem::temp_directory_path() / "opencl-language-server-recording-test.jsonl").string();
+    auto jrpc = CreateJsonRPC();
+    jrpc->RegisterRecorder(CreateSessionRecorder(filePath));
+    jrpc->RegisterOutputCallback([](const std::string&) {});
+    jrpc->RegisterMethodCallback("initialize", [&jrpc](const JRPCMessage& message) {
+        jrpc->Write(json {{"id", message.Id()}, {"result", json::object()}});
+    });
+    const std::string request = R"({"jsonrpc":"2.0","id":0,"method":"initialize","params":{"trace":"off"}})";
+    const auto frame = Frame(request);
+    jrpc->Consume(frame);
+
+    const auto entries = ReadRecording(filePath);
+    std::filesystem::remove(filePath);
+
+    ASSERT_EQ(entries.size(), 2);
+    EXPECT_EQ(entries[0].direction, RecordDirection::inbound);
+    EXPECT_EQ(entries[0].body, request);
+    EXPECT_EQ(entries[1].direction, RecordDirection::outbound);
+    EXPECT_EQ(json::parse(entries[1].body)["id"], 0);
+    EXPECT_LE(entries[0].timestamp, entries[1].timestamp);
+}
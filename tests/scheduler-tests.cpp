@@ -0,0 +1,341 @@
+//
+//  scheduler-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "scheduler.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+using namespace ocls;
+
+namespace {
+
+// Blocks the tasks that wait on it until it is opened
+class Gate
+{
+public:
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] { return m_open; });
+    }
+
+    void Open()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_open = true;
+        }
+        m_cv.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_open = false;
+};
+
+struct Journal
+{
+    std::mutex mutex;
+    std::vector<std::string> entries;
+
+    void Add(const std::string &entry)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(entry);
+    }
+};
+
+} // namespace
+
+TEST(SchedulerTest, KeepsOrderOfTasksWithSameKey)
+{
+    auto scheduler = CreateScheduler(4);
+    scheduler->Start({});
+    Journal journal;
+
+    for (int i = 0; i < 50; i++)
+    {
+        // Alternate priorities, the order must still follow the scheduling order
+        const auto priority = i % 2 ? TaskPriority::interactive : TaskPriority::background;
+        scheduler->Schedule(priority, "kernel.cl", [&journal, i] { journal.Add(std::to_string(i)); });
+    }
+    scheduler->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 50);
+    for (int i = 0; i < 50; i++)
+    {
+        EXPECT_EQ(journal.entries[i], std::to_string(i));
+    }
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, InteractiveTaskIsNotBlockedByBackgroundWork)
+{
+    auto scheduler = CreateScheduler(2);
+    scheduler->Start({});
+    Gate gate;
+    Journal journal;
+
+    // Occupies the only worker background tasks may use, until the interactive task runs
+    scheduler->Schedule(TaskPriority::background, "diag:a.cl", [&gate] { gate.Wait(); });
+    scheduler->Schedule(TaskPriority::background, "diag:b.cl", [&journal] { journal.Add("background"); });
+    scheduler->Schedule(TaskPriority::interactive, "a.cl", [&] {
+        journal.Add("interactive");
+        gate.Open();
+    });
+    scheduler->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 2);
+    EXPECT_EQ(journal.entries[0], "interactive");
+    EXPECT_EQ(journal.entries[1], "background");
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, DefaultWorkersRunABackgroundTaskPerCore)
+{
+    const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    auto scheduler = CreateScheduler();
+    scheduler->Start({});
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t running = 0;
+    size_t together = 0;
+
+    // Every task waits until all of them run at once, or gives up after a while
+    for (size_t i = 0; i < cores; i++)
+    {
+        scheduler->Schedule(TaskPriority::background, "diag:" + std::to_string(i) + ".cl", [&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            together = std::max(together, ++running);
+            cv.notify_all();
+            cv.wait_for(lock, std::chrono::seconds(5), [&] { return running == cores; });
+        });
+    }
+    scheduler->Drain();
+
+    EXPECT_EQ(together, cores);
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, RequestWaitsOnlyForTheWorkOnItsKey)
+{
+    auto scheduler = CreateScheduler(2);
+    Gate gate;
+    Journal journal;
+
+    // The only worker background tasks may use is busy, the parses of both documents are queued
+    scheduler->Schedule(TaskPriority::background, "diag:a.cl", [&gate] { gate.Wait(); });
+    scheduler->Schedule(TaskPriority::background, "a.cl", [&journal] { journal.Add("parse a"); });
+    scheduler->Schedule(TaskPriority::background, "b.cl", [&journal] { journal.Add("parse b"); });
+    scheduler->Schedule(TaskPriority::background, "b.cl", [&journal] { journal.Add("reparse b"); });
+    scheduler->Schedule(TaskPriority::interactive, "b.cl", [&] {
+        journal.Add("complete b");
+        gate.Open();
+    });
+    scheduler->Start({});
+    scheduler->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 4);
+    EXPECT_EQ(journal.entries[0], "parse b");
+    EXPECT_EQ(journal.entries[1], "reparse b");
+    EXPECT_EQ(journal.entries[2], "complete b");
+    EXPECT_EQ(journal.entries[3], "parse a");
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, ReportsFinishedTasksAndSurvivesExceptions)
+{
+    auto scheduler = CreateScheduler(2);
+    std::atomic<int> finished = 0;
+    std::atomic<int> executed = 0;
+    scheduler->Start([&finished] { finished++; });
+
+    scheduler->Schedule(TaskPriority::interactive, "kernel.cl", [] { throw std::runtime_error("failure"); });
+    scheduler->Schedule(TaskPriority::interactive, "kernel.cl", [&executed] { executed++; });
+    scheduler->Drain();
+
+    EXPECT_EQ(executed, 1);
+    EXPECT_EQ(finished, 2);
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, DebouncedTasksWithSameKeyCollapse)
+{
+    using namespace std::chrono_literals;
+    auto scheduler = CreateScheduler(2);
+    scheduler->Start({});
+    Journal journal;
+
+    for (int i = 0; i < 10; i++)
+    {
+        scheduler->ScheduleDebounced(
+            TaskPriority::background, "diag:kernel.cl", 50ms, 10s, [&journal, i] { journal.Add(std::to_string(i)); });
+    }
+    std::this_thread::sleep_for(200ms);
+    scheduler->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 1);
+    EXPECT_EQ(journal.entries[0], "9");
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, DebouncedTaskIsNotPostponedPastMaxLatency)
+{
+    using namespace std::chrono_literals;
+    auto scheduler = CreateScheduler(2);
+    scheduler->Start({});
+    std::atomic<int> executed = 0;
+
+    // Keep the key busy for longer than the max latency, the delay alone would never pass
+    const auto end = std::chrono::steady_clock::now() + 400ms;
+    while (std::chrono::steady_clock::now() < end)
+    {
+        scheduler->ScheduleDebounced(TaskPriority::background, "diag:kernel.cl", 100ms, 150ms, [&executed] {
+            executed++;
+        });
+        std::this_thread::sleep_for(10ms);
+    }
+
+    EXPECT_GE(executed, 1);
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, DrainRunsPendingDebouncedTasks)
+{
+    using namespace std::chrono_literals;
+    auto scheduler = CreateScheduler(2);
+    scheduler->Start({});
+    Journal journal;
+
+    scheduler->ScheduleDebounced(TaskPriority::background, "diag:a.cl", 1h, 1h, [&journal] { journal.Add("a"); });
+    scheduler->ScheduleDebounced(TaskPriority::background, "diag:b.cl", 1h, 1h, [&journal] { journal.Add("b"); });
+    scheduler->Drain();
+
+    EXPECT_EQ(journal.entries.size(), 2);
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, TimerReplacesThePendingOneWithTheSameKey)
+{
+    using namespace std::chrono_literals;
+    auto scheduler = CreateScheduler(2);
+    scheduler->Start({});
+    Journal journal;
+
+    scheduler->ScheduleTimer(TaskPriority::background, "idle", 20ms, [&journal] { journal.Add("first"); });
+    scheduler->ScheduleTimer(TaskPriority::background, "idle", 20ms, [&journal] { journal.Add("second"); });
+    std::this_thread::sleep_for(200ms);
+    scheduler->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 1);
+    EXPECT_EQ(journal.entries[0], "second");
+    scheduler->Stop();
+}
+
+TEST(SchedulerTest, DrainDoesNotRunOrWaitForTimers)
+{
+    using namespace std::chrono_literals;
+    auto shared = CreateScheduler(2);
+    shared->Start({});
+    auto view = CreateScopedScheduler(shared, "view:");
+    view->Start({});
+    std::atomic<int> executed = 0;
+
+    shared->ScheduleTimer(TaskPriority::interactive, "timeout", 1h, [&executed] { executed++; });
+    view->ScheduleTimer(TaskPriority::interactive, "timeout", 1h, [&executed] { executed++; });
+    const auto start = std::chrono::steady_clock::now();
+    view->Drain();
+    shared->Drain();
+
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 1s);
+    EXPECT_EQ(executed, 0);
+    view->Stop();
+    shared->Stop();
+    EXPECT_EQ(executed, 0);
+}
+
+TEST(SchedulerTest, ScopedViewsShareKeyOrdering)
+{
+    auto shared = CreateScheduler(4);
+    shared->Start({});
+    auto first = CreateScopedScheduler(shared, "first:");
+    auto second = CreateScopedScheduler(shared, "second:");
+    std::atomic<int> firstFinished = 0;
+    first->Start([&firstFinished] { firstFinished++; });
+    second->Start({});
+    Journal journal;
+
+    for (int i = 0; i < 20; i++)
+    {
+        auto &view = i % 2 ? second : first;
+        view->Schedule(TaskPriority::background, "kernel.cl", [&journal, i] { journal.Add(std::to_string(i)); });
+    }
+    first->Drain();
+    second->Drain();
+
+    ASSERT_EQ(journal.entries.size(), 20);
+    for (int i = 0; i < 20; i++)
+    {
+        EXPECT_EQ(journal.entries[i], std::to_string(i));
+    }
+    EXPECT_EQ(firstFinished, 10);
+    first->Stop();
+    second->Stop();
+    shared->Stop();
+}
+
+TEST(SchedulerTest, ScopedViewsDoNotReplaceEachOtherDebouncedTasks)
+{
+    using namespace std::chrono_literals;
+    auto shared = CreateScheduler(2);
+    shared->Start({});
+    auto first = CreateScopedScheduler(shared, "first:");
+    auto second = CreateScopedScheduler(shared, "second:");
+    first->Start({});
+    second->Start({});
+    Journal journal;
+
+    first->ScheduleDebounced(TaskPriority::background, "kernel.cl", 10ms, 1s, [&journal] { journal.Add("first"); });
+    second->ScheduleDebounced(TaskPriority::background, "kernel.cl", 10ms, 1s, [&journal] { journal.Add("second"); });
+    first->Drain();
+    second->Drain();
+
+    EXPECT_EQ(journal.entries.size(), 2);
+    first->Stop();
+    second->Stop();
+    shared->Stop();
+}
+
+TEST(SchedulerTest, StoppedScopedViewSkipsQueuedTasks)
+{
+    auto shared = CreateScheduler(2);
+    shared->Start({});
+    auto view = CreateScopedScheduler(shared, "view:");
+    view->Start({});
+    Gate gate;
+    std::atomic<int> executed = 0;
+
+    // Holds the key, so the second task is still queued when the view is stopped
+    shared->Schedule(TaskPriority::interactive, "kernel.cl", [&gate] { gate.Wait(); });
+    view->Schedule(TaskPriority::interactive, "kernel.cl", [&executed] { executed++; });
+    view->Stop();
+    gate.Open();
+    shared->Drain();
+
+    EXPECT_EQ(executed, 0);
+    shared->Stop();
+}
@@ -0,0 +1,119 @@
+//
+//  stats-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "stats.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ocls;
+
+TEST(LatencyHistogramTest, ReportsPercentilesWithinBucketPrecision)
+{
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 1000; value++)
+    {
+        histogram.Record(value * 1000);
+    }
+
+    const auto result = histogram.Percentiles();
+
+    EXPECT_EQ(result.count, 1000);
+    EXPECT_EQ(result.max, 1000000);
+    EXPECT_GE(result.p50, 500000);
+    EXPECT_LE(result.p50, 500000 * 1.0625);
+    EXPECT_GE(result.p90, 900000);
+    EXPECT_LE(result.p90, 900000 * 1.0625);
+    EXPECT_GE(result.p99, 990000);
+    EXPECT_LE(result.p99, result.max);
+}
+
+TEST(LatencyHistogramTest, KeepsSmallAndHugeValues)
+{
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.Percentiles().count, 0);
+
+    histogram.Record(0);
+    histogram.Record(7);
+    histogram.Record(UINT64_MAX);
+
+    const auto result = histogram.Percentiles();
+    EXPECT_EQ(result.count, 3);
+    EXPECT_EQ(result.p50, 7);
+    EXPECT_EQ(result.max, UINT64_MAX);
+    EXPECT_EQ(result.p99, UINT64_MAX);
+}
+
+TEST(LatencyHistogramTest, CountsConcurrentRecords)
+{
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&histogram, i] {
+            for (uint64_t value = 0; value < 10000; value++)
+            {
+                histogram.Record(value + static_cast<uint64_t>(i));
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    const auto result = histogram.Percentiles();
+    EXPECT_EQ(result.count, 40000);
+    EXPECT_EQ(result.max, 10002);
+}
+
+TEST(StatisticsTest, NamesHistogramsOnFirstUse)
+{
+    // Too large for the stack
+    auto statisticsPtr = std::make_unique<Statistics>();
+    auto &statistics = *statisticsPtr;
+    auto completion = statistics.Method("textDocument/completion");
+    ASSERT_NE(completion, nullptr);
+    EXPECT_EQ(statistics.Method("textDocument/completion"), completion);
+    EXPECT_NE(statistics.Method("textDocument/definition"), completion);
+    EXPECT_NE(statistics.Request("textDocument/completion"), completion);
+    EXPECT_EQ(statistics.Method(""), nullptr);
+    EXPECT_EQ(statistics.Method(std::string(100, 'x')), nullptr);
+
+    completion->Record(2000000);
+    statistics.Add(Gauge::translationUnits, 2);
+    statistics.Add(Gauge::translationUnits, -1);
+
+    const auto result = statistics.ToJson();
+    EXPECT_EQ(result["methods"]["textDocument/completion"]["count"], 1);
+    EXPECT_DOUBLE_EQ(result["methods"]["textDocument/completion"]["maxMs"].get<double>(), 2.0);
+    EXPECT_EQ(result["methods"]["textDocument/definition"]["count"], 0);
+    EXPECT_EQ(result["probes"]["clang_parseTranslationUnit2"]["count"], 0);
+    EXPECT_EQ(result["translationUnits"], 1);
+    EXPECT_EQ(result["queues"]["outgoingMessages"], 0);
+}
+
+TEST(StatisticsTest, RunsOutOfSlots)
+{
+    // Too large for the stack
+    auto statisticsPtr = std::make_unique<Statistics>();
+    auto &statistics = *statisticsPtr;
+    size_t named = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        if (statistics.Method("method" + std::to_string(i)))
+        {
+            named++;
+        }
+    }
+    EXPECT_EQ(named, 32);
+    EXPECT_NE(statistics.Method("method0"), nullptr);
+}
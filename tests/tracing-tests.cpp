@@ -0,0 +1,105 @@
+//
+//  tracing-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "tracing.hpp"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+// One file per test, so that the tests can run in parallel
+std::string TraceFilePath()
+{
+    const auto test = ::testing::UnitTest::GetInstance()->current_test_info();
+    const auto fileName = std::string("opencl-language-server-trace-") + test->test_suite_name() + "-" + test->name() + ".json";
+    return (std::filesystem::temp_directory_path() / fileName).string();
+}
+
+json ReadTrace(const std::string& filePath)
+{
+    std::ifstream file(filePath);
+    return json::parse(file);
+}
+
+} // namespace
+
+TEST(TracerTest, WritesCompleteEventsOfEveryThread)
+{
+    const auto filePath = TraceFilePath();
+    Tracer tracer;
+    tracer.Start(filePath);
+    EXPECT_TRUE(tracer.IsEnabled());
+
+    const auto start = Tracer::Clock::now();
+    tracer.Complete("main", "test", start, start + std::chrono::microseconds(5));
+    std::thread([&tracer, start]() {
+        tracer.Complete("worker", "test", start, start + std::chrono::microseconds(7));
+    }).join();
+    tracer.Stop();
+    EXPECT_FALSE(tracer.IsEnabled());
+
+    const auto events = ReadTrace(filePath);
+    ASSERT_EQ(events.size(), 2);
+    std::set<std::string> names;
+    std::set<uint32_t> tids;
+    for (const auto& event : events)
+    {
+        EXPECT_EQ(event["ph"], "X");
+        EXPECT_EQ(event["cat"], "test");
+        names.insert(event["name"].get<std::string>());
+        tids.insert(event["tid"].get<uint32_t>());
+    }
+    EXPECT_EQ(names, (std::set<std::string> {"main", "worker"}));
+    EXPECT_EQ(tids.size(), 2);
+    std::filesystem::remove(filePath);
+}
+
+TEST(TracerTest, TagsSpansWithTheEnclosingContext)
+{
+    const auto filePath = TraceFilePath();
+    GetTracer().Start(filePath);
+    {
+        TraceContext request(json(7), "file:///kernel.cl");
+        TraceSpan outer("textDocument/completion", "lsp");
+        {
+            TraceContext notification(json(), "file:///other.cl");
+            TraceSpan inner("clang_codeCompleteAt", "libclang");
+        }
+    }
+    { TraceSpan orphan("Write", "writer"); }
+    GetTracer().Stop();
+
+    const auto events = ReadTrace(filePath);
+    ASSERT_EQ(events.size(), 3);
+    EXPECT_EQ(events[0]["name"], "clang_codeCompleteAt");
+    EXPECT_FALSE(events[0]["args"].contains("id"));
+    EXPECT_EQ(events[0]["args"]["uri"], "file:///other.cl");
+    EXPECT_EQ(events[1]["name"], "textDocument/completion");
+    EXPECT_EQ(events[1]["args"]["id"], "7");
+    EXPECT_EQ(events[1]["args"]["uri"], "file:///kernel.cl");
+    EXPECT_EQ(events[2]["name"], "Write");
+    EXPECT_TRUE(events[2]["args"].empty());
+    std::filesystem::remove(filePath);
+}
+
+TEST(TracerTest, IgnoresSpansWhileDisabled)
+{
+    EXPECT_FALSE(GetTracer().IsEnabled());
+    TraceContext context(json("request"), "file:///kernel.cl");
+    EXPECT_EQ(TraceContext::Current(), nullptr);
+    TraceSpan span("Parse", "jsonrpc");
+}
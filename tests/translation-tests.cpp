@@ -0,0 +1,697 @@
+//
+//  translation-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "stats.hpp"
+#include "translation.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace ocls;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string TEST_FIXTURE_DIR = fs::path(__FILE__).parent_path().string() + "/fixtures";
+const std::string KERNEL_FILE = TEST_FIXTURE_DIR + "/kernel.cl";
+
+/**
+ Directory of the running test, ctest runs the tests in parallel processes, so they must not share files.
+ */
+fs::path TestDirectory()
+{
+    const auto test = ::testing::UnitTest::GetInstance()->current_test_info();
+    return fs::temp_directory_path() /
+        ("opencl-language-server-" + std::string(test->test_suite_name()) + "-" + test->name());
+}
+
+size_t ProbeCount(Probe probe)
+{
+    return GetStatistics().Of(probe).Percentiles().count;
+}
+
+class TranslationUnitStoreTest : public ::testing::Test
+{
+protected:
+    std::shared_ptr<ITranslationUnitStore> store;
+    std::string content;
+    fs::path testDir;
+    std::string otherKernelFile;
+
+    void SetUp() override
+    {
+        std::ifstream f(KERNEL_FILE);
+        content.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        testDir = TestDirectory();
+        fs::remove_all(testDir);
+        fs::create_directories(testDir);
+        otherKernelFile = (testDir / "other-kernel.cl").string();
+        store = CreateTranslationUnitStore();
+        store->SetTranslationOptions({});
+        fs::copy_file(KERNEL_FILE, otherKernelFile, fs::copy_options::overwrite_existing);
+    }
+
+    void TearDown() override
+    {
+        store->OnFileClose(KERNEL_FILE);
+        store->OnFileClose(otherKernelFile);
+        store.reset();
+        fs::remove_all(testDir);
+    }
+};
+
+} // namespace
+
+TEST_F(TranslationUnitStoreTest, SamplesMemoryOfParsedFiles)
+{
+    const auto before = GetStatistics().Get(Gauge::translationUnitMemory);
+    store->OnFileOpen(KERNEL_FILE, content);
+
+    const auto usage = store->GetMemoryUsage();
+    ASSERT_EQ(usage.size(), 1);
+    EXPECT_EQ(usage[0].filePath, KERNEL_FILE);
+    EXPECT_GT(usage[0].ast, 0);
+    EXPECT_GE(usage[0].total, usage[0].ast + usage[0].preamble);
+    EXPECT_EQ(GetStatistics().Get(Gauge::translationUnitMemory) - before, static_cast<int64_t>(usage[0].total));
+
+    store->OnFileClose(KERNEL_FILE);
+    EXPECT_TRUE(store->GetMemoryUsage().empty());
+    EXPECT_EQ(GetStatistics().Get(Gauge::translationUnitMemory), before);
+}
+
+TEST_F(TranslationUnitStoreTest, ResamplesMemoryAfterReparse)
+{
+    const auto before = GetStatistics().Get(Gauge::translationUnitMemory);
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content + "\nvoid extra() {}\n"}});
+
+    const auto usage = store->GetMemoryUsage();
+    ASSERT_EQ(usage.size(), 1);
+    EXPECT_GT(usage[0].total, 0);
+    EXPECT_EQ(GetStatistics().Get(Gauge::translationUnitMemory) - before, static_cast<int64_t>(usage[0].total));
+
+    store->OnFileClose(KERNEL_FILE);
+    EXPECT_EQ(GetStatistics().Get(Gauge::translationUnitMemory), before);
+}
+
+TEST_F(TranslationUnitStoreTest, ParsesFilesOfTheSharedIndexInParallel)
+{
+    std::thread other([this]() {
+        store->OnFileOpen(otherKernelFile, content);
+        store->OnFileChange(otherKernelFile, {TextChange {std::nullopt, content + "\nvoid other() {}\n"}});
+    });
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content + "\nvoid extra() {}\n"}});
+    other.join();
+
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+    EXPECT_NE(store->Lease(otherKernelFile, LeaseMode::shared).TranslationUnit(), nullptr);
+    EXPECT_EQ(store->GetMemoryUsage().size(), 2);
+}
+
+TEST_F(TranslationUnitStoreTest, KeepsOpenDocumentsWhenTheOptionsChange)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    ASSERT_TRUE(store->Lease(KERNEL_FILE, LeaseMode::shared));
+
+    store->SetTranslationOptions({"-cl-std=CL1.2"});
+    ASSERT_NE(store->GetContent(KERNEL_FILE), nullptr);
+    EXPECT_EQ(*store->GetContent(KERNEL_FILE), content);
+    // Parsed again with the new options
+    const auto lease = store->Lease(KERNEL_FILE, LeaseMode::shared);
+    ASSERT_TRUE(lease);
+    EXPECT_TRUE(lease.IsUpToDate());
+
+    store->OnFileChange(KERNEL_FILE, {TextChange {TextRange {{0, 0}, {0, 0}}, "// options changed\n"}});
+    ASSERT_NE(store->GetContent(KERNEL_FILE), nullptr);
+    EXPECT_EQ(*store->GetContent(KERNEL_FILE), "// options changed\n" + content);
+    EXPECT_TRUE(store->IsUpToDate(KERNEL_FILE));
+}
+
+#if !defined(WIN32) && !defined(__APPLE__)
+TEST_F(TranslationUnitStoreTest, ReusesThePCHOfAnEarlierStore)
+{
+    const auto cacheHome = testDir / "cache";
+    setenv("XDG_CACHE_HOME", cacheHome.c_str(), 1);
+    auto first = CreateTranslationUnitStore();
+    first->SaveHeaders();
+    first->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    first.reset();
+    std::vector<fs::path> pchs;
+    for (const auto &entry : fs::recursive_directory_iterator(cacheHome))
+    {
+        if (entry.path().extension() == ".pch")
+        {
+            pchs.push_back(entry.path());
+        }
+    }
+    ASSERT_EQ(pchs.size(), 1);
+    const auto builtAt = fs::last_write_time(pchs[0]);
+
+    auto second = CreateTranslationUnitStore();
+    second->SaveHeaders();
+    second->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    unsetenv("XDG_CACHE_HOME");
+
+    EXPECT_EQ(fs::last_write_time(pchs[0]), builtAt);
+}
+#endif
+
+TEST_F(TranslationUnitStoreTest, KeepsItsHeadersWhenAnotherStoreIsDestroyed)
+{
+    auto other = CreateTranslationUnitStore();
+    other->SaveHeaders();
+    other->SetTranslationOptions({});
+    store->SaveHeaders();
+    store->SetTranslationOptions({});
+    other.reset();
+
+    store->OnFileOpen(KERNEL_FILE, content);
+    const auto lease = store->Lease(KERNEL_FILE, LeaseMode::shared);
+    ASSERT_TRUE(lease);
+    // A missing precompiled header is a fatal error
+    const auto count = clang_getNumDiagnostics(lease.TranslationUnit());
+    for (unsigned i = 0; i < count; i++)
+    {
+        const auto diagnostic = clang_getDiagnostic(lease.TranslationUnit(), i);
+        EXPECT_NE(clang_getDiagnosticSeverity(diagnostic), CXDiagnostic_Fatal);
+        clang_disposeDiagnostic(diagnostic);
+    }
+}
+
+TEST_F(TranslationUnitStoreTest, KeepsTheRevisionOfALease)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    const auto served = store->Lease(KERNEL_FILE, LeaseMode::shared);
+    ASSERT_TRUE(served);
+    EXPECT_TRUE(served.IsUpToDate());
+
+    const auto text = content + "\nvoid extra() {}\n";
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, text}});
+    const auto next = store->Lease(KERNEL_FILE, LeaseMode::shared);
+    ASSERT_TRUE(next);
+    EXPECT_NE(next.TranslationUnit(), served.TranslationUnit());
+    EXPECT_EQ(*next.Content(), text);
+    EXPECT_EQ(*served.Content(), content);
+    EXPECT_TRUE(store->IsUpToDate(KERNEL_FILE));
+    EXPECT_NE(clang_getFile(served.TranslationUnit(), KERNEL_FILE.c_str()), nullptr);
+
+    // The standby is still leased, so the next revision is parsed into a new unit
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content}});
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), next.TranslationUnit());
+    EXPECT_NE(clang_getFile(served.TranslationUnit(), KERNEL_FILE.c_str()), nullptr);
+
+    // Closing the file does not dispose the leased units either
+    store->OnFileClose(KERNEL_FILE);
+    EXPECT_FALSE(store->Lease(KERNEL_FILE, LeaseMode::shared));
+    EXPECT_NE(clang_getFile(next.TranslationUnit(), KERNEL_FILE.c_str()), nullptr);
+}
+
+TEST_F(TranslationUnitStoreTest, ReparsesTheStandbyIntoTheNextRevision)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    const CXTranslationUnit first = store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit();
+
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content + "\nvoid extra() {}\n"}});
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), first);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content}});
+    EXPECT_EQ(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), first);
+}
+
+TEST_F(TranslationUnitStoreTest, BlocksExclusiveLeasesWhileSharedOnesAreHeld)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    auto shared = std::make_unique<TranslationUnitLease>(store->Lease(KERNEL_FILE, LeaseMode::shared));
+    auto copy = *shared;
+    ASSERT_TRUE(copy);
+
+    std::atomic<bool> leased {false};
+    std::thread completion([this, &leased]() {
+        const auto lease = store->Lease(KERNEL_FILE, LeaseMode::exclusive);
+        leased = true;
+        EXPECT_TRUE(lease);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    shared.reset();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // The copy still holds the lock
+    EXPECT_FALSE(leased);
+    copy = {};
+    completion.join();
+    EXPECT_TRUE(leased);
+}
+
+TEST_F(TranslationUnitStoreTest, KeepsLeasesValidUnderConcurrentOpensChangesAndQueries)
+{
+    const std::vector<std::string> files {KERNEL_FILE, otherKernelFile};
+    std::atomic<bool> done {false};
+    std::atomic<size_t> queries {0};
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < 4; i++)
+    {
+        // One of the readers completes code, which changes the unit and needs an exclusive lease
+        const auto mode = i == 0 ? LeaseMode::exclusive : LeaseMode::shared;
+        readers.emplace_back([this, &files, &done, &queries, mode]() {
+            while (!done)
+            {
+                for (const auto &filePath : files)
+                {
+                    const auto lease = store->Lease(filePath, mode);
+                    if (!lease)
+                    {
+                        continue;
+                    }
+                    ASSERT_NE(lease.Content(), nullptr);
+                    EXPECT_EQ(lease.Content()->compare(0, content.size(), content), 0);
+                    EXPECT_NE(clang_getFile(lease.TranslationUnit(), filePath.c_str()), nullptr);
+                    if (mode == LeaseMode::exclusive)
+                    {
+                        CXUnsavedFile unsavedFile;
+                        unsavedFile.Filename = filePath.c_str();
+                        unsavedFile.Contents = lease.Content()->data();
+                        unsavedFile.Length = static_cast<unsigned long>(lease.Content()->size());
+                        auto results = clang_codeCompleteAt(
+                            lease.TranslationUnit(),
+                            filePath.c_str(),
+                            1,
+                            1,
+                            &unsavedFile,
+                            1,
+                            clang_defaultCodeCompleteOptions());
+                        EXPECT_NE(results, nullptr);
+                        clang_disposeCodeCompleteResults(results);
+                    }
+                    queries++;
+                }
+                // Leaves the writers room to parse on a machine with few cores
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (const auto &filePath : files)
+    {
+        // Calls that change a file must not overlap, so every file has its own writer
+        writers.emplace_back([this, filePath]() {
+            for (int round = 0; round < 5; round++)
+            {
+                store->OnFileOpen(filePath, content);
+                for (int i = 0; i < 3; i++)
+                {
+                    const auto text = content + "\nvoid extra" + std::to_string(i) + "() {}\n";
+                    store->OnFileChange(filePath, {TextChange {std::nullopt, text}});
+                }
+                store->OnFileClose(filePath);
+            }
+            store->OnFileOpen(filePath, content);
+        });
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    done = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_GT(queries, 0);
+    for (const auto &filePath : files)
+    {
+        const auto lease = store->Lease(filePath, LeaseMode::shared);
+        ASSERT_TRUE(lease);
+        EXPECT_TRUE(lease.IsUpToDate());
+        EXPECT_EQ(*lease.Content(), content);
+    }
+    EXPECT_EQ(store->GetMemoryUsage().size(), files.size());
+}
+
+TEST_F(TranslationUnitStoreTest, SelectsLeastRecentlyQueriedBeyondTheCap)
+{
+    TranslationUnitLimits limits;
+    limits.maxTranslationUnits = 1;
+    store->SetLimits(limits);
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileOpen(otherKernelFile, content);
+
+    EXPECT_EQ(store->GetEvictionCandidates(), std::vector<std::string> {KERNEL_FILE});
+    store->Lease(KERNEL_FILE, LeaseMode::shared);
+    EXPECT_EQ(store->GetEvictionCandidates(), std::vector<std::string> {otherKernelFile});
+    EXPECT_EQ(GetStatistics().Get(Gauge::maxTranslationUnits), 1);
+    store->SetLimits({});
+}
+
+TEST_F(TranslationUnitStoreTest, KeepsTheMostRecentTranslationUnitOverBudget)
+{
+    TranslationUnitLimits limits;
+    limits.memoryBudget = 1;
+    store->SetLimits(limits);
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileOpen(otherKernelFile, content);
+
+    EXPECT_EQ(store->GetEvictionCandidates(), std::vector<std::string> {KERNEL_FILE});
+    store->SetLimits({});
+}
+
+TEST_F(TranslationUnitStoreTest, AppliesChangesThatSplitTheDocumentIntoManyPieces)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    std::vector<TextChange> changes;
+    std::string expected = content;
+    for (int i = 0; i < 300; i++)
+    {
+        const auto line = "// " + std::to_string(i) + "\n";
+        changes.push_back(TextChange {TextRange {{0, 0}, {0, 0}}, line});
+        expected.insert(0, line);
+    }
+    store->OnFileChange(KERNEL_FILE, std::move(changes));
+    ASSERT_NE(store->GetContent(KERNEL_FILE), nullptr);
+    EXPECT_EQ(*store->GetContent(KERNEL_FILE), expected);
+
+    store->OnFileChange(KERNEL_FILE, {TextChange {TextRange {{300, 0}, {300, 0}}, "\n"}});
+    expected.insert(expected.find('\n', expected.find("// 0\n")) + 1, "\n");
+    const auto lease = store->Lease(KERNEL_FILE, LeaseMode::shared);
+    ASSERT_TRUE(lease);
+    EXPECT_EQ(*lease.Content(), expected);
+    EXPECT_EQ(store->GetContent(KERNEL_FILE).get(), lease.Content());
+}
+
+TEST_F(TranslationUnitStoreTest, ReleasesStandbysOverBudget)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content + "\nvoid extra() {}\n"}});
+    const auto withStandby = store->GetMemoryUsage().at(0).total;
+
+    // Within the budget the standby stays
+    store->ReleaseStandbys();
+    EXPECT_EQ(store->GetMemoryUsage().at(0).total, withStandby);
+
+    TranslationUnitLimits limits;
+    limits.memoryBudget = 1;
+    store->SetLimits(limits);
+    store->ReleaseStandbys();
+    EXPECT_LT(store->GetMemoryUsage().at(0).total, withStandby);
+
+    // Without a standby the next revision is parsed in full
+    const auto parses = ProbeCount(Probe::parseTranslationUnit);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content}});
+    EXPECT_EQ(ProbeCount(Probe::parseTranslationUnit) - parses, 1);
+    EXPECT_TRUE(store->IsUpToDate(KERNEL_FILE));
+    store->SetLimits({});
+}
+
+TEST_F(TranslationUnitStoreTest, SelectsIdleTranslationUnits)
+{
+    TranslationUnitLimits limits;
+    limits.idleTimeout = std::chrono::milliseconds(1);
+    store->SetLimits(limits);
+    store->OnFileOpen(KERNEL_FILE, content);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    EXPECT_EQ(store->GetEvictionCandidates(), std::vector<std::string> {KERNEL_FILE});
+    store->SetLimits({});
+}
+
+TEST_F(TranslationUnitStoreTest, ParsesEvictedTranslationUnitsOnQuery)
+{
+    const auto evicted = GetStatistics().Get(Gauge::evictedTranslationUnits);
+    store->OnFileOpen(KERNEL_FILE, content);
+
+    store->Evict(KERNEL_FILE);
+
+    EXPECT_TRUE(store->GetMemoryUsage().empty());
+    EXPECT_EQ(GetStatistics().Get(Gauge::evictedTranslationUnits) - evicted, 1);
+    ASSERT_NE(store->GetContent(KERNEL_FILE), nullptr);
+    EXPECT_EQ(*store->GetContent(KERNEL_FILE), content);
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+    EXPECT_EQ(store->GetMemoryUsage().size(), 1);
+}
+
+TEST_F(TranslationUnitStoreTest, ParsesEvictedTranslationUnitOnceForConcurrentLeases)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->Evict(KERNEL_FILE);
+
+    const auto parses = ProbeCount(Probe::parseTranslationUnit);
+    std::atomic<bool> start {false};
+    std::vector<CXTranslationUnit> units(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        threads.emplace_back([&, i]() {
+            while (!start)
+            {
+                std::this_thread::yield();
+            }
+            units[i] = store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit();
+        });
+    }
+    start = true;
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(ProbeCount(Probe::parseTranslationUnit) - parses, 1);
+    for (const auto unit : units)
+    {
+        EXPECT_NE(unit, nullptr);
+        EXPECT_EQ(unit, units.front());
+    }
+}
+
+TEST_F(TranslationUnitStoreTest, ForgetsEvictedTranslationUnitsOnClose)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->Evict(KERNEL_FILE);
+    store->OnFileClose(KERNEL_FILE);
+
+    EXPECT_EQ(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+}
+
+namespace {
+
+class ASTCacheTest : public TranslationUnitStoreTest
+{
+protected:
+    fs::path cacheDir;
+
+    void SetUp() override
+    {
+        TranslationUnitStoreTest::SetUp();
+        cacheDir = testDir / "ast-cache";
+        store->EnableASTCache(cacheDir.string(), 1024 * 1024 * 1024);
+        store->SetTranslationOptions({});
+    }
+
+    std::shared_ptr<ITranslationUnitStore> CreateCachedStore(uint64_t capacity) const
+    {
+        auto cached = CreateTranslationUnitStore();
+        cached->EnableASTCache(cacheDir.string(), capacity);
+        cached->SetTranslationOptions({});
+        return cached;
+    }
+
+    size_t CachedUnits() const
+    {
+        return static_cast<size_t>(std::distance(fs::directory_iterator(cacheDir / "ast"), fs::directory_iterator()));
+    }
+};
+
+} // namespace
+
+TEST_F(ASTCacheTest, RestoresFilesOpenedInAnEarlierRun)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileClose(KERNEL_FILE);
+    EXPECT_EQ(CachedUnits(), 1);
+
+    auto restarted = CreateCachedStore(1024 * 1024 * 1024);
+    const auto restores = ProbeCount(Probe::createTranslationUnit);
+    const auto parses = ProbeCount(Probe::parseTranslationUnit);
+    restarted->OnFileOpen(KERNEL_FILE, content);
+    EXPECT_EQ(ProbeCount(Probe::createTranslationUnit) - restores, 1);
+    EXPECT_EQ(ProbeCount(Probe::parseTranslationUnit), parses);
+    EXPECT_NE(restarted->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+
+    // A restored unit cannot be reparsed, so it is parsed once before a completion
+    EXPECT_NE(restarted->Lease(KERNEL_FILE, LeaseMode::exclusive).TranslationUnit(), nullptr);
+    EXPECT_EQ(ProbeCount(Probe::parseTranslationUnit) - parses, 1);
+    EXPECT_NE(restarted->Lease(KERNEL_FILE, LeaseMode::exclusive).TranslationUnit(), nullptr);
+    EXPECT_EQ(ProbeCount(Probe::parseTranslationUnit) - parses, 1);
+    restarted->OnFileClose(KERNEL_FILE);
+}
+
+TEST_F(ASTCacheTest, SavesTheLastContentOnClose)
+{
+    const auto edited = content + "\nvoid extra() {}\n";
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, edited}});
+    store->OnFileClose(KERNEL_FILE);
+    EXPECT_EQ(CachedUnits(), 2);
+
+    auto restarted = CreateCachedStore(1024 * 1024 * 1024);
+    const auto restores = ProbeCount(Probe::createTranslationUnit);
+    restarted->OnFileOpen(KERNEL_FILE, edited);
+    EXPECT_EQ(ProbeCount(Probe::createTranslationUnit) - restores, 1);
+    restarted->OnFileClose(KERNEL_FILE);
+}
+
+TEST_F(ASTCacheTest, ParsesFilesWithDifferentContent)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    store->OnFileClose(KERNEL_FILE);
+
+    auto restarted = CreateCachedStore(1024 * 1024 * 1024);
+    const auto restores = ProbeCount(Probe::createTranslationUnit);
+    restarted->OnFileOpen(KERNEL_FILE, content + "\n// edited\n");
+    EXPECT_EQ(ProbeCount(Probe::createTranslationUnit), restores);
+    EXPECT_NE(restarted->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+    restarted->OnFileClose(KERNEL_FILE);
+}
+
+TEST_F(ASTCacheTest, RemovesUnitsAboveTheCapacity)
+{
+    auto small = CreateCachedStore(1);
+    small->OnFileOpen(KERNEL_FILE, content);
+    EXPECT_EQ(CachedUnits(), 0);
+    small->OnFileClose(KERNEL_FILE);
+}
+
+namespace {
+
+class PrecompiledHeadersTest : public ASTCacheTest
+{
+protected:
+    void SetUp() override
+    {
+        ASTCacheTest::SetUp();
+        store->SaveHeaders();
+        store->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    }
+
+    std::vector<fs::path> PrecompiledHeaders() const
+    {
+        std::vector<fs::path> result;
+        for (const auto &entry : fs::recursive_directory_iterator(cacheDir))
+        {
+            if (entry.path().extension() == ".pch")
+            {
+                result.push_back(entry.path());
+            }
+        }
+        return result;
+    }
+};
+
+} // namespace
+
+TEST_F(PrecompiledHeadersTest, BuildsOnePCHPerOptions)
+{
+    const auto pchs = PrecompiledHeaders();
+    ASSERT_EQ(pchs.size(), 1);
+    // A rebuilt PCH replaces the file, the link keeps the first one
+    const auto built = testDir / "built.pch";
+    fs::create_hard_link(pchs[0], built);
+
+    store->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    auto other = CreateCachedStore(1024 * 1024 * 1024);
+    other->SaveHeaders();
+    other->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    ASSERT_EQ(PrecompiledHeaders().size(), 1);
+    EXPECT_TRUE(fs::equivalent(pchs[0], built));
+
+    other->SetTranslationOptions(BuildDefaultTranslationOptions("CL2.0"));
+    EXPECT_EQ(PrecompiledHeaders().size(), 2);
+}
+
+TEST_F(PrecompiledHeadersTest, RemovesPCHsAboveTheCapacity)
+{
+    const auto pchs = PrecompiledHeaders();
+    ASSERT_EQ(pchs.size(), 1);
+    const auto capacity = fs::file_size(pchs[0]) + 1;
+
+    // The PCH in use stays, the other one is removed by the trim that follows
+    auto small = CreateCachedStore(capacity);
+    small->SaveHeaders();
+    small->SetTranslationOptions(BuildDefaultTranslationOptions("CL2.0"));
+    ASSERT_EQ(PrecompiledHeaders().size(), 1);
+    EXPECT_FALSE(fs::exists(pchs[0]));
+}
+
+TEST_F(PrecompiledHeadersTest, ParsesFilesWithThePCH)
+{
+    store->OnFileOpen(KERNEL_FILE, content);
+    ASSERT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+    store->OnFileChange(KERNEL_FILE, {TextChange {std::nullopt, content + "\nvoid extra() {}\n"}});
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+    store->OnFileClose(KERNEL_FILE);
+
+    auto restarted = CreateCachedStore(1024 * 1024 * 1024);
+    restarted->SaveHeaders();
+    restarted->SetTranslationOptions(BuildDefaultTranslationOptions("CL1.2"));
+    const auto restores = ProbeCount(Probe::createTranslationUnit);
+    restarted->OnFileOpen(KERNEL_FILE, content);
+    EXPECT_EQ(ProbeCount(Probe::createTranslationUnit) - restores, 1);
+    restarted->OnFileClose(KERNEL_FILE);
+}
+
+TEST_F(PrecompiledHeadersTest, ParsesFilesWithoutLanguageOptions)
+{
+    store->SetTranslationOptions({});
+    store->OnFileOpen(KERNEL_FILE, content);
+    EXPECT_NE(store->Lease(KERNEL_FILE, LeaseMode::shared).TranslationUnit(), nullptr);
+}
+
+TEST(TranslationUnitLeaseTest, MapsPositionsAroundTheChange)
+{
+    const auto parsed = std::make_shared<const std::string>("int a;\nint b;\nint c;\n");
+    const auto latest = std::make_shared<const std::string>("int a;\nint bb = 1;\n\nint c;\n");
+    const TranslationUnitLease lease(nullptr, parsed, latest);
+    EXPECT_FALSE(lease.IsUpToDate());
+
+    unsigned lineno = 1;
+    unsigned columnno = 5;
+    EXPECT_TRUE(lease.MapPosition(lineno, columnno));
+    EXPECT_EQ(lineno, 1);
+    EXPECT_EQ(columnno, 5);
+
+    lineno = 4;
+    columnno = 5;
+    EXPECT_TRUE(lease.MapPosition(lineno, columnno));
+    EXPECT_EQ(lineno, 3);
+    EXPECT_EQ(columnno, 5);
+
+    // Inside the edit and past the end of a line there is nothing to map to
+    lineno = 2;
+    columnno = 6;
+    EXPECT_FALSE(lease.MapPosition(lineno, columnno));
+    lineno = 1;
+    columnno = 20;
+    EXPECT_FALSE(lease.MapPosition(lineno, columnno));
+}
+
+TEST(TranslationUnitLeaseTest, KeepsPositionsOfAnUpToDateUnit)
+{
+    const TranslationUnitLease lease(nullptr, std::make_shared<const std::string>("int a;\n"), nullptr);
+    EXPECT_TRUE(lease.IsUpToDate());
+
+    unsigned lineno = 7;
+    unsigned columnno = 3;
+    EXPECT_TRUE(lease.MapPosition(lineno, columnno));
+    EXPECT_EQ(lineno, 7);
+    EXPECT_EQ(columnno, 3);
+}
@@ -62,7 +62,7 @@ protected:
 // Test basic definition at a function call site
 TEST_F(TypeDefinitionTest, TypeDefinitionAtFunctionCall)
 {
-    auto results = typeDefinition->GetTypeDefinitions(KERNEL_FILE, line, column);
+    auto results = typeDefinition->GetTypeDefinitions(KERNEL_FILE, line, column).locations;
     ASSERT_GT(results.size(), 0);
 
     auto r = results.front();
@@ -0,0 +1,144 @@
+//
+//  writer-tests.cpp
+//  opencl-language-server-tests
+//
+//  Created by Ilia Shoshin on 10/17/26.
+//
+
+#include "jsonrpc.hpp"
+#include "writer.hpp"
+
+#include <gtest/gtest.h>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+
+using namespace ocls;
+using namespace nlohmann;
+
+namespace {
+
+struct CapturingSink
+{
+    std::mutex mutex;
+    std::vector<std::string> blocks;
+
+    WriteSinkFunc Func()
+    {
+        return [this](std::string_view data) {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.emplace_back(data);
+            return true;
+        };
+    }
+};
+
+} // namespace
+
+TEST(MessageWriterTest, FramesMessage)
+{
+    const json body = {{"id", 1}, {"result", nullptr}};
+    std::string scratch;
+    std::string out;
+
+    AppendFramedMessage(body, scratch, out);
+
+    const auto content = body.dump();
+    EXPECT_EQ(
+        out,
+        "Content-Length: " + std::to_string(content.size()) +
+            "\r\nContent-Type: application/vscode-jsonrpc;charset=utf-8\r\n\r\n" + content);
+}
+
+TEST(MessageWriterTest, CoalescesQueuedMessages)
+{
+    CapturingSink sink;
+    auto writer = CreateMessageWriter(sink.Func());
+    writer->Push(json {{"id", 1}});
+    writer->Push(json {{"id", 2}});
+    writer->Push(json {{"id", 3}});
+
+    writer->Start();
+    writer->Flush();
+
+    ASSERT_EQ(sink.blocks.size(), 1);
+    const auto& block = sink.blocks.front();
+    EXPECT_LT(block.find(R"({"id":1})"), block.find(R"({"id":2})"));
+    EXPECT_LT(block.find(R"({"id":2})"), block.find(R"({"id":3})"));
+
+    const auto stats = writer->GetStats();
+    EXPECT_EQ(stats.messages, 3);
+    EXPECT_EQ(stats.batches, 1);
+    EXPECT_EQ(stats.bytesWritten, block.size());
+    writer->Stop();
+}
+
+TEST(MessageWriterTest, StopWritesPendingMessages)
+{
+    CapturingSink sink;
+    auto writer = CreateMessageWriter(sink.Func());
+    writer->Start();
+    for (int i = 0; i < 100; ++i)
+    {
+        writer->Push(json {{"id", i}});
+    }
+
+    writer->Stop();
+
+    EXPECT_EQ(writer->GetStats().messages, 100);
+    std::string output;
+    for (const auto& block : sink.blocks)
+    {
+        output += block;
+    }
+    EXPECT_NE(output.find(R"({"id":99})"), std::string::npos);
+}
+
+TEST(MessageWriterTest, FlushReturnsWhenChannelIsClosed)
+{
+    auto writer = CreateMessageWriter([](std::string_view) { return false; });
+    writer->Start();
+    writer->Push(json {{"id", 1}});
+
+    writer->Flush();
+
+    EXPECT_EQ(writer->GetStats().bytesWritten, 0);
+    writer->Stop();
+}
+
+TEST(MessageWriterTest, JsonRPCDeliversThroughWriter)
+{
+    CapturingSink sink;
+    auto writer = CreateMessageWriter(sink.Func());
+    auto jrpc = CreateJsonRPC();
+    bool isOutputCallbackCalled = false;
+    jrpc->RegisterOutputCallback([&isOutputCallbackCalled](const std::string&) { isOutputCallbackCalled = true; });
+    jrpc->RegisterOutputWriter(writer);
+    writer->Start();
+
+    jrpc->Write({{"id", 7}, {"result", "ok"}});
+    writer->Stop();
+
+    EXPECT_FALSE(isOutputCallbackCalled);
+    ASSERT_EQ(sink.blocks.size(), 1);
+    const auto& block = sink.blocks.front();
+    const auto response = json::parse(block.substr(block.find("\r\n\r\n") + 4));
+    EXPECT_EQ(response["jsonrpc"], "2.0");
+    EXPECT_EQ(response["id"], 7);
+    EXPECT_EQ(response["result"], "ok");
+}
+
+TEST(MessageWriterTest, FramesSerializedMessageAsIs)
+{
+    CapturingSink sink;
+    auto writer = CreateMessageWriter(sink.Func());
+    writer->Start();
+    writer->Push(SerializedMessage {R"({"jsonrpc":"2.0","id":1,"result":[]})"});
+    writer->Stop();
+
+    ASSERT_EQ(sink.blocks.size(), 1);
+    EXPECT_EQ(
+        sink.blocks[0],
+        "Content-Length: 36\r\nContent-Type: application/vscode-jsonrpc;charset=utf-8\r\n\r\n"
+        R"({"jsonrpc":"2.0","id":1,"result":[]})");
+}